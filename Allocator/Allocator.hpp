@@ -45,13 +45,16 @@
 #include "LargeGroup.hpp"
 #include "BasicMemory.hpp"
 #include "NumaMemory.hpp"
+#include "PathProfiler.hpp"
+#include "MemoryPressure.hpp"
 #include <math.h>
+#include <new>
 
 #if defined(PLATFORM_WINDOWS)
     #include <Windows.h>
     #include <Psapi.h>
 #else
-    static_assert(false, "Not yet implemented.");
+    #include <stdint.h>
 #endif
 
 namespace Base {
@@ -61,38 +64,75 @@ private:
     // Nested types
     #pragma pack(push)
     #pragma pack(1) // Make sure the compiler doesn't change the layout of the structures.
+    // The bins of each lifetime are indexed with the small bins first, 
+    // followed by the large ones. A bin is created when first used and stored 
+    // at the next free slot; the first slots are in the context, 
+    // the others in bin chunks.
+    struct BinChunk;
+
     struct BinHeader {
-        unsigned __int64 AvailableGroups;
-        unsigned int UsedBins;
+        unsigned __int64 UsedBins[Constants::LIFETIMES]; // The bins that were created.
+        unsigned __int64 AvailableGroups; // Only short-lived bins can be stolen from.
+        unsigned char Slots[Constants::CONTEXT_BINS];    // The slot of each created bin.
+        unsigned char SlotCount;
+        BinChunk* BinChunks[Constants::BIN_CHUNKS];      // Allocated when needed.
         
         // Padding to cache line.
-        char Padding[Constants::CACHE_LINE_SIZE - 
-                     sizeof(unsigned __int64) - sizeof(unsigned int)];
+        char Padding[(3 * Constants::CACHE_LINE_SIZE) - 
+                     ((Constants::LIFETIMES + 1) * sizeof(unsigned __int64)) - 
+                     Constants::CONTEXT_BINS - sizeof(unsigned char) - 
+                     (Constants::BIN_CHUNKS * sizeof(void*))];
     };
 
     template <class NodeType, class PolicyType>
     struct Bin : public ObjectList<NodeType, PolicyType> {
-        typedef typename ObjectList<NodeType, PolicyType> ListType;
+        typedef ObjectList<NodeType, PolicyType> ListType;
 
-        NodeType* PublicGroup;
+        NodeType* volatile PublicGroup; // Groups with public locations (lock-free stack).
         NodeType* StolenGroup;
-        unsigned int ReturnAllowed;
-        unsigned int CanReturnPartial;
         unsigned int Number;
-        unsigned int PublicLock;
-        unsigned int CanSteal;
         unsigned int StolenLocations;
-        unsigned int MaxStolenLocations;
+        unsigned int LastReturn;  // The time when a group was last returned.
+        unsigned int LastChurn;   // The time when 'Retain' was last changed.
+        unsigned short MaxStolenLocations;
+        unsigned char CanReturnPartial;
+        unsigned char CanSteal;
+        unsigned char Retain;     // The number of groups the bin keeps when they are empty.
+        unsigned char Lifetime;   // The lifetime of the locations allocated from the bin.
 
         // Padding to cache line.
         char Padding[Constants::CACHE_LINE_SIZE - sizeof(ListType) - 
-                    (2 * sizeof(void*)) - (7 * sizeof(unsigned int))];
+                    (2 * sizeof(void*)) - (4 * sizeof(unsigned int)) - 
+                    sizeof(unsigned short) - (4 * sizeof(unsigned char))];
     };
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     typedef Bin<typename SmallTraits::NodeType, typename SmallTraits::PolicyType> SmallBin;
     typedef Bin<typename LargeTraits::NodeType, typename LargeTraits::PolicyType> LargeBin;
 
+    // Storage for a bin of any kind.
+    struct BinSlot {
+        char Data[Constants::CACHE_LINE_SIZE];
+    };
+
+    // Holds the bins that don't fit in the context.
+    struct BinChunk {
+        BinSlot Bins[Constants::BIN_CHUNK_SIZE];
+    };
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Empty groups kept by a thread, so that they can be reused by any bin
+    // without going through the block allocator. The last group is the most recent.
+    // The lowest bit of an entry is set if the memory of the group was never used.
+    struct GroupCache {
+        void* Groups[Constants::GROUP_CACHE_SIZE];
+        unsigned int Count;
+
+        // Padding to cache line.
+        char Padding[Constants::CACHE_LINE_SIZE - 
+                     (Constants::GROUP_CACHE_SIZE * sizeof(void*)) - sizeof(unsigned int)];
+    };
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     // Each thread that made an allocation has an associated context
     // that is retrieved/set through TLS.
@@ -100,13 +140,25 @@ private:
         unsigned int ThreadId;
         unsigned int HugeOperations;
         unsigned int NumaNode; // The node where this thread was first used.
+        PathProfiler::ThreadProfile* Profile; // Used only if 'PROFILE_PATHS' is defined.
+
+        // Used only if 'ADOPT' is defined.
+        volatile unsigned int Active;     // Set while the owner is inside the allocator.
+        volatile unsigned int Adopting;   // Set while another thread adopts groups.
+        volatile unsigned int Operations; // Incremented by the owner on each operation.
+        unsigned int IdleOperations;      // 'Operations' when last seen by an adopting thread.
+        unsigned int IdleSince;           // The time when 'IdleOperations' was last changed.
+        ThreadContext* NextContext;       // The list of all contexts.
+        ThreadContext* PreviousContext;
 
         // Padding to cache line.
-        char Padding[Constants::CACHE_LINE_SIZE - (3 * sizeof(unsigned int))];
+        char Padding[Constants::CACHE_LINE_SIZE - (8 * sizeof(unsigned int)) - 
+                     (3 * sizeof(void*))];
 
+        GroupCache SmallCache;
+        GroupCache LargeCache;
         BinHeader Header;
-        SmallBin SmallBins[Constants::SMALL_BINS];
-        LargeBin LargeBins[Constants::LARGE_BINS];
+        BinSlot InlineBins[Constants::INLINE_BINS];
     };
     #pragma pack(pop) // Restore the original alignment.
 
@@ -114,7 +166,7 @@ private:
     // Arguments for the threads that cleans the cache with huge locations.
     struct CacheThreadArgs {
         void* ThreadHandle;
-        Allocator* Allocator;
+        Allocator* Owner;
         unsigned int Timeout;
     };
     
@@ -135,12 +187,12 @@ private:
     // memory allocation systems (basic and NUMA).
     template <class T, class U, bool IsNuma>
     struct MemoryPolicySelector {
-        typedef typename BasicMemory<T, U> PolicyType;
+        typedef BasicMemory<T, U> PolicyType;
     };
 
     template <class T, class U>
     struct MemoryPolicySelector<T, U, true> {
-        typedef typename NumaMemory<T, U> PolicyType;
+        typedef NumaMemory<T, U> PolicyType;
     };
     
 public:
@@ -155,24 +207,37 @@ public:
     typedef MemoryPolicySelector<SmallBAType, LargeBAType, 
                                  Constants::NUMA_ENABLED>::PolicyType MemoryPolicy;
 
+    // The contexts and the block allocators are allocated from object pools
+    // that divide their blocks into objects having a fixed size.
+    static_assert(sizeof(ThreadContext) <= Constants::THREAD_CONTEXT_SIZE,
+                  "The thread context doesn't fit in THREAD_CONTEXT_SIZE.");
+    static_assert(sizeof(SmallBAType) <= Constants::BA_SIZE,
+                  "The small block allocator doesn't fit in BA_SIZE.");
+    static_assert(sizeof(LargeBAType) <= Constants::BA_SIZE,
+                  "The large block allocator doesn't fit in BA_SIZE.");
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     volatile bool initialized_;
     volatile bool cacheThreadInitialized_;
     unsigned int initLock_; // Used for the initialization of the allocator.
     unsigned int cacheThreadLock_;
     unsigned int tlsIndex_; // The index used by all threads to store their context.
+    unsigned int contextListLock_;
+    ThreadContext* contextList_; // All contexts in use (searched for idle ones).
+    volatile unsigned int lastAdoptScan_;
 
     MemoryPolicy memoryPolicy_;
     SmallBAType* smallBlockAlloc_[Constants::MAX_NUMA_NODES];
     LargeBAType* largeBlockAlloc_[Constants::MAX_NUMA_NODES];
     ObjectPool threadContextPool_;  // Used to allocate thread context objects.
     ObjectPool blockAllocatorPool_; // Used to allocate block allocators for each NUMA node.
+    ObjectPool binChunkPool_;       // Used to allocate the bins that don't fit in a context.
     HugeBin hugeBins_[Constants::HUGE_BINS]; // Keeps track of freed (unused) huge locations.
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     // Provides access to group-specific data, based on the type 
     // of the group (small or large). Selector for small groups.
-    template <class T>
+    template <class T, class Dummy = void>
     struct Selector {
         typedef SmallBAType BAType;
         typedef SmallBin BinType;
@@ -180,14 +245,31 @@ public:
 
         static const unsigned int GroupSize  = Constants::SMALL_GROUP_SIZE;
         static const unsigned int HeaderSize = Constants::SMALL_GROUP_HEADER_SIZE;
+        static const unsigned int FirstBin   = 0; // The index of the first bin in a context.
+        static const unsigned int BinCount   = Constants::SMALL_BINS;
 
         // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
         static SmallBAType* GetBA(Allocator* allocator, unsigned int node) {
             return allocator->smallBlockAlloc_[node];
         }
 
-        static BinType* GetBin(ThreadContext* context, unsigned int index) {
-            return& context->SmallBins[index];
+        static void InitializeBin(BinType* bin, unsigned int number, Lifetime lifetime) {
+            bin->Number = number;
+            bin->Retain = Constants::RETAIN_MIN;
+            bin->PublicGroup = nullptr;
+            bin->CanReturnPartial = Bitmap::IsBitSet(Constants::GROUP_RETURN_PARTIAL, number);
+            bin->Lifetime = (unsigned char)lifetime;
+
+#if defined(STEAL)
+            // Stealing would mix the lifetimes in the same group.
+            bin->CanSteal = lifetime == LIFETIME_SHORT;
+            bin->MaxStolenLocations = (Constants::SMALL_GROUP_SIZE / 
+                                       Constants::SmallBinSize[number]) / 2;
+#endif
+        }
+
+        static GroupCache* GetGroupCache(ThreadContext* context) {
+            return &context->SmallCache;
         }
 
         static void GetAllocInfo(Allocator* alloc, size_t size, 
@@ -198,26 +280,48 @@ public:
         static bool CanReturnPartial(BinType* bin) {
             return bin->CanReturnPartial;
         }
+
+        static GroupType* GetGroup(void* address) {
+            // Mask the first log2(SMALL_GROUP_SIZE) bits to obtain the group address.
+            return reinterpret_cast<GroupType*>((uintptr_t)address &  
+                                                ~((uintptr_t)GroupSize - 1));
+        }
     };
 
 
-    // Selector for large groups.
-    template <>
-    struct Selector<LargeBAType> {
+    // Selector for large groups ('Dummy' makes this a partial specialization, 
+    // explicit specializations are not allowed at class scope).
+    template <class Dummy>
+    struct Selector<LargeBAType, Dummy> {
         typedef LargeBAType BAType;
         typedef LargeBin BinType;
         typedef LargeGroup GroupType;
 
         static const unsigned int GroupSize  = Constants::LARGE_GROUP_SIZE;
         static const unsigned int HeaderSize = Constants::LARGE_GROUP_HEADER_SIZE;
+        static const unsigned int FirstBin   = Constants::SMALL_BINS;
+        static const unsigned int BinCount   = Constants::LARGE_BINS;
 
         // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
         static LargeBAType* GetBA(Allocator* allocator, unsigned int node) {
             return allocator->largeBlockAlloc_[node];
         }
 
-        static BinType* GetBin(ThreadContext* context, unsigned int index) {
-            return& context->LargeBins[index];
+        static void InitializeBin(BinType* bin, unsigned int number, Lifetime lifetime) {
+            bin->Number = number;
+            bin->Retain = Constants::RETAIN_MIN;
+            bin->PublicGroup = nullptr;
+            bin->Lifetime = (unsigned char)lifetime;
+
+#if defined(STEAL)
+            bin->CanSteal = 1;
+            bin->MaxStolenLocations = (Constants::LARGE_GROUP_SIZE / 
+                                       Constants::LargeBinSize[number]) / 2;
+#endif
+        }
+
+        static GroupCache* GetGroupCache(ThreadContext* context) {
+            return &context->LargeCache;
         }
 
         static void GetAllocInfo(Allocator* alloc, size_t size,
@@ -228,13 +332,25 @@ public:
         static bool CanReturnPartial(BinType* bin) {
             return true;
         }
+
+        static GroupType* GetGroup(void* address) {
+            // See if the location is in the first subgroup. 
+            // If not, the start address of the group needs to be recomputed.
+            uintptr_t subgroupAddr = (uintptr_t)address & 
+                                     ~((uintptr_t)Constants::SMALL_GROUP_SIZE - 1);
+            auto castedGroup = reinterpret_cast<LargeTraits::NodeType*>(subgroupAddr);
+            unsigned int subgroup = LargeTraits::PolicyType::GetSubgroup(castedGroup);
+
+            unsigned int subgroupOffset = (subgroup * Constants::SMALL_GROUP_SIZE);
+            return reinterpret_cast<GroupType*>(subgroupAddr - subgroupOffset);
+        }
     };
     
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     void Initialize()	{
         // Uses the double-checked locking, corrected for multicore
         // (see Andrei Alexandrescu - C++ and the Perils of Double-Checked Locking).
-        bool state = Memory::ReadValue(&initialized_);
+        bool state = Atomic::Load(&initialized_, std::memory_order_acquire);
 
         if(!state) {
             // Acquire the lock. Will be automatically released by the destructor.
@@ -246,7 +362,13 @@ public:
 
                 // Make sure that the flag is set
                 // only after the TLS index was allocated.
-                Memory::WriteValue(&initialized_, true);
+                Atomic::Store(&initialized_, true, std::memory_order_release);
+
+#if defined(MEMORY_PRESSURE)
+                // Size the caches now, then periodically from the cache thread.
+                AdjustToMemoryPressure();
+                CreateCacheCleaningThread();
+#endif
             }
         }
     }
@@ -254,6 +376,12 @@ public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Returns the context associated with this thread from TLS.
     ThreadContext* GetCurrentContext() {
+        // The TLS index is not allocated until the first context is created
+        // (a thread can free a location before any thread allocated one).
+        if(!Atomic::Load(&initialized_, std::memory_order_acquire)) {
+            return nullptr;
+        }
+
         return reinterpret_cast<ThreadContext*>(ThreadUtils::GetTLSValue(tlsIndex_));
     }
 
@@ -273,6 +401,17 @@ public:
         new(context) ThreadContext(); 
         context->ThreadId = ThreadUtils::GetCurrentThreadId();
         context->HugeOperations = 0;
+        context->Profile = PathProfiler::CreateProfile(context->ThreadId);
+        context->Active = 0;
+        context->Adopting = 0;
+        context->Operations = 0;
+        context->IdleOperations = 0;
+        context->IdleSince = ThreadUtils::GetMilliseconds();
+        context->SmallCache.Count = 0;
+        context->LargeCache.Count = 0;
+        context->Header.UsedBins[LIFETIME_SHORT] = 0; // The bins are created when first used.
+        context->Header.UsedBins[LIFETIME_LONG] = 0;
+        context->Header.SlotCount = 0;
 
 #if defined(PLATFORM_NUMA)
         // Assign the NUMA node.
@@ -282,44 +421,165 @@ public:
 #endif
         ThreadUtils::SetTLSValue(tlsIndex_, context);
 
-        // Initialize the bins.
-        for(unsigned int i = 0; i < Constants::SMALL_BINS; i++) {
-            SmallBin* bin = &context->SmallBins[i];
-            bin->Number = i;
-            bin->ReturnAllowed = 1;
-            bin->PublicGroup = nullptr;
-            bin->CanReturnPartial = Bitmap::IsBitSet(Constants::GROUP_RETURN_PARTIAL, i);
+#if defined(ADOPT)
+        // Make the context visible to threads that search for idle ones.
+        // Bins created later are seen only after the context was claimed.
+        SpinLock listLock(&contextListLock_);
+        context->PreviousContext = nullptr;
+        context->NextContext = contextList_;
 
-#if defined(STEAL)
-            bin->CanSteal = 1;
-            bin->MaxStolenLocations = (Constants::SMALL_GROUP_SIZE / 
-                                       Constants::SmallBinSize[i]) / 2;
-#endif
+        if(contextList_ != nullptr) {
+            contextList_->PreviousContext = context;
         }
 
-        for(unsigned int i = 0; i < Constants::LARGE_BINS; i++) {
-            LargeBin* bin = &context->LargeBins[i];
-            bin->Number = i;
-            bin->ReturnAllowed = 1;
-            bin->PublicGroup = nullptr;
-
-#if defined(STEAL)
-            bin->CanSteal = 1;
-            bin->MaxStolenLocations = (Constants::LARGE_GROUP_SIZE / 
-                                       Constants::LargeBinSize[i]) / 2;
+        contextList_ = context;
 #endif
-        }
-
         return context;
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Returns the specified context to the context pool.
     void ReleaseContext(ThreadContext* context) {
+#if defined(ADOPT)
+        // A thread that adopts groups holds the lock for the entire operation.
+        SpinLock listLock(&contextListLock_);
+
+        if(context->PreviousContext != nullptr) {
+            context->PreviousContext->NextContext = context->NextContext;
+        }
+        else contextList_ = context->NextContext;
+
+        if(context->NextContext != nullptr) {
+            context->NextContext->PreviousContext = context->PreviousContext;
+        }
+
+        listLock.Unlock();
+#endif
+        // The cached groups are not used by anyone else.
+        FlushGroupCaches(context);
+
+        for(unsigned int i = 0; i < Constants::BIN_CHUNKS; i++) {
+            if(context->Header.BinChunks[i] != nullptr) {
+                binChunkPool_.ReturnObject(context->Header.BinChunks[i]);
+            }
+        }
+
+        PathProfiler::ReleaseProfile(context->Profile);
         ThreadUtils::SetTLSValue(tlsIndex_, nullptr);
         threadContextPool_.ReturnObject(context);
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the storage of the bin found at the specified slot.
+    BinSlot* GetBinSlot(ThreadContext* context, unsigned int slot) {
+        if(slot < Constants::INLINE_BINS) {
+            return &context->InlineBins[slot];
+        }
+
+        slot -= Constants::INLINE_BINS;
+        return &context->Header.BinChunks[slot / Constants::BIN_CHUNK_SIZE]->
+                    Bins[slot % Constants::BIN_CHUNK_SIZE];
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the bin with the specified number and lifetime, or nullptr if the 
+    // context didn't use it yet. Can be used on the context of another thread.
+    template <class Manager>
+    typename Selector<Manager>::BinType* 
+    FindBin(ThreadContext* context, unsigned int number, unsigned int lifetime) {
+        typedef Selector<Manager> GS; // Group selector.
+        unsigned int index = GS::FirstBin + number;
+
+        if(!Bitmap::IsBitSet(context->Header.UsedBins[lifetime], index)) {
+            return nullptr;
+        }
+
+        unsigned int slotIndex = (lifetime * Constants::BIN_NUMBER) + index;
+        BinSlot* slot = GetBinSlot(context, context->Header.Slots[slotIndex]);
+        return reinterpret_cast<typename GS::BinType*>(slot);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the bin with the specified number, creating it if it's the first 
+    // time it's used. Must be called only by the owner of the context.
+    template <class Manager>
+    typename Selector<Manager>::BinType* 
+    GetBin(ThreadContext* context, unsigned int number, Lifetime lifetime) {
+        typedef Selector<Manager> GS; // Group selector.
+        typename GS::BinType* bin = FindBin<Manager>(context, number, lifetime);
+
+        if(bin == nullptr) {
+            bin = CreateBin<Manager>(context, number, lifetime);
+        }
+
+        return bin;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Creates the bin in the next free slot, allocating a chunk when needed.
+    template <class Manager>
+    typename Selector<Manager>::BinType* 
+    CreateBin(ThreadContext* context, unsigned int number, Lifetime lifetime) {
+        typedef Selector<Manager> GS; // Group selector.
+        unsigned int index = GS::FirstBin + number;
+        unsigned int slot = context->Header.SlotCount++;
+
+        if((slot >= Constants::INLINE_BINS) && 
+           ((slot - Constants::INLINE_BINS) % Constants::BIN_CHUNK_SIZE) == 0) {
+            unsigned int chunk = (slot - Constants::INLINE_BINS) / Constants::BIN_CHUNK_SIZE;
+            context->Header.BinChunks[chunk] = 
+                    reinterpret_cast<BinChunk*>(binChunkPool_.GetObject());
+        }
+
+        // The slots are reused with the context, call the constructor.
+        auto bin = new(GetBinSlot(context, slot)) typename GS::BinType();
+        GS::InitializeBin(bin, number, lifetime);
+
+        context->Header.Slots[(lifetime * Constants::BIN_NUMBER) + index] = (unsigned char)slot;
+        Bitmap::SetBit(context->Header.UsedBins[lifetime], index);
+        return bin;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Marks the context as being used by its owner for the duration of an operation.
+    // The owner needs only a compiler barrier, the expensive part of the
+    // synchronization is done by the (rare) thread that adopts groups (see 'ClaimContext').
+    struct ContextGuard {
+        ThreadContext* Context;
+
+        ContextGuard(ThreadContext* context) : Context(context) {
+#if defined(ADOPT)
+            Atomic::Store(&Context->Active, 1u, std::memory_order_relaxed);
+            ThreadUtils::CompilerBarrier();
+
+            while(Atomic::Load(&Context->Adopting, std::memory_order_acquire)) {
+                // Another thread takes groups from our bins.
+                // Step aside and wait until it's done.
+                Atomic::Store(&Context->Active, 0u, std::memory_order_release);
+                unsigned int waitCount = 1;
+
+                while(Atomic::Load(&Context->Adopting, std::memory_order_acquire)) {
+                    ThreadUtils::SpinWait(waitCount);
+                    waitCount = waitCount < 1024 ? waitCount * 2 : 1024;
+                }
+
+                Atomic::Store(&Context->Active, 1u, std::memory_order_relaxed);
+                ThreadUtils::CompilerBarrier();
+            }
+
+            Atomic::Store(&Context->Operations, Context->Operations + 1, 
+                          std::memory_order_relaxed);
+#endif
+        }
+
+        ~ContextGuard() {
+#if defined(ADOPT)
+            // Release the changes made to the bins to an adopting thread.
+            Atomic::Store(&Context->Active, 0u, std::memory_order_release);
+#endif
+        }
+    };
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Makes the specified group the active one.
     template <class GroupType, class BinType>
@@ -451,7 +711,8 @@ public:
             // the "binary search" method. The table is not likely to be held 
             // in cache, because large objects are allocated infrequently, 
             // but it doesn't seem to be an issue even if the whole L1 cache is flushed.
-            allocInfo = Constants::SmallAllocTable2[size / 320];
+            allocInfo = Constants::SmallAllocTable2[((size - 1) / 64) - 
+                                                    (Constants::MAX_SEGREGATED_SIZE / 64)];
         }
     }
 
@@ -473,6 +734,95 @@ public:
         }
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Computes at compile time the information that 'GetAllocationInfoSmall' 
+    // and 'GetAllocationInfoLarge' would return for a location having the 
+    // specified size. Used by 'AllocateFixed'.
+    enum FixedCategory {
+        FIXED_TINY,       // Like the 'SmallAllocTable' lookup.
+        FIXED_SEGREGATED, // Computed from the highest bit of the size.
+        FIXED_SMALL,      // Like the 'SmallAllocTable2' lookup.
+        FIXED_LARGE
+    };
+
+    template <size_t Size>
+    struct FixedCategoryOf {
+        static_assert(Size <= Constants::MAX_LARGE_SIZE, 
+                      "Fixed allocations must be small or large.");
+
+        static const FixedCategory Value = 
+                Size <= Constants::MAX_TINY_SIZE       ? FIXED_TINY :
+                Size <= Constants::MAX_SEGREGATED_SIZE ? FIXED_SEGREGATED :
+                Size <= Constants::MAX_SMALL_SIZE      ? FIXED_SMALL : FIXED_LARGE;
+    };
+
+    template <size_t Value, class Dummy = void>
+    struct HighestBit {
+        static const unsigned int Index = 1 + HighestBit<Value / 2>::Index;
+    };
+
+    template <class Dummy>
+    struct HighestBit<1, Dummy> {
+        static const unsigned int Index = 0;
+    };
+
+    template <size_t Size, FixedCategory Category = FixedCategoryOf<Size>::Value>
+    struct FixedSize;
+
+    template <size_t Size>
+    struct FixedSize<Size, FIXED_TINY> {
+        typedef SmallBAType Manager;
+
+        // Sizes up to 24 bytes are rounded to 4 bytes, the others to 8 bytes.
+        static const unsigned int ROUNDED = Size <= 24 ? ((Size + 3) & ~3) : 
+                                                         ((Size + 7) & ~7);
+        static const unsigned int ALLOCATION_SIZE = ROUNDED < 8 ? 8 : ROUNDED;
+        static const unsigned int BIN = ALLOCATION_SIZE <= 24 ? 
+                                        (ALLOCATION_SIZE / 4) - 2 :
+                                        4 + ((ALLOCATION_SIZE - 24) / 8);
+    };
+
+    template <size_t Size>
+    struct FixedSize<Size, FIXED_SEGREGATED> {
+        typedef SmallBAType Manager;
+
+        static const unsigned int HIGHEST_BIT = HighestBit<Size - 1>::Index;
+        static const unsigned int OFFSET = 127 >> (9 - HIGHEST_BIT);
+        static const unsigned int ALLOCATION_SIZE = (Size + OFFSET) & ~OFFSET;
+        static const unsigned int BIN = ((Size - 1) >> (HIGHEST_BIT - 2)) + 
+                                        (4 * (HIGHEST_BIT - 5)) + 3;
+    };
+
+    template <size_t Size>
+    struct FixedSize<Size, FIXED_SMALL> {
+        typedef SmallBAType Manager;
+
+        static const unsigned int INDEX = Size <= Constants::ALLOCATION_SIZE_1 ? 0 :
+                                          Size <= Constants::ALLOCATION_SIZE_2 ? 1 :
+                                          Size <= Constants::ALLOCATION_SIZE_3 ? 2 :
+                                          Size <= Constants::ALLOCATION_SIZE_4 ? 3 : 4;
+        static const unsigned int ALLOCATION_SIZE = 
+                INDEX == 0 ? Constants::ALLOCATION_SIZE_1 :
+                INDEX == 1 ? Constants::ALLOCATION_SIZE_2 :
+                INDEX == 2 ? Constants::ALLOCATION_SIZE_3 :
+                INDEX == 3 ? Constants::ALLOCATION_SIZE_4 : Constants::ALLOCATION_SIZE_5;
+        static const unsigned int BIN = Constants::AFTER_SEGREGATED_START_BIN + INDEX;
+    };
+
+    template <size_t Size>
+    struct FixedSize<Size, FIXED_LARGE> {
+        typedef LargeBAType Manager;
+
+        static const unsigned int BIN = Size <= Constants::LARGE_ALLOCATION_SIZE_1 ? 0 :
+                                        Size <= Constants::LARGE_ALLOCATION_SIZE_2 ? 1 :
+                                        Size <= Constants::LARGE_ALLOCATION_SIZE_3 ? 2 : 3;
+        static const unsigned int ALLOCATION_SIZE = 
+                BIN == 0 ? Constants::LARGE_ALLOCATION_SIZE_1 :
+                BIN == 1 ? Constants::LARGE_ALLOCATION_SIZE_2 :
+                BIN == 2 ? Constants::LARGE_ALLOCATION_SIZE_3 : 
+                           Constants::LARGE_ALLOCATION_SIZE_4;
+    };
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     bool IsHugeLocation(void* address, void* aligned) {
         // Huge locations always start at 64 bytes, 
@@ -494,10 +844,11 @@ public:
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Tries to steal a mostly-empty group from another bin.
+    // The locations of the group must be large enough for 'size'.
     template <class Manager>
     typename Selector<Manager>::GroupType* 
-    StealGroup(ThreadContext* context, unsigned int startBin) {
-        typedef typename Selector<Manager> GS; // Group selector.
+    StealGroup(ThreadContext* context, unsigned int startBin, unsigned int size) {
+        typedef Selector<Manager> GS; // Group selector.
 
         // Get the index of the first bin that has a (mostly) empty active group.
         // If the found group is not empty enough, continue searching until 
@@ -506,20 +857,20 @@ public:
             unsigned int index = Bitmap::SearchForward(context->Header.AvailableGroups, startBin);
             
             if(index != -1) {
-                auto groupObject = GS::GetBin(context, index)->First;
-                GS::GroupType* group = static_cast<GS::GroupType*>(groupObject);
+                auto groupObject = FindBin<Manager>(context, index, LIFETIME_SHORT)->First();
+                typename GS::GroupType* group = static_cast<typename GS::GroupType*>(groupObject);
 
                 // Need to recheck because the status is updated only when
-                // the group is initialized_ or made active.
-                if(group->CanBeStolen()) {
+                // the group is initialized_ or made active (the bin may be empty now).
+                if((group != nullptr) && group->CanBeStolen() && 
+                   group->CanStealSize(size)) {
                     return group;
                 }
 
                 // Next time search from the returned index.
                 startBin = index + 1;
             }
-
-            break; // No bin with available locations could be found.
+            else break; // No bin with available locations could be found.
         }
 
         return nullptr;
@@ -527,10 +878,10 @@ public:
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Removes the specified group from all the bins that come before the owner one.
-    template <class Manager>
-    void RemoveStolenGroup(ThreadContext* context, typename Selector<Manager>::GroupType* group, 
-                           unsigned int groupBin) {
-        typedef typename Selector<Manager> GC; // Group context.
+    void RemoveStolenGroup(ThreadContext* context, Group* group, unsigned int groupBin) {
+        // The group leaves the bin, stop stealing from it's active stolen 
+        // location, so that it's freed when it's last location is returned.
+        group->ReleaseStolen();
 
         if(group->SmallestStolen == Constants::NOT_STOLEN) {
             // This group hasn't been stolen yet.
@@ -543,9 +894,9 @@ public:
         unsigned int startBin = group->SmallestStolen;
 
         for(unsigned int i = startBin; i < groupBin; i++) {
-            GC::BinType* bin = &context->SmallBins[i];
+            SmallBin* bin = FindBin<SmallBAType>(context, i, LIFETIME_SHORT);
 
-            if(bin->StolenGroup == group) {
+            if((bin != nullptr) && (bin->StolenGroup == group)) {
                 // The group has been stolen by this bin, don't let it anymore.
                 bin->StolenGroup = nullptr;
             }
@@ -553,41 +904,48 @@ public:
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    template <>
-    void RemoveStolenGroup<LargeBAType>(ThreadContext* context, LargeGroup* group, 
-                                        unsigned int groupBin) {
+    void RemoveStolenGroup(ThreadContext* context, LargeGroup* group, 
+                           unsigned int groupBin) {
         // Stealing is always disabled for large groups.
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Marks the specified bin as (un)available for stealing by other bins.
-    template <class GroupType>
-    void SetAvailableForStealing(ThreadContext* context, unsigned int binIndex,
-                                 bool available) {
+    void SetAvailableForStealing(ThreadContext* context, SmallBin* bin, bool available) {
+        if(bin->Lifetime != LIFETIME_SHORT) {
+            return; // Groups with long-lived locations are never stolen.
+        }
+
         if(available) {
-            Bitmap::SetBit(context->Header.AvailableGroups, binIndex);
+            Bitmap::SetBit(context->Header.AvailableGroups, bin->Number);
         }
-        else Bitmap::ResetBit(context->Header.AvailableGroups, binIndex);
+        else Bitmap::ResetBit(context->Header.AvailableGroups, bin->Number);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    template <>
-    void SetAvailableForStealing<LargeGroup>(ThreadContext* context,
-                                             unsigned int binIndex, bool available) {
+    void SetAvailableForStealing(ThreadContext* context, LargeBin* bin, bool available) {
         // Stealing always disabled for large groups.
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    template <class Manager>
-    void* TrySteal(typename Selector<Manager>::BinType* bin, 
-                   ThreadContext* context, AllocationInfo& allocInfo) {
-        typedef typename Selector<Manager> GC; // Group context.
+    // Updates the stealing state of the bin after a location was taken
+    // from the specified group outside of 'AllocateFromBin'. Only the state
+    // of the active group is published, the other groups are ignored.
+    template <class GroupType, class BinType>
+    void UpdateActiveStealing(ThreadContext* context, BinType* bin, GroupType* group) {
+        if(group == bin->First()) {
+            SetAvailableForStealing(context, bin, group->CanBeStolen());
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    void* TrySteal(SmallBin* bin, ThreadContext* context, const AllocationInfo& allocInfo) {
         void* address;
 
-        GC::GroupType* stolenGroup = static_cast<GC::GroupType*>(bin->StolenGroup);
+        Group* stolenGroup = static_cast<Group*>(bin->StolenGroup);
 
         if((stolenGroup == nullptr) && bin->CanSteal) {
-            stolenGroup = StealGroup<Manager>(context, bin->Number + 1);
+            stolenGroup = StealGroup<SmallBAType>(context, bin->Number + 1, allocInfo.Size);
 
             if(stolenGroup != nullptr) {
                 // A group could be stolen and will be now linked 
@@ -621,26 +979,346 @@ public:
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    template <>
-    void* TrySteal<LargeBAType>(LargeBin* bin, ThreadContext* context,
-                                AllocationInfo& allocInfo) {
+    void* TrySteal(LargeBin* bin, ThreadContext* context, const AllocationInfo& allocInfo) {
         // Stealing always disabled for large groups.
         return nullptr;
     }
 
+#if defined(ADOPT)
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Determines if the owner of the context made no allocator operation
+    // in the last 'ADOPT_IDLE_TIME' milliseconds. The activity is sampled
+    // using the operation counter, so the owner never needs to read the time.
+    // Called with the lock of the context list held.
+    bool IsContextIdle(ThreadContext* context, unsigned int time) {
+        unsigned int operations = Atomic::Load(&context->Operations, std::memory_order_relaxed);
+
+        if(operations != context->IdleOperations) {
+            // The owner was active since the last scan, restart the interval.
+            context->IdleOperations = operations;
+            context->IdleSince = time;
+            return false;
+        }
+
+        return (time - context->IdleSince) >= Constants::ADOPT_IDLE_TIME;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Tries to obtain exclusive access to the bins of the specified context.
+    // This is a Dekker-style handshake with 'ContextGuard': we publish 'Adopting',
+    // force the store buffers of the owner to be flushed, and only then check 'Active'.
+    // If the buffers can't be flushed, no group is ever adopted.
+    bool ClaimContext(ThreadContext* context) {
+        if(Atomic::CompareExchange(&context->Adopting, 1, 0) != 0) {
+            return false; // Another thread adopts groups from this context.
+        }
+
+        if(!ThreadUtils::FlushWriteBuffers() ||
+           Atomic::Load(&context->Active, std::memory_order_acquire)) {
+            // The owner woke up in the meantime, or the owner's store 
+            // to 'Active' may still not be visible.
+            Atomic::Store(&context->Adopting, 0u, std::memory_order_release);
+            return false;
+        }
+
+        return true;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Takes an underused group from the bin of an idle context and makes 
+    // the specified bin its owner. The active group is never taken, 
+    // so that the idle thread can continue with it when it wakes up.
+    template <class Manager>
+    typename Selector<Manager>::GroupType* 
+    TakeIdleGroup(ThreadContext* idle, typename Selector<Manager>::BinType* bin, 
+                  ThreadContext* context) {
+        typedef Selector<Manager> GS; // Group selector.
+        typename GS::BinType* idleBin = FindBin<Manager>(idle, bin->Number, bin->Lifetime);
+
+        if((idleBin == nullptr) || (idleBin->Count() < 2)) {
+            return nullptr;
+        }
+
+        auto groupObject = GS::BinType::Policy::GetNext(idleBin->First());
+
+        while(groupObject != nullptr) {
+            typename GS::GroupType* group = static_cast<typename GS::GroupType*>(groupObject);
+
+            if(group->CanBeStolen()) {
+                // Foreign threads should not add the group to the public list 
+                // of the idle bin anymore. The public locations freed until
+                // the group is initialized are found when it becomes active.
+                ClosePublicGroup<Manager>(group, idleBin);
+                Atomic::Store(&group->ParentBin, (void*)bin, std::memory_order_release);
+                idleBin->Remove(group);
+#if defined(STEAL)
+                RemoveStolenGroup(idle, group, idleBin->Number);
+#endif
+                group->InitializeUsed(context->ThreadId);
+                return group;
+            }
+
+            groupObject = GS::BinType::Policy::GetNext(groupObject);
+        }
+
+        return nullptr;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Searches the contexts of idle threads (from the same NUMA node) for an 
+    // underused group from the same bin. This prevents allocating new groups
+    // while threads that stopped allocating still hold mostly empty ones.
+    template <class Manager>
+    typename Selector<Manager>::GroupType* 
+    AdoptGroup(ThreadContext* context, typename Selector<Manager>::BinType* bin) {
+        typedef Selector<Manager> GS; // Group selector.
+        unsigned int time = ThreadUtils::GetMilliseconds();
+
+        // Scanning the contexts is expensive, limit how often it's done.
+        if((time - Atomic::Load(&lastAdoptScan_, std::memory_order_relaxed)) < 
+           Constants::ADOPT_SCAN_INTERVAL) {
+            return nullptr;
+        }
+
+        // The lock also prevents the contexts from being released.
+        SpinLock listLock(&contextListLock_);
+        typename GS::GroupType* group = nullptr;
+        Atomic::Store(&lastAdoptScan_, time, std::memory_order_relaxed);
+
+        for(ThreadContext* idle = contextList_; idle != nullptr; idle = idle->NextContext) {
+            if((idle == context) || (idle->NumaNode != context->NumaNode) ||
+               !IsContextIdle(idle, time) || !ClaimContext(idle)) {
+                continue;
+            }
+
+            group = TakeIdleGroup<Manager>(idle, bin, context);
+            Atomic::Store(&idle->Adopting, 0u, std::memory_order_release); // Let the owner continue.
+
+            if(group != nullptr) {
+                break;
+            }
+        }
+
+        return group;
+    }
+#endif
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Gets a location large enough to hold the specified number of bytes.
     template <class Manager>
-    void* Allocate(size_t size)	{
+    void* Allocate(size_t size, Lifetime lifetime = LIFETIME_SHORT)	{
+        // Get the size and the bin for this allocation.
+        AllocationInfo allocInfo;
+        Selector<Manager>::GetAllocInfo(this, size, allocInfo);
+        return AllocateFromBin<Manager>(allocInfo, lifetime);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Tries to get a location from the group of the hint, or else from another
+    // group of the bin found in the same block. Only groups owned by the bin
+    // are considered, so no synchronization is needed.
+    // The header of the hint's group is read without any check (like in 'Deallocate'),
+    // so the hint must be a live location returned by this allocator.
+    template <class Manager>
+    void* AllocateNear(size_t size, void* hint, Lifetime lifetime) {
+        typedef Selector<Manager> GS; // Group selector.
+        AllocationInfo allocInfo;
+        GS::GetAllocInfo(this, size, allocInfo);
+        ThreadContext* context = GetCurrentContext();
+        assert(GS::BAType::IsValidGroup(GS::GetGroup(hint)));
+
+        if(context != nullptr) {
+            // Don't let other threads adopt groups from our bins while we use them.
+            ContextGuard guard(context);
+            typename GS::BinType* bin = FindBin<Manager>(context, allocInfo.Bin, lifetime);
+            typename GS::GroupType* hintGroup = GS::GetGroup(hint);
+
+            if(bin != nullptr) {
+                // If the hint is in a group of the bin, the group has locations
+                // of the same size and it's owned by this thread.
+                // The parent is changed by other threads if the group is not ours.
+                if(Atomic::Load(&hintGroup->ParentBin, std::memory_order_acquire) == bin) {
+                    void* address = hintGroup->GetPrivateLocation();
+
+                    if(address != nullptr) {
+#if defined(STEAL)
+                        UpdateActiveStealing(context, bin, hintGroup);
+#endif
+                        return address;
+                    }
+                }
+
+                // Taking from any group keeps the order of the bin valid,
+                // because the groups only get more used.
+                auto groupObject = bin->First();
+                unsigned int searched = 0;
+
+                while((groupObject != nullptr) && 
+                      (searched < Constants::NEAR_SEARCH_LIMIT)) {
+                    typename GS::GroupType* group = static_cast<typename GS::GroupType*>(groupObject);
+
+                    if((group != hintGroup) && 
+                       (group->ParentBlock == hintGroup->ParentBlock)) {
+                        void* address = group->GetPrivateLocation();
+
+                        if(address != nullptr) {
+#if defined(STEAL)
+                            UpdateActiveStealing(context, bin, group);
+#endif
+                            return address;
+                        }
+                    }
+
+                    groupObject = GS::BinType::Policy::GetNext(groupObject);
+                    searched++;
+                }
+            }
+        }
+
+        // No nearby location, use the normal allocation path.
+        return AllocateFromBin<Manager>(allocInfo, lifetime);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Computes the number of used and total locations of the first groups of the bin.
+    // The public locations are not merged (see 'GetUsedLocations'), so groups
+    // with many locations freed by other threads appear less sparse than they are.
+    template <class Manager>
+    void SampleBinUsage(typename Selector<Manager>::BinType* bin, 
+                        unsigned __int64& used, unsigned __int64& locations) {
+        typedef Selector<Manager> GS; // Group selector.
+        auto groupObject = bin->First();
+        unsigned int sampled = 0;
+        used = 0;
+        locations = 0;
+
+        while((groupObject != nullptr) && (sampled < Constants::RELOCATE_SAMPLE_GROUPS)) {
+            typename GS::GroupType* sample = static_cast<typename GS::GroupType*>(groupObject);
+            used += sample->GetUsedLocations();
+            locations += sample->Locations;
+            groupObject = GS::BinType::Policy::GetNext(groupObject);
+            sampled++;
+        }
+    }
+
+    // Returns true if the group has fewer used locations than the average 
+    // of the sampled groups. The active group is never considered sparse.
+    template <class Manager>
+    bool IsSparseGroup(typename Selector<Manager>::GroupType* group,
+                       typename Selector<Manager>::BinType* bin,
+                       unsigned __int64 used, unsigned __int64 locations) {
+        if(group == bin->First()) {
+            return false;
+        }
+
+        // used(group) / Locations(group) < used / locations
+        return ((unsigned __int64)group->GetUsedLocations() * locations) < 
+               (used * group->Locations);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    template <class Manager>
+    bool ShouldRelocate(typename Selector<Manager>::GroupType* group) {
+        typedef Selector<Manager> GS; // Group selector.
+
+        if(Atomic::Load(&group->ParentBin, std::memory_order_acquire) == nullptr) {
+            // The group is in a partial list of the block allocator,
+            // so at most 25% of its locations are used.
+            return true;
+        }
+
+        ThreadContext* context = GetCurrentContext();
+
+        if(context != nullptr) {
+            // Don't let other threads adopt groups from our bins while we use them.
+            ContextGuard guard(context);
+
+            // The owner is changed by threads that adopt the group.
+            if(Atomic::Load(&group->ThreadId, std::memory_order_relaxed) == context->ThreadId) {
+                auto bin = reinterpret_cast<typename GS::BinType*>(group->ParentBin);
+                unsigned __int64 used;
+                unsigned __int64 locations;
+
+                SampleBinUsage<Manager>(bin, used, locations);
+                return IsSparseGroup<Manager>(group, bin, used, locations);
+            }
+        }
+
+        // The bins of other threads can't be walked safely; use the same 
+        // limit as for returning partial groups. The counters of the group
+        // may be changed by the owner, the result is only a hint.
+        return (group->GetUsedLocations() * 4) <= group->Locations;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Gets a location for an object that is relocated, avoiding the groups
+    // for which 'ShouldRelocate' would be true.
+    template <class Manager>
+    void* AllocateForRelocation(size_t size, Lifetime lifetime) {
+        typedef Selector<Manager> GS; // Group selector.
+        AllocationInfo allocInfo;
+        GS::GetAllocInfo(this, size, allocInfo);
+        ThreadContext* context = GetCurrentContext();
+
+        if(context != nullptr) {
+            // Don't let other threads adopt groups from our bins while we use them.
+            ContextGuard guard(context);
+            typename GS::BinType* bin = FindBin<Manager>(context, allocInfo.Bin, lifetime);
+
+            if(bin != nullptr) {
+                // Use the first group of the bin that is not sparse.
+                unsigned __int64 used;
+                unsigned __int64 locations;
+                SampleBinUsage<Manager>(bin, used, locations);
+
+                auto groupObject = bin->First();
+                unsigned int searched = 0;
+
+                while((groupObject != nullptr) && 
+                      (searched < Constants::RELOCATE_SAMPLE_GROUPS)) {
+                    typename GS::GroupType* group = static_cast<typename GS::GroupType*>(groupObject);
+
+                    if(!IsSparseGroup<Manager>(group, bin, used, locations)) {
+                        void* address = group->GetPrivateLocation();
+
+                        if(address != nullptr) {
+#if defined(STEAL)
+                            UpdateActiveStealing(context, bin, group);
+#endif
+                            return address;
+                        }
+                    }
+
+                    groupObject = GS::BinType::Policy::GetNext(groupObject);
+                    searched++;
+                }
+            }
+        }
+
+        return AllocateFromBin<Manager>(allocInfo, lifetime, true /* relocation */);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Gets a location from the bin indicated by the allocation information.
+    // Each lifetime has its own bins, so their groups are never shared.
+    // A location that replaces a relocated one is taken only from the active
+    // group or from an empty group, never from the mostly empty groups 
+    // of this bin, of other bins, of idle threads and from the partial lists.
+    template <class Manager>
+    void* AllocateFromBin(const AllocationInfo& allocInfo, 
+                          Lifetime lifetime = LIFETIME_SHORT, bool relocation = false) {
         // It tries to obtain the location in the following order:
         // 1. Active group.
         // 2. Make second group active (if it's empty enough).
         // 3. Make a group with freed location by other threads (public) active.
         // 4. Steal a location (if enabled).
-        // 5. Get a new (partially)empty group.
+        //    Adopt an underused group from an idle thread (if enabled).
+        // 5. Get a new (partially)empty group (an empty one cached by the thread first).
         // If none of the above methods finds a location, 
         // the system has run out of memory!
-        typedef typename Selector<Manager> GS; // Group selector.
+        typedef Selector<Manager> GS; // Group selector.
+        unsigned __int64 callStart = PathProfiler::Start();
+        unsigned __int64 stepStart = callStart;
 
         // Get the context associated with this thread.
         ThreadContext* context = GetCurrentContext();
@@ -649,14 +1327,13 @@ public:
             context = CreateContext();
         }
 
-        // Get the size and the bin for this allocation.
-        AllocationInfo allocInfo;
-        GS::GetAllocInfo(this, size, allocInfo);
+        // Don't let other threads adopt groups from our bins while we use them.
+        ContextGuard guard(context);
 
         // The object is small enough so it will be allocated from a group.
         // Allocate the object from the corresponding bin.
-        GS::BinType* bin = GS::GetBin(context, allocInfo.Bin);
-        GS::GroupType* activeGroup = static_cast<GS::GroupType*>(bin->First());
+        typename GS::BinType* bin = GetBin<Manager>(context, allocInfo.Bin, lifetime);
+        typename GS::GroupType* activeGroup = static_cast<typename GS::GroupType*>(bin->First());
         void* address = nullptr;
 
         // 1. Take from the active group.
@@ -664,16 +1341,24 @@ public:
             address = activeGroup->GetPrivateLocation();
             
             if(address != nullptr) {
+                PathProfiler::Hit(context->Profile, PathProfiler::ALLOCATE_ACTIVE,
+                                  callStart, stepStart);
                 return address;
             }
+
+            stepStart = PathProfiler::Miss(context->Profile, PathProfiler::ALLOCATE_ACTIVE, 
+                                           stepStart);
         }
 
         // 2. An active bin doesn't exist, or it is full.
         // We see if the next group has free locations. If it does not,
         // it is guaranteed that all the other groups don't have free locations too.
-        if(bin->Count() >= 2) {
+        // A relocated location should not go to a mostly empty group, 
+        // neither to one with public locations, which can be sparse too;
+        // an empty group (step 5) is preferred instead.
+        if((bin->Count() >= 2) && !relocation) {
             auto groupObject = GS::BinType::Policy::GetNext(bin->First());
-            activeGroup = static_cast<GS::GroupType*>(groupObject);
+            activeGroup = static_cast<typename GS::GroupType*>(groupObject);
 
             if(activeGroup->IsEmptyEnough()) {
                 Statistics::ActiveGroupChanged(activeGroup->Next);
@@ -681,21 +1366,23 @@ public:
                 // Make the second group the active one.
                 MakeGroupActive(bin, activeGroup);
 #if defined(STEAL)
-                SetAvailableForStealing<GS::GroupType>(context, allocInfo.Bin, 
-                                                       activeGroup->CanBeStolen());
+                SetAvailableForStealing(context, bin, 
+                                        activeGroup->CanBeStolen());
 #endif
-                return activeGroup->GetLocation();
+                address = activeGroup->GetLocation();
+                PathProfiler::Hit(context->Profile, PathProfiler::ALLOCATE_SECOND,
+                                  callStart, stepStart);
+                return address;
             }
+
+            stepStart = PathProfiler::Miss(context->Profile, PathProfiler::ALLOCATE_SECOND, 
+                                           stepStart);
         }
 
         // 3. See if there is any group that has free public locations.
-        if(bin->PublicGroup != nullptr) {
-            // Synchronize access to the public list.
-            SpinLock binLock(&bin->PublicLock);
-
-            activeGroup = static_cast<GS::GroupType*>(bin->PublicGroup);
-            bin->PublicGroup = static_cast<GS::GroupType*>(activeGroup->NextPublic);
-            binLock.Unlock(); // The lock can be released now.
+        if((Atomic::Load(&bin->PublicGroup, std::memory_order_relaxed) != nullptr) && !relocation) {
+            // Foreign threads only add groups to the list, so it can't become empty.
+            activeGroup = PopPublicGroup<Manager>(bin);
             
             if(activeGroup != bin->First()) {
                 // Bring the group to the front of the bin.
@@ -706,44 +1393,115 @@ public:
             address = activeGroup->GetLocation();
 
 #if defined(STEAL)
-            SetAvailableForStealing<GS::GroupType>(context, allocInfo.Bin, 
-                                                   activeGroup->CanBeStolen());
+            SetAvailableForStealing(context, bin, 
+                                    activeGroup->CanBeStolen());
 #endif
 /* RET*/	if(address != nullptr) {
+                PathProfiler::Hit(context->Profile, PathProfiler::ALLOCATE_PUBLIC,
+                                  callStart, stepStart);
                 return address;
             }
+
+            stepStart = PathProfiler::Miss(context->Profile, PathProfiler::ALLOCATE_PUBLIC, 
+                                           stepStart);
         }
 
 #if defined(STEAL)
         // 4. Try to steal a location from a group in another bin. 
         // This reduces memory usage and fragmentation.
-        address = TrySteal<Manager>(bin, context, allocInfo);
+        address = relocation ? nullptr : TrySteal(bin, context, allocInfo);
         if(address != nullptr) {
+            PathProfiler::Hit(context->Profile, PathProfiler::ALLOCATE_STEAL,
+                              callStart, stepStart);
             return address;
         }
+
+        stepStart = PathProfiler::Miss(context->Profile, PathProfiler::ALLOCATE_STEAL, 
+                                       stepStart);
+#endif
+
+#if defined(ADOPT)
+        // 4b. Adopt a group from the same bin of a thread that is idle.
+        activeGroup = relocation ? nullptr : AdoptGroup<Manager>(context, bin);
+
+        if(activeGroup != nullptr) {
+            AddNewGroup(bin, activeGroup);
+            address = activeGroup->GetLocation();
+    #if defined(STEAL)
+            SetAvailableForStealing(context, bin, 
+                                    activeGroup->CanBeStolen());
+    #endif
+            if(address != nullptr) {
+                PathProfiler::Hit(context->Profile, PathProfiler::ALLOCATE_ADOPT,
+                                  callStart, stepStart);
+                return address;
+            }
+        }
+
+        stepStart = PathProfiler::Miss(context->Profile, PathProfiler::ALLOCATE_ADOPT, 
+                                       stepStart);
 #endif
 
         // 5. A new group is needed.
         Statistics::GroupObtained(activeGroup);
+        RecordGroupObtained(bin);
         unsigned int locations = (GS::GroupSize - GS::HeaderSize) / allocInfo.Size;
-        GS::BAType* manager = GS::GetBA(this, context->NumaNode);
+        activeGroup = GetCachedGroup<Manager>(context, bin, allocInfo, locations);
+
+        if((activeGroup == nullptr) && 
+           (bin->Count() >= Constants::GROUP_REFILL_THRESHOLD)) {
+            // The bin is filling fast; take several groups under a single 
+            // acquisition of the block allocator lock and cache them.
+            GroupCache* cache = GS::GetGroupCache(context);
+            typename GS::BAType* manager = GS::GetBA(this, context->NumaNode);
+            cache->Count = manager->template GetGroups<MemoryPolicy>(cache->Groups, 
+                                                            Constants::GROUP_REFILL_SIZE);
+            activeGroup = GetCachedGroup<Manager>(context, bin, allocInfo, locations);
+        }
 
-        auto groupObject = manager->GetGroup<MemoryPolicy>(allocInfo.Size, locations, 
-                                                           bin, context->ThreadId);
-        activeGroup = static_cast<GS::GroupType*>(groupObject);
+        if(activeGroup == nullptr) {
+            typename GS::BAType* manager = GS::GetBA(this, context->NumaNode);
+            auto groupObject = manager->template GetGroup<MemoryPolicy>(allocInfo.Size, locations, 
+                                                               bin, context->ThreadId,
+                                                               !relocation);
+            activeGroup = static_cast<typename GS::GroupType*>(groupObject);
+        }
 
         if(activeGroup == nullptr) {
+            PathProfiler::Miss(context->Profile, PathProfiler::ALLOCATE_NEW_GROUP, stepStart);
             return nullptr; // Failed to allocate memory!
         }
 
 #if defined(STEAL)
-        SetAvailableForStealing<GS::GroupType>(context, allocInfo.Bin, true);
+        SetAvailableForStealing(context, bin, true);
 #endif
         // Add the new group to the bin and return the requested location.
         AddNewGroup(bin, activeGroup);
-        return activeGroup->GetLocation();
+        address = activeGroup->GetLocation();
+        PathProfiler::Hit(context->Profile, PathProfiler::ALLOCATE_NEW_GROUP,
+                          callStart, stepStart);
+        return address;
     }
 
+    // Gets a location that has all bytes set to zero. Locations that were 
+    // never used since the memory was obtained from the OS are already zero.
+    template <class Manager>
+    void* AllocateZeroed(size_t size) {
+        typedef Selector<Manager> GS; // Group selector.
+        void* address = Allocate<Manager>(size);
+
+        if(address != nullptr) {
+            typename GS::GroupType* group = GS::GetGroup(address);
+
+            if(!group->IsZeroedLocation(address)) {
+                Memory::Zero(address, size);
+            }
+        }
+
+        return address;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Allocates a very large location (> 1MB) directly from the OS.
     void* AllocateFromOS(size_t size) {
         // Get the context associated with this thread.
@@ -768,7 +1526,7 @@ public:
 
         // Align the address.
         uintptr_t temp = (uintptr_t)address + Constants::SMALL_GROUP_SIZE - 1;
-        OSHeader* header = reinterpret_cast<OSHeader*>(temp & ~(Constants::SMALL_GROUP_SIZE - 1));
+        OSHeader* header = reinterpret_cast<OSHeader*>(temp & ~((uintptr_t)Constants::SMALL_GROUP_SIZE - 1));
 
         header->RealAddress = address;
         header->LocationAddress = (void*)((uintptr_t)header + sizeof(OSHeader));
@@ -800,10 +1558,8 @@ public:
     bool IsGroupUnused(typename Selector<Manager>::GroupType* group, 
                        typename Selector<Manager>::BinType* bin) {
         // In order to be returned to the global list, the group 
-        // needs to be completely empty and// at least 'ReturnAllowed'
-        // allowed groups should remain in the bin.
-        return group->IsFull() &&
-               (bin->Count() > (bin->ReturnAllowed - 1));
+        // needs to be completely empty and the bin should not retain it.
+        return group->IsFull() && !ShouldRetainGroup(bin);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -815,11 +1571,152 @@ public:
     bool IsGroupAlmostFull(typename Selector<Manager>::GroupType* group, 
                            typename Selector<Manager>::BinType* bin) {
         // In order to be returned to the global list, the group needs
-        // to be completely empty and at least 'ReturnAllowed' allowed 
-        // groups should remain in the bin.
+        // to be mostly empty and the bin should not retain it.
         return Selector<Manager>::CanReturnPartial(bin) && 
-               group->ShouldReturn() &&
-               (bin->Count() > (bin->ReturnAllowed - 1));
+               group->ShouldReturn() && !ShouldRetainGroup(bin);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Determines if the bin should keep an empty group instead of returning it 
+    // to the block allocator. At least 'Retain' groups are kept. The value grows
+    // when the bin needs a new group shortly after returning one (it oscillates 
+    // around a group boundary) and decays after a period without such churn,
+    // so hot bins keep their groups and cold ones return them quickly.
+    template <class BinType>
+    bool ShouldRetainGroup(BinType* bin) {
+        if(bin->Count() > bin->Retain) {
+            return false;
+        }
+
+        if(bin->Retain > Constants::RETAIN_MIN) {
+            unsigned int time = ThreadUtils::GetMilliseconds();
+
+            if((time - bin->LastChurn) >= Constants::RETAIN_DECAY_TIME) {
+                // No churn lately, retain one group less.
+                bin->Retain--;
+                bin->LastChurn = time;
+                return bin->Count() <= bin->Retain;
+            }
+        }
+
+        return true;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Called before the bin obtains a new group from the block allocator.
+    // If a group was returned only a short time ago the bin retains more groups.
+    template <class BinType>
+    void RecordGroupObtained(BinType* bin) {
+        unsigned int time = ThreadUtils::GetMilliseconds();
+
+        if((time - bin->LastReturn) < Constants::RETAIN_CHURN_TIME) {
+            if(bin->Retain < Constants::RETAIN_MAX) {
+                bin->Retain++;
+            }
+
+            bin->LastChurn = time;
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Adds the groups linked through 'NextPublic', starting with 'first', 
+    // to the public list of the bin. Used by both foreign and owner threads.
+    template <class Manager>
+    void PushPublicGroups(typename Selector<Manager>::GroupType* first, 
+                          typename Selector<Manager>::BinType* bin) {
+        typedef Selector<Manager> GS; // Group selector.
+        auto last = first;
+
+        while(last->NextPublic != nullptr) {
+            last = static_cast<typename GS::GroupType*>(last->NextPublic);
+        }
+
+        void* head;
+
+        do {
+            head = Atomic::Load((void* volatile*)&bin->PublicGroup, std::memory_order_relaxed);
+            last->NextPublic = head;
+        } while(Atomic::CompareExchange((void* volatile*)&bin->PublicGroup, (void*)first, 
+                                        head, std::memory_order_release) != head);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Removes the first group from the public list of the bin. 
+    // Only the owner can remove groups, so it takes the whole list 
+    // and puts back the remaining groups (no ABA problem).
+    template <class Manager>
+    typename Selector<Manager>::GroupType* 
+    PopPublicGroup(typename Selector<Manager>::BinType* bin) {
+        typedef Selector<Manager> GS; // Group selector.
+        void* list = Atomic::ExchangePointer((void* volatile*)&bin->PublicGroup, nullptr,
+                                             std::memory_order_acquire);
+        auto group = static_cast<typename GS::GroupType*>(list);
+
+        if(group == nullptr) {
+            return nullptr;
+        }
+
+        auto next = static_cast<typename GS::GroupType*>(group->NextPublic);
+
+        if(next != nullptr) {
+            PushPublicGroups<Manager>(next, bin);
+        }
+
+        // New public locations may add the group to the list again.
+        group->NextPublic = nullptr;
+        Atomic::Store(&group->PublicQueued, Constants::PUBLIC_OPEN, std::memory_order_release);
+        return group;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Makes sure the group is not in the public list of the bin and that
+    // foreign threads don't add it anymore. Called by the owner before 
+    // the group leaves the bin. In the rare case the group is queued, 
+    // it's removed from the list, otherwise no list operation is needed.
+    template <class Manager>
+    void ClosePublicGroup(typename Selector<Manager>::GroupType* group, 
+                          typename Selector<Manager>::BinType* bin) {
+        typedef Selector<Manager> GS; // Group selector.
+        unsigned int waitCount = 1;
+
+        while(Atomic::CompareExchange(&group->PublicQueued, Constants::PUBLIC_CLOSED,
+                                      Constants::PUBLIC_OPEN) != Constants::PUBLIC_OPEN) {
+            // The group is in the list, or a foreign thread is about to add it.
+            void* list = Atomic::ExchangePointer((void* volatile*)&bin->PublicGroup, nullptr,
+                                                 std::memory_order_acquire);
+            auto first = static_cast<typename GS::GroupType*>(list);
+            typename GS::GroupType* previous = nullptr;
+            typename GS::GroupType* current = first;
+            
+            while((current != nullptr) && (current != group)) {
+                previous = current;
+                current = static_cast<typename GS::GroupType*>(current->NextPublic);
+            }
+
+            if(current == group) {
+                // Unlink the group; it can't be added again while it's queued.
+                if(previous != nullptr) {
+                    previous->NextPublic = group->NextPublic;
+                }
+                else first = static_cast<typename GS::GroupType*>(group->NextPublic);
+
+                Statistics::InvalidPublicGroup(group);
+                group->NextPublic = nullptr;
+                Atomic::Store(&group->PublicQueued, Constants::PUBLIC_CLOSED, 
+                              std::memory_order_release);
+            }
+
+            if(first != nullptr) {
+                PushPublicGroups<Manager>(first, bin);
+            }
+
+            if(current == group) {
+                return;
+            }
+
+            ThreadUtils::SpinWait(waitCount);
+            waitCount = waitCount < 1024 ? waitCount * 2 : 1024;
+        }
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -832,7 +1729,7 @@ public:
                                   typename Selector<Manager>::BinType* bin, 
                                   ThreadContext* context) {
         Statistics::UsedGroupReturned(group);
-        typedef typename Selector<Manager> GS; // Group selector.
+        typedef Selector<Manager> GS; // Group selector.
 
         // Remove the group from the bin.
         bin->Remove(group);
@@ -841,85 +1738,150 @@ public:
         // The group may be still referenced by bins that stole 
         // locations from it. This references need to be cleared 
         // before returning the group to the global list.
-        RemoveStolenGroup<Manager>(context, group, bin->Number);
+        RemoveStolenGroup(context, group, bin->Number);
 #endif
 
         // When we entered this method the group had no public locations.
-        // If now it has, it means a foreign thread freed a location and added
-        // the group to the public list. If it has, the group must be removed.
-        // Synchronize access to the public list.
-        SpinLock publicLock(&bin->PublicLock);
-
-        if(group->HasPublic()) {
-            Statistics::InvalidPublicGroup(group);
-
-            if(bin->PublicGroup == group)	{
-                bin->PublicGroup = static_cast<GS::GroupType*>(group->NextPublic);
-            }
-            else {
-                // The group is not the first one in the list, we need to find it.
-                auto previous = static_cast<GS::GroupType*>(bin->PublicGroup);
-                auto current  = static_cast<GS::GroupType*>(previous->NextPublic);
-
-                while(current != nullptr) {
-                    if(current == group)	{
-                        // Remove the group from the list.
-                        previous->NextPublic = current->NextPublic;
-                        break;
-                    }
-
-                    // Advance to next group.
-                    previous = current;
-                    current = static_cast<GS::GroupType*>(current->NextPublic);
-                }
-            }
-        }
-
-        // The lock can be removed.
-        publicLock.Unlock();
+        // If now it has, a foreign thread may have added the group
+        // to the public list; it must be removed from there.
+        ClosePublicGroup<Manager>(group, bin);
 
         // Return the group to the block allocator.
-        GS::BAType* manager = GS::GetBA(this, context->NumaNode);		
-        manager->ReturnPartialGroup<MemoryPolicy>(group, GS::BAType::ADD_GROUP, 
-                                                  bin->Number, context->ThreadId);
+        typename GS::BAType* manager = GS::GetBA(this, context->NumaNode);		
+        manager->template ReturnPartialGroup<MemoryPolicy>(group, GS::BAType::ADD_GROUP, 
+                                                  bin, context->ThreadId);
 
-        // The last group can be removed only once. This prevents situations
-        // when a group would be repeatedly linked and unlinked from the bin.
-        if(bin->Count == (bin->ReturnAllowed - 1)) {
-            bin->ReturnAllowed++;
-        }
+        // Used to detect bins that repeatedly return and obtain groups.
+        bin->LastReturn = ThreadUtils::GetMilliseconds();
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Returns a group that is completely empty to the global list.
-    // No synchronization is required because only the owner thread
-    // can remove the group.
+    // Removes a group that is completely empty from it's bin and adds it 
+    // to the cache of the thread. No synchronization is required because 
+    // only the owner thread can remove the group.
     template<class Manager>
     void ReturnUnusedGroup(typename Selector<Manager>::GroupType* group, 
                            typename Selector<Manager>::BinType* bin, 
                            ThreadContext* context) {
         Statistics::EmptyGroupReturned(group);
-        typedef typename Selector<Manager> GS; // Group context.
+        typedef Selector<Manager> GS; // Group context.
 
-        // The group is completely empty.
-        group->ParentBin = nullptr;
+        // The group is completely empty. It may still be in the public list
+        // if it's public locations were merged while it was active.
+        ClosePublicGroup<Manager>(group, bin);
+        Atomic::Store(&group->ParentBin, (void*)nullptr, std::memory_order_release);
         bin->Remove(group);
 
 #if defined(STEAL)
         // The group may be still referenced by bins that stole 
         // locations from it. This references need to be cleared 
         // before returning the group to the global list.
-        RemoveStolenGroup<Manager>(context, group, bin->Number);
+        RemoveStolenGroup(context, group, bin->Number);
 #endif
 
-        GS::BAType* manager = GS::GetBA(this, context->NumaNode);
-        manager->ReturnFullGroup<MemoryPolicy>(group, true /* lock*/);
+        // Keep the group in the cache of the thread, any bin can take it 
+        // from there without acquiring the lock of the block allocator.
+        GroupCache* cache = GS::GetGroupCache(context);
+
+        if(cache->Count == Constants::GROUP_CACHE_SIZE) {
+            FlushGroupCache<Manager>(context, Constants::GROUP_CACHE_FLUSH);
+        }
+
+        cache->Groups[cache->Count++] = group;
+
+        // Used to detect bins that repeatedly return and obtain groups.
+        bin->LastReturn = ThreadUtils::GetMilliseconds();
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the oldest 'count' groups from the cache of the thread 
+    // to the block allocator.
+    template<class Manager>
+    void FlushGroupCache(ThreadContext* context, unsigned int count) {
+        typedef Selector<Manager> GS; // Group context.
+        GroupCache* cache = GS::GetGroupCache(context);
+        typename GS::BAType* manager = GS::GetBA(this, context->NumaNode);
+        manager->template ReturnFullGroups<MemoryPolicy>(cache->Groups, count);
+
+        for(unsigned int i = count; i < cache->Count; i++) {
+            cache->Groups[i - count] = cache->Groups[i];
+        }
+
+        cache->Count -= count;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns all groups from both caches of the thread to the block allocators.
+    // Must be called by the owner of the context, or after it was claimed.
+    void FlushGroupCaches(ThreadContext* context) {
+        FlushGroupCache<SmallBAType>(context, context->SmallCache.Count);
+        FlushGroupCache<LargeBAType>(context, context->LargeCache.Count);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Moves the empty groups retained by the bins of the context (see 'ShouldRetainGroup')
+    // to the cache of the thread. Groups with public locations that were not merged yet
+    // are not considered empty and remain in their bins.
+    // Must be called by the owner of the context, or after it was claimed.
+    template<class Manager>
+    void ReturnRetainedGroups(ThreadContext* context) {
+        typedef Selector<Manager> GS; // Group context.
+
+        for(unsigned int lifetime = 0; lifetime < Constants::LIFETIMES; lifetime++) {
+            for(unsigned int number = 0; number < GS::BinCount; number++) {
+                typename GS::BinType* bin = FindBin<Manager>(context, number, lifetime);
+
+                if(bin == nullptr) {
+                    continue;
+                }
+
+                auto groupObject = bin->First();
+
+                while(groupObject != nullptr) {
+                    typename GS::GroupType* group = static_cast<typename GS::GroupType*>(groupObject);
+                    groupObject = GS::BinType::Policy::GetNext(groupObject);
+
+                    if(group->IsFull()) {
+                        ReturnUnusedGroup<Manager>(group, bin, context);
+                    }
+                }
+            }
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the empty groups of the bins and the caches of the context
+    // to the block allocators, so that their blocks can be released.
+    // Must be called by the owner of the context, or after it was claimed.
+    void TrimContext(ThreadContext* context) {
+        ReturnRetainedGroups<SmallBAType>(context);
+        ReturnRetainedGroups<LargeBAType>(context);
+        FlushGroupCaches(context);
+    }
 
-        // The last group can be removed only once. This prevents situations
-        // when a group would be repeatedly linked and unlinked from the bin.
-        if(bin->Count() == (bin->ReturnAllowed - 1)) {
-            bin->ReturnAllowed++;
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Takes the most recently cached empty group and initializes it for the bin.
+    // Returns nullptr if the cache of the thread is empty.
+    template<class Manager>
+    typename Selector<Manager>::GroupType* 
+    GetCachedGroup(ThreadContext* context, typename Selector<Manager>::BinType* bin,
+                   const AllocationInfo& allocInfo, unsigned int locations) {
+        typedef Selector<Manager> GS; // Group context.
+        GroupCache* cache = GS::GetGroupCache(context);
+
+        if(cache->Count == 0) {
+            return nullptr;
         }
+
+        // The lowest bit is set for groups taken in a batch from the block 
+        // allocator whose memory was never used. Groups returned by the bins 
+        // were used before, so their memory is not known to be zero.
+        uintptr_t entry = (uintptr_t)cache->Groups[--cache->Count];
+        auto group = reinterpret_cast<typename GS::GroupType*>(entry & ~1);
+        group->InitializeUnused(allocInfo.Size, locations, context->ThreadId, 
+                                (entry & 1) != 0);
+        Atomic::Store(&group->ParentBin, (void*)bin, std::memory_order_release);
+        return group;
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -935,42 +1897,64 @@ public:
         unsigned int publicLocations = group->ReturnPublicLocation(address);
         
         if(publicLocations == 1) {
-            // This is the first public location from the group 
-            // and means that the group is not yet in the list of public ones.
-            // Synchronize access to the public list.
-            SpinLock publicLock(&bin->PublicLock);
-
-            // It's possible that before we could acquire the lock
-            // the parent thread of the group returned it to the list
-            // of partial groups. The group may be still there, or another
-            // thread could have took it. We can add the group to the public 
-            // list if the group is owned, and the owner hasn't changed.
-            if(group->ParentBin == bin) {
-                group->NextPublic = bin->PublicGroup;
-                bin->PublicGroup = group;
+            // This is the first public location from the group and means
+            // that the group may not be in the list of public ones yet.
+            // Only the thread that marks the group as queued can add it.
+            // If the group is already queued, or the owner closed it 
+            // because it leaves the bin, the location is found by the 
+            // owner when the group becomes active.
+            if(Atomic::CompareExchange(&group->PublicQueued, Constants::PUBLIC_QUEUED,
+                                       Constants::PUBLIC_OPEN) != Constants::PUBLIC_OPEN) {
+                return;
+            }
+
+            // It's possible that the parent thread of the group returned it 
+            // to the list of partial groups, and another thread took it 
+            // (or adopted it from an idle owner) since we read the parent. 
+            if(Atomic::Load(&group->ParentBin, std::memory_order_acquire) == bin) {
+                group->NextPublic = nullptr;
+                PushPublicGroups<Manager>(group, bin);
             }
-         }
+            else Atomic::Store(&group->PublicQueued, Constants::PUBLIC_OPEN, 
+                               std::memory_order_release);
+        }
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Deallocates the specified location. Handles both owner and foreign threads.
     template <class Manager>
     void Deallocate(void* address, typename Selector<Manager>::GroupType* group) {
-        typedef typename Selector<Manager> GS; // Group context.
-        GS::BinType* bin = reinterpret_cast<GS::BinType*>(group->ParentBin);
+        typedef Selector<Manager> GS; // Group context.
+        typename GS::BinType* bin = reinterpret_cast<typename GS::BinType*>(group->ParentBin);
+        unsigned __int64 callStart = PathProfiler::Start();
 
-        if(*(volatile uintptr_t*)&group->ParentBin != 0) {
+        if(Atomic::Load(&group->ParentBin, std::memory_order_acquire) != nullptr) {
             // The group is owned by a thread, get the associated context.
+            // The owner of the group can change only while we're 
+            // outside the allocator (another thread adopted it).
             ThreadContext* context = GetCurrentContext();
 
+            if(context == nullptr) {
+                // The thread never allocated, so it can't own the group;
+                // the location is freed like by any other foreign thread.
+                DeallocatePublic<Manager>(address, group, bin);
+                PathProfiler::Deallocated(nullptr, PathProfiler::DEALLOCATE_PUBLIC, callStart);
+                return;
+            }
+
+            ContextGuard guard(context);
+
             if(group->ThreadId == context->ThreadId) {
+                bin = reinterpret_cast<typename GS::BinType*>(group->ParentBin);
                 // The group belongs to the current thread. 
                 // If the group is completely free (and it's allowed), 
                 // we return it to the global pool of free groups.
                 group->ReturnPrivateLocation(address);
 
                 if(IsGroupUnused<Manager>(group, bin)) {
-                    ReturnUnusedGroup<Manager>(group, bin, context);				
+                    ReturnUnusedGroup<Manager>(group, bin, context);
+                    PathProfiler::Deallocated(context->Profile, 
+                                              PathProfiler::DEALLOCATE_GROUP_RETURN, callStart);
                     return;
                 }
                 else if(group != bin->First()) { 
@@ -985,15 +1969,18 @@ public:
 
                         bin->Remove(group);
                         bin->AddAfter(bin->First(), group);
-                        return;
                     }
                 }
+
+                PathProfiler::Deallocated(context->Profile, 
+                                          PathProfiler::DEALLOCATE_PRIVATE, callStart);
             } // END: group->ThreadId == context->ThreadId
             else {
                 // This thread is not the owner of the group. 
                 // The location is added to the synchronized public list.
                 DeallocatePublic<Manager>(address, group, bin);
-                return;
+                PathProfiler::Deallocated(context->Profile, 
+                                          PathProfiler::DEALLOCATE_PUBLIC, callStart);
             }
         } // END: group->IsOwnedn
         else {
@@ -1007,12 +1994,22 @@ public:
                 // it from the partial list and add it to the full list 
                 // (it's the block allocator's responsibility to check 
                 // that the group is still in the partial list).
+                // The thread may not have a context if it never allocated.
                 ThreadContext* context = GetCurrentContext();
-                auto manager = Selector<Manager>::GetBA(this, context->NumaNode);
+                unsigned int numaNode = context != nullptr ? context->NumaNode : 0;
+                unsigned int threadId = context != nullptr ? context->ThreadId : 
+                                                             ThreadUtils::GetCurrentThreadId();
+                auto manager = Selector<Manager>::GetBA(this, numaNode);
 
-                manager->ReturnPartialGroup<MemoryPolicy>(group, GS::BAType::REMOVE_GROUP, 
-                                                          bin->Number, context->ThreadId);
+                manager->template ReturnPartialGroup<MemoryPolicy>(group, GS::BAType::REMOVE_GROUP, 
+                                                          nullptr, threadId);
             }
+
+#if defined(PROFILE_PATHS)
+            ThreadContext* context = GetCurrentContext();
+            PathProfiler::Deallocated(context != nullptr ? context->Profile : nullptr,
+                                      PathProfiler::DEALLOCATE_ORPHAN, callStart);
+#endif
         }
     }
 
@@ -1098,7 +2095,7 @@ public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Creates the thread that cleans the huge location cache on a regular interval.
     void CreateCacheCleaningThread() {
-        bool state = Memory::ReadValue(&cacheThreadInitialized_);
+        bool state = Atomic::Load(&cacheThreadInitialized_, std::memory_order_acquire);
 
         if(!state) {
             // Acquire the lock. Will be automatically released by the destructor.
@@ -1113,12 +2110,19 @@ public:
                     return; // Not enough memory available!
                 }
 
-                cacheArgs->Allocator = this;
+                cacheArgs->Owner = this;
+#if defined(MEMORY_PRESSURE)
+                cacheArgs->Timeout = Constants::PRESSURE_CHECK_INTERVAL;
+#else
                 cacheArgs->Timeout = Constants::CACHE_CLEANING_INTERVAL;
-                cacheArgs->ThreadHandle = ThreadUtils::CreateThread(Allocator::CacheCleaningThread,
-                                                                    cacheArgs);
+#endif
+                // The priority is set here, the thread could otherwise
+                // run before the handle is stored.
+                cacheArgs->ThreadHandle = ThreadUtils::CreateThread(
+                                                (void*)Allocator::CacheCleaningThread, cacheArgs);
+                ThreadUtils::SetThreadLowPriority(cacheArgs->ThreadHandle);
 
-                Memory::WriteValue(&cacheThreadInitialized_, true);
+                Atomic::Store(&cacheThreadInitialized_, true, std::memory_order_release);
             }
         }
     }
@@ -1127,7 +2131,7 @@ public:
     // Makes sure that the huge cache cleaning thread is started.
     // Called only by the huge location allocation method.
     void EnsureCacheThreadActive() {
-        if(!cacheThreadInitialized_) {
+        if(!Atomic::Load(&cacheThreadInitialized_, std::memory_order_relaxed)) {
             CreateCacheCleaningThread();
         }
     }
@@ -1141,14 +2145,94 @@ public:
 #endif
 
         CacheThreadArgs* threadArgs = reinterpret_cast<CacheThreadArgs*>(args);
-        ThreadUtils::SetThreadLowPriority(threadArgs->ThreadHandle);
+#if defined(MEMORY_PRESSURE)
+        unsigned int elapsed = 0;
+#endif
 
         // The thread never exits.
         while(true) {
             ThreadUtils::Sleep(threadArgs->Timeout);
-            threadArgs->Allocator->CleanHugeCache();
+
+#if defined(MEMORY_PRESSURE)
+            // The memory status is checked more often than the cache is cleaned.
+            threadArgs->Owner->AdjustToMemoryPressure();
+            elapsed += threadArgs->Timeout;
+
+            if(elapsed < Constants::CACHE_CLEANING_INTERVAL) {
+                continue;
+            }
+
+            elapsed = 0;
+#endif
+            threadArgs->Owner->CleanHugeCache();
+        }
+    }
+
+#if defined(MEMORY_PRESSURE)
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Resizes the block and huge location caches based on the memory 
+    // the process can still use before reaching it's limit (job object or cgroup).
+    // Under high pressure the caches are disabled and all unused memory is released.
+    void AdjustToMemoryPressure() {
+        MemoryPressure::Status status;
+
+        if(!MemoryPressure::Query(status)) {
+            return;
+        }
+
+        MemoryPressure::Level level = MemoryPressure::GetLevel(status);
+        unsigned int smallLimit = 0;
+        unsigned int largeLimit = 0;
+
+        if(level != MemoryPressure::PRESSURE_HIGH) {
+            // The allowed blocks are split between small and large groups
+            // in the same proportion as the default cache sizes.
+            unsigned __int64 blocks = (MemoryPressure::GetHeadroom(status) / 
+                                       Constants::PRESSURE_HEADROOM_FRACTION) / 
+                                      Constants::BLOCK_SIZE;
+            unsigned int factor = level == MemoryPressure::PRESSURE_NONE ?
+                                  Constants::PRESSURE_MAX_CACHE_FACTOR : 1;
+            unsigned __int64 maxSmall = Constants::BLOCK_SMALL_CACHE * factor;
+            unsigned __int64 maxLarge = Constants::BLOCK_LARGE_CACHE * factor;
+            unsigned __int64 totalDefault = Constants::BLOCK_SMALL_CACHE + 
+                                            Constants::BLOCK_LARGE_CACHE;
+            unsigned __int64 small = (blocks * Constants::BLOCK_SMALL_CACHE) / totalDefault;
+            unsigned __int64 large = (blocks * Constants::BLOCK_LARGE_CACHE) / totalDefault;
+
+            smallLimit = (unsigned int)(small < maxSmall ? small : maxSmall);
+            largeLimit = (unsigned int)(large < maxLarge ? large : maxLarge);
+        }
+
+        unsigned int lastNode = memoryPolicy_.GetNodeNumber() +
+                                (memoryPolicy_.IsNuma() ? 0 : 1);
+
+        for(unsigned int node = 0; node < lastNode; node++) {
+            smallBlockAlloc_[node]->SetCacheLimit(smallLimit);
+            largeBlockAlloc_[node]->SetCacheLimit(largeLimit);
+        }
+
+        // Under moderate pressure the huge caches return to half their default size.
+        for(unsigned int i = Constants::HUGE_START; i < Constants::HUGE_BINS; i++) {
+            HugeBin* bin = &hugeBins_[i];
+            unsigned int size = level == MemoryPressure::PRESSURE_HIGH ? 0 :
+                                level == MemoryPressure::PRESSURE_MODERATE ? 
+                                bin->MaxCacheSize / 2 : bin->MaxCacheSize;
+
+            if((level != MemoryPressure::PRESSURE_NONE) || (bin->CacheSize < size)) {
+                bin->CacheSize = size;
+            }
+        }
+
+        // The block caches shrink only when groups are returned, 
+        // so release the blocks above the new limits now.
+        if(level == MemoryPressure::PRESSURE_HIGH) {
+            Trim(0);
+        }
+        else if(level == MemoryPressure::PRESSURE_MODERATE) {
+            Trim((size_t)(smallLimit + largeLimit) * Constants::BLOCK_SIZE);
         }
     }
+#endif
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Initializes a huge location that has no other linked locations.
@@ -1186,13 +2270,10 @@ public:
             if(addRef) parent->AddRef();
 
             // There is space for at least one small group.
-            // Compute the bitmap of the available groups.
             unsigned int nGroups = available / Constants::SMALL_GROUP_SIZE;
-            unsigned __int64 bitmap = (1 << nGroups) - 1;
 
             auto manager = Selector<SmallBAType>::GetBA(this, context->NumaNode);
-            auto block = manager->AddBlock<MemoryPolicy>(address, bitmap,
-                                                         nGroups, address);
+            auto block = manager->AddBlock<MemoryPolicy>(address, nGroups, address);
 
             InitializeHugeLocationEx(address, bin, size, true, parent, block);
             return true;
@@ -1217,7 +2298,7 @@ public:
         while(start < end) {
             // Align to the size of a small group.
             start = (char*)(((uintptr_t)start + Constants::SMALL_GROUP_SIZE - 1) & 
-                            ~(Constants::SMALL_GROUP_SIZE - 1));
+                            ~((uintptr_t)Constants::SMALL_GROUP_SIZE - 1));
 
             if(start >= end) {
                 break; // We are past the allocated block.
@@ -1255,8 +2336,9 @@ public:
     }
     
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Allocates a huge location.
-    void* AllocateHuge(unsigned int size) {
+    // Allocates a huge location. 'zeroed' is set if the location
+    // was obtained directly from the OS (it's filled with zero).
+    void* AllocateHuge(unsigned int size, bool& zeroed) {
         // The object is large and must be allocated from the OS 
         // 1. Check if an unused locations with the corresponding size is cached.
         // 2. If not, search the next 2 bins for a cached location and take it from there.
@@ -1279,9 +2361,11 @@ public:
         /*void* address = hugeBins_[startBin].Cache.Pop();
 
         if(address != nullptr) {
+            zeroed = false; // The location was used before.
             return HugeToClient(address);
         }
 */
+        zeroed = true;
         // The demand for this size may be very high, 
         // try to increase the cache.
         hugeBins_[startBin].IncreaseCacheSize();
@@ -1315,7 +2399,7 @@ public:
         else {
             // Align to the size of a small group.
             unusedP = (char*)(((uintptr_t)unusedP + Constants::SMALL_GROUP_SIZE - 1) & 
-                             ~(Constants::SMALL_GROUP_SIZE - 1));
+                             ~((uintptr_t)Constants::SMALL_GROUP_SIZE - 1));
             foundAvailable = UnusedAsGroups(address, unusedP, endP, startBin, 
                                             objSize, true /*addRef*/, context);
         }
@@ -1355,19 +2439,33 @@ public:
 
 
 public:
+    // The location returned by 'AllocateAtLeast' and it's usable size.
+    struct AllocationResult {
+        void* Address;
+        size_t Size;
+    };
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     Allocator() {
         initialized_ = false;
         initLock_ = 0;
         cacheThreadInitialized_ = false;
         cacheThreadLock_ = 0;
+        contextListLock_ = 0;
+        contextList_ = nullptr;
+        lastAdoptScan_ = 0;
         threadContextPool_ = ObjectPool(Constants::THREAD_CONTEXT_ALLOCATION_SIZE, 
-                                        Constants::THREAD_CONTEXT_SIZE,
-                                        Constants::THREAD_CONTEXT_CACHE);
+                                        Constants::THREAD_CONTEXT_SIZE);
 
         blockAllocatorPool_ = ObjectPool(Constants::BA_ALLOCATION_SIZE,
-                                         Constants::BA_SIZE,
-                                         Constants::BA_CACHE);
+                                         Constants::BA_SIZE);
+
+        binChunkPool_ = ObjectPool(Constants::BIN_CHUNK_ALLOCATION_SIZE,
+                                   sizeof(BinChunk));
     
+        // Select the bitmap kernels supported by the processor.
+        BitmapKernels::Initialize();
+
         // Initialize the memory policy and the block allocators.
         memoryPolicy_.Initialize();
         unsigned int lastNode = memoryPolicy_.GetNodeNumber() +
@@ -1395,18 +2493,21 @@ public:
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Allocates a location having the specified size.
-    void* Allocate(size_t size) {
+    // Allocates a location having the specified size. The lifetime is a hint
+    // that separates locations freed at different times into different groups,
+    // so that they can be returned sooner. It's ignored for huge locations.
+    void* Allocate(size_t size, Lifetime lifetime = LIFETIME_SHORT) {
         // Determine in which category (small, large, huge) the allocation 
         // size is, and allocate using the corresponding method.
         if(size <= Constants::MAX_SMALL_SIZE) {
-            return Allocate<SmallBAType>(size);	
+            return Allocate<SmallBAType>(size, lifetime);	
         }
         else if(size <= Constants::MAX_LARGE_SIZE) {
-            return Allocate<LargeBAType>(size);	
+            return Allocate<LargeBAType>(size, lifetime);	
         }
         else if(size <= Constants::MAX_HUGE_SIZE) {
-            return AllocateHuge(size);
+            bool zeroed;
+            return AllocateHuge(size, zeroed);
         }
 
         // The location can't be handled by the allocator
@@ -1415,6 +2516,101 @@ public:
         return AllocateFromOS(size);
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Allocates a location having the specified size, preferably in the same 
+    // group or block as the hint (for example, the parent node of a tree).
+    // The hint must be a live location returned by this allocator, its group
+    // is accessed without validation (checked only in debug builds). If the hint
+    // is not a small or large location, or has a different kind than the 
+    // requested size, the location is allocated as usual.
+    void* AllocateNear(size_t size, void* hint, Lifetime lifetime = LIFETIME_SHORT) {
+        if((hint != nullptr) && (size <= Constants::MAX_LARGE_SIZE)) {
+            void* alignedHint = (void*)((uintptr_t)hint &  
+                                        ~((uintptr_t)Constants::SMALL_GROUP_SIZE - 1));
+
+            if(!IsHugeLocation(hint, alignedHint)) {
+                bool largeHint = IsLargeLocation(hint, alignedHint);
+
+                if((size <= Constants::MAX_SMALL_SIZE) && !largeHint) {
+                    return AllocateNear<SmallBAType>(size, hint, lifetime);
+                }
+                else if((size > Constants::MAX_SMALL_SIZE) && largeHint) {
+                    return AllocateNear<LargeBAType>(size, hint, lifetime);
+                }
+            }
+        }
+
+        return Allocate(size, lifetime);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Reports if moving the object found at the specified address would help 
+    // to free its group, because the group is used less than the other groups 
+    // of its bin. Used by defragmenters of movable objects, which should
+    // allocate the new copy using 'AllocateForRelocation'.
+    bool ShouldRelocate(void* address) {
+        if(address == nullptr) {
+            return false;
+        }
+
+        void* alignedAddress = (void*)((uintptr_t)address &  
+                                ~((uintptr_t)Constants::SMALL_GROUP_SIZE - 1));
+
+        if(IsHugeLocation(address, alignedAddress)) {
+            return false; // Huge locations are returned as soon as they are freed.
+        }
+        else if(!IsLargeLocation(address, alignedAddress)) {
+            return ShouldRelocate<SmallBAType>(Selector<SmallBAType>::GetGroup(address));
+        }
+        else return ShouldRelocate<LargeBAType>(Selector<LargeBAType>::GetGroup(address));
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Allocates the new copy of an object that is relocated. The location is not
+    // placed in sparse groups, which would be candidates for relocation themselves.
+    void* AllocateForRelocation(size_t size, Lifetime lifetime = LIFETIME_SHORT) {
+        if(size <= Constants::MAX_SMALL_SIZE) {
+            return AllocateForRelocation<SmallBAType>(size, lifetime);
+        }
+        else if(size <= Constants::MAX_LARGE_SIZE) {
+            return AllocateForRelocation<LargeBAType>(size, lifetime);
+        }
+
+        return Allocate(size, lifetime);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Allocates a location for 'count' elements having the specified size,
+    // with all bytes set to zero (like 'calloc'). Only memory that may have
+    // been used before is written, memory from the OS is already zero-filled.
+    void* AllocateZeroed(size_t count, size_t size) {
+        if((size != 0) && (count > ((size_t)-1 / size))) {
+            return nullptr; // The total size would overflow.
+        }
+
+        size_t totalSize = count * size;
+
+        if(totalSize <= Constants::MAX_SMALL_SIZE) {
+            return AllocateZeroed<SmallBAType>(totalSize);	
+        }
+        else if(totalSize <= Constants::MAX_LARGE_SIZE) {
+            return AllocateZeroed<LargeBAType>(totalSize);	
+        }
+        else if(totalSize <= Constants::MAX_HUGE_SIZE) {
+            bool zeroed;
+            void* address = AllocateHuge(totalSize, zeroed);
+
+            if((address != nullptr) && !zeroed) {
+                Memory::Zero(address, totalSize);
+            }
+
+            return address;
+        }
+
+        // Memory allocated directly from the OS is always zero-filled.
+        return AllocateFromOS(totalSize);
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Deallocates the location indicated by the specified address.
     void Deallocate(void* address) {
@@ -1429,20 +2625,13 @@ public:
 
         if(!IsHugeLocation(address, alignedAddress)) {
             if(!IsLargeLocation(address, alignedAddress)) {
-                // The location is "small". We mask the first 
-                // log2(SMALL_GROUP_SIZE) bits to obtain the group address.
-                Group* group = reinterpret_cast<Group*>(alignedAddress);
+                // The location is "small".
+                Group* group = Selector<SmallBAType>::GetGroup(address);
                 Deallocate<SmallBAType>(address, group);
             }
             else {
-                // The location is "large". See if it's located in the first subgroup. 
-                // If not, the start address of the group needs to be recomputed.
-                LargeGroup* group = reinterpret_cast<LargeGroup*>(alignedAddress);
-                auto castedGroup = reinterpret_cast<LargeTraits::NodeType*>(group);
-                unsigned int subgroup = LargeTraits::PolicyType::GetSubgroup(castedGroup);
-
-                unsigned int subgroupOffset = (subgroup * Constants::SMALL_GROUP_SIZE);
-                group = reinterpret_cast<LargeGroup*>((uintptr_t)group - subgroupOffset);
+                // The location is "large".
+                LargeGroup* group = Selector<LargeBAType>::GetGroup(address);
                 Deallocate<LargeBAType>(address, group);
             }
         }
@@ -1458,6 +2647,238 @@ public:
         }
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Deallocates a location whose requested size is known. 
+    // For small and large locations the category doesn't need to be determined.
+    void Deallocate(void* address, size_t size) {
+        if(address == nullptr) {
+            return;
+        }
+
+        if(size <= Constants::MAX_SMALL_SIZE) {
+            DeallocateSmall(address);
+        }
+        else if(size <= Constants::MAX_LARGE_SIZE) {
+            DeallocateLarge(address);
+        }
+        else Deallocate(address);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Allocates and deallocates locations whose size is known to be small 
+    // (<= MAX_SMALL_SIZE) or large (<= MAX_LARGE_SIZE). Used by the adaptors
+    // that can determine the category of a size at compile time.
+    void* AllocateSmall(size_t size) {
+        return Allocate<SmallBAType>(size);
+    }
+
+    void* AllocateLarge(size_t size) {
+        return Allocate<LargeBAType>(size);
+    }
+
+    void DeallocateSmall(void* address) {
+        Deallocate<SmallBAType>(address, Selector<SmallBAType>::GetGroup(address));
+    }
+
+    void DeallocateLarge(void* address) {
+        Deallocate<LargeBAType>(address, Selector<LargeBAType>::GetGroup(address));
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Allocates and deallocates locations having a size known at compile time.
+    // The bin, the kind of group and the location size are not computed
+    // at runtime. The size must be at most MAX_LARGE_SIZE.
+    template <size_t Size>
+    void* AllocateFixed() {
+        typedef FixedSize<Size> FS;
+        return AllocateFromBin<typename FS::Manager>(AllocationInfo(FS::ALLOCATION_SIZE, 
+                                                                    FS::BIN));
+    }
+
+    template <size_t Size>
+    void DeallocateFixed(void* address) {
+        typedef typename FixedSize<Size>::Manager Manager;
+
+        if(address != nullptr) {
+            Deallocate<Manager>(address, Selector<Manager>::GetGroup(address));
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Allocates a location aligned to the specified power of two.
+    // Alignments up to MAX_NATURAL_ALIGNMENT are obtained by rounding the size,
+    // for larger ones the location is over-allocated and the address 
+    // returned by 'Allocate' is stored right before the aligned one.
+    // The location must be deallocated using 'DeallocateAligned'.
+    void* AllocateAligned(size_t size, size_t alignment) {
+        assert((alignment & (alignment - 1)) == 0);
+
+        if(alignment <= Constants::MAX_NATURAL_ALIGNMENT) {
+            return Allocate((size + alignment - 1) & ~(alignment - 1));
+        }
+
+        if(size > ((size_t)-1 - alignment)) {
+            return nullptr; // The total size would overflow.
+        }
+
+        void* address = Allocate(size + alignment);
+
+        if(address == nullptr) {
+            return nullptr;
+        }
+
+        // There is always place for the original address, because
+        // the alignment is larger than the size of a pointer.
+        uintptr_t aligned = ((uintptr_t)address + alignment) & ~((uintptr_t)alignment - 1);
+        reinterpret_cast<void**>(aligned)[-1] = address;
+        return (void*)aligned;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Deallocates a location obtained from 'AllocateAligned' with the same
+    // size and alignment.
+    void DeallocateAligned(void* address, size_t size, size_t alignment) {
+        if(address == nullptr) {
+            return;
+        }
+
+        if(alignment <= Constants::MAX_NATURAL_ALIGNMENT) {
+            Deallocate(address, (size + alignment - 1) & ~(alignment - 1));
+        }
+        else Deallocate(reinterpret_cast<void**>(address)[-1], size + alignment);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the number of bytes that can be used at the specified location,
+    // which may be larger than the size that was requested when allocating it.
+    size_t UsableSize(void* address) {
+        if(address == nullptr) {
+            return 0;
+        }
+
+        void* alignedAddress = (void*)((uintptr_t)address &  
+                                ~((uintptr_t)Constants::SMALL_GROUP_SIZE - 1));
+
+        if(!IsHugeLocation(address, alignedAddress)) {
+            if(!IsLargeLocation(address, alignedAddress)) {
+                // The location is "small" (stolen locations are handled by the group).
+                return Selector<SmallBAType>::GetGroup(address)->GetUsableSize(address);
+            }
+            else {
+                // The location is "large".
+                return Selector<LargeBAType>::GetGroup(address)->GetUsableSize(address);
+            }
+        }
+        else {
+            if(!IsOSLocation(address, alignedAddress)) {
+                // The location is "huge". The stored size includes the header.
+                return HugeFromClient(address)->Size - Constants::HUGE_HEADER_SIZE;
+            }
+            else {
+#if defined(PLATFORM_WINDOWS)
+                return Memory::GetRegionSize(address);
+#else
+                OSHeader* header = reinterpret_cast<OSHeader*>((uintptr_t)address - 
+                                                               sizeof(OSHeader));
+                return Memory::GetRegionSize(header->RealAddress) - 
+                       ((uintptr_t)address - (uintptr_t)header->RealAddress);
+#endif
+            }
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Allocates a location having at least the specified size and
+    // returns it together with the number of bytes that can actually be used.
+    AllocationResult AllocateAtLeast(size_t size) {
+        AllocationResult result;
+        AllocationInfo allocInfo;
+
+        // For small and large locations the size is given by the bin,
+        // there is no need to look at the group again.
+        if(size <= Constants::MAX_SMALL_SIZE) {
+            GetAllocationInfoSmall(size, allocInfo);
+            result.Address = Allocate<SmallBAType>(size);
+            result.Size = allocInfo.Size;
+        }
+        else if(size <= Constants::MAX_LARGE_SIZE) {
+            GetAllocationInfoLarge(size, allocInfo);
+            result.Address = Allocate<LargeBAType>(size);
+            result.Size = allocInfo.Size;
+        }
+        else {
+            result.Address = Allocate(size);
+            result.Size = UsableSize(result.Address);
+        }
+
+        if(result.Address == nullptr) {
+            result.Size = 0;
+        }
+
+        return result;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns unused memory to the OS, keeping at most 'keepBytes' of unused
+    // blocks for future allocations. Should be called when the application
+    // becomes idle or the system is low on memory.
+    // 1. The empty groups retained by the bins of the current thread and its group
+    //    caches are returned to the block allocators. The bins and caches of other 
+    //    threads are trimmed only if 'ADOPT' is defined and the threads are idle;
+    //    otherwise only the owner may access them.
+    // 2. Blocks without any used group are released (highest first only if 
+    //    'ADDRESS_ORDERED' is defined). Partially used groups are not returned,
+    //    so their blocks remain.
+    // The huge location cache is currently disabled (see 'DeallocateHuge'),
+    // so there are no cached huge locations to release.
+    // Returns the number of bytes returned to the OS.
+    size_t Trim(size_t keepBytes) {
+        if(!Atomic::Load(&initialized_, std::memory_order_acquire)) {
+            return 0; // Nothing was allocated yet.
+        }
+
+        ThreadContext* context = GetCurrentContext();
+
+        if(context != nullptr) {
+            ContextGuard guard(context);
+            TrimContext(context);
+        }
+
+#if defined(ADOPT)
+        {
+            // The lock prevents the contexts from being released.
+            SpinLock listLock(&contextListLock_);
+            unsigned int time = ThreadUtils::GetMilliseconds();
+
+            for(ThreadContext* idle = contextList_; idle != nullptr; idle = idle->NextContext) {
+                if((idle == context) || !IsContextIdle(idle, time) || !ClaimContext(idle)) {
+                    continue;
+                }
+
+                TrimContext(idle);
+                Atomic::Store(&idle->Adopting, 0u, std::memory_order_release); // Let the owner continue.
+            }
+        }
+#endif
+
+        unsigned int lastNode = memoryPolicy_.GetNodeNumber() +
+                                (memoryPolicy_.IsNuma() ? 0 : 1);
+        size_t released = 0;
+
+        for(unsigned int node = 0; node < lastNode; node++) {
+            released += smallBlockAlloc_[node]->ReleaseUnusedBlocks<MemoryPolicy>(keepBytes);
+            released += largeBlockAlloc_[node]->ReleaseUnusedBlocks<MemoryPolicy>(keepBytes);
+        }
+
+        return released;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns to the OS all memory that is not used. 
+    size_t ReleaseFreeMemory() {
+        return Trim(0);
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     void* Realloc(void* address, size_t newSize) {
         //! TODO: Not yet implemented (problems on 64 bit systems with the assembly code).
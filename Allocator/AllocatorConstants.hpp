@@ -35,6 +35,14 @@
 #ifndef PC_BASE_ALLOCATOR_CONSTANTS_HPP
 #define PC_BASE_ALLOCATOR_CONSTANTS_HPP
 
+#include "ThreadUtils.hpp"
+
+// The size of a block in MB (1, 2, 4 or 8). Larger blocks contain more 
+// than 64 groups, but reduce the number of block descriptors and lock operations.
+#if !defined(BLOCK_SIZE_MB)
+    #define BLOCK_SIZE_MB 1
+#endif
+
 namespace Base {
 
 struct AllocationInfo {
@@ -47,6 +55,14 @@ struct AllocationInfo {
             Size(size), Bin(bin) {}
 };
 
+// The expected lifetime of a location. Locations with different lifetimes
+// are allocated from separate bins and groups, so that long-lived locations
+// don't keep the groups of short-lived ones partially used.
+enum Lifetime {
+    LIFETIME_SHORT, // The default.
+    LIFETIME_LONG
+};
+
 
 class Constants {
 public:
@@ -62,26 +78,63 @@ public:
 
     static const unsigned __int64 GROUP_RETURN_PARTIAL = 0x3FFFEA200;
 
+    // The size of a descriptor depends on the number of groups in a block
+    // and is computed by the block allocator.
     static const unsigned int BLOCK_DESCRIPTOR_ALLOCATION_SIZE = 4096; // 1 page file on x86.
-    static const unsigned int BLOCK_DESCRIPTOR_SIZE = 64;              // 1 cache line
-    static const unsigned int BLOCK_DESCRIPTOR_CACHE = 4;              // 252 block descriptors.
     static const unsigned int BLOCK_SMALL_CACHE = 16;
     static const unsigned int BLOCK_LARGE_CACHE = 8;
-    
-    static const unsigned int THREAD_CONTEXT_ALLOCATION_SIZE = 64*  1024; // Enough for 27 threads.
-    static const unsigned int THREAD_CONTEXT_SIZE = 2368;
-    static const unsigned int THREAD_CONTEXT_CACHE = 1;
-
-    static const unsigned int BA_ALLOCATION_SIZE = 8192;
-    static const unsigned int BA_SIZE = 4032;
-    static const unsigned int BA_CACHE = 1;
 
-    static const unsigned int BLOCK_SIZE = 1024*  1024;      // 1 MB
+    // Partially used groups are kept in PARTIAL_BUCKETS lists per bin,
+    // ordered by the fraction of used locations. New groups are taken from 
+    // the fullest bucket, so that nearly unused groups can become unused.
+    static const unsigned int PARTIAL_BUCKETS = 4;
+    // The bucket of a group is updated when it's found in the wrong one while
+    // taking a group; this bounds the number of groups moved at a time.
+    static const unsigned int PARTIAL_REBUCKET_LIMIT = 8;
+
+    // The states of a group relative to the public group list of it's bin.
+    // Only the thread that changes the state from open to queued adds the group 
+    // to the list; the owner closes it before the group leaves the bin.
+    static const unsigned int PUBLIC_OPEN   = 0; // Must be 0 (the header is reset).
+    static const unsigned int PUBLIC_QUEUED = 1;
+    static const unsigned int PUBLIC_CLOSED = 2;
+    
+    static const unsigned int THREAD_CONTEXT_ALLOCATION_SIZE = 64*  1024; // Enough for 102 threads.
+    static const unsigned int THREAD_CONTEXT_SIZE = 640;
+
+    // Each thread keeps a few empty groups of each kind that can be used 
+    // by any of it's bins. When the cache is full, the oldest 
+    // GROUP_CACHE_FLUSH groups are returned to the block allocator.
+    static const unsigned int GROUP_CACHE_SIZE = 6; // Must fit in a cache line.
+    static const unsigned int GROUP_CACHE_FLUSH = 3;
+
+    // Bins that already own GROUP_REFILL_THRESHOLD groups are filling fast;
+    // when they need another group, GROUP_REFILL_SIZE groups are taken 
+    // from the block allocator at once and stored into the group cache.
+    // Returned groups are processed in batches of GROUP_BATCH_SIZE.
+    static const unsigned int GROUP_REFILL_THRESHOLD = 2;
+    static const unsigned int GROUP_REFILL_SIZE = 4; // At most GROUP_CACHE_SIZE.
+    static const unsigned int GROUP_BATCH_SIZE = 8;
+
+    // The number of groups of a bin searched by 'AllocateNear' 
+    // for one found in the same block as the hint.
+    static const unsigned int NEAR_SEARCH_LIMIT = 8;
+
+    // The number of groups of a bin used to compute the average 
+    // number of used locations by 'ShouldRelocate'.
+    static const unsigned int RELOCATE_SAMPLE_GROUPS = 16;
+
+    // A block allocator holds the partial group lists of all it's bins,
+    // the largest one (for small groups) needs almost 6 KB.
+    static const unsigned int BA_ALLOCATION_SIZE = 64*  1024; // Enough for 10 block allocators.
+    static const unsigned int BA_SIZE = 6400;
+
+    static const unsigned int BLOCK_SIZE = BLOCK_SIZE_MB * 1024 * 1024;
     static const unsigned int SMALL_GROUP_SIZE = 16*  1024;  // 16 KB
     static const unsigned int LARGE_GROUP_SIZE = 64*  1024;  // 64 KB
     static const unsigned int SMALL_GROUP_HEADER_SIZE = 256; // 4 cache lines.
     static const unsigned int LARGE_GROUP_HEADER_SIZE = 192; // 3 cache lines.
-    static const unsigned int GROUPS_PER_BLOCK = 64;
+    static const unsigned int GROUPS_PER_BLOCK = BLOCK_SIZE / SMALL_GROUP_SIZE; // 64 - 512
 
     static const unsigned int HUGE_GRANULARITY = 4096;         // 1 page file on x86/x64.
     static const unsigned int HUGE_HEADER_SIZE = 64;
@@ -99,12 +152,28 @@ public:
     static const unsigned int SMALL_BINS = 31;
     static const unsigned int LARGE_BINS = 4;
     static const unsigned int BIN_NUMBER = SMALL_BINS + LARGE_BINS;
+
+    // Each lifetime has its own set of bins.
+    static const unsigned int LIFETIMES = 2;
+    static const unsigned int CONTEXT_BINS = LIFETIMES * BIN_NUMBER;
+
+    // The bins of a thread are created when first used. The first ones are stored
+    // in the thread context, the others in chunks allocated from a separate pool.
+    static const unsigned int INLINE_BINS = 4;
+    static const unsigned int BIN_CHUNK_SIZE = 8; // Bins per chunk.
+    static const unsigned int BIN_CHUNKS = (CONTEXT_BINS - INLINE_BINS + BIN_CHUNK_SIZE - 1) / 
+                                           BIN_CHUNK_SIZE;
+    static const unsigned int BIN_CHUNK_ALLOCATION_SIZE = 64 * 1024;
     static const unsigned int AFTER_SEGREGATED_START_BIN = 26;
 
     static const size_t MAX_TINY_SIZE       = 64;
     static const size_t MAX_SEGREGATED_SIZE = 896;
     static const size_t MAX_SMALL_SIZE      = 2688;
-    static const size_t MAX_LARGE_SIZE      = 8128; // ~8 KB
+    static const size_t MAX_LARGE_SIZE      = 8096; // ~8 KB
+
+    // All locations are aligned to the largest power of two (up to this value)
+    // that divides their size, because all allocation sizes are multiple of it.
+    static const size_t MAX_NATURAL_ALIGNMENT = 16;
 
     static const size_t ALLOCATION_SIZE_1 = 1152;
     static const size_t ALLOCATION_SIZE_2 = 1472;
@@ -114,11 +183,25 @@ public:
 
     static const unsigned int LARGE_ALLOCATION_SIZE_1 = 3200;
     static const unsigned int LARGE_ALLOCATION_SIZE_2 = 4048;
-    static const unsigned int LARGE_ALLOCATION_SIZE_3 = 5397;
+    static const unsigned int LARGE_ALLOCATION_SIZE_3 = 5392;
     static const unsigned int LARGE_ALLOCATION_SIZE_4 = 8096;
 
     static const unsigned int NOT_STOLEN = 255;
 
+    // Adaptive retention of empty groups by bins (times in milliseconds).
+    // A group obtained sooner than RETAIN_CHURN_TIME after one was returned 
+    // makes the bin retain one more group. The retention decays by one group
+    // after each RETAIN_DECAY_TIME without such churn.
+    static const unsigned int RETAIN_MIN = 0;
+    static const unsigned int RETAIN_MAX = 8;
+    static const unsigned int RETAIN_CHURN_TIME = 100;
+    static const unsigned int RETAIN_DECAY_TIME = 1000;
+
+    // Groups can be adopted from the bins of threads that made no allocator
+    // operation in the last ADOPT_IDLE_TIME milliseconds.
+    static const unsigned int ADOPT_IDLE_TIME = 500;
+    static const unsigned int ADOPT_SCAN_INTERVAL = 50; // Minimum time between scans.
+
     static const size_t SmallBinSize[];
     static const size_t LargeBinSize[];
     static const AllocationInfo SmallAllocTable[];
@@ -133,14 +216,54 @@ public:
     static const unsigned int CACHE_CLEANING_INTERVAL = 30*1000; // 30 seconds.
     static const char* CACHE_THREAD_NAME; // Used for debugging in Visual C++.
     static const unsigned int MAX_HUGE_CACHE = 512;
+
+    // Used only if 'MEMORY_PRESSURE' is defined. The memory status is checked 
+    // every PRESSURE_CHECK_INTERVAL milliseconds. Without pressure, the unused 
+    // blocks can take at most 1/PRESSURE_HEADROOM_FRACTION of the remaining memory,
+    // and the block caches grow up to PRESSURE_MAX_CACHE_FACTOR times the defaults.
+    // The usage is in percent of the limit, the stall is in percent of time (PSI).
+    static const unsigned int PRESSURE_CHECK_INTERVAL = 1000;
+    static const unsigned int PRESSURE_HEADROOM_FRACTION = 8;
+    static const unsigned int PRESSURE_MAX_CACHE_FACTOR = 4;
+    static const unsigned int PRESSURE_MODERATE_USAGE = 75;
+    static const unsigned int PRESSURE_HIGH_USAGE = 90;
+    static const unsigned int PRESSURE_MODERATE_STALL = 1;
+    static const unsigned int PRESSURE_HIGH_STALL = 10;
 };
 
+// A large group is made of 4 small-group-sized subgroups, each one having
+// its own header followed by 2 locations of the largest large size.
+static_assert(Constants::LARGE_GROUP_HEADER_SIZE + (2 * Constants::LARGE_ALLOCATION_SIZE_4) <=
+              Constants::SMALL_GROUP_SIZE, "Large locations don't fit in a subgroup.");
+// The locations of a large group are split evenly between the subgroups
+// (the allocator computes their number for the whole group).
+template <unsigned int Size>
+struct LargeSubgroupsValid {
+    static const bool Value = ((Constants::LARGE_GROUP_SIZE - Constants::LARGE_GROUP_HEADER_SIZE) / Size) ==
+                              (4 * ((Constants::SMALL_GROUP_SIZE - Constants::LARGE_GROUP_HEADER_SIZE) / Size));
+};
+
+static_assert(LargeSubgroupsValid<Constants::LARGE_ALLOCATION_SIZE_1>::Value &&
+              LargeSubgroupsValid<Constants::LARGE_ALLOCATION_SIZE_2>::Value &&
+              LargeSubgroupsValid<Constants::LARGE_ALLOCATION_SIZE_3>::Value &&
+              LargeSubgroupsValid<Constants::LARGE_ALLOCATION_SIZE_4>::Value,
+              "Large locations are not split evenly between the subgroups.");
+static_assert(Constants::MAX_LARGE_SIZE == Constants::LARGE_ALLOCATION_SIZE_4,
+              "The largest large size must match the last large bin.");
+// Only the block sizes documented for BLOCK_SIZE_MB are supported
+// (at most 512 small groups, 8 words in the group bitmaps of a block).
+static_assert((BLOCK_SIZE_MB == 1) || (BLOCK_SIZE_MB == 2) ||
+              (BLOCK_SIZE_MB == 4) || (BLOCK_SIZE_MB == 8),
+              "BLOCK_SIZE_MB must be 1, 2, 4 or 8.");
+
 
 const char* Constants::CACHE_THREAD_NAME = "Allocator_Cache_Thread";
 
 
 const size_t Constants::SmallBinSize[] = {
-    8, 12, 16, 20, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 
+    8, 12, 16, 20, 24, 32, 40, 48, 56, 64, 
+    0, // Bin 10 is not used by any size.
+    80, 96, 112, 128, 160, 
     192, 224, 256, 320, 384, 448, 512, 640, 768, 896,
     Constants::ALLOCATION_SIZE_1, Constants::ALLOCATION_SIZE_2,
     Constants::ALLOCATION_SIZE_3, Constants::ALLOCATION_SIZE_4,
@@ -149,9 +272,16 @@ const size_t Constants::SmallBinSize[] = {
 
 
 const size_t Constants::LargeBinSize[] = {
-    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1 // Prevents error in the test code.
+    Constants::LARGE_ALLOCATION_SIZE_1, Constants::LARGE_ALLOCATION_SIZE_2,
+    Constants::LARGE_ALLOCATION_SIZE_3, Constants::LARGE_ALLOCATION_SIZE_4
 };
 
+// The tables are indexed by the bin number.
+static_assert(sizeof(Constants::SmallBinSize) / sizeof(size_t) == Constants::SMALL_BINS,
+              "A small bin has no size.");
+static_assert(sizeof(Constants::LargeBinSize) / sizeof(size_t) == Constants::LARGE_BINS,
+              "A large bin has no size.");
+
 
 const AllocationInfo Constants::SmallAllocTable[] = {
     // 64 structures in format Size, Bin
@@ -181,14 +311,34 @@ const AllocationInfo Constants::SmallAllocTable[] = {
 
 
 const AllocationInfo Constants::SmallAllocTable2[] = {
-    AllocationInfo(0, 0), // Not used
-    AllocationInfo(0, 0),
-    AllocationInfo(0, 0),
+    // Indexed by (size - 1) / 64 - MAX_SEGREGATED_SIZE / 64, all allocation
+    // sizes are multiple of 64, so each entry covers a single bin.
+    AllocationInfo(Constants::ALLOCATION_SIZE_1, Constants::AFTER_SEGREGATED_START_BIN + 0),
+    AllocationInfo(Constants::ALLOCATION_SIZE_1, Constants::AFTER_SEGREGATED_START_BIN + 0),
+    AllocationInfo(Constants::ALLOCATION_SIZE_1, Constants::AFTER_SEGREGATED_START_BIN + 0),
     AllocationInfo(Constants::ALLOCATION_SIZE_1, Constants::AFTER_SEGREGATED_START_BIN + 0),
     AllocationInfo(Constants::ALLOCATION_SIZE_2, Constants::AFTER_SEGREGATED_START_BIN + 1),
+    AllocationInfo(Constants::ALLOCATION_SIZE_2, Constants::AFTER_SEGREGATED_START_BIN + 1),
+    AllocationInfo(Constants::ALLOCATION_SIZE_2, Constants::AFTER_SEGREGATED_START_BIN + 1),
+    AllocationInfo(Constants::ALLOCATION_SIZE_2, Constants::AFTER_SEGREGATED_START_BIN + 1),
+    AllocationInfo(Constants::ALLOCATION_SIZE_2, Constants::AFTER_SEGREGATED_START_BIN + 1),
+    AllocationInfo(Constants::ALLOCATION_SIZE_3, Constants::AFTER_SEGREGATED_START_BIN + 2),
     AllocationInfo(Constants::ALLOCATION_SIZE_3, Constants::AFTER_SEGREGATED_START_BIN + 2),
     AllocationInfo(Constants::ALLOCATION_SIZE_3, Constants::AFTER_SEGREGATED_START_BIN + 2),
+    AllocationInfo(Constants::ALLOCATION_SIZE_3, Constants::AFTER_SEGREGATED_START_BIN + 2),
+    AllocationInfo(Constants::ALLOCATION_SIZE_3, Constants::AFTER_SEGREGATED_START_BIN + 2),
+    AllocationInfo(Constants::ALLOCATION_SIZE_4, Constants::AFTER_SEGREGATED_START_BIN + 3),
+    AllocationInfo(Constants::ALLOCATION_SIZE_4, Constants::AFTER_SEGREGATED_START_BIN + 3),
     AllocationInfo(Constants::ALLOCATION_SIZE_4, Constants::AFTER_SEGREGATED_START_BIN + 3),
+    AllocationInfo(Constants::ALLOCATION_SIZE_4, Constants::AFTER_SEGREGATED_START_BIN + 3),
+    AllocationInfo(Constants::ALLOCATION_SIZE_4, Constants::AFTER_SEGREGATED_START_BIN + 3),
+    AllocationInfo(Constants::ALLOCATION_SIZE_4, Constants::AFTER_SEGREGATED_START_BIN + 3),
+    AllocationInfo(Constants::ALLOCATION_SIZE_4, Constants::AFTER_SEGREGATED_START_BIN + 3),
+    AllocationInfo(Constants::ALLOCATION_SIZE_4, Constants::AFTER_SEGREGATED_START_BIN + 3),
+    AllocationInfo(Constants::ALLOCATION_SIZE_5, Constants::AFTER_SEGREGATED_START_BIN + 4),
+    AllocationInfo(Constants::ALLOCATION_SIZE_5, Constants::AFTER_SEGREGATED_START_BIN + 4),
+    AllocationInfo(Constants::ALLOCATION_SIZE_5, Constants::AFTER_SEGREGATED_START_BIN + 4),
+    AllocationInfo(Constants::ALLOCATION_SIZE_5, Constants::AFTER_SEGREGATED_START_BIN + 4),
     AllocationInfo(Constants::ALLOCATION_SIZE_5, Constants::AFTER_SEGREGATED_START_BIN + 4),
     AllocationInfo(Constants::ALLOCATION_SIZE_5, Constants::AFTER_SEGREGATED_START_BIN + 4)
 };
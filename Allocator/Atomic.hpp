@@ -36,6 +36,7 @@
 #define PC_BASE_ALLOCATOR_ATOMIC_HPP
 
 #include "ThreadUtils.hpp"
+#include <atomic>
 #if defined(PLATFORM_WINDOWS)
     #include <windows.h>
     #include <intrin.h>
@@ -79,19 +80,76 @@
     #pragma intrinsic(_InterlockedAnd, _InterlockedAnd8, _InterlockedAnd16, _InterlockedAnd64)
     #pragma intrinsic(_InterlockedOr, _InterlockedOr8, _InterlockedOr16, _InterlockedOr64)
     #pragma intrinsic(_InterlockedXor, _InterlockedXor8, _InterlockedXor16, _InterlockedXor64)
-#else
-    static_assert(false, "Not yet implemented.");
 #endif
 
 namespace Base {
 
 class Atomic {
+private:
+    // Accesses the location as a std::atomic of the same type. Only naturally
+    // aligned types with a lock-free implementation are used, which have 
+    // the same representation as the underlying type.
+    template <class T>
+    static std::atomic<T>* AsAtomic(volatile T* location) {
+        static_assert(sizeof(std::atomic<T>) == sizeof(T), "Unsupported atomic type.");
+        return reinterpret_cast<std::atomic<T>*>(const_cast<T*>(location));
+    }
+
+    // The order used when a compare-exchange fails (no value is written).
+    static std::memory_order FailureOrder(std::memory_order order) {
+        return order == std::memory_order_acq_rel ? std::memory_order_acquire :
+               order == std::memory_order_release ? std::memory_order_relaxed : order;
+    }
+
 public:
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Operations with an explicit memory order, implemented using std::atomic.
+    // They should be used with the weakest order that is correct, 
+    // the operations without an order are always full barriers.
+    template <class T>
+    static T Load(volatile T* location, std::memory_order order) {
+        return AsAtomic(location)->load(order);
+    }
+
+    template <class T>
+    static void Store(volatile T* location, T value, std::memory_order order) {
+        AsAtomic(location)->store(value, order);
+    }
+
+    static unsigned int Increment(volatile unsigned int* location, std::memory_order order) {
+        return AsAtomic(location)->fetch_add(1, order) + 1;
+    }
+
+    static unsigned int Decrement(volatile unsigned int* location, std::memory_order order) {
+        return AsAtomic(location)->fetch_sub(1, order) - 1;
+    }
+
+    // Returns the previous value, like the version without an order.
+    static unsigned int Add(volatile unsigned int* location, unsigned int value, 
+                            std::memory_order order) {
+        return AsAtomic(location)->fetch_add(value, order);
+    }
+
+    // The compare-exchange operations return the previous value.
+    template <class T>
+    static T CompareExchange(volatile T* location, T value, T comparand, 
+                             std::memory_order order) {
+        AsAtomic(location)->compare_exchange_strong(comparand, value, order, 
+                                                    FailureOrder(order));
+        return comparand;
+    }
+
+    static void* ExchangePointer(void* volatile* location, void* value, 
+                                 std::memory_order order) {
+        return AsAtomic(location)->exchange(value, order);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     static unsigned int Increment(volatile unsigned int* location) {
 #if defined(PLATFORM_WINDOWS)
         return (int)_InterlockedIncrement((long*)location);
 #else
-        static_assert(false, "Not yet implemented.");
+        return Increment(location, std::memory_order_seq_cst);
 #endif
     }
 
@@ -100,7 +158,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedIncrement64((__int64*)location);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_add(1) + 1;
 #endif
     }
 
@@ -109,7 +167,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return (unsigned int)_InterlockedDecrement((long*)location);
 #else
-        static_assert(false, "Not yet implemented.");
+        return Decrement(location, std::memory_order_seq_cst);
 #endif
     }
     
@@ -118,7 +176,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedDecrement64((__int64*)location);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_sub(1) - 1;
 #endif
     }
 
@@ -127,7 +185,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return (unsigned int)_InterlockedExchangeAdd((long*)location, (long)value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return Add(location, value, std::memory_order_seq_cst);
 #endif
     }
 
@@ -136,7 +194,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedExchangeAdd64(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_add(value);
 #endif
     }
 
@@ -145,7 +203,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return (unsigned int)InterlockedExchange((long*)location, (long)value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->exchange(value);
 #endif
     }
     
@@ -154,7 +212,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedExchange64(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->exchange(value);
 #endif
     }
 
@@ -165,7 +223,7 @@ public:
         return (unsigned int)_InterlockedCompareExchange((long*)location, (long)value, 
                                                          (long)comparand);
 #else
-        static_assert(false, "Not yet implemented.");
+        return CompareExchange(location, value, comparand, std::memory_order_seq_cst);
 #endif
     }
 
@@ -177,7 +235,7 @@ public:
         return (unsigned __int64)_InterlockedCompareExchange64((__int64*)location, 
                                                                value, comparand);
 #else
-    static_assert(false, "Not yet implemented.");
+        return CompareExchange(location, value, comparand, std::memory_order_seq_cst);
 #endif
     }
 
@@ -190,7 +248,15 @@ public:
         return _InterlockedCompareExchange128((__int64*)location, valueHigh, valueLow,
                                               (__int64*)comparand);
 #else
-        static_assert(false, "Not yet implemented.");
+        // The comparand receives the current value, like with the intrinsic.
+        unsigned char result;
+        __asm__ __volatile__("lock cmpxchg16b %1\n\t"
+                             "setz %0"
+                             : "=q" (result), "+m" (*location), 
+                               "+d" (comparand[1]), "+a" (comparand[0])
+                             : "c" (valueHigh), "b" (valueLow)
+                             : "cc", "memory");
+        return result;
 #endif
     }
 
@@ -199,7 +265,15 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedCompareExchangePointer(location, value, comparand);
 #else
-        static_assert(false, "Not yet implemented.");
+        return CompareExchange(location, value, comparand, std::memory_order_seq_cst);
+#endif
+    }
+
+    static void* ExchangePointer(void* volatile* location, void* value) {
+#if defined(PLATFORM_WINDOWS)
+        return _InterlockedExchangePointer(location, value);
+#else
+        return ExchangePointer(location, value, std::memory_order_seq_cst);
 #endif
     }
 
@@ -208,7 +282,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return (unsigned int)_InterlockedAnd((long*)location, (long)value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_and(value);
 #endif
     }
 
@@ -217,7 +291,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedAnd8(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_and(value);
 #endif
     }
 
@@ -226,7 +300,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedAnd16(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_and(value);
 #endif
     }
 
@@ -235,7 +309,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedAnd64(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_and(value);
 #endif
     }
 
@@ -244,7 +318,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return (unsigned int)_InterlockedOr((long*)location, (long)value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_or(value);
 #endif
     }
 
@@ -253,7 +327,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedOr8(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_or(value);
 #endif
     }
     
@@ -262,7 +336,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedOr16(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_or(value);
 #endif
     }
 
@@ -271,7 +345,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedOr64(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_or(value);
 #endif
     }
 
@@ -280,7 +354,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return (unsigned int)_InterlockedXor((long*)location, (long)value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_xor(value);
 #endif
     }
 
@@ -289,7 +363,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedXor8(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_xor(value);
 #endif
     }
 
@@ -298,7 +372,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedXor16(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_xor(value);
 #endif
     }
 
@@ -307,7 +381,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return _InterlockedXor64(location, value);
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_xor(value);
 #endif
     }
 
@@ -333,7 +407,7 @@ public:
         }
         return temp;
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_or(1ULL << position);
 #endif
     }
 
@@ -359,7 +433,7 @@ public:
         }
         return temp;
 #else
-        static_assert(false, "Not yet implemented.");
+        return AsAtomic(location)->fetch_and(~(1ULL << position));
 #endif
     }
 };
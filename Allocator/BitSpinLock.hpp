@@ -38,6 +38,7 @@
 
 #include "Memory.hpp"
 #include "Atomic.hpp"
+#include <type_traits>
 
 namespace Base {
 
@@ -51,27 +52,15 @@ template <class T, unsigned int Index>
 class BitSpinLock {
 public:
     // Implements the atomic operations, based on the integer type.
-    template<class Type> // Gives a compiler error if an invalid type is used.
+    // Gives a compiler error if an invalid type is used (no overload matches).
+    template<class Type>
     struct AtomicSelector {
-        static unsigned int CompareExchange(volatile unsigned int* location, 
-                                            unsigned int value, 
-                                            unsigned int comparand)	{
-            static_assert(false, "No version of CompareExchange selected!");
-            return 0;
-        }
-    };
-
-    template <>
-    struct AtomicSelector<unsigned int>	{
         static unsigned int CompareExchange(volatile unsigned int* location, 
                                             unsigned int value, 
                                             unsigned int comparand)	{
             return Atomic::CompareExchange(location, value, comparand);
         }
-    };
 
-    template <>
-    struct AtomicSelector<unsigned __int64> {
         static unsigned __int64 CompareExchange(volatile unsigned __int64* location, 
                                                 unsigned __int64 value, 
                                                 unsigned __int64 comparand) {
@@ -82,26 +71,14 @@ public:
     // Verifies whether the a type is an accepted one (signed/unsigned integer).
     template <class U>
     struct TypeValidator {
-        template<class V>
-        struct ValidType { enum { Valid = false }; };
-
-        template<> struct ValidType<short>   { enum { Valid = true }; };
-        template<> struct ValidType<int>     { enum { Valid = true }; };
-        template<> struct ValidType<__int64> { enum { Valid = true }; };
-
-        template<> struct ValidType<unsigned short>   { enum { Valid = true }; };
-        template<> struct ValidType<unsigned int>     { enum { Valid = true }; };
-        template<> struct ValidType<unsigned __int64> { enum { Valid = true }; };
-
-        enum { Valid = ValidType<U>::Valid };
+        enum { Valid = std::is_integral<U>::value && (sizeof(U) >= sizeof(short)) };
     };
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    static const T DataMask = ((((T)1 << (sizeof(T) * 8)) - 1)) - ((T)1 << Index); // 11101...111
-    static const T LockMask = ~DataMask;
+    static const T DataMask = (T)~(T)0 - ((T)1 << Index); // 11101...111
+    static const T LockMask = (T)~DataMask;
     static const T LowPartMask = ((T)1 << Index) - 1;
-    static const T HighPartMask =  ((((T)1 << (sizeof(T) * 8)) - 1)) - 
-                                   (((T)1 << (Index + 1)) - 1);
+    static const T HighPartMask = (T)~(LowPartMask | LockMask);
     T lockValue_;
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -109,27 +86,32 @@ public:
     T SetLocked(T value)      { return (value |= LockMask);  }
     T ResetLocked(T value)    { return (value &= ~LockMask); }
 
+    // Reads the value without a barrier; it's only used as the comparand
+    // of the next compare-exchange, which does the synchronization.
+    T LoadValue() { return Atomic::Load(&lockValue_, std::memory_order_relaxed); }
+
 public:
     BitSpinLock(T initialValue) : lockValue_(initialValue) {
-        StaticAssert<TypeValidator<T>::Valid>();
-        StaticAssert<Index<(sizeof(T) * 8)>();
+        static_assert(TypeValidator<T>::Valid, "Invalid lock value type!");
+        static_assert(Index < (sizeof(T) * 8), "Invalid lock bit index!");
     }
 
     BitSpinLock() : lockValue_(0) {
-        StaticAssert<TypeValidator<T>::Valid>();
-        StaticAssert<Index<(sizeof(T) * 8)>();
+        static_assert(TypeValidator<T>::Valid, "Invalid lock value type!");
+        static_assert(Index < (sizeof(T) * 8), "Invalid lock bit index!");
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Waits until the lock could be successfully acquired.
     void Lock() {
-        T oldValue = lockValue_;
+        T oldValue = LoadValue();
         T newValue = SetLocked(oldValue);
 
         // In order to properly acquire the lock, it should be released.
         oldValue = ResetLocked(oldValue);
 
-        if(lockValue_ != newValue) {
+        if(LoadValue() == newValue) {
+            // Already locked, let the owner run.
             ThreadUtils::SwitchToThread();
         }
 
@@ -145,7 +127,7 @@ public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Releases the lock.
     void Unlock() {
-        T oldValue = lockValue_;
+        T oldValue = LoadValue();
         T newValue = ResetLocked(oldValue);
 
         while((newValue = AtomicSelector<T>::CompareExchange(&lockValue_, newValue, 
@@ -159,13 +141,13 @@ public:
     // Extracts the low part (from LSB to the lock bit).
     T GetLowPart() {
         // Extracts the low part of the lock value (not including the lock bit).
-        return Memory::ReadValue(&lockValue_) & LowPartMask;
+        return LoadValue() & LowPartMask;
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Sets the low part (from LSB to the lock bit) to the specified value.
     void SetLowPart(T value) {
-        T oldValue = lockValue_;
+        T oldValue = LoadValue();
         T newValue = (oldValue & ~LowPartMask) | value;
 
         while((newValue = AtomicSelector<T>::CompareExchange(&lockValue_, newValue, 
@@ -178,7 +160,7 @@ public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Increments the low part (from LSB to the lock bit) with the specified value.
     void AddLowPart(T value) {
-        T oldValue = lockValue_;
+        T oldValue = LoadValue();
         T newValue = (oldValue & ~LowPartMask) | ((oldValue&  LowPartMask) + value);
 
         while((newValue = AtomicSelector<T>::CompareExchange(&lockValue_, newValue, 
@@ -188,17 +170,24 @@ public:
         }
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Sets the whole value, the lock bit included. Can be used 
+    // only when no other thread may access the lock.
+    void Reset(T value) {
+        Atomic::Store(&lockValue_, value, std::memory_order_relaxed);
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Extracts the low part (from LSB to the lock bit).
     T GetHighPart() {
         // Extracts the low part of the lock value (not including the lock bit).
-        return Memory::ReadValue(&lockValue_) & HighPartMask;
+        return LoadValue() & HighPartMask;
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Sets the low part (from LSB to the lock bit) to the specified value.
     void SetHighPart(T value) {
-        T oldValue = lockValue_;
+        T oldValue = LoadValue();
         T newValue = (oldValue & ~HighPartMask) | (value << (Index + 1));
 
         while((newValue = AtomicSelector<T>::CompareExchange(&lockValue_, newValue, 
@@ -211,7 +200,7 @@ public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Increments the low part (from LSB to the lock bit) with the specified value.
     void AddHighPart(T value) {
-        T oldValue = lockValue_;
+        T oldValue = LoadValue();
         T newValue = (oldValue & ~HighPartMask) | 
                      ((((oldValue & HighPartMask) >> (Index + 1)) + value) << (Index + 1));
 
@@ -232,7 +221,9 @@ private:
     BitSpinLock<T, Index>* lock_;
 
 public:
-    BSLHolder(BitSpinLock<T, Index>* bitLock) : lock_(bitLock) {}
+    BSLHolder(BitSpinLock<T, Index>* bitLock) : lock_(bitLock) {
+        lock_->Lock();
+    }
 
    ~BSLHolder() { 
        lock_->Unlock(); 
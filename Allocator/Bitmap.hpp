@@ -35,6 +35,8 @@
 #ifndef PC_BASE_ALLOCATOR_BITMAP_HPP
 #define PC_BASE_ALLOCATOR_BITMAP_HPP 
 
+#include "Atomic.hpp"
+
 #if defined(PLATFORM_WINDOWS)
     #include <intrin.h>
 
@@ -46,7 +48,7 @@
         #pragma intrinsic(_BitScanReverse64)
     #endif
 #else
-    static_assert(false, "Not yet implemented.");
+    #include <limits.h>
 #endif
 
 namespace Base {
@@ -68,7 +70,7 @@ public:
 
         return UINT_MAX; // Not found.
 #else
-        static_assert(false, "Not yet implemented.");
+        return mask != 0 ? 31 - __builtin_clz(mask) : UINT_MAX;
 #endif
     }
 
@@ -91,7 +93,7 @@ public:
 
         return -1; // Not found.
     #else
-        static_assert(false, "Not yet implemented.");
+        return mask != 0 ? 63 - __builtin_clzll(mask) : UINT_MAX;
     #endif
 #else
     #if defined(PLATFORM_WINDOWS)
@@ -103,7 +105,7 @@ public:
 
         return UINT_MAX; // Not found.
     #else
-        static_assert(false, "Not yet implemented.");
+        return mask != 0 ? 63 - __builtin_clzll(mask) : UINT_MAX;
     #endif
 #endif
     }
@@ -121,7 +123,7 @@ public:
 
         return UINT_MAX; // Not found.
 #else
-        static_assert(false, "Not yet implemented.");
+        return mask != 0 ? __builtin_ctz(mask) : UINT_MAX;
 #endif
     }
 
@@ -144,7 +146,7 @@ public:
 
         return ULLONG_MAX; // Not found.
     #else
-        static_assert(false, "Not yet implemented.");
+        return mask != 0 ? __builtin_ctzll(mask) : UINT_MAX;
     #endif
 #else
     #if defined(PLATFORM_WINDOWS)
@@ -156,7 +158,7 @@ public:
 
         return UINT_MAX; // Not found.
     #else
-        static_assert(false, "Not yet implemented.");
+        return mask != 0 ? __builtin_ctzll(mask) : UINT_MAX;
     #endif
 #endif
     }
@@ -192,7 +194,8 @@ public:
 
         return -1; // Not found.
     #else
-        static_assert(false, "Not yet implemented.");
+        unsigned __int64 data = mask & ((start < 64) ? ((1ULL << start) - 1) : ~0ULL);
+        return data != 0 ? 63 - __builtin_clzll(data) : UINT_MAX;
     #endif
 #else
     #if defined(PLATFORM_WINDOWS)
@@ -206,7 +209,8 @@ public:
 
         return UINT_MAX; // Not found.
     #else
-        static_assert(false, "Not yet implemented.");
+        unsigned __int64 data = mask & ((start < 64) ? ((1ULL << start) - 1) : ~0ULL);
+        return data != 0 ? 63 - __builtin_clzll(data) : UINT_MAX;
     #endif
 #endif
     }
@@ -242,7 +246,8 @@ public:
 
         return UINT_MAX; // Not found.		
     #else
-        static_assert(false, "Not yet implemented.");
+        unsigned __int64 data = mask & ~((1ULL << start) - 1);
+        return data != 0 ? __builtin_ctzll(data) : UINT_MAX;
     #endif
 #else
     #if defined(PLATFORM_WINDOWS)
@@ -256,7 +261,8 @@ public:
 
         return UINT_MAX; // Not found.
     #else
-        static_assert(false, "Not yet implemented.");
+        unsigned __int64 data = mask & ~((1ULL << start) - 1);
+        return data != 0 ? __builtin_ctzll(data) : UINT_MAX;
     #endif
 #endif
     }
@@ -275,7 +281,7 @@ public:
         return (mask & (1 << index)) != 0;
     }
 
-    static bool IsBitSet(const unsigned __int64& mask, unsigned int index) {
+    static bool IsBitSet(unsigned __int64 mask, unsigned int index) {
         return (mask & (1ULL << index)) != 0;
     }
 
@@ -297,7 +303,8 @@ public:
     static unsigned int NumberOfSetBits64(unsigned __int64 mask) {
         mask = mask - ((mask >> 1) & 0x5555555555555555);
         mask = (mask&  0x3333333333333333) + ((mask >> 2) & 0x3333333333333333);
-        return (unsigned int)((mask + (mask >> 4) & 0xF0F0F0FF0F0F0F) * 0x10101011010101) >> 24;
+        return (unsigned int)((((mask + (mask >> 4)) & 0x0F0F0F0F0F0F0F0F) * 
+                               0x0101010101010101) >> 56);
     }
 };
 
@@ -0,0 +1,571 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Implements kernels that operate on arrays of 64-bit bitmaps 
+// (merging, counting and searching for a set bit across many words at once).
+// The SSE4.1 or AVX2 versions are selected at runtime, if supported.
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+#ifndef PC_BASE_ALLOCATOR_BITMAP_KERNELS_HPP
+#define PC_BASE_ALLOCATOR_BITMAP_KERNELS_HPP
+
+#include "Bitmap.hpp"
+
+#if defined(PLATFORM_WINDOWS)
+    #include <intrin.h>
+    #include <immintrin.h>
+    #define BITMAP_KERNELS_SIMD
+    #define KERNEL_TARGET(name)
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define BITMAP_KERNELS_SIMD
+    // Only the kernels are compiled for the newer instruction sets.
+    #define KERNEL_TARGET(name) __attribute__((target(name)))
+#endif
+
+namespace Base {
+
+// The merge kernels compute 'destination |= source' and return a mask 
+// having bit 'i' set if 'source[i]' is not zero (at most 64 words are allowed).
+// The search kernels return the index of the first set bit found starting with 
+// 'start' (forward), or the index of the first set bit before 'start' (reverse).
+// UINT_MAX is returned if no set bit is found.
+// The count kernels return the number of set bits in all words.
+struct BitmapKernelsScalar {
+    static unsigned __int64 Merge(unsigned __int64* destination, 
+                                  const unsigned __int64* source, unsigned int words) {
+        unsigned __int64 used = 0;
+
+        for(unsigned int i = 0; i < words; i++) {
+            if(source[i] != 0) {
+                destination[i] |= source[i];
+                used |= 1ULL << i;
+            }
+        }
+
+        return used;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    static unsigned int SearchForward(const unsigned __int64* bitmap, 
+                                      unsigned int words, unsigned int start) {
+        unsigned int word = start / 64;
+
+        if(word >= words) {
+            return UINT_MAX;
+        }
+
+        // The first word may be only partially searched.
+        unsigned int index = Bitmap::SearchForward(bitmap[word], start % 64);
+
+        if(index != UINT_MAX) {
+            return (word * 64) + index;
+        }
+
+        for(word++; word < words; word++) {
+            if(bitmap[word] != 0) {
+                return (word * 64) + Bitmap::SearchForward(bitmap[word]);
+            }
+        }
+
+        return UINT_MAX;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    static unsigned int SearchReverse(const unsigned __int64* bitmap, 
+                                      unsigned int words, unsigned int start) {
+        if(start > (words * 64)) {
+            start = words * 64;
+        }
+
+        unsigned int word = start / 64;
+
+        if((start % 64) != 0) {
+            // The last word may be only partially searched.
+            unsigned int index = Bitmap::SearchReverse(bitmap[word], start % 64);
+
+            if(index != UINT_MAX) {
+                return (word * 64) + index;
+            }
+        }
+
+        while(word > 0) {
+            word--;
+
+            if(bitmap[word] != 0) {
+                return (word * 64) + Bitmap::SearchReverse(bitmap[word]);
+            }
+        }
+
+        return UINT_MAX;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    static unsigned int PopCount(const unsigned __int64* bitmap, unsigned int words) {
+        unsigned int count = 0;
+
+        for(unsigned int i = 0; i < words; i++) {
+            count += Bitmap::NumberOfSetBits64(bitmap[i]);
+        }
+
+        return count;
+    }
+};
+
+
+#if defined(BITMAP_KERNELS_SIMD)
+// Tests 2 words at a time for zero (PTEST and PCMPEQQ are SSE4.1 instructions).
+struct BitmapKernelsSSE4 {
+    KERNEL_TARGET("sse4.1")
+    static unsigned __int64 Merge(unsigned __int64* destination, 
+                                  const unsigned __int64* source, unsigned int words) {
+        unsigned __int64 used = 0;
+        unsigned int i = 0;
+        __m128i zero = _mm_setzero_si128();
+
+        for(; (i + 2) <= words; i += 2) {
+            __m128i data = _mm_loadu_si128((const __m128i*)(source + i));
+            __m128i result = _mm_or_si128(data, _mm_loadu_si128((__m128i*)(destination + i)));
+            _mm_storeu_si128((__m128i*)(destination + i), result);
+
+            unsigned int empty = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(data, zero)));
+            used |= (unsigned __int64)(~empty & 0x3) << i;
+        }
+
+        if(i < words) {
+            used |= BitmapKernelsScalar::Merge(destination + i, source + i, words - i) << i;
+        }
+
+        return used;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    KERNEL_TARGET("sse4.1")
+    static unsigned int SearchForward(const unsigned __int64* bitmap, 
+                                      unsigned int words, unsigned int start) {
+        unsigned int word = start / 64;
+
+        if(word >= words) {
+            return UINT_MAX;
+        }
+
+        unsigned int index = Bitmap::SearchForward(bitmap[word], start % 64);
+
+        if(index != UINT_MAX) {
+            return (word * 64) + index;
+        }
+
+        // Skip over the empty words.
+        for(word++; (word + 2) <= words; word += 2) {
+            __m128i data = _mm_loadu_si128((const __m128i*)(bitmap + word));
+
+            if(!_mm_testz_si128(data, data)) {
+                break;
+            }
+        }
+
+        return BitmapKernelsScalar::SearchForward(bitmap, words, word * 64);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    KERNEL_TARGET("sse4.1")
+    static unsigned int SearchReverse(const unsigned __int64* bitmap, 
+                                      unsigned int words, unsigned int start) {
+        if(start > (words * 64)) {
+            start = words * 64;
+        }
+
+        unsigned int word = start / 64;
+
+        if((start % 64) != 0) {
+            unsigned int index = Bitmap::SearchReverse(bitmap[word], start % 64);
+
+            if(index != UINT_MAX) {
+                return (word * 64) + index;
+            }
+        }
+
+        // Skip over the empty words.
+        for(; word >= 2; word -= 2) {
+            __m128i data = _mm_loadu_si128((const __m128i*)(bitmap + word - 2));
+
+            if(!_mm_testz_si128(data, data)) {
+                break;
+            }
+        }
+
+        return BitmapKernelsScalar::SearchReverse(bitmap, word, word * 64);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Counts the bits of each nibble using a table kept in a register (PSHUFB),
+    // then adds the counts of the bytes in each word (PSADBW).
+    KERNEL_TARGET("sse4.1")
+    static unsigned int PopCount(const unsigned __int64* bitmap, unsigned int words) {
+        const __m128i table = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m128i nibble = _mm_set1_epi8(0x0F);
+        __m128i zero = _mm_setzero_si128();
+        __m128i total = zero;
+        unsigned int i = 0;
+
+        for(; (i + 2) <= words; i += 2) {
+            __m128i data = _mm_loadu_si128((const __m128i*)(bitmap + i));
+            __m128i low = _mm_shuffle_epi8(table, _mm_and_si128(data, nibble));
+            __m128i high = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(data, 4), nibble));
+            total = _mm_add_epi64(total, _mm_sad_epu8(_mm_add_epi8(low, high), zero));
+        }
+
+        unsigned int count = (unsigned int)_mm_cvtsi128_si32(total) + 
+                             (unsigned int)_mm_cvtsi128_si32(_mm_unpackhi_epi64(total, total));
+
+        if(i < words) {
+            count += BitmapKernelsScalar::PopCount(bitmap + i, words - i);
+        }
+
+        return count;
+    }
+};
+
+
+// Tests 4 words at a time for zero.
+struct BitmapKernelsAVX2 {
+    KERNEL_TARGET("avx2")
+    static unsigned __int64 Merge(unsigned __int64* destination, 
+                                  const unsigned __int64* source, unsigned int words) {
+        unsigned __int64 used = 0;
+        unsigned int i = 0;
+        __m256i zero = _mm256_setzero_si256();
+
+        for(; (i + 4) <= words; i += 4) {
+            __m256i data = _mm256_loadu_si256((const __m256i*)(source + i));
+            __m256i result = _mm256_or_si256(data, 
+                                             _mm256_loadu_si256((__m256i*)(destination + i)));
+            _mm256_storeu_si256((__m256i*)(destination + i), result);
+
+            unsigned int empty = _mm256_movemask_pd(
+                                    _mm256_castsi256_pd(_mm256_cmpeq_epi64(data, zero)));
+            used |= (unsigned __int64)(~empty & 0xF) << i;
+        }
+
+        // Avoid the penalty of mixing AVX and SSE code.
+        _mm256_zeroupper();
+        if(i < words) {
+            used |= BitmapKernelsScalar::Merge(destination + i, source + i, words - i) << i;
+        }
+
+        return used;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    KERNEL_TARGET("avx2")
+    static unsigned int SearchForward(const unsigned __int64* bitmap, 
+                                      unsigned int words, unsigned int start) {
+        unsigned int word = start / 64;
+
+        if(word >= words) {
+            return UINT_MAX;
+        }
+
+        unsigned int index = Bitmap::SearchForward(bitmap[word], start % 64);
+
+        if(index != UINT_MAX) {
+            return (word * 64) + index;
+        }
+
+        // Skip over the empty words.
+        for(word++; (word + 4) <= words; word += 4) {
+            __m256i data = _mm256_loadu_si256((const __m256i*)(bitmap + word));
+
+            if(!_mm256_testz_si256(data, data)) {
+                break;
+            }
+        }
+
+        _mm256_zeroupper();
+        return BitmapKernelsScalar::SearchForward(bitmap, words, word * 64);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    KERNEL_TARGET("avx2")
+    static unsigned int SearchReverse(const unsigned __int64* bitmap, 
+                                      unsigned int words, unsigned int start) {
+        if(start > (words * 64)) {
+            start = words * 64;
+        }
+
+        unsigned int word = start / 64;
+
+        if((start % 64) != 0) {
+            unsigned int index = Bitmap::SearchReverse(bitmap[word], start % 64);
+
+            if(index != UINT_MAX) {
+                return (word * 64) + index;
+            }
+        }
+
+        // Skip over the empty words.
+        for(; word >= 4; word -= 4) {
+            __m256i data = _mm256_loadu_si256((const __m256i*)(bitmap + word - 4));
+
+            if(!_mm256_testz_si256(data, data)) {
+                break;
+            }
+        }
+
+        _mm256_zeroupper();
+        return BitmapKernelsScalar::SearchReverse(bitmap, word, word * 64);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Like the SSE4.1 version, but 4 words at a time.
+    KERNEL_TARGET("avx2")
+    static unsigned int PopCount(const unsigned __int64* bitmap, unsigned int words) {
+        const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                               0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i nibble = _mm256_set1_epi8(0x0F);
+        __m256i zero = _mm256_setzero_si256();
+        __m256i total = zero;
+        unsigned int i = 0;
+
+        for(; (i + 4) <= words; i += 4) {
+            __m256i data = _mm256_loadu_si256((const __m256i*)(bitmap + i));
+            __m256i low = _mm256_shuffle_epi8(table, _mm256_and_si256(data, nibble));
+            __m256i high = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(data, 4), 
+                                                                       nibble));
+            total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(low, high), zero));
+        }
+
+        __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(total), 
+                                    _mm256_extracti128_si256(total, 1));
+        unsigned int count = (unsigned int)_mm_cvtsi128_si32(sum) + 
+                             (unsigned int)_mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+
+        _mm256_zeroupper();
+        if(i < words) {
+            count += BitmapKernelsScalar::PopCount(bitmap + i, words - i);
+        }
+
+        return count;
+    }
+};
+#endif
+
+
+struct BitmapKernels {
+    typedef unsigned __int64 (*MERGE_FUNCTION)(unsigned __int64* destination, 
+                                               const unsigned __int64* source, 
+                                               unsigned int words);
+    typedef unsigned int (*SEARCH_FUNCTION)(const unsigned __int64* bitmap,
+                                            unsigned int words, unsigned int start);
+    typedef unsigned int (*COUNT_FUNCTION)(const unsigned __int64* bitmap, unsigned int words);
+    static MERGE_FUNCTION MergeImpl;
+    static SEARCH_FUNCTION SearchForwardImpl;
+    static SEARCH_FUNCTION SearchReverseImpl;
+    static COUNT_FUNCTION PopCountImpl;
+
+    static void Initialize() {
+        // Detect if SSE4.1 or AVX2 are supported and use
+        // the optimized versions of the kernels if possible.
+        bool hasSSE4 = false;
+        bool hasAVX2 = false;
+
+#if defined(PLATFORM_WINDOWS)
+        int cpuInfo[4];
+        __cpuid(cpuInfo, 1);
+        hasSSE4 = (cpuInfo[2] & (1 << 19)) != 0;
+
+        // AVX2 can be used only if the OS saves the YMM registers.
+        bool osSavesYMM = ((cpuInfo[2] & (1 << 27)) != 0) && 
+                          ((_xgetbv(0) & 0x6) == 0x6);
+        __cpuid(cpuInfo, 0);
+
+        if(osSavesYMM && (cpuInfo[0] >= 7)) {
+            __cpuidex(cpuInfo, 7, 0);
+            hasAVX2 = (cpuInfo[1] & (1 << 5)) != 0;
+        }
+#elif defined(BITMAP_KERNELS_SIMD)
+        // Also checks if the OS saves the YMM registers.
+        __builtin_cpu_init();
+        hasSSE4 = __builtin_cpu_supports("sse4.1") != 0;
+        hasAVX2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+#if defined(BITMAP_KERNELS_SIMD)
+        if(hasAVX2) {
+            MergeImpl = BitmapKernelsAVX2::Merge;
+            SearchForwardImpl = BitmapKernelsAVX2::SearchForward;
+            SearchReverseImpl = BitmapKernelsAVX2::SearchReverse;
+            PopCountImpl = BitmapKernelsAVX2::PopCount;
+            return;
+        }
+        else if(hasSSE4) {
+            MergeImpl = BitmapKernelsSSE4::Merge;
+            SearchForwardImpl = BitmapKernelsSSE4::SearchForward;
+            SearchReverseImpl = BitmapKernelsSSE4::SearchReverse;
+            PopCountImpl = BitmapKernelsSSE4::PopCount;
+            return;
+        }
+#endif
+        MergeImpl = BitmapKernelsScalar::Merge;
+        SearchForwardImpl = BitmapKernelsScalar::SearchForward;
+        SearchReverseImpl = BitmapKernelsScalar::SearchReverse;
+        PopCountImpl = BitmapKernelsScalar::PopCount;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    static unsigned __int64 Merge(unsigned __int64* destination, 
+                                  const unsigned __int64* source, unsigned int words) {
+        return MergeImpl(destination, source, words);
+    }
+
+    static unsigned int SearchForward(const unsigned __int64* bitmap, 
+                                      unsigned int words, unsigned int start) {
+        return SearchForwardImpl(bitmap, words, start);
+    }
+
+    static unsigned int SearchReverse(const unsigned __int64* bitmap, 
+                                      unsigned int words, unsigned int start) {
+        return SearchReverseImpl(bitmap, words, start);
+    }
+
+    static unsigned int PopCount(const unsigned __int64* bitmap, unsigned int words) {
+        return PopCountImpl(bitmap, words);
+    }
+};
+
+// The scalar versions are used until 'Initialize' is called.
+BitmapKernels::MERGE_FUNCTION BitmapKernels::MergeImpl = BitmapKernelsScalar::Merge;
+BitmapKernels::SEARCH_FUNCTION BitmapKernels::SearchForwardImpl = BitmapKernelsScalar::SearchForward;
+BitmapKernels::SEARCH_FUNCTION BitmapKernels::SearchReverseImpl = BitmapKernelsScalar::SearchReverse;
+BitmapKernels::COUNT_FUNCTION BitmapKernels::PopCountImpl = BitmapKernelsScalar::PopCount;
+
+
+// A fixed-width bitmap made of 'Bits' / 64 words (the number of bits
+// is rounded up to a multiple of 64). The searches and the counting
+// of the set bits use the kernels above.
+template <unsigned int Bits>
+class WideBitmap {
+public:
+    static const unsigned int WORDS = (Bits + 63) / 64;
+    unsigned __int64 Words[WORDS];
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    void Clear() {
+        for(unsigned int i = 0; i < WORDS; i++) {
+            Words[i] = 0;
+        }
+    }
+
+    // Sets the first 'count' bits and resets the other ones.
+    void SetFirst(unsigned int count) {
+        for(unsigned int i = 0; i < WORDS; i++) {
+            if(count >= ((i + 1) * 64)) {
+                Words[i] = ~0ULL;
+            }
+            else if(count > (i * 64)) {
+                Words[i] = (1ULL << (count - (i * 64))) - 1;
+            }
+            else Words[i] = 0;
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    bool IsBitSet(unsigned int index) const {
+        return Bitmap::IsBitSet(Words[index / 64], index % 64);
+    }
+
+    void SetBit(unsigned int index) {
+        Bitmap::SetBit(Words[index / 64], index % 64);
+    }
+
+    void ResetBit(unsigned int index) {
+        Bitmap::ResetBit(Words[index / 64], index % 64);
+    }
+
+    // The atomic versions return the previous value of the word that contains the bit.
+    unsigned __int64 AtomicSetBit(unsigned int index) {
+        return Atomic::SetBit64(&Words[index / 64], index % 64);
+    }
+
+    unsigned __int64 AtomicResetBit(unsigned int index) {
+        return Atomic::ResetBit64(&Words[index / 64], index % 64);
+    }
+
+    // Sets/resets all bits from the mask in the specified word using a single
+    // atomic operation. Returns the previous value of the word.
+    unsigned __int64 AtomicSetBits(unsigned int word, unsigned __int64 mask) {
+        return (unsigned __int64)Atomic::Or64((volatile __int64*)&Words[word], 
+                                              (__int64)mask);
+    }
+
+    unsigned __int64 AtomicResetBits(unsigned int word, unsigned __int64 mask) {
+        return (unsigned __int64)Atomic::And64((volatile __int64*)&Words[word], 
+                                               (__int64)~mask);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the index of the first set bit, or UINT_MAX if no bit is set.
+    unsigned int SearchForward() const {
+        return BitmapKernels::SearchForward(Words, WORDS, 0);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    unsigned int NumberOfSetBits() const {
+        return BitmapKernels::PopCount(Words, WORDS);
+    }
+
+    bool IsZero() const {
+        unsigned __int64 value = 0;
+
+        for(unsigned int i = 0; i < WORDS; i++) {
+            value |= Words[i];
+        }
+
+        return value == 0;
+    }
+
+    bool operator== (const WideBitmap<Bits>& other) const {
+        for(unsigned int i = 0; i < WORDS; i++) {
+            if(Words[i] != other.Words[i]) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool operator!= (const WideBitmap<Bits>& other) const {
+        return !this->operator ==(other);
+    }
+};
+
+} // namespace Base
+#endif
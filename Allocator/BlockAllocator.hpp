@@ -39,7 +39,7 @@
 #include "ObjectPool.hpp"
 #include "Memory.hpp"
 #include "AllocatorConstants.hpp"
-#include "Bitmap.hpp"
+#include "BitmapKernels.hpp"
 #include "FreeObjectList.hpp"
 #include "Statistics.hpp"
 #include "Atomic.hpp"
@@ -48,13 +48,13 @@
 #if defined(PLATFORM_WINDOWS)
     #include <Windows.h>
 #else
-    static_assert(false, "Not yet implemented.");
+    #include <stdint.h>
 #endif
 
 namespace Base {
 
-// Small and medium groups are allocated in blocks (1MB) that contain a maximum
-// of 64 groups (limited by the 64-bit bitmap used to keep track of used blocks).
+// Small and medium groups are allocated in blocks (1MB by default, up to 8MB)
+// that contain a maximum of 512 groups (tracked using a bitmap of the used groups).
 // Keeping track of the groups makes it possible to return the memory to the system
 // when it's no longer needed. A specified number of blocks are cached to prevent
 // situations in which a group is repeatedly obtained and returned to the OS.
@@ -63,45 +63,33 @@ template <unsigned int BinNumber, unsigned int BlockSize, unsigned int GroupSize
 class BlockAllocator {
 private:
     // Nested types
+    static const unsigned int GROUPS = BlockSize / GroupSize;
+    typedef WideBitmap<GROUPS> GroupBitmapType;
+
     #pragma pack(push)
     #pragma pack(1)
     struct BlockDescriptor : public ObjectList<>::Node {
         // Full block  - all groups are unused, available.
         // Empty block - all groups are used, unavailable.
-        void* StartAddress;           // The address of the first usable group.
-        void* RealAddress;            // The address of the first byte of the block.
-        unsigned __int64 GroupBitmap; // Keeps track of used groups.
-        unsigned __int64 FullBitmap;  // The bitmap when the block is full (no group is used).
+        void* StartAddress;              // The address of the first usable group.
+        void* RealAddress;               // The address of the first byte of the block.
+        GroupBitmapType GroupBitmap;     // Keeps track of used groups.
+        GroupBitmapType DirtyBitmap;     // The groups used at least once since the memory was allocated.
 #if defined(PLATFORM_WINDOWS)
-        HugeLocation* HugeParent;     // The associated huge location (only under Windows).
+        HugeLocation* HugeParent;        // The associated huge location (only under Windows).
 #endif
-        unsigned int FreeGroups;      // The number of free groups in the block.
-        unsigned int NumaNode;        // Only for NUMA.
+        volatile unsigned int FreeGroups; // The number of free groups in the block.
+        unsigned int Groups;             // The number of groups when the block is full.
+        unsigned int NumaNode;           // Only for NUMA.
 
         // Padded to cache line by the object pool.
     };
     #pragma pack(pop)
 
-    // Helper that creates a bitmap that describes a block when it's unused.
-    // (sets the first BSize/GSize bits to 1).
-    template <unsigned int BSize, unsigned int GSize>
-    struct EmptyMask {
-        enum { N = BSize / GSize };
-        static const unsigned __int64 Mask = EmptyMaskImpl<N>::Mask;
-    };
-
-    template <unsigned int N>
-    struct EmptyMaskImpl {
-        static const unsigned __int64 Mask = (1 << N) - 1;
-    };
-
-    template <>
-    struct EmptyMaskImpl<64> {
-        // Special case for N = 64 (shifting undefined).
-        static const unsigned __int64 Mask = -1;
-    };
-
-    typedef typename EmptyMask<BlockSize, GroupSize> Empty;
+    // The descriptors are allocated by the object pool in multiples of the cache line.
+    static const unsigned int DESCRIPTOR_SIZE = 
+            ((sizeof(BlockDescriptor) + Constants::CACHE_LINE_SIZE - 1) / 
+             Constants::CACHE_LINE_SIZE) * Constants::CACHE_LINE_SIZE;
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     ObjectPool blockDescriptorPool_; // 1 cache line.
@@ -110,10 +98,14 @@ private:
     void* allocator_;
     unsigned int lock_;
     unsigned int numaNode_;
+    unsigned int cacheLimit_; // The number of unused blocks kept (initially 'CacheSize').
 
-    // The bins that contain partial freed groups.
-    ObjectList<typename PartialTraits::NodeType,
-               typename PartialTraits::PolicyType> partialFreeGroups_[BinNumber];
+    // The bins that contain partial freed groups, separate for each lifetime
+    // and bucketed by the fraction of used locations (0 - least used).
+    typedef ObjectList<typename PartialTraits::NodeType,
+                       typename PartialTraits::PolicyType> PartialListType;
+    PartialListType partialFreeGroups_[Constants::LIFETIMES * BinNumber]
+                                      [Constants::PARTIAL_BUCKETS];
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Allocates and initializes a block of memory.
@@ -134,14 +126,19 @@ private:
 #else
         rawBlockAddr = memPolicy->AllocateMemory(BlockSize + GroupSize, numaNode_);
         alignedBlockAddr = (void*)(((uintptr_t)rawBlockAddr + GroupSize - 1) & 
-                                  ~(GroupSize - 1));
+                                  ~((uintptr_t)GroupSize - 1));
 #endif	
         // Get a block descriptor from the pool.
         auto block = reinterpret_cast<BlockDescriptor*>(blockDescriptorPool_.GetObject());             
 
         if((rawBlockAddr != nullptr) && (block != nullptr)) {
             // Initialize the block header.
-            block->GroupBitmap = block->FullBitmap = Empty::Mask;
+            block->GroupBitmap.SetFirst(GROUPS);
+            block->DirtyBitmap.Clear(); // Memory from the OS is zero-filled.
+            block->FreeGroups = block->Groups = GROUPS;
+#if defined(PLATFORM_WINDOWS)
+            block->HugeParent = nullptr;
+#endif
             block->RealAddress = rawBlockAddr;
             block->StartAddress = alignedBlockAddr;
 
@@ -176,18 +173,24 @@ private:
     }
 
     // Gets the first available group from the specified block.
-    GroupType* GetGroupFromBlock(BlockDescriptor* block, unsigned int& isEmpty) {
+    // 'zeroed' is set if the memory of the group was never used.
+    GroupType* GetGroupFromBlock(BlockDescriptor* block, unsigned int& isEmpty, 
+                                 bool& zeroed) {
         // Find the first available group.
         // The found index is guaranteed to be valid because:
         // 1. Only this thread can get groups from the block (the access is serialized).
         // 2. Blocks that return groups only set bits, don't reset them.
-        unsigned int groupIndex = Bitmap::SearchForward(block->GroupBitmap);
-        unsigned __int64* bitmapAddr = (unsigned __int64*)&block->GroupBitmap;
-        unsigned __int64 oldBitmap = Atomic::ResetBit64(bitmapAddr, groupIndex);
+        unsigned int groupIndex = block->GroupBitmap.SearchForward();
+        block->GroupBitmap.AtomicResetBit(groupIndex);
 
-        // If only one bit was set, the block has no groups anymore
-        // and must be removed from the "full" list and added to the "empty" list.
-        isEmpty = ((oldBitmap & (oldBitmap - 1)) == 0); // Resets the first set bit.
+        // If this was the last free group, the block must be removed 
+        // from the "full" list and added to the "empty" list.
+        // The bitmap has more than one word, so the counter decides the transitions.
+        isEmpty = Atomic::Decrement(&block->FreeGroups) == 0;
+
+        // Only this thread can get groups from the block, no atomic operation needed.
+        zeroed = !block->DirtyBitmap.IsBitSet(groupIndex);
+        block->DirtyBitmap.SetBit(groupIndex);
     
         // Initialize the group.
         void* groupAddr = (char*)block->StartAddress + (groupIndex*  GroupSize);
@@ -202,24 +205,242 @@ private:
         return group;
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Takes up to 'count' available groups from the specified block.
+    // The bitmap is updated with a single atomic operation for each word.
+    // Returns the number of groups stored in 'groups'; the lowest bit of each
+    // pointer is set if the memory of the group was never used.
+    unsigned int GetGroupsFromBlock(BlockDescriptor* block, void** groups, 
+                                    unsigned int count, unsigned int& isEmpty) {
+        // A returned group has its bit set before it's counted, so more groups 
+        // than counted may be found. Taking them would make the counter wrap
+        // (the block would never be seen as empty), so at most 'FreeGroups' are taken.
+        // The counter can only be incremented while we hold the lock.
+        unsigned int freeGroups = Atomic::Load(&block->FreeGroups, std::memory_order_acquire);
+        count = count < freeGroups ? count : freeGroups;
+        unsigned int taken = 0;
+
+        for(unsigned int word = 0; (word < GroupBitmapType::WORDS) && (taken < count); word++) {
+            // Only this thread can get groups from the block, other threads
+            // can only set bits while we're here, so the copy stays valid.
+            unsigned __int64 available = Atomic::Load(&block->GroupBitmap.Words[word], 
+                                                       std::memory_order_acquire);
+            unsigned __int64 mask = 0;
+
+            while((available != 0) && (taken < count)) {
+                unsigned int bit = Bitmap::SearchForward(available);
+                unsigned int groupIndex = (word * 64) + bit;
+                available &= available - 1;
+                mask |= 1ULL << bit;
+
+                void* groupAddr = (char*)block->StartAddress + (groupIndex*  GroupSize);
+                GroupType* group = reinterpret_cast<GroupType*>(groupAddr);
+                group->ParentBlock = block;
+
+                bool zeroed = !block->DirtyBitmap.IsBitSet(groupIndex);
+                groups[taken++] = (void*)((uintptr_t)group | (zeroed ? 1 : 0));
+
+#if defined(PLATFORM_WINDOWS)
+                if(block->HugeParent != nullptr) {
+                    block->HugeParent->AddRef();			
+                }
+#endif
+            }
+
+            if(mask != 0) {
+                block->GroupBitmap.AtomicResetBits(word, mask);
+                block->DirtyBitmap.Words[word] |= mask;
+            }
+        }
+
+        isEmpty = Atomic::Add(&block->FreeGroups, 0 - taken) == taken;
+        return taken;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Adds a block with available groups to the full list.
+    // If 'ADDRESS_ORDERED' is defined the list is sorted by address, so that groups 
+    // are always taken from the lowest block. The live data is concentrated 
+    // in fewer blocks, and the higher ones can become unused and be released.
+    void AddFullBlock(BlockDescriptor* block) {
+#if defined(ADDRESS_ORDERED)
+        // This is called under the lock only when a block gets its first available 
+        // group, not for each returned group. Groups are taken only from the lowest
+        // block, so the blocks that had no available groups are usually the lowest
+        // ones and are added at the front. The list is searched from both ends,
+        // so a block is found quickly near any of them; at a random position
+        // an insertion took ~20ns with 64 blocks and ~230ns with 512 blocks (512MB).
+        // A heap would make the insertion O(log n), but it can't be walked
+        // in address order when the highest blocks are released.
+        auto low = static_cast<BlockDescriptor*>(fullBlockList_.First());
+        auto high = static_cast<BlockDescriptor*>(fullBlockList_.Last());
+
+        if((low == nullptr) || (low->StartAddress > block->StartAddress)) {
+            fullBlockList_.AddFirst(block);
+            return;
+        }
+        else if(high->StartAddress < block->StartAddress) {
+            fullBlockList_.AddLast(block);
+            return;
+        }
+
+        // 'low' is below and 'high' above the block, so the searches
+        // can't pass the end of the list.
+        while(true) {
+            auto next = static_cast<BlockDescriptor*>(low->Next);
+
+            if(next->StartAddress > block->StartAddress) {
+                fullBlockList_.AddAfter(low, block);
+                return;
+            }
+
+            auto previous = static_cast<BlockDescriptor*>(high->Previous);
+
+            if(previous->StartAddress < block->StartAddress) {
+                fullBlockList_.AddAfter(previous, block);
+                return;
+            }
+
+            low = next;
+            high = previous;
+        }
+#else
+        fullBlockList_.AddFirst(block);
+#endif
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Moves the block between the lists after groups were returned to it.
+    // 'wasEmpty' indicates that the block had no free groups before.
+    // The manager lock must be held by the caller.
+    template <class MemoryPolicy>
+    void UpdateBlockLists(BlockDescriptor* block, bool wasEmpty) {
+        if(wasEmpty) {
+            emptyBlockList_.Remove(block);
+            AddFullBlock(block);
+        }
+
+        // The block may be full; check if it should be kept into cache.
+        // It can be returned to the OS only if no other thread took
+        // a group before we acquired the manager lock and only if 
+        // enough blocks remain in the cache.
+        // When the blocks are ordered by address, a block that is not the lowest
+        // one with available groups is released immediately, because groups 
+        // will be taken from it only after all lower blocks are used.
+        bool release = (fullBlockList_.Count() + emptyBlockList_.Count()) >
+                       Atomic::Load(&cacheLimit_, std::memory_order_relaxed);
+#if defined(ADDRESS_ORDERED)
+        release = release || (block != fullBlockList_.First());
+#endif
+
+        if((Atomic::Load(&block->FreeGroups, std::memory_order_relaxed) == block->Groups) && release) {
+            // Return the block to the OS.
+            fullBlockList_.Remove(block);
+            DeallocateBlock<MemoryPolicy>(block);
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Selects the partial list bucket based on the number of used locations.
+    // Groups are returned to the partial lists only when at most 25% 
+    // of their locations are used, so the buckets divide this range.
+    // The locations freed by other threads are counted as used by the group
+    // until they are merged, but they are free and are not counted here.
+    static unsigned int GetPartialBucket(GroupType* group) {
+        unsigned int used = group->GetUsedLocations();
+        unsigned int publicLocations = group->GetPublicLocations();
+
+        used = publicLocations < used ? used - publicLocations : 0;
+        unsigned int bucket = (used * Constants::PARTIAL_BUCKETS * 4) / group->Locations;
+        return bucket < Constants::PARTIAL_BUCKETS ? bucket : Constants::PARTIAL_BUCKETS - 1;
+    }
+
+    // Returns the partial lists used by the specified bin.
+    static unsigned int GetPartialBin(BinType* bin) {
+        return (bin->Lifetime * BinNumber) + bin->Number;
+    }
+
+    // Returns the list found at the position stored in 'PartialBucket'.
+    PartialListType& GetPartialList(unsigned int position) {
+        return partialFreeGroups_[position / Constants::PARTIAL_BUCKETS]
+                                 [position % Constants::PARTIAL_BUCKETS];
+    }
+
+    // Removes the group with the most used locations from the partial lists.
+    // The bucket is selected when the group is added, but other threads
+    // continue to free its locations, so the group may belong to a lower bucket
+    // by now. Such a group is moved to its current bucket instead of being taken.
+    GroupType* RemovePartialGroup(BinType* bin) {
+        unsigned int partialBin = GetPartialBin(bin);
+        unsigned int moved = 0;
+
+        for(int bucket = Constants::PARTIAL_BUCKETS - 1; bucket >= 0; bucket--) {
+            while(partialFreeGroups_[partialBin][bucket].Count() > 0) {
+                void* groupObject = partialFreeGroups_[partialBin][bucket].RemoveFirst();
+                GroupType* group = reinterpret_cast<GroupType*>(groupObject);
+                unsigned int current = GetPartialBucket(group);
+
+                if((current < (unsigned int)bucket) &&
+                   (moved < Constants::PARTIAL_REBUCKET_LIMIT)) {
+                    // Groups only move to lower buckets, so the search ends.
+                    group->PartialBucket = (partialBin * Constants::PARTIAL_BUCKETS) + current;
+                    GetPartialList(group->PartialBucket).AddFirst(group);
+                    moved++;
+                    continue;
+                }
+
+                return group;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Adds 'returned' to the number of free groups of the block, unless the block
+    // was empty or becomes full (no group is used), in which case it must be moved 
+    // between the lists and the caller should use 'AddFreeGroups' under the lock.
+    // Groups are taken only under the lock, so a block can become full or be 
+    // released (by 'UpdateBlockLists' or 'ReleaseUnusedBlocks') only while 
+    // the lock is held, never while another thread still returns groups to it.
+    static bool TryAddFreeGroups(BlockDescriptor* block, unsigned int returned) {
+        unsigned int freeGroups = Atomic::Load(&block->FreeGroups, std::memory_order_relaxed);
+
+        while((freeGroups != 0) && ((freeGroups + returned) != block->Groups)) {
+            unsigned int previous = Atomic::CompareExchange(&block->FreeGroups, 
+                                                            freeGroups + returned, 
+                                                            freeGroups);
+            if(previous == freeGroups) {
+                return true;
+            }
+
+            freeGroups = previous;
+        }
+
+        return false;
+    }
+
+    // Adds 'returned' to the number of free groups of the block 
+    // and moves the block between the lists if it's needed.
+    // The manager lock must be held by the caller.
+    template <class MemoryPolicy>
+    void AddFreeGroups(BlockDescriptor* block, unsigned int returned) {
+        unsigned int previous = Atomic::Add(&block->FreeGroups, returned);
+        UpdateBlockLists<MemoryPolicy>(block, previous == 0);
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Returns the specified group to the owner block.
     unsigned int ReturnGroupToBlock(BlockDescriptor* block, GroupType* group) {
         // Mark the group as unused.
         unsigned int groupIndex = ((char*)group - (char*)block->StartAddress) / GroupSize;
-        unsigned __int64* bitmapAddr = (unsigned __int64*)&block->GroupBitmap;
-        unsigned __int64 oldBitmap = Atomic::SetBit64(bitmapAddr, groupIndex);
-
-        // If the block had no free groups it must be removed 
-        // from the empty list and added to the full list.
-        if(oldBitmap == 0) {
-            // The block was empty.
-            return BLOCK_WAS_EMPTY;
-        }
-        else if((oldBitmap | (oldBitmap + 1)) == block->FullBitmap) {
-            // Sets the lowest unset bit and checks if all bits are set.
-            // The block is now completely full (no group is used).
-            return BLOCK_IS_FULL;
+        block->GroupBitmap.AtomicSetBit(groupIndex);
+
+        // If the block had no free groups it must be removed from the empty list 
+        // and added to the full list; if it's now completely full (no group is used)
+        // it may be released. The counter is then updated under the lock.
+        if(!TryAddFreeGroups(block, 1)) {
+            return BLOCK_MOVE;
         }
 
 #if defined(PLATFORM_WINDOWS)
@@ -231,34 +452,32 @@ private:
     }
 
 public:
-    typedef typename GroupType GroupT;
-    typedef typename BlockAllocator<BinNumber, BlockSize, GroupSize, 
+    typedef GroupType GroupT;
+    typedef BinType BinT;
+    typedef BlockAllocator<BinNumber, BlockSize, GroupSize, 
                                     CacheSize, GroupType, BinType, PartialTraits> BAType;
-    typedef typename ObjectList<typename PartialTraits::NodeType,
-                                typename PartialTraits::PolicyType> PartialListType;
 
     static const unsigned int REMOVE_GROUP    = 1;
     static const unsigned int ADD_GROUP       = 2;
 
     static const unsigned int BLOCK_NO_ACTION = 0;
     static const unsigned int BLOCK_FROM_HUGE = 1;
-    static const unsigned int BLOCK_WAS_EMPTY = 2;
-    static const unsigned int BLOCK_IS_FULL   = 3;
+    static const unsigned int BLOCK_MOVE      = 2;
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     template <class MemoryPolicy>
     void Initialize(void* allocator, unsigned int numaNode) {
         lock_ = 0;
+        cacheLimit_ = CacheSize;
         allocator_ = allocator;
         numaNode_ = numaNode;
         auto memoryPolicy = static_cast<MemoryPolicy*>(allocator_);
 
-        memoryPolicy->SetBlockAllocator<BAType>(this, numaNode_);
-        memoryPolicy->BlockUnavailable<BAType>(numaNode_);
+        memoryPolicy->template SetBlockAllocator<BAType>(this, numaNode_);
+        memoryPolicy->template BlockUnavailable<BAType>(numaNode_);
 
         blockDescriptorPool_ = ObjectPool(Constants::BLOCK_DESCRIPTOR_ALLOCATION_SIZE, 
-                                          Constants::BLOCK_DESCRIPTOR_SIZE,
-                                          Constants::BLOCK_DESCRIPTOR_CACHE);
+                                          DESCRIPTOR_SIZE);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -273,20 +492,21 @@ public:
     //    at least an unused group by step 2).
     template <class MemoryPolicy>
     GroupType* GetGroup(unsigned int locationSize, unsigned int locations, 
-                        BinType* bin, unsigned int currentThreadId) {
+                        BinType* bin, unsigned int currentThreadId, bool usePartial) {
         // Will be released when the method exists.
         SpinLock managerLock(&lock_); 
         unsigned int isEmpty = 0;
+        bool zeroed = false;
 
-        // Try to get the group from the list of partially used groups.
-        // If it fails, get a unused group.
-        void* groupObject = partialFreeGroups_[bin->Number].RemoveFirst();
-        auto group = reinterpret_cast<GroupType*>(groupObject);
+        // Try to get the group from the list of partially used groups,
+        // preferring the ones with the most used locations.
+        // If it fails (or it's not allowed), get a unused group.
+        auto group = usePartial ? RemovePartialGroup(bin) : nullptr;
 
         if(group != nullptr) {
             // We could get a group from the partial list; mark it as owned.
             group->InitializeUsed(currentThreadId);
-            Memory::WriteValue((uintptr_t*)&group->ParentBin, (uintptr_t)bin);
+            Atomic::Store(&group->ParentBin, (void*)bin, std::memory_order_release);
             return group;
         }
 
@@ -294,7 +514,7 @@ public:
         if(fullBlockList_.Count() > 0) {
             // Get a group from the first block with unused groups.
             auto descriptor = static_cast<BlockDescriptor*>(fullBlockList_.First());
-            group = GetGroupFromBlock(descriptor, isEmpty);
+            group = GetGroupFromBlock(descriptor, isEmpty, zeroed);
         
             if(isEmpty) {
                 // The block has no free groups anymore. It needs to be moved
@@ -303,8 +523,8 @@ public:
             }
 
             // Initialize the unused group.
-            group->InitializeUnused(locationSize, locations, currentThreadId);
-            Memory::WriteValue((uintptr_t*)&group->ParentBin, (uintptr_t)bin);
+            group->InitializeUnused(locationSize, locations, currentThreadId, zeroed);
+            Atomic::Store(&group->ParentBin, (void*)bin, std::memory_order_release);
             return group;
         }
         else {
@@ -313,13 +533,14 @@ public:
             MemoryPolicy* memPolicy = static_cast<MemoryPolicy*>(allocator_);
 
             // Announce that there are no groups available anymore.
-            memPolicy->BlockUnavailable<BAType>(numaNode_);
-            groupObject = memPolicy->GetGroup<BAType>(numaNode_, currentThreadId);
+            memPolicy->template BlockUnavailable<BAType>(numaNode_);
+            void* groupObject = memPolicy->template GetGroup<BAType>(numaNode_, currentThreadId);
             group = reinterpret_cast<GroupType*>(groupObject);
             
             if(group != nullptr) {
-                group->InitializeUnused(locationSize, locations, currentThreadId);
-                Memory::WriteValue((uintptr_t*)&group->ParentBin, (uintptr_t)bin);
+                // It's not known if a group from another node was used before.
+                group->InitializeUnused(locationSize, locations, currentThreadId, false);
+                Atomic::Store(&group->ParentBin, (void*)bin, std::memory_order_release);
                 return group;
             }
 
@@ -330,18 +551,18 @@ public:
                 return nullptr; // Failed to allocate block.
             }
 
-            fullBlockList_.AddFirst(block);
+            AddFullBlock(block);
 
             // Announce that there are groups available now.
-            memPolicy->BlockAvailable<BAType>(numaNode_);
+            memPolicy->template BlockAvailable<BAType>(numaNode_);
 
             // Get a group from the newly allocated block and initialize it.
-            group = GetGroupFromBlock(static_cast<BlockDescriptor*>(block), isEmpty);
-            group->InitializeUnused(locationSize, locations, currentThreadId);
-            Memory::WriteValue((uintptr_t*)&group->ParentBin, (uintptr_t)bin);
+            group = GetGroupFromBlock(static_cast<BlockDescriptor*>(block), isEmpty, zeroed);
+            group->InitializeUnused(locationSize, locations, currentThreadId, zeroed);
+            Atomic::Store(&group->ParentBin, (void*)bin, std::memory_order_release);
 
             // The block cannot be empty from the first allocation
-            // with the current values (64 groups/block).
+            // (it has at least 16 groups).
             return group;
         }
     }
@@ -354,10 +575,11 @@ public:
         // Will be released when the method exists.
         SpinLock managerLock(&lock_);
 
-        if(fullBlockList_.Count > 0) {
+        if(fullBlockList_.Count() > 0) {
             unsigned int isEmpty = false;
+            bool zeroed;
             auto descriptor = static_cast<BlockDescriptor*>(fullBlockList_.First);
-            auto group = GetGroupFromBlock(descriptor, isEmpty);
+            auto group = GetGroupFromBlock(descriptor, isEmpty, zeroed);
             
             group->ThreadId = currentThreadId;
 
@@ -389,30 +611,10 @@ public:
                 // Main case (> 95%).
                 return;
             }
-            else if(result >= BLOCK_WAS_EMPTY) {
+            else if(result == BLOCK_MOVE) {
                 // Will be released when the method exists.
                 SpinLock managerLock(&lock_);
-
-                if(result == BLOCK_IS_FULL) {
-                    // The block is full; check if it should be kept into cache.
-                    // It can be returned to the OS only if no other thread took
-                    // a group before we acquired the manager lock and only if 
-                    // enough blocks remain in the cache.
-                    if((block->GroupBitmap == Empty::Mask) &&
-                       ((fullBlockList_.Count() + emptyBlockList_.Count()) > CacheSize)) {
-                        // Return the block to the OS.
-                        fullBlockList_.Remove(block);
-                        DeallocateBlock<MemoryPolicy>(block);
-                    }
-                }
-                else if (block->GroupBitmap != 0) { 
-                    // The block hasn't been changed by another thread.
-                    // The bitmap becomes 0 only if a thread took a group
-                    // from the block. Threads that return groups only set bits, 
-                    // so the bitmap cannot be 0 in this case.
-                    emptyBlockList_.Remove(block);
-                    fullBlockList_.AddFirst(block);
-                }
+                AddFreeGroups<MemoryPolicy>(block, 1);
             }
 #if defined(PLATFORM_WINDOWS)
             else if(result == BLOCK_FROM_HUGE) {
@@ -439,16 +641,145 @@ public:
 #endif
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Gets up to 'count' unused groups while holding the manager lock only once.
+    // The groups are not initialized; the lowest bit of each returned pointer
+    // is set if the memory of the group was never used.
+    // Partially used groups and groups from other NUMA nodes are not considered;
+    // if no group is returned the caller should fall back to 'GetGroup'.
+    template <class MemoryPolicy>
+    unsigned int GetGroups(void** groups, unsigned int count) {
+        // Will be released when the method exists.
+        SpinLock managerLock(&lock_); 
+        unsigned int taken = 0;
+
+        while(taken < count) {
+            if(fullBlockList_.Count() == 0) {
+                if(taken > 0) {
+                    // Don't allocate a new block only to complete the batch.
+                    break;
+                }
+
+                MemoryPolicy* memPolicy = static_cast<MemoryPolicy*>(allocator_);
+                memPolicy->template BlockUnavailable<BAType>(numaNode_);
+                BlockDescriptor* block = AllocateBlock<MemoryPolicy>();
+
+                if(block == nullptr) {
+                    break; // Failed to allocate block.
+                }
+
+                AddFullBlock(block);
+                memPolicy->template BlockAvailable<BAType>(numaNode_);
+            }
+
+            unsigned int isEmpty = 0;
+            auto descriptor = static_cast<BlockDescriptor*>(fullBlockList_.First());
+            taken += GetGroupsFromBlock(descriptor, groups + taken, count - taken, isEmpty);
+
+            if(isEmpty) {
+                // The block has no free groups anymore.
+                emptyBlockList_.AddFirst(fullBlockList_.RemoveFirst());
+            }
+        }
+
+        return taken;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the specified groups to their parent blocks.
+    // Consecutive groups from the same bitmap word are returned using a single
+    // atomic operation, and the manager lock is taken at most once for 
+    // each GROUP_BATCH_SIZE groups. The lowest bit of the pointers is ignored.
+    template <class MemoryPolicy>
+    void ReturnFullGroups(void** groups, unsigned int count) {
+        BlockDescriptor* changed[Constants::GROUP_BATCH_SIZE];
+        unsigned int pending[Constants::GROUP_BATCH_SIZE]; // Groups not yet counted.
+        unsigned int position = 0;
+
+        while(position < count) {
+            unsigned int limit = position + Constants::GROUP_BATCH_SIZE;
+            limit = limit < count ? limit : count;
+            unsigned int changedCount = 0;
+
+            while(position < limit) {
+                auto group = reinterpret_cast<GroupType*>((uintptr_t)groups[position] & ~1);
+                auto block = reinterpret_cast<BlockDescriptor*>(group->ParentBlock);
+
+#if defined(PLATFORM_WINDOWS)
+                bool single = block->HugeParent != nullptr;
+#else
+                bool single = false;
+#endif
+#if defined(PLATFORM_NUMA)
+                single = single || (block->numaNode_ != numaNode_);
+#endif
+                if(single) {
+                    // Groups from huge locations and other NUMA nodes
+                    // need special handling, return them one by one.
+                    ReturnFullGroup<MemoryPolicy>(group, true);
+                    position++;
+                    continue;
+                }
+
+                // Merge the following groups that belong to the same bitmap word.
+                unsigned int groupIndex = ((char*)group - (char*)block->StartAddress) / GroupSize;
+                unsigned int word = groupIndex / 64;
+                unsigned __int64 mask = 1ULL << (groupIndex % 64);
+                unsigned int returned = 1;
+                position++;
+
+                while(position < limit) {
+                    auto next = reinterpret_cast<GroupType*>((uintptr_t)groups[position] & ~1);
+                    unsigned int nextIndex = ((char*)next - (char*)block->StartAddress) / GroupSize;
+
+                    if((next->ParentBlock != block) || ((nextIndex / 64) != word)) {
+                        break;
+                    }
+
+                    mask |= 1ULL << (nextIndex % 64);
+                    returned++;
+                    position++;
+                }
+
+                block->GroupBitmap.AtomicSetBits(word, mask);
+
+                // A block is recorded only once, because it may be deallocated.
+                // After it was recorded, all it's groups are counted under the lock.
+                unsigned int i = 0;
+                while((i < changedCount) && (changed[i] != block)) i++;
+
+                if(i < changedCount) {
+                    pending[i] += returned;
+                }
+                else if(!TryAddFreeGroups(block, returned)) {
+                    // The block needs to be moved between the lists.
+                    changed[changedCount] = block;
+                    pending[changedCount] = returned;
+                    changedCount++;
+                }
+            }
+
+            if(changedCount > 0) {
+                // Will be released at the end of the iteration.
+                SpinLock managerLock(&lock_);
+
+                for(unsigned int i = 0; i < changedCount; i++) {
+                    AddFreeGroups<MemoryPolicy>(changed[i], pending[i]);
+                }
+            }
+        }
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Adds/removes the specified group to/from the associated partial list.
+    // The bin is needed only when adding, the group remembers its list.
     template <class MemoryPolicy>
     void ReturnPartialGroup(GroupType* group, unsigned int action, 
-                            unsigned int bin, unsigned int currentThreadId) {
+                            BinType* bin, unsigned int currentThreadId) {
         // Partially used groups are not returned to the parent 
         // NUMA node until they are completely unused. This prevents 
         // nodes to access locations that reside on another nodes.
         auto block = reinterpret_cast<BlockDescriptor*>(group->ParentBlock);
-        auto partialList = &partialFreeGroups_[bin];
         SpinLock managerLock(&lock_); // Will be released when the method exists.
 
         if(action == ADD_GROUP)	{
@@ -466,7 +797,9 @@ public:
             }
 
             group->ParentBin = nullptr;
-            partialList->AddFirst(group);
+            group->PartialBucket = (GetPartialBin(bin) * Constants::PARTIAL_BUCKETS) + 
+                                   GetPartialBucket(group);
+            GetPartialList(group->PartialBucket).AddFirst(group);
         }
         else {
             // The group needs to be removed from the partial list
@@ -478,7 +811,7 @@ public:
                 return;
             }
 
-            partialList->Remove(group);
+            GetPartialList(group->PartialBucket).Remove(group);
             managerLock.Unlock();
             ReturnFullGroup<MemoryPolicy>(group, false /* lock already taken */);
         }
@@ -486,15 +819,16 @@ public:
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Creates a block descriptor for the specified memory range.
+    // The first 'groups' groups of the range are available.
     template <class MemoryPolicy>
-    void* AddBlock(void* address, unsigned __int64 bitmap, 
-                   unsigned int groups, void* parent) {
+    void* AddBlock(void* address, unsigned int groups, void* parent) {
         auto block = reinterpret_cast<BlockDescriptor*>(blockDescriptorPool_.GetObject());             
 
         // Initialize the block header.
         block->Next = block->Previous = nullptr;
-        block->GroupBitmap = block->FullBitmap = bitmap;
-        block->FreeGroups = groups;
+        block->GroupBitmap.SetFirst(groups);
+        block->DirtyBitmap.SetFirst(groups); // The range may have been used before.
+        block->FreeGroups = block->Groups = groups;
         block->RealAddress = address;
         block->StartAddress = address;
 #if defined(PLATFORM_WINDOWS)
@@ -503,7 +837,7 @@ public:
 
         // Will be automatically released by the destructor.
         SpinLock managerLock(&lock_);
-        fullBlockList_.AddFirst(block);
+        AddFullBlock(block);
         return block;
     }
 
@@ -519,13 +853,79 @@ public:
         DeallocateBlock<MemoryPolicy>(block);
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns to the OS the blocks that have no used group, ignoring the block cache. 
+    // Unused blocks are kept while their size fits in 'keepBytes', 
+    // which is decremented accordingly. The blocks at the end of the full list
+    // are released first; only if 'ADDRESS_ORDERED' is defined these are 
+    // the highest ones. A block becomes unused only under the lock
+    // (see 'TryAddFreeGroups'), so no thread is returning groups to it.
+    // Groups kept by the bins ('Retain') and the partial lists count as used.
+    // Returns the number of released bytes.
+    template <class MemoryPolicy>
+    size_t ReleaseUnusedBlocks(size_t& keepBytes) {
+        // Will be released when the method exists.
+        SpinLock managerLock(&lock_);
+        auto block = static_cast<BlockDescriptor*>(fullBlockList_.Last());
+        size_t released = 0;
+
+        while(block != nullptr) {
+            auto previous = static_cast<BlockDescriptor*>(block->Previous);
+
+#if defined(PLATFORM_WINDOWS)
+            // Blocks that are part of huge locations are released 
+            // together with the location.
+            bool canRelease = block->HugeParent == nullptr;
+#else
+            bool canRelease = true;
+#endif
+            if(canRelease && (Atomic::Load(&block->FreeGroups, std::memory_order_relaxed) == block->Groups)) {
+                if(keepBytes >= BlockSize) {
+                    keepBytes -= BlockSize;
+                }
+                else {
+                    fullBlockList_.Remove(block);
+                    DeallocateBlock<MemoryPolicy>(block);
+                    released += BlockSize;
+                }
+            }
+
+            block = previous;
+        }
+
+        return released;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Sets the number of blocks that are kept when they become unused.
+    // Blocks above the limit are released only when more groups are returned.
+    void SetCacheLimit(unsigned int limit) {
+        Atomic::Store(&cacheLimit_, limit, std::memory_order_relaxed);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Checks that the group lies inside the block it points to. Used to validate
+    // the addresses received from the application in debug builds; the memory 
+    // of the group must be readable, so it can't detect all invalid addresses.
+    static bool IsValidGroup(GroupType* group) {
+        auto block = static_cast<BlockDescriptor*>(group->ParentBlock);
+
+        if(block == nullptr) {
+            return false;
+        }
+
+        char* start = (char*)block->StartAddress;
+        return ((char*)group >= start) && 
+               ((char*)group < (start + ((size_t)block->Groups * GroupSize)));
+    }
+
     // For debugging only.
     unsigned int GetEmptyCount() { 
-        return emptyBlockList_.Count; 
+        return emptyBlockList_.Count(); 
     }
 
     unsigned int GetFullCount() { 
-        return fullBlockList_.Count; 
+        return fullBlockList_.Count(); 
     }
 };
 
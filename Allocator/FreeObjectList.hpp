@@ -46,15 +46,17 @@ template <class NodeType = ListTraits<>::NodeType,
           class NodePolicy = ListTraits<>::PolicyType>
 class FreeObjectList : public ObjectList<NodeType, NodePolicy> {
 private:
+    typedef ObjectList<NodeType, NodePolicy> ListType;
+
     unsigned int lock_;
     unsigned int maxObjects_;
 
 public:
     FreeObjectList() : 
-            ObjectList(), lock_(0), maxObjects_(0x7FFFFFFF) { }
+            ListType(), lock_(0), maxObjects_(0x7FFFFFFF) { }
 
     FreeObjectList(unsigned int maxObjects) : 
-            ObjectList(), lock_(0), maxObjects_(maxObjects) { }
+            ListType(), lock_(0), maxObjects_(maxObjects) { }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     // Tries to add the specified node to the list. If the maximum number 
@@ -62,8 +64,8 @@ public:
     // is returned, otherwise 'nullptr' is returned.
     // Note that this doesn't take the lock!
     NodeType* AddObjectUnlocked(NodeType* node)	{
-        if(Count < maxObjects_) {
-            AddFirst(node);
+        if(this->Count() < maxObjects_) {
+            this->AddFirst(node);
             return nullptr; 
         }
                 
@@ -85,7 +87,7 @@ public:
     void RemoveObject(NodeType* node) {
         // Acquire the lock. Will be automatically released by the destructor.
         SpinLock headerLock(&lock_);
-        Remove(node);
+        this->Remove(node);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -94,7 +96,7 @@ public:
     NodeType* RemoveFirst() {
         // Acquire the lock. Will be automatically released by the destructor.
         SpinLock headerLock(&lock_);
-        return ObjectList::RemoveFirst();
+        return ListType::RemoveFirst();
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -102,7 +104,7 @@ public:
     // Returns 'nullptr' if no object could be found.
     // Note that this doesn't take the lock!
     NodeType* RemoveFirstUnlocked() {
-        return ObjectList::RemoveFirst();
+        return ListType::RemoveFirst();
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -116,7 +118,7 @@ public:
     // Removes the specified object from the list.
     // Note that this doesn't take the lock!
     void RemoveObjectUnlocked(NodeType* node) {
-        Remove(node);
+        this->Remove(node);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -43,7 +43,9 @@
 #include "Atomic.hpp"
 #include "BitSpinLock.hpp"
 #include "ListHead.hpp"
+#include "BitmapKernels.hpp"
 #include <assert.h>
+#include <stdio.h>
 
 namespace Base {
 
@@ -56,6 +58,9 @@ namespace Base {
     typedef void* LocationPtr;
 #endif
 
+// The list end marker converted to the type of the location pointers.
+const LocationPtr LOCATION_LIST_END = (LocationPtr)Constants::LIST_END;
+
 
 // Contains information about a location that has been freed. 8 bytes in size.
 struct LocationInfo {
@@ -71,18 +76,19 @@ struct LocationInfo {
 #pragma pack(push)
 #pragma pack(1)
 struct StolenLocation {
-    unsigned short Free;
-
     // The position of the active range is stored in the first 31 bits 
     // of the spinlock. The highest bit (bit 31) stores the lock state.
+    // It's the first field so that the atomic operations are aligned.
     BitSpinLock<unsigned int, 31> Position;
+    unsigned short Free;
+    unsigned short Padding; // Keeps the ranges aligned to 4 bytes.
 };
 
 
 // Describes a range of stolen location that have the same size.
 struct StolenRange {
-    char Number;
-    char Freed;
+    unsigned char Number;
+    unsigned char Freed;
 
     // The alignment is stored in the upper 2 bits of 'Size' as a multiple of 4.
     unsigned short Size;
@@ -156,6 +162,7 @@ private:
     static const int BITMAP_START      = 2;  // After the 'Next' pointer field (2 bytes).
     static const int BITMAP_SIZE       = 6;  // 48 bits.
     static const int MERGE_THRESHOLD   = 16;
+    static const int MERGE_WORDS       = 32; // Enough for all locations (2048 > 43 * 48).
 #endif
 
 public:
@@ -170,10 +177,11 @@ public:
     unsigned int Locations;      // The maximum number of locations that can be allocated from this group.
     unsigned int LocationSize;   // The size of a location in this group.
     unsigned int SmallestStolen; // The number of the bin with the smallest location size that stole from this group.
+    unsigned int PartialBucket;  // The partial list of the block allocator in which the group is.
 
     // Padding to cache line.
     char Padding2[Constants::CACHE_LINE_SIZE - 
-                  (3 * sizeof(void*)) - (4 * sizeof(unsigned int))];
+                  (3 * sizeof(void*)) - (5 * sizeof(unsigned int))];
     // ------------------------------------ END OF CACHE LINE 2 ------------------------* 
 
     // The fields are split in two cache lines so that no cache coherency problems
@@ -184,6 +192,7 @@ public:
     LocationPtr CurrentLocation; // The last allocated location.
     LocationPtr PrivateStart;    // The index of the first location in the private free list.
     LocationPtr PrivateEnd;      // The index of the last location in the private free list.
+    LocationPtr ZeroedEnd;       // The locations starting with this one are known to be zero.
 
 #if defined(SORT)
     unsigned __int64 PrivateSetsBitmap; // Tracks which private location sets are used.
@@ -191,8 +200,8 @@ public:
     char PrivateSets[SET_SIZE];         // The array used to keep track of freed locations by the owner thread.
 
     // Padding to cache line.
-    char Padding2[Constants::CACHE_LINE_SIZE - 
-                  (3 * sizeof(LocationPtr)) - (1 * sizeof(unsigned __int64)) -
+    char Padding3[Constants::CACHE_LINE_SIZE - 
+                  (4 * sizeof(LocationPtr)) - (1 * sizeof(unsigned __int64)) -
                   (1 * sizeof(unsigned short)) - SET_SIZE];
 #else
     LocationPtr  LastLocation;         // The address of the last possible location.
@@ -200,7 +209,7 @@ public:
 
     // Padding to cache line.
     char Padding3[Constants::CACHE_LINE_SIZE -
-                  (4 * sizeof(LocationPtr)) - (1 * sizeof(unsigned int))];
+                  (5 * sizeof(LocationPtr)) - (1 * sizeof(unsigned int))];
 #endif
     // ------------------------------------ END OF CACHE LINE 3 ------------------------*
 
@@ -208,10 +217,7 @@ public:
     // (it's about 4 times faster than using a lock).
     ListHead<LocationPtr> PublicStart;
     void * NextPublic; // The next group that has public locations.
-
-#if defined(STEAL) // Lock STILL NEEDED for stolen locations.
-    int PublicLock; // A lock is needed for public stolen locations too.
-#endif
+    volatile unsigned int PublicQueued; // If the group is in the public list of the bin.
 
 private:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -288,7 +294,7 @@ private:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Determines whether the private and public lists should be merged.
     bool ShouldMerge() {
-        return PublicFree >= MERGE_THRESHOLD;
+        return LoadPublicStart().GetCount() >= MERGE_THRESHOLD;
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -307,17 +313,22 @@ private:
     // Returns the number of freed locations 
     // using the bitmap from the specified location.
     unsigned int FreedLocationNumber(FreedLocation* freedLoc) {
-    #ifdef PLATFORM_32
-        unsigned int val = *((unsigned int*)freedLoc->Bitmap);
-        unsigned int ct = Bitmap::NumberOfSetBits(val);
-
-        val = *((short unsigned int*)freedLoc->Bitmap + 2);
-        ct += Bitmap::NumberOfSetBits(val);
-        return ct;
-    #else
-        unsigned __int64 val = *((unsigned __int64*)freedLoc->Bitmap) & 0xFFFFFFFFFFFF0000;
-        return Bitmap::NumberOfSetBits64(val);
-    #endif
+        return Bitmap::NumberOfSetBits64(ReadSetBitmap(freedLoc));
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Reads the 48-bit bitmap of the set from the freed location at the given address.
+    // The bitmap is stored in the upper 48 bits of the first 8 bytes,
+    // after the 'Next' pointer, so it can be accessed using a single operation.
+    unsigned __int64 ReadSetBitmap(void* address) {
+        return *((unsigned __int64*)address) >> 16;
+    }
+
+    // Writes the 48-bit bitmap of the set, preserving the 'Next' pointer.
+    // All 8 bytes belong to the freed location, because a location is at least 8 bytes.
+    void WriteSetBitmap(void* address, unsigned __int64 bitmap) {
+        unsigned __int64 next = (unsigned short)((FreedLocation*)address)->Next;
+        *((unsigned __int64*)address) = (bitmap << 16) | next;
     }
 #endif
 
@@ -329,15 +340,21 @@ private:
 #if defined(SORT)
         // The location needs to be removed from the bitmap.
         RemoveFromBitmap(PrivateSets, &PrivateSetsBitmap, PrivateStart);
+
+        // The list is used before the bump region, so the locations 
+        // below its end can't be considered zero-filled anymore.
+        if(ZeroedEnd < CurrentLocation) {
+            ZeroedEnd = CurrentLocation;
+        }
 #endif
         // Remove the location from the list of free ones.
         PrivateStart = GetNextLocation(address);
         PrivateUsed++;
 
-        if(PrivateUsed == 0)	{
+        if(PrivateStart == LOCATION_LIST_END)	{
             // Set the last location in the list.
             // Used when merging with the public list.
-            PrivateEnd = Constants::LIST_END;
+            PrivateEnd = LOCATION_LIST_END;
         }
 
         return address;
@@ -348,14 +365,16 @@ private:
 #if defined(SORT)
     void RemoveFromBitmap(char* setArray, unsigned __int64* setBitmap, 
                           LocationPtr location) {
-        LocationPtr bitmapHolder = GetBitmapHolder(setArray, location);
-        void locationAddr = LocationToAddress(bitmapHolder);
-        FreedLocation* freedLoc = static_cast<FreedLocation*>(locationAddr);
+        unsigned int bitmapHolder = GetBitmapHolder(setArray, location);
 
         if(bitmapHolder == INVALID_INDEX) {
           return; // It's the first time the location is allocated.
         }
-        else if(bitmapHolder != location) {
+
+        void* locationAddr = LocationToAddress(bitmapHolder);
+        FreedLocation* freedLoc = static_cast<FreedLocation*>(locationAddr);
+
+        if(bitmapHolder != (unsigned int)location) {
             // Mark the location as reallocated.
             ResetBitmapLocationState(freedLoc, LocationInSet(location));
         }
@@ -368,10 +387,9 @@ private:
 
                 // We need to make sure the bitmap is not lost, so we copy it 
                 // to the last freed location that is part of this set.
-                void* locationAddr = LocationToAddress(bitmapHolder);
                 unsigned int offset = LOCATIONS_PER_SET * LocationSet(bitmapHolder);
                 unsigned int lastLocation = offset + BitmapLastFree(locationAddr, 
-                                                                    LOCATIONS_PER_SET - 1);
+                                                                    LOCATIONS_PER_SET);
 
                 CopyLocationBitmap(LocationToAddress(lastLocation), freedLoc);
                 SetBitmapHolder(setArray, lastLocation);
@@ -403,81 +421,52 @@ private:
 #if defined(SORT)
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Copies the bitmap from the freed source location to the destination one.
+    // The 'Next' pointer of the destination is preserved.
     void CopyLocationBitmap(void* dest, void* source) {
-        // Save the 'Next' pointer of the destination.
-        unsigned short dstNext = ((FreedLocation*)dest)->Next;
-
-    #ifdef PLATFORM_32
-        UnrolledCopy<int, 0, sizeof(FreedLocation) / sizeof(int)>::Execute(dest, source);
-    #else
-        UnrolledCopy<__int64, 0, sizeof(FreedLocation) / sizeof(__int64)>::Execute(dest, source);
-    #endif
-
-        // Restore the 'Next' pointer.
-        ((FreedLocation*)dest)->Next = dstNext;
+        WriteSetBitmap(dest, ReadSetBitmap(source));
     }
 
     // Merges the bitmap of the freed source location and  destination one, 
     // and stores it in destination.
     void MergeLocationBitmap(void* dest, void* source) {
-        // Save the 'Next' pointer of the destination.
-        unsigned short dstNext = ((FreedLocation*)dest)->Next;
-
-    #ifdef PLATFORM_32
-        UnrolledOr<int, 0, sizeof(FreedLocation) / sizeof(int)>::Execute(dest, source);
-    #else
-        UnrolledOr<__int64, 0, sizeof(FreedLocation) / sizeof(__int64)>::Execute(dest, source);
-    #endif
-        // Restore the 'Next' pointer.
-        ((FreedLocation*)dest)->Next = dstNext;
+        WriteSetBitmap(dest, ReadSetBitmap(dest) | ReadSetBitmap(source));
     }
 
     // Finds the nearest location to the given one, that has been freed 
     // and is part of the given set, or of a set that comes before this one.
+    // Only the set of the location and the nearest set before it 
+    // that has freed locations need to be checked.
     unsigned int FindNearestFreedLocation(char* setArray, unsigned __int64* setBitmap, 
                                           unsigned int location, unsigned int locationSet,
                                           unsigned int& usedSet, unsigned int& bitmapHolder) {
-        unsigned int startLocation = location;
-
-        do {
-            unsigned int result = setArray[locationSet];
-
-            if(result != 0) {
-                // We found a set that has freed locations.
-                // Compute the index of the location that holds the bitmap.
-                unsigned int offset = LOCATIONS_PER_SET*  locationSet;
-
-                // We need to subtract 1 because the location is stored as:
-                // Location + 1 (0 means the set has no freed locations).
-                result = offset + (result - 1); 
-
-                // Check if there is a freed location before this one in the set.
-                unsigned int firstFreed = BitmapLastFree(LocationToAddress(result), 
-                                                         LocationInSet(startLocation));
-                if(firstFreed != INVALID_INDEX) {
-                    // Return the found location.
-                    bitmapHolder = result;
-                    usedSet = locationSet;
-                    return firstFreed + offset;
-                }
+        unsigned int holder = GetBitmapHolder(setArray, location);
+
+        if(holder != INVALID_INDEX) {
+            // Check if there is a freed location before this one in the set.
+            unsigned int firstFreed = BitmapLastFree(LocationToAddress(holder), 
+                                                     LocationInSet(location));
+            if(firstFreed != INVALID_INDEX) {
+                bitmapHolder = holder;
+                usedSet = locationSet;
+                return (LOCATIONS_PER_SET * locationSet) + firstFreed;
             }
+        }
 
-            // Go back to the first set with freed locations. If no one is found, 
-            // FindLastUsedSet returns -1, // so it's guaranteed that we leave the loop.
-            locationSet--;
-
-            if(locationSet >= 0) {
-                startLocation = LOCATIONS_PER_SET - 1;
+        // All locations in the previous sets are before this one,
+        // so the last freed location of the nearest used set is the one.
+        unsigned int previousSet = Bitmap::SearchReverse(*setBitmap, locationSet);
 
-                if(setArray[locationSet] == 0) {
-                    locationSet = Bitmap::SearchReverse(*setBitmap, locationSet);
-                }
-            }
+        if(previousSet != INVALID_INDEX) {
+            holder = GetBitmapHolder(setArray, LOCATIONS_PER_SET * previousSet);
+            bitmapHolder = holder;
+            usedSet = previousSet;
+            return (LOCATIONS_PER_SET * previousSet) + 
+                   BitmapLastFree(LocationToAddress(holder), LOCATIONS_PER_SET);
         }
-        while(locationSet >= 0);
         
         // No freed location was found.
         usedSet = INVALID_INDEX;
+        bitmapHolder = INVALID_INDEX;
         return INVALID_INDEX;
     }
 
@@ -502,7 +491,7 @@ private:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Gets the location that holds the bitmap used to keep track
     // of used location in its set.
-    LocationPtr GetBitmapHolder(char* setArray, LocationPtr location) {
+    unsigned int GetBitmapHolder(char* setArray, unsigned int location) {
         unsigned int locationSet = LocationSet(location);
 
         // We need to subtract 1 because the location is represented 
@@ -520,49 +509,29 @@ private:
     // Gets the bitmap associated with the given location as a 64-bit number.
     // Use for debugging only.
     unsigned __int64 GetBitmap(void* address)	{
-        FreedLocation* freedLoc = static_cast<FreedLocation*>(address);
-
-        unsigned __int64 low = *((unsigned int*)freedLoc->Bitmap);
-        unsigned __int64 high = freedLoc->Bitmap[4];
-        return (high << 32) | low;
+        return ReadSetBitmap(address);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Gets the state (freed or used) of the given location from the associated bitmap.
     unsigned int GetBitmapLocationState(void* address, unsigned int location) {
-        FreedLocation* freedLoc = static_cast<FreedLocation*>(address);
-        unsigned __int64 bitmap = *((unsigned __int64*)freedLoc->Bitmap);
-        return (bitmap &  (1ULL << location)) != 0;
+        return (ReadSetBitmap(address) & (1ULL << location)) != 0;
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Marks the location as freed in the bitmap associated 
     // with the location at the given address.
     void SetBitmapLocationState(void* address, unsigned int location) {
-        // We need to make sure we don't write after the 6 bytes, 
+        // We need to make sure we don't write after the 8 bytes of the location, 
         // because it could be the start of another location and this 
-        // would overwrite it's data. We can't take the affected data 
-        // and rewrite it along with the bitmap, because until we write it,
-        // the data could have been changed by other threads!
-        FreedLocation* freedLoc = static_cast<FreedLocation*>(address);
-        unsigned __int64 bitmap = *((unsigned __int64*)freedLoc->Bitmap);
-        bitmap |= 1ULL << location; // Set the bit.
-        
-        // Write the bitmap back to memory (low and high parts).
-        *((unsigned int*)freedLoc->Bitmap) = (unsigned int)bitmap;
-        *((unsigned short*)freedLoc->Bitmap + 2) = (unsigned short)(bitmap >> 32);
+        // would overwrite it's data. 
+        WriteSetBitmap(address, ReadSetBitmap(address) | (1ULL << location));
     }
 
     // Marks the location as used in the bitmap associated
     // with the location at the given address.
     void ResetBitmapLocationState(void* address, unsigned int location) {
-        FreedLocation* freedLoc = static_cast<FreedLocation*>(address);
-        unsigned __int64 bitmap = *((unsigned __int64*)freedLoc->Bitmap);
-        bitmap &= ~(1ULL << location); // Reset the bit.
-
-        // Write the bitmap back to memory (low and high parts).
-        *((unsigned int*)freedLoc->Bitmap) = (unsigned int)bitmap;
-        *((unsigned short*)freedLoc->Bitmap + 2) = (unsigned short)(bitmap >> 32);
+        WriteSetBitmap(address, ReadSetBitmap(address) & ~(1ULL << location));
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -570,11 +539,7 @@ private:
     // the given 'startLocation'. If no such location could be found, 
     // INVALID_INDEX is returned.
     unsigned int BitmapLastFree(void* address, unsigned int startLocation) {
-        FreedLocation* freedLoc = static_cast<FreedLocation*>(address);
-
-        // Mask the first two bytes (not port of the bitmap).
-        unsigned __int64 bitmap = *((unsigned __int64*)freedLoc->Bitmap) & ~0xFFFF;
-        return Bitmap::SearchReverse(bitmap, startLocation);
+        return Bitmap::SearchReverse(ReadSetBitmap(address), startLocation);
     }
  
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -612,66 +577,171 @@ private:
         unsigned int previous = FindNearestFreedLocation(PrivateSets, &PrivateSetsBitmap, 
                                                          locInfo.Location, locationSet, 
                                                          previousSet, bitmapHolder);
+        // Mark the location as freed in its set.
+        AddFreedLocation(PrivateSets, &PrivateSetsBitmap, locInfo);
 
-        // We found a freed location that is before this one!
-        if(locationSet == previousSet) {
-            // The previous location is in the same set as this one.
-            SetBitmapLocationState(LocationToAddress(bitmapHolder), 
-                                   LocationInSet(locInfo.Location));
+        if(previous == INVALID_INDEX) {
+            // No freed location is before this one.
+            SetNextLocation(locInfo.Address, PrivateStart);
+            PrivateStart = locInfo.Location;
         }
         else {
-            AddFreedLocation(PrivateSets, &PrivateSetsBitmap, locInfo);
+            // Link this location to the one determined to be previous.
+            void* parentAddress = LocationToAddress(previous);
+            SetNextLocation(locInfo.Address, GetNextLocation(parentAddress));
+            SetNextLocation(parentAddress, locInfo.Location);
+        }
+
+        if(GetNextLocation(locInfo.Address) == LOCATION_LIST_END) {
+            PrivateEnd = locInfo.Location;
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Adds the 48-bit bitmap of a set to the bitmap of the entire group,
+    // starting with the specified location.
+    void InsertSetBitmap(unsigned __int64* bitmap, unsigned int first, 
+                         unsigned __int64 setBitmap) {
+        unsigned int word = first / 64;
+        unsigned int shift = first % 64;
+        bitmap[word] |= setBitmap << shift;
+
+        if(shift > (64 - LOCATIONS_PER_SET)) {
+            // The set continues in the next word.
+            bitmap[word + 1] |= setBitmap >> (64 - shift);
+        }
+    }
+
+    // Extracts the 48-bit bitmap of a set from the bitmap of the entire group.
+    unsigned __int64 ExtractSetBitmap(unsigned __int64* bitmap, unsigned int first) {
+        unsigned int word = first / 64;
+        unsigned int shift = first % 64;
+        unsigned __int64 setBitmap = bitmap[word] >> shift;
+
+        if(shift > (64 - LOCATIONS_PER_SET)) {
+            setBitmap |= bitmap[word + 1] << (64 - shift);
         }
 
-        // Link this location to the one determined to be previous.
-        void* parentAddress = LocationToAddress(previous);
-        SetNextLocation(locInfo.Address, GetNextLocation(parentAddress));
-        SetNextLocation(parentAddress, locInfo.Location);
+        return setBitmap & ((1ULL << LOCATIONS_PER_SET) - 1);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Adds all the locations found in the specified 
     // list to the private list (sorted).
-    void FreeLocationList(ListHead& location) {
-        // All locations that were public need now to be inserted in the private list
-        // (this preserves the property that the locations are always sorted).
-        LocationPtr current = (LocationPtr)location.First;
-        while(current != Constants::LIST_END) {
-            // Obtain the next location first because it's going 
-            // to be modified by 'FreeLocationUsingBitmap'.
-            LocationPtr next = GetNextLocation(LocationToAddress(current)); 
-            FreeLocationUsingBitmap(LocationInfo(current, LocationToAddress(current)));
-            current = next;
+    // Instead of searching the position of each location separately, 
+    // the public and private locations are merged as bitmaps covering 
+    // the entire group. Then the neighbors of each public location are found
+    // using the bitmap kernels (which skip over many empty sets at once), 
+    // and the bitmap of each touched set is written only once.
+    void FreeLocationList(ListHead<LocationPtr>& location) {
+        unsigned __int64 publicBitmap[MERGE_WORDS];
+        unsigned __int64 freeBitmap[MERGE_WORDS];
+        unsigned __int64 touchedSets = 0;
+        unsigned int words = (Locations + 63) / 64;
+
+        UnrolledSet<unsigned __int64, 0, 0, MERGE_WORDS>::Execute(publicBitmap);
+        UnrolledSet<unsigned __int64, 0, 0, MERGE_WORDS>::Execute(freeBitmap);
+
+        // Mark the public locations.
+        LocationPtr current = (LocationPtr)location.GetFirst();
+
+        while(current != LOCATION_LIST_END) {
+            Bitmap::SetBit(publicBitmap[current / 64], current % 64);
+            AddSetToBitmap(&touchedSets, LocationSet(current));
+            current = GetNextLocation(LocationToAddress(current));
+        }
+
+        // Mark the private locations, using the bitmap of each used set.
+        unsigned __int64 usedSets = PrivateSetsBitmap;
+
+        while(usedSets != 0) {
+            unsigned int set = Bitmap::SearchForward(usedSets);
+            unsigned int holder = GetBitmapHolder(PrivateSets, LOCATIONS_PER_SET * set);
+
+            InsertSetBitmap(freeBitmap, LOCATIONS_PER_SET * set, 
+                            ReadSetBitmap(LocationToAddress(holder)));
+            RemoveSetFromBitmap(&usedSets, set);
+        }
+
+        BitmapKernels::Merge(freeBitmap, publicBitmap, words);
+
+        // Link each public location between the nearest freed locations.
+        // If the previous location is public too, it's linked when it's reached.
+        unsigned int position = words * 64;
+
+        while((position = BitmapKernels::SearchReverse(publicBitmap, words, 
+                                                       position)) != INVALID_INDEX) {
+            unsigned int next = BitmapKernels::SearchForward(freeBitmap, words, position + 1);
+            unsigned int previous = BitmapKernels::SearchReverse(freeBitmap, words, position);
+
+            SetNextLocation(LocationToAddress(position), next == INVALID_INDEX ? 
+                            LOCATION_LIST_END : (LocationPtr)next);
+
+            if((previous != INVALID_INDEX) && 
+               !Bitmap::IsBitSet(publicBitmap[previous / 64], previous % 64)) {
+                SetNextLocation(LocationToAddress(previous), (LocationPtr)position);
+            }
+        }
+
+        PrivateStart = (LocationPtr)BitmapKernels::SearchForward(freeBitmap, words, 0);
+        PrivateEnd = (LocationPtr)BitmapKernels::SearchReverse(freeBitmap, words, words * 64);
+
+        // Update the bitmap of each set that received public locations.
+        while(touchedSets != 0) {
+            unsigned int set = Bitmap::SearchForward(touchedSets);
+            unsigned int first = LOCATIONS_PER_SET * set;
+            unsigned int holder = GetBitmapHolder(PrivateSets, first);
+            unsigned __int64 setBitmap = ExtractSetBitmap(freeBitmap, first);
+
+            if(holder == INVALID_INDEX) {
+                // The set had no freed locations, the first one holds the bitmap.
+                holder = first + Bitmap::SearchForward(setBitmap);
+                SetBitmapHolder(PrivateSets, holder);
+                AddSetToBitmap(&PrivateSetsBitmap, set);
+            }
+
+            WriteSetBitmap(LocationToAddress(holder), setBitmap);
+            RemoveSetFromBitmap(&touchedSets, set);
         }
     }
 #endif
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Reads the head of the public list, which is changed by foreign threads.
+    // The value is only a hint, the updates are made using compare-exchange.
+    ListHead<LocationPtr> LoadPublicStart() {
+        return ListHead<LocationPtr>(Atomic::Load((unsigned __int64*)&PublicStart, 
+                                                  std::memory_order_relaxed));
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Copies the public list to the private one.
     void CopyFreeLists() {
         // Use atomic instructions to get the correct PublicStart 
         // and set it to Constants::LIST_END.
         ListHead<LocationPtr> location;
-        ListHead<LocationPtr> test = PublicStart;
+        ListHead<LocationPtr> test = LoadPublicStart();
 
         do {
             location = test;
             auto listEnd = &ListHead<LocationPtr>::ListEnd;
+            // Acquire the locations pushed by foreign threads.
             unsigned __int64 temp = 
-                    Atomic::CompareExchange64((unsigned __int64*)&PublicStart, 
-                                              *((unsigned __int64*)listEnd),
-                                              *((unsigned __int64*)&location));
+                    Atomic::CompareExchange((unsigned __int64*)&PublicStart, 
+                                            *((unsigned __int64*)listEnd),
+                                            *((unsigned __int64*)&location),
+                                            std::memory_order_acquire);
             test = *reinterpret_cast<ListHead<LocationPtr>*>(&temp);
         } while (test != location);
 
         // 'location' now contains the correct public list start.
         // Add the number of elements from the public list to the private counter.
-        PrivateStart = (LocationPtr)location.GetFirst();
-        PrivateUsed -= location.GetCount();
-
 #if defined(SORT)
         FreeLocationList(location);
+#else
+        PrivateStart = (LocationPtr)location.GetFirst();
 #endif
+        PrivateUsed -= location.GetCount();
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -682,32 +752,35 @@ private:
         // Use atomic instructions to get the correct PublicStart 
         // and set it to Constants::LIST_END.
         ListHead<LocationPtr> location;
-        ListHead<LocationPtr> test = PublicStart;
+        ListHead<LocationPtr> test = LoadPublicStart();
 
         do {
             location = test;
             auto listEnd = &ListHead<LocationPtr>::ListEnd;
+            // Acquire the locations pushed by foreign threads.
             unsigned __int64 temp = 
-                    Atomic::CompareExchange64((unsigned __int64*)&PublicStart, 
-                                              *((unsigned __int64*)listEnd),
-                                              *((unsigned __int64*)&location));
+                    Atomic::CompareExchange((unsigned __int64*)&PublicStart, 
+                                            *((unsigned __int64*)listEnd),
+                                            *((unsigned __int64*)&location),
+                                            std::memory_order_acquire);
             test = *reinterpret_cast<ListHead<LocationPtr>*>(&temp);
         } while (test != location);
 
-        // Link the public list to the end of the private one.
-        SetNextLocation(LocationToAddress(PrivateEnd), location.GetFirst());
-        PrivateUsed -= location.GetCount();
-
 #if defined(SORT)
+        // The public locations are linked at their place in the private list.
         FreeLocationList(location);
+#else
+        // Link the public list to the end of the private one.
+        SetNextLocation(LocationToAddress(PrivateEnd), location.GetFirst());
 #endif
+        PrivateUsed -= location.GetCount();
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Computes the required alignment for the specified size.
     // 'size' multiple of 16 => 16 bytes alignment, else 8 byte alignment.
     unsigned int GetLocationAlignment(unsigned int size) {
-        return 8 + (8 & (((size & 0xF) - 1) >> 31));
+        return (size & 0xF) == 0 ? 16 : 8;
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -754,11 +827,10 @@ private:
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Creates and initializes a stolen location at the specified address.
-    // It also allocates a location having the specified 'size'.
-    void* InitializeStolen(void* location, unsigned int size) {
+    // Initializes the specified stolen location, without changing the state
+    // of it's lock. It also allocates a location having the specified 'size'.
+    void* InitializeStolen(StolenLocation* stolen, unsigned int size) {
         // Create the first StolenRange structure.
-        auto stolen = reinterpret_cast<StolenLocation*>(location);
         auto rangeAddr = (char*)stolen + sizeof(StolenLocation);
         auto range = reinterpret_cast<StolenRange*>(rangeAddr);
 
@@ -787,88 +859,116 @@ private:
         return reinterpret_cast<StolenRange*>((char*)range + GetRangeSize(range));
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Determines if all the locations stolen from the specified location 
+    // were returned. The lock of the location should be held.
+    bool IsStolenEmpty(StolenLocation* stolen) {
+        StolenRange* current = GetFirstRange(stolen);
+
+        do {
+            if(!current->IsEmpty()) {
+                return false;
+            }
+
+            current = GetNextRange(current);
+        } while(current != nullptr);
+
+        return true;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the address of the location that contains the specified address.
+    void* GetLocationStart(void* address) {
+        size_t offset = (char*)address - ((char*)this + HEADER_SIZE);
+        return (char*)address - (offset % LocationSize);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Determines if the specified address was stolen by a smaller bin
+    // (it doesn't point to the start of a location).
+    bool IsStolenAddress(void* address) {
+        size_t offset = (char*)address - ((char*)this + HEADER_SIZE);
+        return (offset % LocationSize) != 0;
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Returns a location that has been stoled to the source location.
     // If the source locations becomes empty, the method return 
-    // it's address, else nullptr.
+    // it's address, else nullptr. The active stolen location is never returned,
+    // the owner may be waiting for it's lock; it's reused when it becomes full.
     void* ReturnStolen(void* address) {
+        void* location = GetLocationStart(address);
+
         // 'LocationSize' = 12 is considered a special case.
-        if(LocationSize != 12) {
-            // Compute the starting address of the stolen location
-            // from which this one was taken (it strips off the first bits 
-            // of the address, corresponding to the offset in the location).
-            auto startAddr = (uintptr_t)address - Constants::SMALL_GROUP_HEADER_SIZE - 
-                             (uintptr_t)this;
-            void* stolenAddress = (void*)((startAddr & ~((uintptr_t)LocationSize - 1)) + 
-                                         (uintptr_t)this + Constants::SMALL_GROUP_HEADER_SIZE);
-
-            // Synchronize access on this location.
-            auto stolen = reinterpret_cast<StolenLocation*>(stolenAddress);
-            BSLHolder<unsigned int, 31> lock(&stolen->Position);
+        if(LocationSize == 12) {
+            return location; // The whole location was given, nothing to do here.
+        }
 
-            StolenRange* previous = nullptr;
-            StolenRange* current = GetFirstRange(stolen);
-            StolenRange* firstEmpty; // Keeps track of the last start of a series of empty ranges.
-            unsigned int seriesSize; // Used to return the space from ranges that weren't 
-                                     // last when they've been freed.
-
-            // Walk from first to last range, until the one 
-            // that holds the location is found.
-            do {
-                if((previous != nullptr) && previous->IsEmpty()) {
-                    seriesSize += GetRangeSize(previous);
-
-                    if(firstEmpty == nullptr) {
-                        firstEmpty = previous; // The beginning of a new series was found.
-                    }
-                }
-                else {
-                    // An used location has been found, the series must be reset.
-                    firstEmpty = nullptr;
-                    seriesSize = 0;
-                }
+        // Synchronize access on this location.
+        auto stolen = reinterpret_cast<StolenLocation*>(location);
+        BSLHolder<unsigned int, 31> lock(&stolen->Position);
+        StolenRange* current = GetFirstRange(stolen);
 
-                char* rangeStart = (char*)current;
-                char* rangeEnd = rangeStart + GetRangeSize(current);
-
-                if(((char*)address < rangeEnd) && ((char*)address > rangeStart)){
-                    // Found the required range!
-                    current->Freed++;
-
-                    if(current->IsEmpty() && current->IsLast()) {
-                        if(firstEmpty == nullptr) {
-                            // Make the previous range the active one.
-                            stolen->Position.SetLowPart((char*)previous - (char*)stolen);
-                            stolen->Free += GetRangeSize(current);
-                        }
-                        else {
-                            // A series of ranges before this (last) one are free. 
-                            // Move the position to the start of the series.
-                            stolen->Position.SetLowPart((char*)firstEmpty - (char*)stolen);
-                            stolen->Free += GetRangeSize(current) + seriesSize;
-                        }
-                    }
-
-                    if(stolen->Position.GetLowPart() == sizeof(StolenLocation)) {
-                        return current; // The location can be freed.
-                    }
-                    else return nullptr;
-                }
+        // Walk from first to last range, until the one 
+        // that holds the location is found.
+        do {
+            char* rangeStart = (char*)current;
+            char* rangeEnd = rangeStart + GetRangeSize(current);
 
-                previous = current;
-                current = GetNextRange(current);
-            } while (current != nullptr);
+            if(((char*)address < rangeEnd) && ((char*)address > rangeStart)) {
+                current->Freed++; // Found the required range!
+                break;
+            }
+
+            current = GetNextRange(current);
+        } while(current != nullptr);
+
+        // The owner replaces the active location only while holding it's lock.
+        // The space of the empty ranges is reused only after all are empty.
+        if((Atomic::Load(&Stolen, std::memory_order_relaxed) == location) ||
+           !IsStolenEmpty(stolen)) {
+            return nullptr;
         }
-        else { // LocationSize == 12
-            return address; // Nothing to do here, just return the received address.
+
+        return location; // The location can be freed.
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the size of a location that has been stolen from this group
+    // (the size of the range that contains it).
+    unsigned int GetStolenSize(void* address) {
+        void* location = GetLocationStart(address);
+
+        // 'LocationSize' = 12 is considered a special case.
+        if(LocationSize == 12) {
+            return LocationSize - (unsigned int)((char*)address - (char*)location);
         }
+
+        // The ranges may be modified by the owner of the stolen group.
+        auto stolen = reinterpret_cast<StolenLocation*>(location);
+        BSLHolder<unsigned int, 31> lock(&stolen->Position);
+        StolenRange* current = GetFirstRange(stolen);
+
+        do {
+            char* rangeStart = (char*)current;
+            char* rangeEnd = rangeStart + GetRangeSize(current);
+
+            if(((char*)address < rangeEnd) && ((char*)address > rangeStart)) {
+                return current->GetSize();
+            }
+
+            current = GetNextRange(current);
+        } while(current != nullptr);
+
+        return 0; // Should not be reached for a valid address.
     }
 
 public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Initializes a group that has all it's locations free.
+    // 'zeroed' indicates that the memory of the group was never used.
     void InitializeUnused(unsigned int locationSize, unsigned int locations, 
-                          unsigned int threadId) {
+                          unsigned int threadId, bool zeroed) {
         void* tempBlock = ParentBlock;
         Reset();
         ParentBlock = tempBlock;
@@ -876,25 +976,32 @@ public:
         ThreadId = threadId;
         LocationSize = locationSize;
         Locations = locations;
-        PrivateStart = Constants::LIST_END;
+        PrivateStart = LOCATION_LIST_END;
+        PrivateEnd = LOCATION_LIST_END; // Not 0 when sorting is enabled.
         PublicStart = ListHead<LocationPtr>::ListEnd;
         SmallestStolen = Constants::NOT_STOLEN;
 
-#if !defined(SORT)
+#if defined(SORT)
+        ZeroedEnd = zeroed ? 0 : Locations;
+#else
         CurrentLocation = (char*)this + HEADER_SIZE;
         LastLocation    = (char*)this + HEADER_SIZE + (LocationSize*  Locations);
+        ZeroedEnd = zeroed ? CurrentLocation : LastLocation;
 #endif
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Initializes a group that has some of it's locations used.
     void InitializeUsed(unsigned int threadId) {
-        // Assign the new owner.
-        ThreadId = threadId;
+        // Assign the new owner. Other threads may read it 
+        // while the group is adopted.
+        Atomic::Store(&ThreadId, threadId, std::memory_order_relaxed);
         SmallestStolen = Constants::NOT_STOLEN;
+        // Foreign threads can queue the group again.
+        Atomic::Store(&PublicQueued, Constants::PUBLIC_OPEN, std::memory_order_release);
 
         // Make the public list private.
-        if(PrivateStart == Constants::LIST_END) {
+        if(PrivateStart == LOCATION_LIST_END) {
             CopyFreeLists();
         }
         else MergeFreeLists();
@@ -915,18 +1022,29 @@ public:
         return PrivateUsed <= ((Locations* 3) / 4); // 75%
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Determines if a location having the specified 'size' fits in a location
+    // of this group, together with the stolen headers and the largest alignment.
+    bool CanStealSize(unsigned int size) {
+        if(LocationSize == 12) {
+            return size <= 8;
+        }
+
+        return LocationSize >= (sizeof(StolenLocation) + sizeof(StolenRange) + 12 + size);
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     bool ShouldReturn() {
         // The group can return to the global pool 
         // if it has more than 75% free locations.
         return (PrivateUsed <= (Locations / 4) && 
-               (PublicStart == ListHead<LocationPtr>::ListEnd));
+               (LoadPublicStart() == ListHead<LocationPtr>::ListEnd));
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     bool IsFull() {
         return (PrivateUsed == 0) && 
-               (PublicStart == ListHead<LocationPtr>::ListEnd);
+               (LoadPublicStart() == ListHead<LocationPtr>::ListEnd);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -934,9 +1052,49 @@ public:
         return (PrivateUsed - publicLocations == 0);
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the number of used locations. The locations freed by other threads
+    // are counted as used until they are merged, so the result is an upper bound.
+    unsigned int GetUsedLocations() {
+        return PrivateUsed;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the number of locations freed by other threads that were not 
+    // merged yet. Like the head of the public list, the value is only a hint.
+    unsigned int GetPublicLocations() {
+        return LoadPublicStart().GetCount();
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Determines if the specified location, just allocated from this group,
+    // is known to be filled with zero. Only locations from the never used 
+    // part of the bump region qualify ('ZeroedEnd' is moved past the bump region
+    // when the freed locations start to be reused). Stolen locations are never 
+    // aligned to the size of a location and are always considered used.
+    bool IsZeroedLocation(void* address) {
+        size_t offset = (char*)address - ((char*)this + HEADER_SIZE);
+
+        return ((offset % LocationSize) == 0) &&
+               (address >= LocationToAddress(ZeroedEnd));
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the number of bytes that can be used at the specified location.
+    // A location that was stolen by a smaller bin is as large as 
+    // the size of the range in which it was allocated.
+    unsigned int GetUsableSize(void* address) {
+#if defined(STEAL)
+        if(IsStolenAddress(address)) {
+            return GetStolenSize(address);
+        }
+#endif
+        return LocationSize;
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     bool HasPublic() {
-        return (PublicStart != ListHead<LocationPtr>::ListEnd);
+        return (LoadPublicStart() != ListHead<LocationPtr>::ListEnd);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -951,13 +1109,13 @@ public:
             MergeFreeLists();
         }
 
-        if(PrivateStart != Constants::LIST_END) {
+        if(PrivateStart != LOCATION_LIST_END) {
             // Use the private list until it's empty.
             return GetListLocation();
         }
         else if(CurrentLocation < Locations) {
-            // We still have free locations at the end of the group;
-            RemoveFromBitmap(PrivateSets, &PrivateSetsBitmap, CurrentLocation);
+            // We still have free locations at the end of the group
+            // (they are never part of the set bitmaps).
             PrivateUsed++;
             return LocationToAddress(CurrentLocation++);
         }
@@ -967,12 +1125,19 @@ public:
             void* address = CurrentLocation;
             CurrentLocation = (char*)CurrentLocation + LocationSize;
             PrivateUsed++;
+
+            if(CurrentLocation == LastLocation) {
+                // The list is used only after the bump region, and all
+                // its locations were used before, so none is zero-filled.
+                ZeroedEnd = LastLocation;
+            }
+
             return address;
         }
 
         // No location at the end of the group is available, 
         // get from the list of freed locations.
-        if(PrivateStart != Constants::LIST_END) {
+        if(PrivateStart != LOCATION_LIST_END) {
             return GetListLocation();
         }
 #endif
@@ -986,7 +1151,7 @@ public:
         // and private free lists and try again to get a private 
         // location.  If the allocation fails the second time,
         // the group has no longer free locations.
-        if(PublicStart == ListHead<LocationPtr>::ListEnd) {
+        if(LoadPublicStart() == ListHead<LocationPtr>::ListEnd) {
             return nullptr;
         }
 
@@ -1013,7 +1178,7 @@ public:
     void ReturnPrivateLocation(void* address) {
         assert(address != nullptr);
 #if defined(STEAL)
-        if(((size_t)address - Constants::SMALL_GROUP_HEADER_SIZE) % LocationSize != 0) {
+        if(IsStolenAddress(address)) {
             address = ReturnStolen(address);
 
             if(address == nullptr) {
@@ -1031,7 +1196,7 @@ public:
         SetNextLocation(address, PrivateStart);
         PrivateStart = location;
 
-        if(PrivateEnd == Constants::LIST_END) {
+        if(PrivateEnd == LOCATION_LIST_END) {
             // This is the first location to be added in the list.
             PrivateEnd = location;
         }
@@ -1042,19 +1207,19 @@ public:
         // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     unsigned int ReturnPublicLocation(void* address) {
 #if defined(STEAL)
-        SpinLock publicLock(&PublicLock);
-
         // See if the location was stolen by another bin.
-        if(((size_t)address - Constants::SMALL_GROUP_HEADER_SIZE) % LocationSize != 0) {
-            publicLock.Lock();
+        // The lock of the stolen location synchronizes with the owner.
+        if(IsStolenAddress(address)) {
             address = ReturnStolen(address);
-            if(address == nullptr) return address; // The location is not empty yet.
-            publicLock.Unlock(); // The lock is no longer needed.
+
+            if(address == nullptr) {
+                return 0; // The location is not completely free yet.
+            }
         }
 #endif
         // Use atomic instructions to insert the location into the public list.
         ListHead<LocationPtr> firstLocation;
-        ListHead<LocationPtr> test = PublicStart;
+        ListHead<LocationPtr> test = LoadPublicStart();
         ListHead<LocationPtr> replacement(0, AddressToLocation(address));
 
         do	{
@@ -1064,10 +1229,12 @@ public:
             replacement.SetCount(firstLocation.GetCount() + 1);
             SetNextLocation(address, firstLocation.GetFirst());
 
+            // Release the link stored in the location to the owner.
             unsigned __int64 temp = 
-                    Atomic::CompareExchange64((unsigned __int64*)&PublicStart, 
-                                              *((unsigned __int64*)&replacement),
-                                              *((unsigned __int64*)&firstLocation));
+                    Atomic::CompareExchange((unsigned __int64*)&PublicStart, 
+                                            *((unsigned __int64*)&replacement),
+                                            *((unsigned __int64*)&firstLocation),
+                                            std::memory_order_release);
             test = *reinterpret_cast<ListHead<LocationPtr>*>(&temp);
         } while (test != firstLocation);
 
@@ -1075,40 +1242,11 @@ public:
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Tries to steal a location having the specified 'size'. 
-    // 'size' = 12 is considered a special case. If a location
-    // couldn't be obtained from the active stolen one, the method 
-    // is called recursively if it's still allowed to steal from the group.
-    void* StealLocation(unsigned int size) {
-        if(Stolen == nullptr) {
-            // No stolen location is defined, try to get one.
-            Stolen = GetLocation();
-
-            if(Stolen == nullptr) {
-                return nullptr;
-            }
-
-            if(LocationSize != 12) {
-                // It is guaranteed that at least one time 
-                // can be allocated from this stolen location.
-                return InitializeStolen(Stolen, size);
-            }
-            else {
-                // LocationSize = 12 is a special case.
-                // We can fit only a 8 byte location, either at offset 0,
-                // or at offset 4 in order to be properly aligned.
-                void* stolenTmp = Stolen;
-                Stolen = nullptr;
-
-                if((unsigned int)stolenTmp % 8 == 0) {
-                    return stolenTmp;
-                }
-                else return (void*)((char*)stolenTmp + sizeof(StolenLocation));
-            }
-        }
-
+    // Allocates a location having the specified 'size' from the active stolen
+    // location. If the location is full it's no longer the active one
+    // and nullptr is returned.
+    void* AllocateFromStolen(StolenLocation* stolen, unsigned int size) {
         // Synchronize access to this location.
-        StolenLocation* stolen = reinterpret_cast<StolenLocation*>(Stolen);
         BSLHolder<unsigned int, 31> lock(&stolen->Position);
 
         if(stolen->Free >= size) {
@@ -1134,32 +1272,107 @@ public:
             // Check if enough space is available.
             unsigned int alignment = GetRangeAlignment(range, size);
 
-            if((stolen->Free - sizeof(StolenRange) - alignment) >= size) {
+            if(stolen->Free >= (size + sizeof(StolenRange) + alignment)) {
                 // Initialize this range and allocate from it.
                 prevRange->ResetLast();
                 CreateStolenRange(range, size, alignment);
 
                 // 'GetRangeSize' will return the size of an empty range.
-                // Needs to be incremented atomically.
                 stolen->Free -= size + GetRangeSize(range); 
                 stolen->Position.AddLowPart(rangeOffset);
                 return AllocateFromRange(range);
             }
         }
 
-        // This location is full. Steal and allocate from another one 
-        // (or return nullptr if none is found).
-        Stolen = nullptr;
+        if(IsStolenEmpty(stolen)) {
+            // All the stolen locations were returned in the meantime,
+            // start again with a single range.
+            return InitializeStolen(stolen, size);
+        }
+
+        // This location is full, other threads may free it from now on.
+        Atomic::Store(&Stolen, (void*)nullptr, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Tries to steal a location having the specified 'size'. 
+    // 'size' = 12 is considered a special case. If a location
+    // couldn't be obtained from the active stolen one, the method 
+    // is called recursively if it's still allowed to steal from the group.
+    // 'CanStealSize' should be checked before.
+    void* StealLocation(unsigned int size) {
+        void* location = Stolen; // Changed only by the owner.
+
+        if(location == nullptr) {
+            // No stolen location is defined, try to get one.
+            location = GetLocation();
 
+            if(location == nullptr) {
+                return nullptr;
+            }
+
+            if(LocationSize == 12) {
+                // LocationSize = 12 is a special case.
+                // We can fit only a 8 byte location, either at offset 0,
+                // or at offset 4 in order to be properly aligned.
+                if((uintptr_t)location % 8 == 0) {
+                    return location;
+                }
+                else return (void*)((char*)location + 4);
+            }
+
+            // It is guaranteed that at least one location can be allocated 
+            // from this stolen location. The memory may contain anything,
+            // the lock bit included.
+            auto stolen = reinterpret_cast<StolenLocation*>(location);
+            stolen->Position.Reset(0);
+            void* address = InitializeStolen(stolen, size);
+            Atomic::Store(&Stolen, location, std::memory_order_relaxed);
+            return address;
+        }
+
+        void* address = AllocateFromStolen(reinterpret_cast<StolenLocation*>(location), size);
+
+        if(address != nullptr) {
+            return address;
+        }
+
+        // Steal and allocate from another location 
+        // (or return nullptr if none is found).
         if(CanBeStolen()) {
             return StealLocation(size);
         }
         else return nullptr;
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Stops stealing from the active stolen location, so that it can be freed 
+    // by any thread when it becomes empty. Called by the owner of the group.
+    void ReleaseStolen() {
+        auto stolen = reinterpret_cast<StolenLocation*>(Stolen);
+
+        if(stolen == nullptr) {
+            return;
+        }
+
+        bool empty;
+        {
+            BSLHolder<unsigned int, 31> lock(&stolen->Position);
+            Atomic::Store(&Stolen, (void*)nullptr, std::memory_order_relaxed);
+            empty = IsStolenEmpty(stolen);
+        }
+
+        if(empty) {
+            // The lock must be released before, the location is linked
+            // in the list of free ones.
+            ReturnPrivateLocation(stolen);
+        }
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     void PrivatizeLocations() {
-        if(PrivateStart != Constants::LIST_END) {
+        if(PrivateStart != LOCATION_LIST_END) {
             MergeFreeLists();
         }
         else CopyFreeLists();
@@ -1173,14 +1386,12 @@ public:
         }
 
         StolenLocation* stolen = (StolenLocation*)Stolen;
-        StolenRange* range = (StolenRange*)((char*)stolen + 4);
+        StolenRange* range = GetFirstRange(stolen);
 
         while(true)	{
-            std::cout<<"Size: "<<range->GetSize()<<", Number: "
-                     <<(int)range->Number<<", Freed: "
-                     <<(int)range->Freed<<", Alignment: "
-                     <<range->GetAlignment();
-            std::cout<<"\n";
+            printf("Size: %u, Number: %d, Freed: %d, Alignment: %u\n",
+                   range->GetSize(), (int)range->Number,
+                   (int)range->Freed, range->GetAlignment());
 
             if(range->IsLast()) {
                 break;
@@ -1198,11 +1409,15 @@ public:
     void VerifyLocations() {
         LocationPtr loc = PrivateStart;
         
-        while(loc != Constants::LIST_END) {
+        while(loc != LOCATION_LIST_END) {
             LocationPtr next = GetNextLocation(LocationToAddress(loc));
             
-            if(next != Constants::LIST_END && next < loc) {
+            if(next != LOCATION_LIST_END && next < loc) {
+#if defined(PLATFORM_WINDOWS)
                 MessageBeep(-1);
+#else
+                assert(false);
+#endif
             }
             
             loc = next;
@@ -1213,10 +1428,10 @@ public:
     void DumpLocations() {
         /*LocationPtr loc = PrivateStart;
         
-        while(loc != Constants::LIST_END) {
+        while(loc != LOCATION_LIST_END) {
             std::cout<<loc<<" ";
             LocationPtr next = GetNextLocation(LocationToAddress(loc));
-            assert(next == Constants::LIST_END || next > loc);
+            assert(next == LOCATION_LIST_END || next > loc);
             loc = next;
         }
 
@@ -1224,7 +1439,7 @@ public:
         std::cout<<"\n\nPublic: ";
         loc = PublicStart;
         
-        while(loc != Constants::LIST_END) {
+        while(loc != LOCATION_LIST_END) {
             std::cout<<loc<<" ";
             loc = GetNextLocation(LocationToAddress(loc));
         }
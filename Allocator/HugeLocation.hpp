@@ -66,12 +66,13 @@ struct HugeLocation : public ListNode {
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     void AddRef()  { 
-        Atomic::Increment(&References); 
+        // Only the last release needs to be ordered.
+        Atomic::Increment(&References, std::memory_order_relaxed); 
     }
     
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     bool Release() { 
-        return Atomic::Decrement(&References) == 0; 
+        return Atomic::Decrement(&References, std::memory_order_acq_rel) == 0; 
     }
 };
 
@@ -92,7 +93,7 @@ struct HugeBin {
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     void IncreaseCacheSize() {
         // Increase the size of the cache if the demand is very high.
-        if(Atomic::Increment((unsigned int*)&CacheFullHits) % 4 == 0) {
+        if(Atomic::Increment((unsigned int*)&CacheFullHits, std::memory_order_relaxed) % 4 == 0) {
             //CacheSize = std::min(CacheSize + 1, ExtendedCacheSize);
             //Cache.SetMaxObjects(CacheSize);
         }
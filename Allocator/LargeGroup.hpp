@@ -44,7 +44,7 @@
     #if defined PLATFORM_WINDOWS
         #include <intrin.h>
     #else
-        static_assert(false, "Not yet implemented.");
+        #include <emmintrin.h>
     #endif
 #endif
 
@@ -57,9 +57,11 @@ struct BitmapHolder {
 #if defined(PLATFORM_32)
     unsigned int Bitmap : 20;
     unsigned int Count  : 12;
+    typedef unsigned int ValueType;
 #else
     unsigned int Bitmap;
     unsigned int Count;
+    typedef unsigned __int64 ValueType; // Both fields are updated by the same CAS.
 #endif
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -69,8 +71,12 @@ struct BitmapHolder {
             Bitmap(bitmap), Count(count) { }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    ValueType GetValue() const {
+        return *((ValueType*)this);
+    }
+
     bool operator ==(const BitmapHolder& other) {
-        return* ((unsigned int*)this) == *((unsigned int*)&other);
+        return GetValue() == other.GetValue();
     }
 
     bool operator !=(const BitmapHolder& other) {
@@ -78,14 +84,15 @@ struct BitmapHolder {
     }
 };
 
-const BitmapHolder BitmapHolder::None = BitmapHolder(-1, 0);
+// No public location (a zero-filled header is also empty).
+const BitmapHolder BitmapHolder::None = BitmapHolder(0, 0);
 
 
-// Creates a 32-bit mask that stores on each 2 bits the mapping 
-// between a location and the corresponding subgroup.
+// Creates a 64-bit mask that stores on each 2 bits the mapping 
+// between a location and the corresponding subgroup (up to 32 locations).
 // Replaces the expensive division that would have been necessary on each allocation.
 struct SubgroupMapping {
-    unsigned int Mask;
+    unsigned __int64 Mask;
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     SubgroupMapping() {}
@@ -94,13 +101,13 @@ struct SubgroupMapping {
         Mask = 0;
 
         for(unsigned int i = 0; i < totalLoc; i++) {
-            Mask |= (i / locPerSubgroup) << (i * 2);
+            Mask |= (unsigned __int64)(i / locPerSubgroup) << (i * 2);
         }
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     unsigned int GetSubgroup(unsigned int index) {
-        return (Mask >> (index * 2)) & 0x03;
+        return (unsigned int)(Mask >> (index * 2)) & 0x03;
     }
 };
 
@@ -117,30 +124,50 @@ public:
     void* ParentBin;           // The owner of the group.
     void* ParentBlock;         // The block to which the group belongs.
     void* NextPublic;          // The next group that has public locations. 
+    volatile unsigned int PublicQueued; // If the group is in the public list of the bin.
     unsigned int ThreadId;     // The ID of the thread who owns this group.
     unsigned int Locations;    // The maximum number of locations that can be allocated.
     unsigned int LocationSize; // The size of a location in this group.
     unsigned int PrivateFree;
     unsigned int PrivateBitmap;
+    unsigned int ZeroedBitmap; // The free locations that are known to be zero.
     SubgroupMapping Subgroups;
 
     // Padding to cache line.
     char Padding2[Constants::CACHE_LINE_SIZE - (3 *  sizeof(void*)) - 
-                  (5 * sizeof(unsigned int)) - sizeof(SubgroupMapping)];
+                  (7 * sizeof(unsigned int)) - sizeof(SubgroupMapping)];
     // ------------------------------------ END OF CACHE LINE 2 ------------------------* 
 
     BitmapHolder PublicBitmap;
+    unsigned int PartialBucket; // The partial list of the block allocator in which the group is.
 
 private:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Reads the public bitmap, which is changed by foreign threads.
+    // The value is only a hint, the updates are made using compare-exchange.
+    BitmapHolder LoadPublicBitmap() {
+        BitmapHolder value;
+        *((BitmapHolder::ValueType*)&value) = 
+                Atomic::Load((BitmapHolder::ValueType*)&PublicBitmap, std::memory_order_relaxed);
+        return value;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Each subgroup starts with its own header, followed by 'Locations / 4' locations.
+    // A location never starts at a subgroup boundary, where the header is.
     void* LocationToAddress(unsigned int location) {
-        return (void*)((uintptr_t)this + ((Subgroups.GetSubgroup(location) + 1) * HEADER_SIZE) + 
-                       (LocationSize*  location));
+        unsigned int subgroup = Subgroups.GetSubgroup(location);
+        unsigned int index = location - (subgroup * (Locations / 4));
+        return (void*)((uintptr_t)this + (subgroup * Constants::SMALL_GROUP_SIZE) + 
+                       HEADER_SIZE + (LocationSize * index));
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     unsigned int AddressToLocation(void* address) {
-        return (unsigned int)(((uintptr_t)address - (uintptr_t)this) / LocationSize);
+        unsigned int offset = (unsigned int)((uintptr_t)address - (uintptr_t)this);
+        unsigned int subgroup = offset / Constants::SMALL_GROUP_SIZE;
+        offset -= (subgroup * Constants::SMALL_GROUP_SIZE) + HEADER_SIZE;
+        return (subgroup * (Locations / 4)) + (offset / LocationSize);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -155,33 +182,38 @@ private:
         // Use atomic instructions to get the correct PublicStart 
         // and set it to Constants::LIST_END.
         BitmapHolder currentBitmap;
-        BitmapHolder test = PublicBitmap;
+        BitmapHolder test = LoadPublicBitmap();
 
         do	{
             currentBitmap = test;
-            unsigned int temp = 
-                    Atomic::CompareExchange((unsigned int*)&PublicBitmap, 
-                                            *((unsigned int*)&BitmapHolder::None),
-                                            *((unsigned int*)&currentBitmap));
+            BitmapHolder::ValueType temp = 
+                    Atomic::CompareExchange((BitmapHolder::ValueType*)&PublicBitmap, 
+                                            BitmapHolder::None.GetValue(),
+                                            currentBitmap.GetValue(),
+                                            std::memory_order_acquire);
             test = *reinterpret_cast<BitmapHolder*>(&temp);
         } while (test != currentBitmap);
 
         // 'location' now contains the correct public list start.
         // Add the number of elements in the public list to the private counter.
         PrivateBitmap |= currentBitmap.Bitmap;
+        ZeroedBitmap &= ~currentBitmap.Bitmap;
         PrivateFree += currentBitmap.Count;
     }
 
 public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Initializes a group that has all it's locations free.
+    // 'zeroed' indicates that the memory of the group was never used.
     void InitializeUnused(unsigned int locationSize, unsigned int locations, 
-                          unsigned int threadId) {
+                          unsigned int threadId, bool zeroed) {
         ThreadId = threadId;
         LocationSize = locationSize;
         Locations = locations;
         PrivateFree = locations;
         PrivateBitmap = -1;
+        ZeroedBitmap = zeroed ? -1 : 0;
+        PublicQueued = Constants::PUBLIC_OPEN; // The header is not reset.
 
         Subgroups = SubgroupMapping(Locations, Locations / 4);
 
@@ -197,7 +229,10 @@ public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Initializes a group that has some of it's locations used.
     void InitializeUsed(unsigned int threadId) {
-        ThreadId = threadId;
+        // Other threads may read the owner while the group is adopted.
+        Atomic::Store(&ThreadId, threadId, std::memory_order_relaxed);
+        // Foreign threads can queue the group again.
+        Atomic::Store(&PublicQueued, Constants::PUBLIC_OPEN, std::memory_order_release);
 
         // Make the public bitmap list private.
         if(PrivateFree != Locations) {
@@ -220,13 +255,13 @@ public:
         // The group can return to the global pool if it
         // has more than 75% free locations.
         return (PrivateFree >= ((Locations*  3) / 4) && 
-               (PublicBitmap == BitmapHolder::None));
+               (LoadPublicBitmap() == BitmapHolder::None));
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     bool IsFull() {
         return (PrivateFree == Locations) && 
-               (PublicBitmap == BitmapHolder::None);
+               (LoadPublicBitmap() == BitmapHolder::None);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -234,9 +269,23 @@ public:
         return (PrivateFree + publicLocations == Locations);
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the number of used locations. The locations freed by other threads
+    // are counted as used until they are merged, so the result is an upper bound.
+    unsigned int GetUsedLocations() {
+        return Locations - PrivateFree;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the number of locations freed by other threads that were not 
+    // merged yet. Like the public bitmap, the value is only a hint.
+    unsigned int GetPublicLocations() {
+        return LoadPublicBitmap().Count;
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     bool HasPublic() {
-        return (PublicBitmap != BitmapHolder::None);
+        return (LoadPublicBitmap() != BitmapHolder::None);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -253,7 +302,7 @@ public:
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     void* GetPublicLocation() {
-        if(PublicBitmap == BitmapHolder::None) {
+        if(LoadPublicBitmap() == BitmapHolder::None) {
             return nullptr;
         }
 
@@ -277,25 +326,42 @@ public:
     void ReturnPrivateLocation(void* address) {
         unsigned int location = AddressToLocation(address);
         Bitmap::SetBit(PrivateBitmap, location);
+        Bitmap::ResetBit(ZeroedBitmap, location);
         PrivateFree++;
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Determines if the specified location, just allocated from this group,
+    // is known to be filled with zero (it was never used since the group was created).
+    // The bit of a location is reset when the location is freed.
+    bool IsZeroedLocation(void* address) {
+        return Bitmap::IsBitSet(ZeroedBitmap, AddressToLocation(address));
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the number of bytes that can be used at the specified location.
+    // Large groups don't allow stealing, so all locations have the same size.
+    unsigned int GetUsableSize(void* address) {
+        return LocationSize;
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     unsigned int ReturnPublicLocation(void* address) {
         unsigned int location = AddressToLocation(address);
         BitmapHolder currentBitmap;
         BitmapHolder replacement;
-        BitmapHolder test = PublicBitmap;
+        BitmapHolder test = LoadPublicBitmap();
 
         do {
             currentBitmap = test;
             replacement.Count = currentBitmap.Count + 1; 
             replacement.Bitmap = currentBitmap.Bitmap | (1 << location);
 
-            unsigned int temp = 
-                    Atomic::CompareExchange((unsigned int*)&PublicBitmap, 
-                                            *((unsigned int*)&replacement),
-                                            *((unsigned int*)&currentBitmap));
+            BitmapHolder::ValueType temp = 
+                    Atomic::CompareExchange((BitmapHolder::ValueType*)&PublicBitmap, 
+                                            replacement.GetValue(),
+                                            currentBitmap.GetValue(),
+                                            std::memory_order_release);
             test = *reinterpret_cast<BitmapHolder*>(&temp);
         } while (test != currentBitmap);
 
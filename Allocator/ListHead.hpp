@@ -62,13 +62,14 @@ public:
         *((unsigned __int64*)this) = *((unsigned __int64*)&other);
     }
 
-    ListHead(int count, void* first) : Count(count), First((PtrType)first) { }
+    // 'T' is a pointer, or the index of a location when sorting is enabled.
+    ListHead(int count, T first) : Count(count), First((PtrType)first) { }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     int GetCount() { return Count; }
     void SetCount(int count) { Count = count; }
-    T GetFirst() { return reinterpret_cast<T>(First); }
-    void SetFirst(T* address) { First = (PtrType)address; }
+    T GetFirst() { return (T)(PtrType)First; }
+    void SetFirst(T first) { First = (PtrType)first; }
 
     bool operator== (const ListHead<T>& other)	{
         return *(reinterpret_cast<unsigned __int64*>((void*)&other)) ==
@@ -89,7 +90,7 @@ public:
 
 // Definition of the list end (or list empty) marker.
 template <class T>
-const ListHead<T> ListHead<T>::ListEnd = ListHead<T>(0, Constants::LIST_END);
+const ListHead<T> ListHead<T>::ListEnd = ListHead<T>(0, (T)(intptr_t)Constants::LIST_END);
 
 
 /**
@@ -107,8 +108,8 @@ private:
 #else
     unsigned int Count;
     unsigned int Time;
-    unsigned unsigned __int64 First;
-    typedef unsigned unsigned __int64 PtrType;
+    unsigned __int64 First;
+    typedef unsigned __int64 PtrType;
 #endif
 
 public:
@@ -38,34 +38,50 @@
 #include "ListHead.hpp"
 #include "Atomic.hpp"
 #include "Memory.hpp"
-#include "ObjectList.hpp"
-#include "FreeObjectList.hpp"
+#include "ThreadUtils.hpp"
 
 namespace Base {
 
-#if LOCK_FREE
+// The nodes need a 'Next' field of type 'T*'. The memory of a popped node
+// must remain readable while the stack is used (a concurrent 'Pop' may still
+// read its 'Next' field), so the nodes should not be returned to the OS.
 template <class T>
 class Stack {
 private:
+    // The head contains the first node and a tag that is incremented 
+    // by each operation (prevents the ABA problem). The tag has 16 bits
+    // on 64-bit systems, where only 48 bits are used by pointers.
     typedef ListHead<T*> HeadType;
-    HeadType head_;
+    volatile unsigned __int64 head_;
+    unsigned int count_;
     unsigned int time_;
     unsigned int maxObjects_;
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-    bool CompareExchange(HeadType& oldHead, HeadType& newHead) {
-#if defined(PLATFORM_32)
-        return Atomic::CompareExchange64((__int64*)&head_, (__int64)newHead, 
-                                         (__int64)oldHead) == (__int64)oldHead;
-#else
-        return Atomic::CompareExchange128((__int64*)&head_,* (((__int64*)&newHead) + 1),
-                                         * ((__int64*)&newHead), (__int64*)&oldHead) == 1;
-#endif
+    bool CompareExchange(HeadType oldHead, HeadType newHead, std::memory_order order) {
+        unsigned __int64 comparand = oldHead;
+        return Atomic::CompareExchange(&head_, (unsigned __int64)newHead, 
+                                       comparand, order) == comparand;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    void BackOff(int& waitCount) {
+        if((++waitCount % 50) == 0) {
+            // Give threads with a lower priority a chance to run.
+            ThreadUtils::SwitchToThread();
+        }
+        else {
+            for(int i = 0; i < waitCount; i++) {
+                ThreadUtils::Wait();
+            }
+        }
     }
 
 public:
-    Stack() : head_(0), maxObjects_(0xFFFFFFFF) { }
-    Stack(int maxObjects) : head_(0), maxObjects_(maxObjects) { }
+    Stack() : head_(HeadType(0, nullptr)), count_(0), time_(0), 
+              maxObjects_(0xFFFFFFFF) { }
+    Stack(unsigned int maxObjects) : head_(HeadType(0, nullptr)), count_(0), 
+                                     time_(0), maxObjects_(maxObjects) { }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     // Tries to insert an object in the stack.
@@ -73,41 +89,34 @@ public:
     // isn't inserted anymore and the method returns the address of the object.
     // If the object could be inserted, the method returns nullptr.
     T* Push(T* node) {
-        int waitCount = 0; // Used for back off.
-        time_ = ThreadUtils::GetSystemTime();
+        return PushList(node, node, 1);
+    }
 
-        while(true) {
-            HeadType oldHead = Memory::ReadValue(&head_);
+    // Inserts a list of 'count' objects linked through 'Next'
+    // using a single update of the head.
+    T* PushList(T* first, T* last, unsigned int count) {
+        int waitCount = 0; // Used for back off.
+        Atomic::Store(&time_, ThreadUtils::GetSystemTime(), std::memory_order_relaxed);
 
-            if(oldHead.GetCount() >= maxObjects_) {
-                return node; // The stack has reached the maximum number of objects.
-            }
+        if((maxObjects_ != 0xFFFFFFFF) &&
+           (Atomic::Load(&count_, std::memory_order_relaxed) + count > maxObjects_)) {
+            return first; // The stack has reached the maximum number of objects.
+        }
 
-            // Set the new head of the stack and update the oldest location.
-            HeadType newHead = HeadType(oldHead.GetCount() + 1, node);
+        while(true) {
+            HeadType oldHead = Atomic::Load(&head_, std::memory_order_relaxed);
+            HeadType newHead = HeadType(oldHead.GetCount() + 1, first);
 
-            // Is 'head' still the same?
-            if(oldHead == Memory::ReadValue(&head_)) {
-                // Link the node to the current head of the stack.
-                node->Next = oldHead.GetFirst();
+            // Link the nodes to the current head of the stack. 
+            // The release makes the contents of the nodes visible to 'Pop'.
+            last->Next = oldHead.GetFirst();
 
-                if(CompareExchange(oldHead, newHead)) {
-                    T* temp = newHead.GetFirst();
-                    temp->Next = temp->Next;
-                    return nullptr; // The head was successfully updated.
-                }
+            if(CompareExchange(oldHead, newHead, std::memory_order_release)) {
+                Atomic::Add(&count_, count, std::memory_order_relaxed);
+                return nullptr; // The head was successfully updated.
             }
 
-            if((++waitCount % 50) == 0) {
-                // Give threads with a lower priority a chance to run.
-                ThreadUtils::SwitchToThread();
-            }
-            else {
-                // Back off.
-                for(int i = 0; i < waitCount; i++) {
-                    ThreadUtils::Wait();
-                }
-            }
+            BackOff(waitCount);
         }
     }
 
@@ -115,113 +124,53 @@ public:
     // Tries to extract the top object of the stack.
     // If the stack is empty, the method returns nullptr.
     T* Pop() {
-        T* node;
         int waitCount = 0; // Used for back off.
-        time_ = ThreadUtils::GetSystemTime();
+        Atomic::Store(&time_, ThreadUtils::GetSystemTime(), std::memory_order_relaxed);
 
         while(true) {
-            HeadType oldHead = Memory::ReadValue(&head_);
-            node = oldHead.GetFirst();
+            HeadType oldHead = Atomic::Load(&head_, std::memory_order_acquire);
+            T* node = oldHead.GetFirst();
 
             if(node == nullptr) {
                 return nullptr; // The stack is empty;
             }
 
-            // Is 'head' still the same?
-            if(oldHead == Memory::ReadValue(&head_)) {
-                HeadType newHead = HeadType(oldHead.GetCount() - 1, node->Next);
+            // 'Next' may be stale if the node was popped in the meantime,
+            // but then the tag changed and the exchange fails.
+            HeadType newHead = HeadType(oldHead.GetCount() + 1, 
+                                        Atomic::Load(&node->Next, std::memory_order_relaxed));
 
-                if(CompareExchange(oldHead, newHead)) {
-                    return node; // The head was successfully updated.
-                }
+            if(CompareExchange(oldHead, newHead, std::memory_order_acquire)) {
+                Atomic::Decrement(&count_, std::memory_order_relaxed);
+                return node; // The head was successfully updated.
             }
 
-            if((++waitCount % 50) == 0) {
-                // Give threads with a lower priority a chance to run.
-                ThreadUtils::SwitchToThread();
-            }
-            else {
-                // Backoff.
-                for(int i = 0; i < waitCount; i++) {
-                    ThreadUtils::Wait();
-                }
-            }
+            BackOff(waitCount);
         }
     }
 
     T* Peek() {
-        return head_.GetFirst();
-    }
-
-    int Count() {
-        return Memory::ReadValue(&head_).GetCount();
-    }
-
-    int OldestTime() {
-        return time_;
-    }
-
-    int MaxObjects() {
-        return maxObjects_; 
-    }
-
-    void SetMaxObjects(int value) { 
-        maxObjects_ =  value; 
-    }
-};
-
-#else
-
-// Implementation that uses a lock.
-template <class T>
-class Stack {
-private:
-    FreeObjectList<> list_;
-    unsigned int time_;
-
-public:
-    Stack() : list_(FreeObjectList<>(0xFFFFFFF)), time_(0x7FFFFFFF) {}
-    Stack(unsigned int maxObj) : list_(FreeObjectList<>(maxObj)), time_(0x7FFFFFFF) {}
-
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-    // Tries to insert an object in the stack.
-    // If the maximum number of objects is reached, the object 
-    // isn't inserted anymore and the method returns the address of the object.
-    // If the object could be inserted, the method returns nullptr.
-    T Push(T node) {
-        time_ = ThreadUtils::GetSystemTime();
-        return reinterpret_cast<T>(list_.AddObject(node));
-    }
-
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Tries to extract the top object of the stack.
-    // If the stack is empty, the method returns nullptr.
-    T Pop() {
-        time_ = ThreadUtils::GetSystemTime();
-        return reinterpret_cast<T>(list_.RemoveFirst());
-    }
-
-    T Peek() {
-        return nullptr;
+        HeadType head = Atomic::Load(&head_, std::memory_order_acquire);
+        return head.GetFirst();
     }
 
+    // The number of objects is only approximate while the stack is modified.
     unsigned int Count() {
-        return list_.GetCount();
+        return Atomic::Load(&count_, std::memory_order_relaxed);
     }
 
     unsigned int OldestTime() {
-        return time_;
+        return Atomic::Load(&time_, std::memory_order_relaxed);
     }
 
     unsigned int MaxObjects() {
-        return list_.GetMaxObjects();
+        return maxObjects_; 
     }
 
     void SetMaxObjects(unsigned int value) { 
-        list_.SetMaxObjects(value);
+        maxObjects_ =  value; 
     }
 };
-#endif
 
 } // namespace Base {
 #endif
@@ -38,11 +38,15 @@
 #include "Statistics.hpp"
 #include "ThreadUtils.hpp"
 
+#include <cstring>
+#include <atomic>
+
 #ifdef PLATFORM_WINDOWS
     #include <Windows.h>
     #include <intrin.h>
 #else
-    static_assert(false, "Not yet implemented.");
+    #include <sys/mman.h>
+    #include <emmintrin.h>
 #endif
 
 namespace Base {
@@ -54,9 +58,63 @@ class Memory {
                                                    DWORD, DWORD, DWORD);
     static const char* NAME_VIRTUAL_ALLOC_EX_NUMA;
     static VIRTUAL_ALLOC_EX_NUMA VirtualAllocExNumaFct;
+#else
+    // The memory is aligned like the one returned by 'VirtualAlloc', so that 
+    // the object pools and the huge locations can find their start by masking. 
+    // The size of the mapping is stored in front of the returned address, 
+    // in a page that is part of the mapping.
+    static const size_t GRANULARITY = 64 * 1024;
+
+    struct RegionHeader {
+        void* Start;   // The address returned to the caller.
+        size_t Size;   // The number of usable bytes.
+        void* Mapping; // The start of the whole mapping (includes the header page).
+        size_t MappingSize;
+    };
+
+    static RegionHeader* GetRegionHeader(void* address) {
+        return reinterpret_cast<RegionHeader*>((uintptr_t)address - sizeof(RegionHeader));
+    }
+
+    static void* MapAligned(size_t size) {
+        size_t pageSize = GetPageSize();
+        size = (size + pageSize - 1) & ~(pageSize - 1);
+        size_t reserved = size + GRANULARITY + pageSize;
+        void* mapping = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, 
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if(mapping == MAP_FAILED) {
+            return nullptr;
+        }
+
+        // Keep a single page in front of the aligned address
+        // and return the unused memory at both ends to the OS.
+        uintptr_t start = ((uintptr_t)mapping + pageSize + GRANULARITY - 1) & 
+                          ~(uintptr_t)(GRANULARITY - 1);
+        uintptr_t first = start - pageSize;
+        uintptr_t end = start + size;
+
+        if(first > (uintptr_t)mapping) {
+            munmap(mapping, first - (uintptr_t)mapping);
+        }
+
+        if(end < ((uintptr_t)mapping + reserved)) {
+            munmap((void*)end, ((uintptr_t)mapping + reserved) - end);
+        }
+
+        RegionHeader* header = GetRegionHeader((void*)start);
+        header->Start = (void*)start;
+        header->Size = size;
+        header->Mapping = (void*)first;
+        header->MappingSize = end - first;
+        return (void*)start;
+    }
 #endif
 
 public:
+    // Ranges at least this large are zeroed using non-temporal stores.
+    static const size_t NON_TEMPORAL_ZERO_SIZE = 256 * 1024;
+
     // Allocates the specified amount of bytes from virtual memory.
     static void* Allocate(size_t size) {
         Statistics::BlockAllocated();
@@ -64,7 +122,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return VirtualAlloc(nullptr, size, MEM_COMMIT, PAGE_READWRITE);
 #else
-        static_assert(false, "Not yet implemented.");
+        return MapAligned(size);
 #endif
     }
 
@@ -84,7 +142,8 @@ public:
             return VirtualAlloc(nullptr, size, MEM_COMMIT, PAGE_READWRITE);
         }
 #else
-        static_assert(false, "Not yet implemented.");
+        // NUMA is not yet supported, the memory is allocated on any node.
+        return MapAligned(size);
 #endif
     }
 
@@ -96,7 +155,8 @@ public:
 #if defined(PLATFORM_WINDOWS)
         VirtualFree(address, 0, MEM_RELEASE);
 #else
-        static_assert(false, "Not yet implemented.");
+        RegionHeader* header = GetRegionHeader(address);
+        munmap(header->Mapping, header->MappingSize);
 #endif
     }
 
@@ -108,7 +168,26 @@ public:
 #if defined(PLATFORM_WINDOWS)
         VirtualFreeEx(GetCurrentProcess(), address, 0, MEM_RELEASE);
 #else
-        static_assert(false, "Not yet implemented.");
+        RegionHeader* header = GetRegionHeader(address);
+        munmap(header->Mapping, header->MappingSize);
+#endif
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the number of bytes in the region of virtual memory 
+    // that starts at the specified address.
+    static size_t GetRegionSize(void* address) {
+#if defined(PLATFORM_WINDOWS)
+        MEMORY_BASIC_INFORMATION info;
+
+        if(VirtualQuery(address, &info, sizeof(info)) == 0) {
+            return 0;
+        }
+
+        return info.RegionSize;
+#else
+        // Only the start of a region can be queried.
+        return GetRegionHeader(address)->Size;
 #endif
     }
 
@@ -119,7 +198,7 @@ public:
         GetSystemInfo(&si);
         return si.dwPageSize;
 #else
-        static_assert(false, "Not yet implemented.");
+        return (unsigned int)sysconf(_SC_PAGE_SIZE);
 #endif
     }
 
@@ -141,7 +220,7 @@ public:
 
         return false;
 #else
-        static_assert(false, "Not yet implemented.");
+        return false; // Not yet implemented.
 #endif
     }
 
@@ -154,7 +233,7 @@ public:
         GetVersionEx((LPOSVERSIONINFO)&info);
         return info.dwMajorVersion >= 6; // Vista+
 #else
-        static_assert(false, "Not yet implemented.");
+        return false; // Not yet implemented.
 #endif
     }
 
@@ -167,8 +246,6 @@ public:
                                                     NAME_VIRTUAL_ALLOC_EX_NUMA);
         }
         else VirtualAllocExNumaFct = nullptr;
-#else
-        static_assert(false, "Not yet implemented.");
 #endif
     }
 
@@ -181,33 +258,68 @@ public:
         MemoryBarrier();
     #endif
 #else
-        static_assert(false, "Not yet implemented.");
+        std::atomic_thread_fence(std::memory_order_seq_cst);
 #endif
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Reads a value published by another thread (acquire semantics).
+    // Works with any type, including the 128 bit list heads; scalar values
+    // should use 'Atomic::Load' instead. A full barrier is not needed for 
+    // publication; use 'FullBarrier' explicitly where a store must be 
+    // ordered before a following load.
     template <class T>
     static T ReadValue(volatile T* address) {
         T value = *address;
-        FullBarrier();
+        std::atomic_thread_fence(std::memory_order_acquire);
         return value;
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Publishes a value to other threads (release semantics).
     template <class T>
     static void WriteValue(volatile T* address, const T& value) {
-        FullBarrier();
+        std::atomic_thread_fence(std::memory_order_release);
         *address = value;
     }
 
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Sets the specified memory range to zero. Large ranges are written using 
+    // non-temporal stores, so that they don't evict the whole cache.
+    static void Zero(void* address, size_t size) {
+        if(size < NON_TEMPORAL_ZERO_SIZE) {
+            memset(address, 0, size);
+            return;
+        }
+
+        // Zero the bytes until the first 16 byte boundary.
+        char* position = (char*)address;
+        size_t unaligned = (16 - ((uintptr_t)position & 15)) & 15;
+        memset(position, 0, unaligned);
+        position += unaligned;
+        size -= unaligned;
+
+        // Zero 64 bytes (a cache line) at a time.
+        __m128i zero = _mm_setzero_si128();
+        char* end = position + (size & ~(size_t)63);
+
+        while(position < end) {
+            _mm_stream_si128((__m128i*)position, zero);
+            _mm_stream_si128((__m128i*)(position + 16), zero);
+            _mm_stream_si128((__m128i*)(position + 32), zero);
+            _mm_stream_si128((__m128i*)(position + 48), zero);
+            position += 64;
+        }
+
+        // The non-temporal stores are weakly ordered.
+        _mm_sfence();
+        memset(position, 0, size & 63);
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     static void Prefetch(void* address) {
 #if defined(PLATFORM_64)
-    #if defined(PLATFORM_WINDOWS)
         _mm_prefetch((char*)address, _MM_HINT_NTA);
-    #else
-        static_assert(false, "Not yet implemented.");
-    #endif
 #endif
     }
 };
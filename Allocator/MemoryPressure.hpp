@@ -0,0 +1,325 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Implements a module that determines how much memory the process can still use
+// and how much the system is stalled waiting for memory. On Windows the limit
+// is given by the job object (if any) and the physical memory. On Linux it's 
+// given by the cgroup v2 memory controller, and the stall by the PSI interface.
+// The allocator uses it to size it's caches (see 'MEMORY_PRESSURE').
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+#ifndef PC_BASE_ALLOCATOR_MEMORY_PRESSURE_HPP
+#define PC_BASE_ALLOCATOR_MEMORY_PRESSURE_HPP
+
+#include "AllocatorConstants.hpp"
+
+#if defined(PLATFORM_WINDOWS)
+    #include <Windows.h>
+    #include <Psapi.h>
+#else
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <string.h>
+    #include <unistd.h>
+#endif
+
+namespace Base {
+
+class MemoryPressure {
+public:
+    enum Level {
+        PRESSURE_NONE,     // The caches can grow.
+        PRESSURE_MODERATE, // The caches should be kept small.
+        PRESSURE_HIGH      // All unused memory should be returned to the OS.
+    };
+
+    struct Status {
+        unsigned __int64 Limit; // The maximum memory the process can use.
+        unsigned __int64 Used;  // The memory used now (counted against the limit).
+        unsigned int Stall;     // Percent of time stalled waiting for memory (Linux only).
+    };
+
+private:
+#if !defined(PLATFORM_WINDOWS)
+    // The status is queried while the allocator is initialized (with its lock held),
+    // so the files are read with 'open' and 'read' into buffers on the stack 
+    // and parsed here; 'fopen' and 'sscanf' may allocate memory.
+    static const int FILE_BUFFER_SIZE = 4096;
+    static const int PATH_BUFFER_SIZE = 512;
+
+    // Reads the specified file into 'buffer', as a null-terminated string.
+    // Returns false if the file doesn't exist or is empty.
+    static bool ReadFile(const char* path, char* buffer, int size) {
+        int file = open(path, O_RDONLY | O_CLOEXEC);
+
+        if(file < 0) {
+            return false;
+        }
+
+        int length = 0;
+
+        while(length < (size - 1)) {
+            ssize_t count = read(file, buffer + length, size - 1 - length);
+
+            if(count > 0) {
+                length += (int)count;
+            }
+            else if((count == 0) || (errno != EINTR)) {
+                break;
+            }
+        }
+
+        close(file);
+        buffer[length] = '\0';
+        return length > 0;
+    }
+
+    // Parses the decimal number found at the start of 'text', ignoring the spaces.
+    // Returns false if there is no number (the limit of a cgroup is "max" if it's not set).
+    static bool ParseNumber(const char* text, unsigned __int64& value) {
+        while(*text == ' ') {
+            text++;
+        }
+
+        if((*text < '0') || (*text > '9')) {
+            return false;
+        }
+
+        value = 0;
+
+        while((*text >= '0') && (*text <= '9')) {
+            value = (value * 10) + (*text - '0');
+            text++;
+        }
+
+        return true;
+    }
+
+    // Returns the text that follows 'name' in the first line that starts with it,
+    // or nullptr if there is no such line.
+    static const char* FindField(const char* buffer, const char* name) {
+        size_t length = strlen(name);
+        const char* line = buffer;
+
+        while(line != nullptr) {
+            if(strncmp(line, name, length) == 0) {
+                return line + length;
+            }
+
+            line = strchr(line, '\n');
+            line = line != nullptr ? line + 1 : nullptr;
+        }
+
+        return nullptr;
+    }
+
+    // Searches the specified file for the line that starts with 'name', 
+    // followed by a number ("MemAvailable: 1024 kB", "inactive_file 4096").
+    // Returns false if the file or the line don't exist.
+    static bool ReadField(const char* path, const char* name, unsigned __int64& value) {
+        char buffer[FILE_BUFFER_SIZE];
+
+        if(!ReadFile(path, buffer, sizeof(buffer))) {
+            return false;
+        }
+
+        const char* field = FindField(buffer, name);
+        return (field != nullptr) && ParseNumber(field, value);
+    }
+
+    // Reads the file that contains a single number.
+    static bool ReadNumber(const char* path, unsigned __int64& value) {
+        char buffer[64];
+        return ReadFile(path, buffer, sizeof(buffer)) && ParseNumber(buffer, value);
+    }
+
+    // Builds the path of the specified file of the cgroup (v2) of the process.
+    // The cgroup is found in the line "0::/path" of /proc/self/cgroup and it's
+    // relative to the mount point (it's "/" inside a container with its own namespace).
+    static bool GetCgroupFile(const char* name, char* path, size_t size) {
+        char buffer[FILE_BUFFER_SIZE];
+
+        if(!ReadFile("/proc/self/cgroup", buffer, sizeof(buffer))) {
+            return false;
+        }
+
+        const char* group = FindField(buffer, "0::");
+
+        if(group == nullptr) {
+            return false; // The process doesn't use cgroup v2.
+        }
+
+        const char* groupEnd = strchr(group, '\n');
+        size_t groupLength = groupEnd != nullptr ? groupEnd - group : strlen(group);
+        const char mount[] = "/sys/fs/cgroup";
+        size_t mountLength = sizeof(mount) - 1;
+        size_t nameLength = strlen(name);
+
+        if((groupLength == 1) && (group[0] == '/')) {
+            groupLength = 0; // The root cgroup.
+        }
+
+        if((mountLength + groupLength + nameLength + 2) > size) {
+            return false;
+        }
+
+        memcpy(path, mount, mountLength);
+        memcpy(path + mountLength, group, groupLength);
+        path[mountLength + groupLength] = '/';
+        memcpy(path + mountLength + groupLength + 1, name, nameLength + 1);
+        return true;
+    }
+#endif
+
+public:
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Obtains the current memory status. Returns false if it's not available.
+    static bool Query(Status& status) {
+#if defined(PLATFORM_WINDOWS)
+        MEMORYSTATUSEX memoryStatus;
+        memoryStatus.dwLength = sizeof(MEMORYSTATUSEX);
+
+        if(!GlobalMemoryStatusEx(&memoryStatus)) {
+            return false;
+        }
+
+        status.Limit = memoryStatus.ullTotalPhys;
+        status.Used = memoryStatus.ullTotalPhys - memoryStatus.ullAvailPhys;
+        status.Stall = 0;
+
+        // If the process is part of a job with a memory limit, 
+        // only it's own committed memory counts against the limit.
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION jobInfo;
+
+        if(QueryInformationJobObject(nullptr, JobObjectExtendedLimitInformation,
+                                     &jobInfo, sizeof(jobInfo), nullptr)) {
+            unsigned __int64 jobLimit = 0;
+
+            if(jobInfo.BasicLimitInformation.LimitFlags & JOB_OBJECT_LIMIT_PROCESS_MEMORY) {
+                jobLimit = jobInfo.ProcessMemoryLimit;
+            }
+            else if(jobInfo.BasicLimitInformation.LimitFlags & JOB_OBJECT_LIMIT_JOB_MEMORY) {
+                jobLimit = jobInfo.JobMemoryLimit;
+            }
+
+            PROCESS_MEMORY_COUNTERS counters;
+
+            if((jobLimit != 0) && (jobLimit < status.Limit) &&
+               GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+                status.Limit = jobLimit;
+                status.Used = counters.PagefileUsage;
+            }
+        }
+
+        return true;
+#else
+        char path[PATH_BUFFER_SIZE];
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long pageSize = sysconf(_SC_PAGE_SIZE);
+        
+        if((pages <= 0) || (pageSize <= 0)) {
+            return false;
+        }
+
+        status.Limit = (unsigned __int64)pages * pageSize;
+        status.Stall = 0;
+
+        // The free memory ('_SC_AVPHYS_PAGES') doesn't include the page cache,
+        // which the kernel can reclaim, so the available memory is used instead.
+        // It's reported in KB; kernels older than 3.14 don't report it.
+        unsigned __int64 value;
+
+        if(ReadField("/proc/meminfo", "MemAvailable:", value) && 
+           ((value * 1024) < status.Limit)) {
+            status.Used = status.Limit - (value * 1024);
+        }
+        else status.Used = status.Limit - ((unsigned __int64)sysconf(_SC_AVPHYS_PAGES) * pageSize);
+
+        // The limit of the cgroup is "max" if it's not set.
+        if(GetCgroupFile("memory.max", path, sizeof(path)) &&
+           ReadNumber(path, value) && (value < status.Limit)) {
+            status.Limit = value;
+
+            if(GetCgroupFile("memory.current", path, sizeof(path)) &&
+               ReadNumber(path, value)) {
+                status.Used = value;
+
+                // The usage of the cgroup includes the page cache too; 
+                // the inactive part is the first to be reclaimed.
+                unsigned __int64 inactive;
+
+                if(GetCgroupFile("memory.stat", path, sizeof(path)) &&
+                   ReadField(path, "inactive_file ", inactive) &&
+                   (inactive < status.Used)) {
+                    status.Used -= inactive;
+                }
+            }
+        }
+
+        // The first line has the form "some avg10=0.00 avg60=0.00 avg300=0.00 total=0".
+        // Only the integer part of the percent is used.
+        if(ReadField("/proc/pressure/memory", "some avg10=", value)) {
+            status.Stall = (unsigned int)value;
+        }
+
+        return true;
+#endif
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the number of bytes that can still be used before reaching the limit.
+    static unsigned __int64 GetHeadroom(const Status& status) {
+        return status.Used < status.Limit ? status.Limit - status.Used : 0;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    static Level GetLevel(const Status& status) {
+        if(status.Limit == 0) {
+            return PRESSURE_NONE;
+        }
+
+        unsigned int usage = (unsigned int)((status.Used * 100) / status.Limit);
+
+        if((usage >= Constants::PRESSURE_HIGH_USAGE) || 
+           (status.Stall >= Constants::PRESSURE_HIGH_STALL)) {
+            return PRESSURE_HIGH;
+        }
+        else if((usage >= Constants::PRESSURE_MODERATE_USAGE) || 
+                (status.Stall >= Constants::PRESSURE_MODERATE_STALL)) {
+            return PRESSURE_MODERATE;
+        }
+
+        return PRESSURE_NONE;
+    }
+};
+
+} // namespace Base
+#endif
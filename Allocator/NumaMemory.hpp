@@ -45,7 +45,7 @@ namespace Base {
 template <class SmallBAType, class LargeBAType>
 class NumaMemory {
 private:
-    typedef typename NumaMemory<SmallBAType, LargeBAType> PolicyType;
+    typedef NumaMemory<SmallBAType, LargeBAType> PolicyType;
     static const unsigned int MAX_CPU = 64;
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -97,9 +97,9 @@ private:
     #pragma pack(pop)
 
     // Selects the appropriate block allocator (small or large).
-    template <class BAType>
+    template <class BAType, class Dummy = void>
     struct BASelector {
-        typedef typename SmallBAType AllocType;
+        typedef SmallBAType AllocType;
         typedef typename SmallBAType::GroupT GroupType;
 
         static AllocType* GetAllocator(NumaNode* node) {
@@ -119,9 +119,9 @@ private:
         }
     };
 
-    template <>
-    struct BASelector<LargeBAType> {
-        typedef typename LargeBAType AllocType;
+    template <class Dummy>
+    struct BASelector<LargeBAType, Dummy> {
+        typedef LargeBAType AllocType;
         typedef typename LargeBAType::GroupT GroupType;
 
         static AllocType* GetAllocator(NumaNode* node) {
@@ -203,7 +203,7 @@ public:
             if(BASelector<T>::GetFreeBlock(victim)) {
                 // Found a node with at least one free block.
                 auto group = BASelector<T>::GetAllocator(victim)
-                                ->TryGetGroup<PolicyType>(currentThreadId);
+                                ->template TryGetGroup<PolicyType>(currentThreadId);
                 if(group != nullptr) {
                     return group;
                 }
@@ -217,9 +217,9 @@ public:
     template <class T>
     void ReturnGroup(void* group, unsigned int parentNode) {
         NumaNode* info = &nodes_[parentNode];
-        auto castedGroup = reinterpret_cast<BASelector<T>::GroupType*>(group);
+        auto castedGroup = reinterpret_cast<typename BASelector<T>::GroupType*>(group);
         BASelector<T>::GetAllocator(info)
-            ->ReturnFullGroup<PolicyType>(castedGroup, true);
+            ->template ReturnFullGroup<PolicyType>(castedGroup, true);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -36,6 +36,7 @@
 #define PC_BASE_ALLOCATOR_OBJECT_LIST_HPP
 
 #include "AllocatorConstants.hpp"
+#include "Atomic.hpp"
 
 namespace Base {
 
@@ -65,13 +66,15 @@ public:
 
 // Policy used to handle operations on the Next and Previous pointers of a ListNode
 // in the default case (used by small groups).
+// 'Next' is stored atomically, because other threads read the type
+// of the group from it when they free a location (see 'LargeNodePolicy').
 struct DefaultNodePolicy {
     static ListNode* GetNext(ListNode* node) {
         return node->Next;
     }
 
     static void SetNext(ListNode* node, ListNode* next) {
-        node->Next = next;
+        Atomic::Store(&node->Next, next, std::memory_order_relaxed);
     }
 
     static ListNode* GetPrevious(ListNode* node) {
@@ -86,6 +89,8 @@ struct DefaultNodePolicy {
 
 // Policy used with large groups. It packs two values (type and subgroup) into the
 // most significant 3 bits of the Next pointer. 64 bit version.
+// The type and subgroup are read by any thread that frees a location,
+// while the owner changes the pointer, so 'Next' is accessed atomically.
 struct LargeNodePolicy {
     static const unsigned int TypeIndex     = (sizeof(uintptr_t) * 8) - 1;
     static const uintptr_t TypeMask         = (intptr_t)1 << TypeIndex;
@@ -101,8 +106,7 @@ struct LargeNodePolicy {
     }
 
     static void SetNext(ListNode* node, ListNode* next) {
-        node->Next = reinterpret_cast<ListNode*>(((uintptr_t)node->Next&  DataMask) |
-                                                  (uintptr_t)next);
+        SetData(node, ((uintptr_t)node->Next & DataMask) | (uintptr_t)next);
     }
 
     static ListNode* GetPrevious(ListNode* node) {
@@ -114,24 +118,34 @@ struct LargeNodePolicy {
     }
 
     static unsigned int GetType(ListNode* node) {
-        return ((uintptr_t)node->Next&  TypeMask) >> TypeIndex;
+        return (GetData(node) & TypeMask) >> TypeIndex;
     }
 
     static void SetType(ListNode* node) {
-        node->Next = reinterpret_cast<ListNode*>((uintptr_t)node->Next | TypeMask);
+        SetData(node, (uintptr_t)node->Next | TypeMask);
     }
 
     static void ResetType(ListNode* node) {
-        node->Next = reinterpret_cast<ListNode*>((uintptr_t)node->Next&  ~TypeMask);
+        SetData(node, (uintptr_t)node->Next & ~TypeMask);
     }
 
     static unsigned int GetSubgroup(ListNode* node) {
-        return ((uintptr_t)node->Next&  SubgroupMask) >> (SubgroupIndex - 1);
+        return (GetData(node) & SubgroupMask) >> (SubgroupIndex - 1);
     }
 
     static void SetSubgroup(ListNode* node, unsigned int value) {
-        node->Next = reinterpret_cast<ListNode*>(((uintptr_t)node->Next&  ~SubgroupMask) |
-                                                   (uintptr_t)value << (SubgroupIndex - 1));
+        SetData(node, ((uintptr_t)node->Next & ~SubgroupMask) |
+                      (uintptr_t)value << (SubgroupIndex - 1));
+    }
+
+private:
+    static uintptr_t GetData(ListNode* node) {
+        return (uintptr_t)Atomic::Load(&node->Next, std::memory_order_relaxed);
+    }
+
+    static void SetData(ListNode* node, uintptr_t value) {
+        Atomic::Store(&node->Next, reinterpret_cast<ListNode*>(value), 
+                      std::memory_order_relaxed);
     }
 };
 
@@ -183,8 +197,8 @@ struct LargeNodePolicy32 {
 template <class NodeType = ListNode, class NodePolicy = DefaultNodePolicy>
 class ObjectList {
 public:
-    typedef typename NodePolicy Policy;
-    typedef typename NodeType Node;
+    typedef NodePolicy Policy;
+    typedef NodeType Node;
 
 protected:
     NodeType* first_;
@@ -36,38 +36,47 @@
 #define PC_BASE_ALLOCATOR_OBJECT_POOL_HPP
 
 #include "Memory.hpp"
+#include "Atomic.hpp"
 #include "SpinLock.hpp"
-#include "Bitmap.hpp"
+#include "LockFreeStack.hpp"
 #include "AllocatorConstants.hpp"
-#include "FreeObjectList.hpp"
+#include "ObjectList.hpp"
 
 namespace Base {
 
 // Provides a pool of objects allocated directly from the OS.
-// Objects are allocated in blocks with a maximum of 63 objects/block.
 // Used to allocate block and thread descriptors (multiple descriptors
 // will be allocated in the same page file => lesser chance of a page fault).
+// The free objects of all blocks are kept in a lock-free stack, the lock
+// is taken only when a new block is added to the list of blocks.
+// The blocks are returned to the OS only when the pool is destroyed,
+// because a concurrent 'Pop' may still read an object that was taken.
 class ObjectPool : public ObjectList<> {
 private:
     static const unsigned int BLOCK_HEADER_SIZE = Constants::CACHE_LINE_SIZE;
 
     // Nested types
-    // Describes a block containing at most 63 objects.
+    // Describes a block of objects.
+    #pragma pack(push)
     #pragma pack(1)
     struct BlockHeader : public ListNode {
-        unsigned __int64 Bitmap; // Keeps track of the free objects.
-        unsigned int FreeObjects;
+        volatile unsigned int FreeObjects; // Updated atomically, used for debugging.
 
         // Padding to cache line.
-        char Padding[BLOCK_HEADER_SIZE - sizeof(ListNode) - 
-                     sizeof(unsigned __int64) - sizeof(unsigned int)];
+        char Padding[BLOCK_HEADER_SIZE - sizeof(ListNode) - sizeof(unsigned int)];
+    };
+    #pragma pack(pop)
+
+    // An object while it is in the stack of free objects.
+    struct FreeObject {
+        FreeObject* Next;
     };
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    Stack<FreeObject> freeObjects_;
     unsigned int blockSize_; // Must be a number power of 2!
     unsigned int objectSize_;
-    unsigned int cacheSize_;
-    unsigned int lock_;
+    unsigned int lock_;      // Protects only the list of blocks.
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Returns the maximum number of objects that can be stored in a block. 
@@ -76,51 +85,41 @@ private:
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Initializes the specified block.
-    void InitializeBlock(BlockHeader* block) {
-        block->Bitmap = -1; // All divisions are available.
-        block->FreeObjects = MaxObjectNumber();
+    // Returns the block that contains the specified object.
+    // It's not needed to search for the corresponding block, 
+    // because it can be obtained from the address by mapping 
+    // some of the first bits (depending on blockSize_).
+    BlockHeader* GetBlock(void* address) {
+        return reinterpret_cast<BlockHeader*>((uintptr_t)address & 
+                                              ~((uintptr_t)blockSize_ - 1));
     }
 
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Allocates a new block and adds it to the list.
-    void AllocateBlock() {
-        // Allocate a new block of memory and add it to the list as the active one.
-        auto block = reinterpret_cast<BlockHeader*>(Memory::Allocate(blockSize_));
-        InitializeBlock(block);
-        AddNewBlock(block);
+    FreeObject* GetObjectAt(BlockHeader* block, unsigned int index) {
+        return reinterpret_cast<FreeObject*>((char*)block + BLOCK_HEADER_SIZE + 
+                                             (index * objectSize_));
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    void AddNewBlock(BlockHeader* block) {
-        AddFirst(block);
-    }
+    // Allocates a new block and returns its first object. The other 
+    // objects are linked and pushed on the stack of free objects at once.
+    FreeObject* AllocateBlock() {
+        auto block = reinterpret_cast<BlockHeader*>(Memory::Allocate(blockSize_));
+        unsigned int objects = MaxObjectNumber();
+        block->FreeObjects = objects - 1; // The first object is returned.
 
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Tries to make the specified block the active one.
-    // If the specified block has fever objects than the active one,
-    // or the active one has more than 25% free objects, the block 
-    // is put on the second position.
-    void MakeBlockActive(BlockHeader* block) {
-        if(First() == nullptr) {
-            AddFirst(block); // The First() block in the list.
-        }
-        else {
-            unsigned int firstFree = static_cast<BlockHeader*>(First())->FreeObjects;
-
-            if((firstFree <= (MaxObjectNumber() / 4)) && 
-               (block->FreeObjects > firstFree)) {
-                // Few unused objects are in the active block, 
-                // and this one has more unused objects, so make it active.
-                Remove(block);
-                AddFirst(block);
-            }
-            else {
-                // Add the block after the active one.
-                Remove(block);
-                AddAfter(First(), block);
+        if(objects > 1) {
+            for(unsigned int i = 1; i < objects - 1; i++) {
+                GetObjectAt(block, i)->Next = GetObjectAt(block, i + 1);
             }
+
+            freeObjects_.PushList(GetObjectAt(block, 1), 
+                                  GetObjectAt(block, objects - 1), objects - 1);
         }
+
+        // Acquire the lock. Will be automatically released by the destructor.
+        SpinLock lock(&lock_);
+        AddFirst(block);
+        return GetObjectAt(block, 0);
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -129,95 +128,46 @@ private:
         Memory::Deallocate(block);
     }
 
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Gets an unused object from the specified block.
-    void* GetObjectFromBlock(BlockHeader* block)	{
-        // Find the first available object.
-        unsigned int objectIndex = Bitmap::SearchForward(block->Bitmap);
-        
-        // Mark the object as used and return it's address;
-        block->Bitmap &= ~(1ULL << objectIndex);
-        block->FreeObjects--;
-        return (char*)block + BLOCK_HEADER_SIZE + (objectIndex * objectSize_);
-    }
-
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Returns an unused object to the specified block.
-    void ReturnObjectToBlock(BlockHeader* block, unsigned int objectOffset)	{
-        // Mark the object as unused.
-        unsigned int objectIndex = (objectOffset - BLOCK_HEADER_SIZE) / objectSize_;
-        block->Bitmap |= 1ULL << objectIndex;
-        block->FreeObjects++;
-    }
-
 public:
     ObjectPool() { }
 
-    ObjectPool(unsigned int blockSize, unsigned int divisionSize, 
-               unsigned int cacheSize) : 
+    ObjectPool(unsigned int blockSize, unsigned int divisionSize) : 
             ObjectList(), blockSize_(blockSize), 
-            objectSize_(divisionSize), lock_(0), cacheSize_(cacheSize) { }
+            objectSize_(divisionSize), lock_(0) { }
 
     ~ObjectPool() {
         // Acquire the lock. Will be automatically released by the destructor.
         SpinLock lock(&lock_);
 
         while(Count() > 0) {
-            RemoveFirst();
-            DeallocateBlock(static_cast<BlockHeader*>(First()));
+            auto block = static_cast<BlockHeader*>(RemoveFirst());
+            DeallocateBlock(block);
         }
     }	
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Gets an object from the pool.
     void* GetObject()	{
-        // Acquire the lock. Will be automatically released by the destructor.
-        SpinLock lock(&lock_);
+        FreeObject* object = freeObjects_.Pop();
         
-        if((Count() == 0) || (static_cast<BlockHeader*>(First())->FreeObjects == 0)) {
-            // No free block is available, a new one needs to be allocated.
-            AllocateBlock();
+        if(object == nullptr) {
+            // No free object is available, a new block needs to be allocated.
+            // Threads that race here allocate separate blocks, 
+            // the unused objects are found later by all threads.
+            return AllocateBlock();
         }
 
-        return GetObjectFromBlock(static_cast<BlockHeader*>(First()));
+        // The count is only informative, no ordering is needed.
+        Atomic::Decrement(&GetBlock(object)->FreeObjects, std::memory_order_relaxed);
+        return object;
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Returns the specified object to the pool.
     void ReturnObject(void* address)	{
-        // Acquire the lock. Will be automatically released by the destructor.
-        SpinLock lock(&lock_);
-        BlockHeader* block;
-        unsigned int objectOffset;
-
-        // It's not needed to search for the corresponding block, 
-        // because it can be obtained from the address by mapping 
-        // some of the first bits (depending on blockSize_).
-#ifdef PLATFORM_32
-        objectOffset = (unsigned int)address % blockSize_;
-        block = reinterpret_cast<BlockHeader*>((unsigned int)address - objectOffset);
-#else
-        objectOffset = (unsigned int)((unsigned __int64)address % blockSize_);
-        block = reinterpret_cast<BlockHeader*>((unsigned __int64)address - objectOffset);
-#endif
-        ReturnObjectToBlock(block, objectOffset);
-
-        if(block != First()) {
-            // Keep at least 'cacheSize_' blocks in the list.
-            if((block->FreeObjects == MaxObjectNumber()) && 
-               (Count() > cacheSize_) && 
-               (static_cast<BlockHeader*>(First())->FreeObjects > 0)) {
-                // This block can be returned to the OS.
-                Remove(block);
-                DeallocateBlock(block);
-            }
-            else {
-                // Bring the block to the front of the list. This preserves 
-                // the property that if the first block has no free objects, 
-                // all the other ones don't have free objects either.
-                MakeBlockActive(block);
-            }
-        }
+        auto object = static_cast<FreeObject*>(address);
+        Atomic::Increment(&GetBlock(object)->FreeObjects, std::memory_order_relaxed);
+        freeObjects_.Push(object);
     }
 };
 
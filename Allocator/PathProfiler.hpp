@@ -0,0 +1,337 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Implements a module that measures the latency of the allocation
+// and deallocation paths using the processor timestamp counter.
+// The data is collected per thread (no synchronization on the fast path)
+// and can be aggregated at any time using a snapshot.
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+#ifndef PC_BASE_ALLOCATOR_PATH_PROFILER_HPP
+#define PC_BASE_ALLOCATOR_PATH_PROFILER_HPP
+
+#include "AllocatorConstants.hpp"
+#include "Bitmap.hpp"
+#include "Memory.hpp"
+#include "SpinLock.hpp"
+#include "ThreadUtils.hpp"
+#include <stdio.h>
+#include <string.h>
+
+namespace Base {
+
+class PathProfiler {
+public:
+    // The steps tried by 'Allocate', in order.
+    enum AllocatePath {
+        ALLOCATE_ACTIVE,    // The active group.
+        ALLOCATE_SECOND,    // The second group made active.
+        ALLOCATE_PUBLIC,    // A group with public locations made active.
+        ALLOCATE_STEAL,     // A location stolen from another bin.
+        ALLOCATE_ADOPT,     // A group adopted from an idle thread.
+        ALLOCATE_NEW_GROUP, // A new group from the block allocator.
+        ALLOCATE_PATHS
+    };
+
+    // The ways a location can be freed by 'Deallocate'.
+    enum DeallocatePath {
+        DEALLOCATE_PRIVATE,      // Freed by the owner thread.
+        DEALLOCATE_GROUP_RETURN, // Freed by the owner thread, the group was returned.
+        DEALLOCATE_PUBLIC,       // Freed by a foreign thread.
+        DEALLOCATE_ORPHAN,       // Freed into a group that has no owner.
+        DEALLOCATE_PATHS
+    };
+
+    // Bucket 'i' counts the intervals in [2^i, 2^(i+1)) cycles.
+    static const unsigned int BUCKETS = 40;
+    static const unsigned int PROFILE_CHUNK_SIZE = 64 * 1024;
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    struct PathData {
+        unsigned __int64 Attempts; // How many times the step was tried.
+        unsigned __int64 Hits;     // How many times the step satisfied the request.
+        unsigned __int64 Cycles;   // The total time spent in the step.
+        unsigned __int64 StepBuckets[BUCKETS];  // Time spent in the step.
+        unsigned __int64 TotalBuckets[BUCKETS]; // Time of the whole call, for hits.
+    };
+
+    // The data collected by a single thread. Written only by the owner.
+    struct ThreadProfile {
+        ThreadProfile* Next;
+        unsigned int ThreadId;
+        unsigned int Active;
+
+        // Padding to cache line.
+        char Padding[Constants::CACHE_LINE_SIZE - sizeof(void*) - 
+                     (2 * sizeof(unsigned int))];
+
+        PathData Allocate[ALLOCATE_PATHS];
+        PathData Deallocate[DEALLOCATE_PATHS];
+    };
+
+    // The aggregated data of one or more threads.
+    struct Snapshot {
+        unsigned int Threads;
+        PathData Allocate[ALLOCATE_PATHS];
+        PathData Deallocate[DEALLOCATE_PATHS];
+    };
+
+private:
+    static unsigned int lock_;
+    static ThreadProfile* profiles_; // All profiles ever created.
+    static char* chunk_;             // The memory from which profiles are taken.
+    static size_t chunkUsed_;
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    static void AddToBucket(unsigned __int64* buckets, unsigned __int64 cycles) {
+        unsigned int bucket = cycles > 0 ? Bitmap::SearchReverse(cycles) : 0;
+        buckets[bucket < BUCKETS ? bucket : (BUCKETS - 1)]++;
+    }
+
+    static void AddPath(PathData& destination, const volatile PathData& source) {
+        destination.Attempts += source.Attempts;
+        destination.Hits += source.Hits;
+        destination.Cycles += source.Cycles;
+
+        for(unsigned int i = 0; i < BUCKETS; i++) {
+            destination.StepBuckets[i] += source.StepBuckets[i];
+            destination.TotalBuckets[i] += source.TotalBuckets[i];
+        }
+    }
+
+public:
+#if defined(PROFILE_PATHS)
+    static unsigned __int64 Start() {
+        return ThreadUtils::ReadTimestamp();
+    }
+
+    // Records a step that didn't satisfy the request.
+    // Returns the time at which the next step starts.
+    static unsigned __int64 Miss(ThreadProfile* profile, unsigned int path, 
+                                 unsigned __int64 stepStart) {
+        unsigned __int64 now = ThreadUtils::ReadTimestamp();
+
+        if(profile == nullptr) {
+            return now;
+        }
+
+        PathData& data = profile->Allocate[path];
+        data.Attempts++;
+        data.Cycles += now - stepStart;
+        AddToBucket(data.StepBuckets, now - stepStart);
+        return now;
+    }
+
+    // Records the step that satisfied the request.
+    static void Hit(ThreadProfile* profile, unsigned int path, 
+                    unsigned __int64 callStart, unsigned __int64 stepStart) {
+        if(profile == nullptr) {
+            return;
+        }
+
+        unsigned __int64 now = ThreadUtils::ReadTimestamp();
+        PathData& data = profile->Allocate[path];
+
+        data.Attempts++;
+        data.Hits++;
+        data.Cycles += now - stepStart;
+        AddToBucket(data.StepBuckets, now - stepStart);
+        AddToBucket(data.TotalBuckets, now - callStart);
+    }
+
+    // Records the path taken by a deallocation. The profile is missing
+    // if the thread never allocated (it can free locations from other threads).
+    // A missing profile is ignored by all methods.
+    static void Deallocated(ThreadProfile* profile, unsigned int path, 
+                            unsigned __int64 callStart) {
+        if(profile == nullptr) {
+            return;
+        }
+
+        unsigned __int64 cycles = ThreadUtils::ReadTimestamp() - callStart;
+        PathData& data = profile->Deallocate[path];
+
+        data.Attempts++;
+        data.Hits++;
+        data.Cycles += cycles;
+        AddToBucket(data.StepBuckets, cycles);
+        AddToBucket(data.TotalBuckets, cycles);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Returns a profile for a new thread. The profiles of the threads
+    // that ended are reused, so their data is not lost.
+    static ThreadProfile* CreateProfile(unsigned int threadId) {
+        SpinLock lock(&lock_);
+        ThreadProfile* profile = profiles_;
+
+        while(profile != nullptr) {
+            if(profile->Active == 0) {
+                profile->ThreadId = threadId;
+                profile->Active = 1;
+                return profile;
+            }
+
+            profile = profile->Next;
+        }
+
+        if((chunk_ == nullptr) || 
+           ((chunkUsed_ + sizeof(ThreadProfile)) > PROFILE_CHUNK_SIZE)) {
+            chunk_ = reinterpret_cast<char*>(Memory::Allocate(PROFILE_CHUNK_SIZE));
+            chunkUsed_ = 0;
+
+            if(chunk_ == nullptr) {
+                return nullptr;
+            }
+        }
+
+        profile = reinterpret_cast<ThreadProfile*>(chunk_ + chunkUsed_);
+        chunkUsed_ += sizeof(ThreadProfile);
+
+        memset(profile, 0, sizeof(ThreadProfile));
+        profile->ThreadId = threadId;
+        profile->Active = 1;
+        profile->Next = profiles_;
+        profiles_ = profile;
+        return profile;
+    }
+
+    static void ReleaseProfile(ThreadProfile* profile) {
+        if(profile != nullptr) {
+            SpinLock lock(&lock_);
+            profile->Active = 0;
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Aggregates the data of all threads, or of the thread with the specified ID.
+    // The counters are read while the threads are running,
+    // so the snapshot is only approximately consistent.
+    static void GetSnapshot(Snapshot& snapshot, unsigned int threadId = 0) {
+        memset(&snapshot, 0, sizeof(Snapshot));
+        SpinLock lock(&lock_);
+        ThreadProfile* profile = profiles_;
+
+        while(profile != nullptr) {
+            if((threadId == 0) || (profile->ThreadId == threadId)) {
+                const volatile ThreadProfile* data = profile;
+                snapshot.Threads++;
+
+                for(unsigned int i = 0; i < ALLOCATE_PATHS; i++) {
+                    AddPath(snapshot.Allocate[i], data->Allocate[i]);
+                }
+
+                for(unsigned int i = 0; i < DEALLOCATE_PATHS; i++) {
+                    AddPath(snapshot.Deallocate[i], data->Deallocate[i]);
+                }
+            }
+
+            profile = profile->Next;
+        }
+    }
+#else
+    // No profiling data collected.
+    static unsigned __int64 Start() { return 0; }
+    static unsigned __int64 Miss(ThreadProfile* profile, unsigned int path, 
+                                 unsigned __int64 stepStart) { return 0; }
+    static void Hit(ThreadProfile* profile, unsigned int path, 
+                    unsigned __int64 callStart, unsigned __int64 stepStart) {}
+    static void Deallocated(ThreadProfile* profile, unsigned int path, 
+                            unsigned __int64 callStart) {}
+    static ThreadProfile* CreateProfile(unsigned int threadId) { return nullptr; }
+    static void ReleaseProfile(ThreadProfile* profile) {}
+    static void GetSnapshot(Snapshot& snapshot, unsigned int threadId = 0) {
+        memset(&snapshot, 0, sizeof(Snapshot));
+    }
+#endif
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Returns the upper bound (in cycles) of the bucket that contains
+    // the specified percentile (0.999 for p99.9).
+    static unsigned __int64 Percentile(const unsigned __int64* buckets, double percentile) {
+        unsigned __int64 total = 0;
+
+        for(unsigned int i = 0; i < BUCKETS; i++) {
+            total += buckets[i];
+        }
+
+        if(total == 0) {
+            return 0;
+        }
+
+        unsigned __int64 target = (unsigned __int64)(total * percentile);
+        unsigned __int64 count = 0;
+
+        for(unsigned int i = 0; i < BUCKETS; i++) {
+            count += buckets[i];
+
+            if((count > target) || (count == total)) {
+                return 2ULL << i;
+            }
+        }
+
+        return 0;
+    }
+
+    static void DisplayPath(const PathData& data, const char* message) {
+        printf("%25s: %12llu/%12llu avg %6llu  p50 %8llu  p99 %8llu  p99.9 %8llu\n", 
+               message, data.Hits, data.Attempts, 
+               data.Attempts > 0 ? data.Cycles / data.Attempts : 0,
+               Percentile(data.StepBuckets, 0.5), Percentile(data.StepBuckets, 0.99),
+               Percentile(data.StepBuckets, 0.999));
+    }
+
+    static void Display() {
+        Snapshot snapshot;
+        GetSnapshot(snapshot);
+
+        DisplayPath(snapshot.Allocate[ALLOCATE_ACTIVE],      "Active group");
+        DisplayPath(snapshot.Allocate[ALLOCATE_SECOND],      "Second group");
+        DisplayPath(snapshot.Allocate[ALLOCATE_PUBLIC],      "Public group");
+        DisplayPath(snapshot.Allocate[ALLOCATE_STEAL],       "Steal");
+        DisplayPath(snapshot.Allocate[ALLOCATE_ADOPT],       "Adopted group");
+        DisplayPath(snapshot.Allocate[ALLOCATE_NEW_GROUP],   "New group");
+        DisplayPath(snapshot.Deallocate[DEALLOCATE_PRIVATE], "Private free");
+        DisplayPath(snapshot.Deallocate[DEALLOCATE_GROUP_RETURN], "Group return");
+        DisplayPath(snapshot.Deallocate[DEALLOCATE_PUBLIC],  "Public free");
+        DisplayPath(snapshot.Deallocate[DEALLOCATE_ORPHAN],  "Orphan free");
+    }
+};
+
+
+// Default values.
+unsigned int PathProfiler::lock_ = 0;
+PathProfiler::ThreadProfile* PathProfiler::profiles_ = nullptr;
+char* PathProfiler::chunk_ = nullptr;
+size_t PathProfiler::chunkUsed_ = 0;
+
+} // namespace Base
+#endif
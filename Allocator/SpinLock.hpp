@@ -57,16 +57,15 @@ public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
     // Waits until the spin lock is acquired.
     void Lock() {
-#if defined(PLATFORM_WINDOWS)
-        if(Atomic::CompareExchange(lockValue_, 1, 0) != 0) {
+        if(Atomic::CompareExchange(lockValue_, 1u, 0u, std::memory_order_acquire) != 0) {
             unsigned int waitCount = 1;
             ThreadUtils::Wait();
 
             while(true) {
                 // Spin on the lock value without using CAS because it's faster.
-                if(*(volatile unsigned int*)lockValue_ == 0) {
+                if(Atomic::Load(lockValue_, std::memory_order_relaxed) == 0) {
                     // Do a CAS read to be really sure the lock is availalble.
-                    if(Atomic::CompareExchange(lockValue_, 1, 0) == 0) {
+                    if(Atomic::CompareExchange(lockValue_, 1u, 0u, std::memory_order_acquire) == 0) {
                         return; // Lock acquired.
                     }
                 }
@@ -80,15 +79,13 @@ public:
                 }
             }
         }
-#else
-        static_assert(false, "Not yet implemented.");
-#endif
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Releases the spin lock.
+    // Releases the spin lock. A CAS is used so that releasing 
+    // an already released lock has no effect.
     void Unlock() {
-        Atomic::CompareExchange(lockValue_, 0, 1);
+        Atomic::CompareExchange(lockValue_, 0u, 1u, std::memory_order_release);
     }
 };
 
@@ -35,6 +35,7 @@
 #ifndef PC_BASE_ALLOCATOR_STATISTICS_HPP
 #define PC_BASE_ALLOCATOR_STATISTICS_HPP
 
+#include "AllocatorConstants.hpp"
 #include "Atomic.hpp"
 #include <stdio.h>
 
@@ -57,47 +58,48 @@ public:
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 #if defined(STATISTICS)
     static void GroupObtained(void* group) {
-        Atomic::Increment(&groupsObtained);
+        // The counters are only displayed, no ordering is needed.
+        Atomic::Increment(&groupsObtained, std::memory_order_relaxed);
     }
 
     static void UsedGroupReturned(void* group) {
-        Atomic::Increment(&usedGroupsReturned);
+        Atomic::Increment(&usedGroupsReturned, std::memory_order_relaxed);
     }
 
     static void EmptyGroupReturned(void* group)	{
-        Atomic::Increment(&emptyGroupsReturned);
+        Atomic::Increment(&emptyGroupsReturned, std::memory_order_relaxed);
     }
 
     static void InvalidPublicGroup(void* group)	{
-        Atomic::Increment(&invalidPublicGroups);
+        Atomic::Increment(&invalidPublicGroups, std::memory_order_relaxed);
     }
 
     static void PublicLocationFreed(void* group) {
-        Atomic::Increment(&publicLocationFreed);
+        Atomic::Increment(&publicLocationFreed, std::memory_order_relaxed);
     }
 
     static void ActiveGroupChanged(void* group) {
-        Atomic::Increment(&activeGroupChanged);
+        Atomic::Increment(&activeGroupChanged, std::memory_order_relaxed);
     }
 
     static void BlockAllocated() {
-        Atomic::Increment(&blocksAllocated);
+        Atomic::Increment(&blocksAllocated, std::memory_order_relaxed);
     }
 
     static void BlockDeallocated() {
-        Atomic::Increment(&blocksDeallocated);
+        Atomic::Increment(&blocksDeallocated, std::memory_order_relaxed);
     }
 
     static void BroughtToFront() {
-        Atomic::Increment(&broughtToFront);
+        Atomic::Increment(&broughtToFront, std::memory_order_relaxed);
     }
 
     static void ThreadCreated() {
-        Atomic::Increment(&threadsCreated);
+        Atomic::Increment(&threadsCreated, std::memory_order_relaxed);
     }
 
     static void ThreadDestroyed() {
-        Atomic::Increment(&threadsDestroyed);
+        Atomic::Increment(&threadsDestroyed, std::memory_order_relaxed);
     }
 #else
     // No statistics collected.
@@ -114,7 +116,7 @@ public:
     static void ThreadDestroyed() {}
 #endif
 
-    static void DisplayInt(unsigned int value, char* message) {
+    static void DisplayInt(unsigned int value, const char* message) {
         printf("%25s: %d\n", message, value);
     }
 
@@ -0,0 +1,353 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Implements adaptors that allow the STL containers to use the allocator:
+// a stateless allocator usable with all containers and, when the standard 
+// library provides it (MEMORY_RESOURCE defined), a 'std::pmr::memory_resource'.
+// For single objects, the category of the size (small, large) is determined
+// at compile time, so the node-based containers skip the size tests.
+// Also implements a base class that makes the objects of a class 
+// use the fixed-size allocation path in their 'operator new/delete'.
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+#ifndef PC_BASE_ALLOCATOR_STL_ALLOCATOR_HPP
+#define PC_BASE_ALLOCATOR_STL_ALLOCATOR_HPP
+
+#include "Allocator.hpp"
+#include "AllocatorConstants.hpp"
+#include "Atomic.hpp"
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#if defined(MEMORY_RESOURCE)
+    #include <memory_resource>
+#endif
+
+namespace Base {
+
+// Provides the allocator instance used by the adaptors.
+// If no instance is set before the first allocation, one is created.
+class StlAllocatorInstance {
+private:
+    static Allocator* volatile instance_;
+
+public:
+    static Allocator* Get() {
+        Allocator* allocator = instance_;
+
+        if(allocator != nullptr) {
+            return allocator;
+        }
+
+        // Another thread may create the instance at the same time, 
+        // in which case ours is not needed anymore.
+        allocator = new Allocator();
+        Allocator* previous = static_cast<Allocator*>(
+                Atomic::CompareExchangePointer((void* volatile*)&instance_, 
+                                               allocator, nullptr));
+        if(previous != nullptr) {
+            delete allocator;
+            return previous;
+        }
+
+        return allocator;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Must be called before any container uses the adaptors.
+    static void Set(Allocator* allocator) {
+        instance_ = allocator;
+    }
+};
+
+
+// The ways in which a location can be allocated by the adaptors.
+enum SizeCategory {
+    SIZE_SMALL,
+    SIZE_LARGE,
+    SIZE_OTHER,  // Huge or from the OS, the category is determined at runtime.
+    SIZE_ALIGNED // The alignment can't be obtained by rounding the size.
+};
+
+// Determines at compile time how a location having the specified size 
+// and alignment is allocated.
+template <size_t Size, size_t Alignment>
+struct SizeClass {
+    static const SizeCategory Value = 
+            Alignment > Constants::MAX_NATURAL_ALIGNMENT ? SIZE_ALIGNED :
+            Size <= Constants::MAX_SMALL_SIZE ? SIZE_SMALL :
+            Size <= Constants::MAX_LARGE_SIZE ? SIZE_LARGE : SIZE_OTHER;
+};
+
+
+// Allocation and deallocation for each size category.
+template <SizeCategory Category>
+struct SizeClassOps {
+    static void* Allocate(Allocator* allocator, size_t size, size_t alignment) {
+        return allocator->AllocateAligned(size, alignment);
+    }
+
+    static void Deallocate(Allocator* allocator, void* address, 
+                           size_t size, size_t alignment) {
+        allocator->DeallocateAligned(address, size, alignment);
+    }
+};
+
+template <>
+struct SizeClassOps<SIZE_SMALL> {
+    static void* Allocate(Allocator* allocator, size_t size, size_t alignment) {
+        return allocator->AllocateSmall(size);
+    }
+
+    static void Deallocate(Allocator* allocator, void* address, 
+                           size_t size, size_t alignment) {
+        allocator->DeallocateSmall(address);
+    }
+};
+
+template <>
+struct SizeClassOps<SIZE_LARGE> {
+    static void* Allocate(Allocator* allocator, size_t size, size_t alignment) {
+        return allocator->AllocateLarge(size);
+    }
+
+    static void Deallocate(Allocator* allocator, void* address, 
+                           size_t size, size_t alignment) {
+        allocator->DeallocateLarge(address);
+    }
+};
+
+
+// Stateless allocator that can be used with all STL containers.
+// Objects can be deallocated by any instance, on any thread.
+template <class T>
+class ParallelStlAllocator {
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind {
+        typedef ParallelStlAllocator<U> other;
+    };
+
+private:
+    static const size_t ALIGNMENT = std::alignment_of<T>::value;
+    typedef SizeClass<sizeof(T), ALIGNMENT> ObjectClass;
+    typedef SizeClassOps<ObjectClass::Value> ObjectOps;
+
+    // The size of an object already respects it's alignment, 
+    // so 'Allocate' doesn't need to round it.
+    static_assert((sizeof(T) % ALIGNMENT) == 0, "Invalid object size.");
+
+public:
+    ParallelStlAllocator() {}
+
+    template <class U>
+    ParallelStlAllocator(const ParallelStlAllocator<U>& other) {}
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    pointer allocate(size_type count, const void* hint = nullptr) {
+        Allocator* allocator = StlAllocatorInstance::Get();
+        void* address;
+
+        if(count == 1) {
+            // Node-based containers allocate one object at a time.
+            address = ObjectOps::Allocate(allocator, sizeof(T), ALIGNMENT);
+        }
+        else if(count > max_size()) {
+            throw std::bad_alloc();
+        }
+        else address = allocator->AllocateAligned(count * sizeof(T), ALIGNMENT);
+
+        if(address == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<pointer>(address);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    void deallocate(pointer address, size_type count) {
+        Allocator* allocator = StlAllocatorInstance::Get();
+
+        if(count == 1) {
+            ObjectOps::Deallocate(allocator, address, sizeof(T), ALIGNMENT);
+        }
+        else allocator->DeallocateAligned(address, count * sizeof(T), ALIGNMENT);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    size_type max_size() const {
+        return ((std::numeric_limits<size_type>::max)() - ALIGNMENT) / sizeof(T);
+    }
+
+    pointer address(reference value) const {
+        return &value;
+    }
+
+    const_pointer address(const_reference value) const {
+        return &value;
+    }
+
+    void construct(pointer address, const T& value) {
+        new((void*)address) T(value);
+    }
+
+    template <class U>
+    void destroy(U* address) {
+        address->~U();
+    }
+};
+
+template <class T, class U>
+bool operator ==(const ParallelStlAllocator<T>& a, const ParallelStlAllocator<U>& b) {
+    return true;
+}
+
+template <class T, class U>
+bool operator !=(const ParallelStlAllocator<T>& a, const ParallelStlAllocator<U>& b) {
+    return false;
+}
+
+
+// Base class that allocates the objects of the derived class using
+// 'AllocateFixed', the bin being determined at compile time:
+//     class Node : public PoolAllocated<Node> { ... };
+// Objects of classes derived from 'T' having a different size 
+// and arrays are allocated using the size known at runtime.
+template <class T>
+class PoolAllocated {
+public:
+    static void* operator new(size_t size) {
+        static_assert(std::alignment_of<T>::value <= Constants::MAX_NATURAL_ALIGNMENT,
+                      "Over-aligned types are not supported.");
+        Allocator* allocator = StlAllocatorInstance::Get();
+        void* address;
+
+        if(size == sizeof(T)) {
+            address = allocator->AllocateFixed<sizeof(T)>();
+        }
+        else address = allocator->Allocate(size);
+
+        if(address == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return address;
+    }
+
+    static void operator delete(void* address, size_t size) {
+        Allocator* allocator = StlAllocatorInstance::Get();
+
+        if(size == sizeof(T)) {
+            allocator->DeallocateFixed<sizeof(T)>(address);
+        }
+        else allocator->Deallocate(address, size);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    static void* operator new[](size_t size) {
+        void* address = StlAllocatorInstance::Get()->Allocate(size);
+
+        if(address == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return address;
+    }
+
+    static void operator delete[](void* address) {
+        StlAllocatorInstance::Get()->Deallocate(address);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // The class-specific versions hide the placement form.
+    static void* operator new(size_t size, void* place) {
+        return place;
+    }
+
+    static void operator delete(void* address, void* place) {}
+};
+
+
+#if defined(MEMORY_RESOURCE)
+// Memory resource that can be used with the 'std::pmr' containers.
+// Two resources are equal if they use the same allocator instance.
+class ParallelMemoryResource : public std::pmr::memory_resource {
+private:
+    Allocator* allocator_;
+
+public:
+    ParallelMemoryResource() : allocator_(StlAllocatorInstance::Get()) {}
+
+    explicit ParallelMemoryResource(Allocator* allocator) : allocator_(allocator) {}
+
+    Allocator* GetAllocator() const {
+        return allocator_;
+    }
+
+protected:
+    virtual void* do_allocate(size_t size, size_t alignment) override {
+        void* address = allocator_->AllocateAligned(size, alignment);
+
+        if(address == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return address;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    virtual void do_deallocate(void* address, size_t size, size_t alignment) override {
+        allocator_->DeallocateAligned(address, size, alignment);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    virtual bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        auto resource = dynamic_cast<const ParallelMemoryResource*>(&other);
+        return (resource != nullptr) && (resource->allocator_ == allocator_);
+    }
+};
+#endif
+
+// Default values.
+Allocator* volatile StlAllocatorInstance::instance_ = nullptr;
+
+} // namespace Base
+#endif
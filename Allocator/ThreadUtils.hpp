@@ -39,7 +39,18 @@
     #include <Windows.h>
     #include <intrin.h>
 #else
-    static_assert(false, "Not yet implemented.");
+    #include <pthread.h>
+    #include <sched.h>
+    #include <linux/membarrier.h>
+    #include <sys/syscall.h>
+    #include <time.h>
+    #include <unistd.h>
+    #include <x86intrin.h>
+    #include <stddef.h>
+    #include <stdint.h>
+
+    // The 64 bit integer type of Visual C++.
+    #define __int64 long long
 #endif
 
 namespace Base {
@@ -65,8 +76,6 @@ public:
         GetNumaNodeProcessorMaskFct = (GET_NUMA_NODE_PROCESSOR_MASK)
                                        GetProcAddress(GetModuleHandle(TEXT("kernel32.dll")),
                                        NAME_GET_NUMA_NODE_PROCESSOR_MASK);
-#else
-        static_assert(false, "Not yet implemented.");
 #endif
     }
 
@@ -75,7 +84,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return (unsigned int)::GetCurrentThreadId();
 #else
-        static_assert(false, "Not yet implemented.");
+        return (unsigned int)syscall(SYS_gettid);
 #endif
     }
 
@@ -86,7 +95,7 @@ public:
         GetSystemInfo(&si);
         return si.dwNumberOfProcessors;
 #else
-        static_assert(false, "Not yet implemented.");
+        return (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
 #endif
     }
 
@@ -106,7 +115,8 @@ public:
         return 0;
     #endif
 #else
-        static_assert(false, "Not yet implemented.");
+        int cpu = sched_getcpu();
+        return cpu >= 0 ? (unsigned int)cpu : 0;
 #endif
     }
 
@@ -117,7 +127,7 @@ public:
         GetNumaHighestNodeNumber((PULONG)&number);
         return number;
 #else
-        static_assert(false, "Not yet implemented.");
+        return 0; // NUMA is not yet supported, all processors are on node 0.
 #endif
     }
 
@@ -131,7 +141,7 @@ public:
 
         return mask;
 #else
-        static_assert(false, "Not yet implemented.");
+        return node == 0 ? ~0ULL : 0;
 #endif
     }
 
@@ -140,7 +150,9 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return TlsAlloc();
 #else
-        static_assert(false, "Not yet implemented.");
+        pthread_key_t key;
+        pthread_key_create(&key, nullptr);
+        return (unsigned int)key;
 #endif
     }
 
@@ -150,7 +162,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return TlsGetValue(index);
 #else
-        static_assert(false, "Not yet implemented.");
+        return pthread_getspecific((pthread_key_t)index);
 #endif
     }
 
@@ -159,7 +171,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         TlsSetValue(index, data);
 #else
-        static_assert(false, "Not yet implemented.");
+        pthread_setspecific((pthread_key_t)index, data);
 #endif	
     }
 
@@ -168,7 +180,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         TlsFree(index);
 #else
-        static_assert(false, "Not yet implemented.");
+        pthread_key_delete((pthread_key_t)index);
 #endif	
     }
 
@@ -177,7 +189,7 @@ public:
 #if defined(PLATFORM_WINDOWS)
         ::SwitchToThread();
 #else
-        static_assert(false, "Not yet implemented.");
+        sched_yield();
 #endif
     }
 
@@ -190,7 +202,7 @@ public:
             // doesn't allow inline assembly.
             __nop();
     #else
-            static_assert(false, "Not yet implemented.");
+            __asm__ __volatile__("nop");
     #endif
         }
 #else
@@ -198,7 +210,8 @@ public:
         _mm_pause();
         _mm_pause();
     #else
-        static_assert(false, "Not yet implemented.");
+        _mm_pause();
+        _mm_pause();
     #endif
 #endif
     }
@@ -224,7 +237,63 @@ public:
         time >>= 10;
         return time;
 #else
-        static_assert(false, "Not yet implemented.");
+        return GetMilliseconds() >> 10;
+#endif
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the value of the processor timestamp counter.
+    // Used to measure short intervals, it's not serializing.
+    static unsigned __int64 ReadTimestamp() {
+#if defined(PLATFORM_WINDOWS)
+        return __rdtsc();
+#else
+        return __rdtsc();
+#endif
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Returns the system time in milliseconds (wraps around after ~49 days).
+    static unsigned int GetMilliseconds() {
+#if defined(PLATFORM_WINDOWS)
+        return GetTickCount();
+#else
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return (unsigned int)(((unsigned __int64)time.tv_sec * 1000) + 
+                              (time.tv_nsec / 1000000));
+#endif
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Prevents the compiler from reordering memory accesses.
+    // Used on the fast side of an asymmetric barrier (see 'FlushWriteBuffers').
+    static void CompilerBarrier() {
+#if defined(PLATFORM_WINDOWS)
+        _ReadWriteBarrier();
+#else
+        __asm__ __volatile__("" ::: "memory");
+#endif
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    // Forces the store buffers of all processors running threads 
+    // of this process to be flushed. Used on the slow side of an asymmetric barrier, 
+    // it makes the other side need only a compiler barrier.
+    // Returns false if the buffers could not be flushed; the asymmetric barrier
+    // is not correct then and the caller must not rely on it.
+    static bool FlushWriteBuffers() {
+#if defined(PLATFORM_WINDOWS)
+        FlushProcessWriteBuffers();
+        return true;
+#else
+        // The expedited command must be registered once before being used.
+        // It's not supported by kernels older than 4.14 and can be blocked by seccomp.
+        static int registered = syscall(SYS_membarrier, 
+                                        MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0);
+
+        return (registered == 0) &&
+               (syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0);
 #endif
     }
 
@@ -237,7 +306,16 @@ public:
         return ::CreateThread(nullptr, stackSize, (LPTHREAD_START_ROUTINE)startAddress, 
                               param, STACK_SIZE_PARAM_IS_A_RESERVATION, &threadId);
 #else
-        static_assert(false, "Not yet implemented.");
+        // The stack size is only a reservation on Windows; 
+        // on Linux the default size is used.
+        pthread_t thread;
+
+        if(pthread_create(&thread, nullptr, (void* (*)(void*))startAddress, param) != 0) {
+            return nullptr;
+        }
+
+        pthread_detach(thread);
+        return (void*)thread;
 #endif
     }
 
@@ -246,8 +324,11 @@ public:
 #if defined(PLATFORM_WINDOWS)
         return SetThreadPriority((HANDLE)threadHandle, THREAD_PRIORITY_BELOW_NORMAL) != 0;
 #else
-        static_assert(false, "Not yet implemented.");
-#endif`
+        // The thread runs only when the processors would be otherwise idle.
+        sched_param param;
+        param.sched_priority = 0;
+        return pthread_setschedparam((pthread_t)threadHandle, SCHED_IDLE, &param) == 0;
+#endif
     }
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -255,7 +336,10 @@ public:
 #if defined(PLATFORM_WINDOWS)
         ::Sleep(milliseconds);
 #else
-        static_assert(false, "Not yet implemented.");
+        timespec time;
+        time.tv_sec = milliseconds / 1000;
+        time.tv_nsec = (milliseconds % 1000) * 1000000;
+        nanosleep(&time, nullptr);
 #endif
     }
 
@@ -39,7 +39,7 @@
     #if defined PLATFORM_WINDOWS
         #include <intrin.h>
     #else
-        static_assert(false, "Not yet implemented.");
+        #include <emmintrin.h>
     #endif
 #endif
 
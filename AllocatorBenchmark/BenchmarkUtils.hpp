@@ -0,0 +1,378 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Helpers shared by the benchmark applications.
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+#ifndef PC_BENCHMARK_UTILS_HPP
+#define PC_BENCHMARK_UTILS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The Parallel Allocator is available only when the platform is
+// selected (PLATFORM_32/PLATFORM_64, set by the project files).
+#if defined(PLATFORM_32) || defined(PLATFORM_64)
+    #define BENCHMARK_PARALLEL
+    #include <Allocator.hpp>
+#endif
+
+#if defined(_WIN32)
+    #include <Windows.h>
+    #include <Psapi.h>
+    #pragma comment(lib, "Psapi.lib")
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/resource.h>
+#endif
+
+namespace Benchmark {
+
+// Interface that must be implemented by the supported allocators.
+class AllocatorInterface {
+public:
+    virtual void* Allocate(size_t size) = 0;
+    virtual void Deallocate(void* data) = 0;
+    virtual const char* Name() const = 0;
+
+    virtual ~AllocatorInterface() { }
+};
+
+// Implementation for an allocator using the default CRT allocator.
+class NativeAllocator : public AllocatorInterface {
+public:
+    virtual void* Allocate(size_t size) {
+        return malloc(size);
+    }
+
+    virtual void Deallocate(void* data) {
+        free(data);
+    }
+
+    virtual const char* Name() const {
+        return "native";
+    }
+};
+
+#if defined(BENCHMARK_PARALLEL)
+// Implementation for an allocator using the Parallel Allocator.
+class ParallelAllocator : public AllocatorInterface {
+private:
+    Base::Allocator* allocator_;
+
+public:
+    ParallelAllocator() : allocator_(new Base::Allocator()) { }
+
+    virtual ~ParallelAllocator() {
+        delete allocator_;
+    }
+
+    virtual void* Allocate(size_t size) {
+        return allocator_->Allocate(size);
+    }
+
+    virtual void Deallocate(void* data) {
+        allocator_->Deallocate(data);
+    }
+
+    virtual const char* Name() const {
+        return "parallel";
+    }
+
+    Base::Allocator* Instance() {
+        return allocator_;
+    }
+};
+#endif
+
+// Creates the allocator with the specified name.
+// Returns nullptr if the name is not recognized.
+inline AllocatorInterface* CreateAllocator(const std::string& name) {
+    if(name == "native") {
+        return new NativeAllocator();
+    }
+#if defined(BENCHMARK_PARALLEL)
+    else if(name == "parallel") {
+        return new ParallelAllocator();
+    }
+#endif
+
+    return nullptr;
+}
+
+
+// Random number generator with an explicit seed, so that
+// all runs of a benchmark execute the same sequence of operations.
+class Random {
+private:
+    std::mt19937 generator_;
+
+public:
+    explicit Random(unsigned int seed) : generator_(seed) { }
+
+    // Returns a number in the range [0, maxValue).
+    unsigned int Next(unsigned int maxValue) {
+        return generator_() % maxValue;
+    }
+
+    // Returns a size in the range [minSize, maxSize].
+    size_t NextSize(size_t minSize, size_t maxSize) {
+        return minSize + (generator_() % (maxSize - minSize + 1));
+    }
+
+    // Returns a size in the range [minSize, maxSize], with small
+    // sizes being much more likely than large ones.
+    size_t NextSkewedSize(size_t minSize, size_t maxSize) {
+        size_t range = generator_() % (maxSize - minSize + 1);
+        return minSize + (generator_() % (range + 1));
+    }
+
+    // Computes the seed used by the thread with the specified index.
+    static unsigned int ThreadSeed(unsigned int seed, unsigned int thread) {
+        return seed ^ ((thread + 1) * 0x9E3779B9);
+    }
+};
+
+
+// Measures the wall-clock time elapsed since it was created.
+class Timer {
+private:
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    Timer() : start_(std::chrono::steady_clock::now()) { }
+
+    double Seconds() const {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        return std::chrono::duration_cast<std::chrono::duration<double>>(elapsed).count();
+    }
+};
+
+
+// Per-thread counters, each on its own cache line.
+// Only the owner thread writes to them, the monitor just reads.
+struct ThreadCounters {
+    std::atomic<long long> LiveBytes;
+    std::atomic<unsigned long long> Operations;
+    char Padding[64 - sizeof(std::atomic<long long>) - 
+                 sizeof(std::atomic<unsigned long long>)];
+
+    ThreadCounters() {
+        Reset();
+    }
+
+    void Reset() {
+        LiveBytes.store(0, std::memory_order_relaxed);
+        Operations.store(0, std::memory_order_relaxed);
+    }
+
+    void Add(long long bytes) {
+        // Single writer, a plain read-modify-write is enough.
+        LiveBytes.store(LiveBytes.load(std::memory_order_relaxed) + bytes,
+                        std::memory_order_relaxed);
+        Operations.store(Operations.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+    }
+};
+
+
+// Allocates an object and stores its size in the first word,
+// so that the thread that deallocates it can update its counters.
+inline void* AllocateObject(AllocatorInterface* allocator, size_t size, 
+                            ThreadCounters& counters) {
+    if(size < sizeof(size_t)) {
+        size = sizeof(size_t);
+    }
+
+    void* object = allocator->Allocate(size);
+
+    if(object == nullptr) {
+        printf("Object of size %u could not be allocated!\n", (unsigned int)size);
+        exit(-1);
+    }
+
+    *reinterpret_cast<size_t*>(object) = size;
+    counters.Add((long long)size);
+    return object;
+}
+
+inline void DeallocateObject(AllocatorInterface* allocator, void* object,
+                             ThreadCounters& counters) {
+    size_t size = *reinterpret_cast<size_t*>(object);
+    allocator->Deallocate(object);
+    counters.Add(-(long long)size);
+}
+
+
+// Queries the memory used by the process.
+class MemoryUsage {
+public:
+    // Returns the amount of physical memory currently used by the process.
+    static size_t Resident() {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        
+        if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return counters.WorkingSetSize;
+        }
+
+        return 0;
+#else
+        // The second value from 'statm' is the number of resident pages.
+        // 'read' is used directly to avoid allocating while sampling.
+        char buffer[128];
+        int file = open("/proc/self/statm", O_RDONLY);
+        if(file == -1) return 0;
+
+        ssize_t count = read(file, buffer, sizeof(buffer) - 1);
+        close(file);
+        if(count <= 0) return 0;
+
+        buffer[count] = 0;
+        unsigned long long size;
+        unsigned long long resident;
+        
+        if(sscanf(buffer, "%llu %llu", &size, &resident) != 2) {
+            return 0;
+        }
+
+        return (size_t)(resident * sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    // Returns the peak amount of physical memory used since the process started.
+    static size_t PeakResident() {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        
+        if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return counters.PeakWorkingSetSize;
+        }
+
+        return 0;
+#else
+        struct rusage usage;
+
+        if(getrusage(RUSAGE_SELF, &usage) == 0) {
+            return (size_t)usage.ru_maxrss * 1024; // Reported in kilobytes.
+        }
+
+        return 0;
+#endif
+    }
+};
+
+
+// Samples periodically the resident memory and the number of bytes
+// requested by all threads, remembering the peak values seen during a run.
+// The process-wide peak cannot be reset, so sampling is used instead.
+class MemoryMonitor {
+private:
+    static const unsigned int SAMPLE_INTERVAL = 1; // Milliseconds.
+
+    ThreadCounters* counters_;
+    unsigned int threads_;
+    std::atomic<bool> stop_;
+    std::thread sampler_;
+    size_t baseResident_;
+    size_t peakResident_;
+    long long peakRequested_;
+
+    void Sample() {
+        size_t resident = MemoryUsage::Resident();
+        long long requested = 0;
+
+        for(unsigned int i = 0; i < threads_; i++) {
+            requested += counters_[i].LiveBytes.load(std::memory_order_relaxed);
+        }
+
+        if(resident > peakResident_) peakResident_ = resident;
+        if(requested > peakRequested_) peakRequested_ = requested;
+    }
+
+    void SampleLoop() {
+        while(!stop_.load(std::memory_order_acquire)) {
+            Sample();
+            std::this_thread::sleep_for(std::chrono::milliseconds((int)SAMPLE_INTERVAL));
+        }
+    }
+
+public:
+    MemoryMonitor(ThreadCounters* counters, unsigned int threads) :
+            counters_(counters), threads_(threads), baseResident_(0), 
+            peakResident_(0), peakRequested_(0) {
+        stop_.store(false);
+    }
+
+    void Start() {
+        baseResident_ = MemoryUsage::Resident();
+        peakResident_ = baseResident_;
+        peakRequested_ = 0;
+        stop_.store(false);
+        sampler_ = std::thread([this]() { SampleLoop(); });
+    }
+
+    void Stop() {
+        stop_.store(true, std::memory_order_release);
+        sampler_.join();
+        Sample();
+    }
+
+    size_t BaseResident() const {
+        return baseResident_;
+    }
+
+    // Returns the peak resident memory above the one present when started.
+    size_t PeakResident() const {
+        return peakResident_ - baseResident_;
+    }
+
+    size_t PeakRequested() const {
+        return peakRequested_ > 0 ? (size_t)peakRequested_ : 0;
+    }
+
+    // Returns the ratio between the peak number of bytes requested
+    // and the peak resident memory. Higher is better.
+    double Efficiency() const {
+        size_t resident = PeakResident();
+        return resident > 0 ? (double)PeakRequested() / (double)resident : 0.0;
+    }
+};
+
+} // namespace Benchmark
+#endif
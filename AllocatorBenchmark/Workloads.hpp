@@ -0,0 +1,421 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Multi-threaded allocation workloads modeled after the classic allocator benchmarks.
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+#ifndef PC_BENCHMARK_WORKLOADS_HPP
+#define PC_BENCHMARK_WORKLOADS_HPP
+
+#include "BenchmarkUtils.hpp"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace Benchmark {
+
+// Parameters shared by all workloads.
+struct WorkloadContext {
+    AllocatorInterface* Allocator;
+    ThreadCounters* Counters; // One for each thread.
+    unsigned int Threads;
+    unsigned int Seed;
+    double Scale;             // Multiplies the number of operations.
+
+    unsigned int Scaled(unsigned int value) const {
+        unsigned int result = (unsigned int)(value * Scale);
+        return result > 0 ? result : 1;
+    }
+};
+
+
+// Base class for all workloads.
+class Workload {
+public:
+    virtual const char* Name() const = 0;
+    virtual void Run(WorkloadContext& context) = 0;
+
+    virtual ~Workload() { }
+
+protected:
+    // Runs the specified function on each thread and waits for all to finish.
+    template <class Function>
+    static void RunThreads(unsigned int threads, Function function) {
+        std::vector<std::thread> handles;
+
+        for(unsigned int i = 0; i < threads; i++) {
+            handles.push_back(std::thread(function, i));
+        }
+
+        for(unsigned int i = 0; i < threads; i++) {
+            handles[i].join();
+        }
+    }
+};
+
+
+// Larson server simulation: each thread replaces random objects from
+// its own array. At the end of a round the arrays are handed over
+// to new threads, so most objects are freed by a thread other
+// than the one that allocated them.
+class LarsonWorkload : public Workload {
+private:
+    static const unsigned int MIN_SIZE = 8;
+    static const unsigned int MAX_SIZE = 1000;
+    static const unsigned int OBJECTS = 1000;
+    static const unsigned int ROUNDS = 10;
+    static const unsigned int REPLACEMENTS = 100000;
+
+public:
+    virtual const char* Name() const {
+        return "larson";
+    }
+
+    virtual void Run(WorkloadContext& context) {
+        std::vector<std::vector<void*>> arrays(context.Threads);
+        unsigned int replacements = context.Scaled(REPLACEMENTS);
+
+        // Create the initial objects.
+        for(unsigned int i = 0; i < context.Threads; i++) {
+            Random random(Random::ThreadSeed(context.Seed, i));
+
+            for(unsigned int j = 0; j < OBJECTS; j++) {
+                arrays[i].push_back(AllocateObject(context.Allocator, 
+                                    random.NextSize(MIN_SIZE, MAX_SIZE), 
+                                    context.Counters[i]));
+            }
+        }
+
+        for(unsigned int round = 0; round < ROUNDS; round++) {
+            RunThreads(context.Threads, [&](unsigned int thread) {
+                // Continue with the array of the previous thread.
+                std::vector<void*>& objects = arrays[(thread + round) % context.Threads];
+                Random random(Random::ThreadSeed(context.Seed + round, thread));
+                ThreadCounters& counters = context.Counters[thread];
+
+                for(unsigned int i = 0; i < replacements; i++) {
+                    unsigned int victim = random.Next(OBJECTS);
+                    DeallocateObject(context.Allocator, objects[victim], counters);
+                    objects[victim] = AllocateObject(context.Allocator, 
+                                                     random.NextSize(MIN_SIZE, MAX_SIZE),
+                                                     counters);
+                }
+            });
+        }
+
+        for(unsigned int i = 0; i < context.Threads; i++) {
+            for(unsigned int j = 0; j < OBJECTS; j++) {
+                DeallocateObject(context.Allocator, arrays[i][j], context.Counters[i]);
+            }
+        }
+    }
+};
+
+
+// Hoard's threadtest: each thread repeatedly allocates a batch
+// of same-sized objects and then frees all of them.
+class ThreadTestWorkload : public Workload {
+private:
+    static const unsigned int OBJECT_SIZE = 64;
+    static const unsigned int OBJECTS = 10000;
+    static const unsigned int ITERATIONS = 100;
+
+public:
+    virtual const char* Name() const {
+        return "threadtest";
+    }
+
+    virtual void Run(WorkloadContext& context) {
+        unsigned int iterations = context.Scaled(ITERATIONS);
+
+        RunThreads(context.Threads, [&](unsigned int thread) {
+            std::vector<void*> objects(OBJECTS);
+            ThreadCounters& counters = context.Counters[thread];
+
+            for(unsigned int i = 0; i < iterations; i++) {
+                for(unsigned int j = 0; j < OBJECTS; j++) {
+                    objects[j] = AllocateObject(context.Allocator, OBJECT_SIZE, counters);
+                }
+
+                for(unsigned int j = 0; j < OBJECTS; j++) {
+                    DeallocateObject(context.Allocator, objects[j], counters);
+                }
+            }
+        });
+    }
+};
+
+
+// Similar to SmartHeap's shbench: objects of mostly small, varying sizes
+// with mixed lifetimes. Half of each batch is freed in random order
+// and replaced before the whole batch is released.
+class ShBenchWorkload : public Workload {
+private:
+    static const unsigned int MIN_SIZE = 1;
+    static const unsigned int MAX_SIZE = 1000;
+    static const unsigned int OBJECTS = 1000;
+    static const unsigned int ITERATIONS = 1000;
+
+public:
+    virtual const char* Name() const {
+        return "shbench";
+    }
+
+    virtual void Run(WorkloadContext& context) {
+        unsigned int iterations = context.Scaled(ITERATIONS);
+
+        RunThreads(context.Threads, [&](unsigned int thread) {
+            std::vector<void*> objects(OBJECTS);
+            Random random(Random::ThreadSeed(context.Seed, thread));
+            ThreadCounters& counters = context.Counters[thread];
+
+            for(unsigned int i = 0; i < iterations; i++) {
+                for(unsigned int j = 0; j < OBJECTS; j++) {
+                    objects[j] = AllocateObject(context.Allocator, 
+                                                random.NextSkewedSize(MIN_SIZE, MAX_SIZE),
+                                                counters);
+                }
+
+                for(unsigned int j = 0; j < OBJECTS / 2; j++) {
+                    unsigned int victim = random.Next(OBJECTS);
+                    DeallocateObject(context.Allocator, objects[victim], counters);
+                    objects[victim] = AllocateObject(context.Allocator, 
+                                                     random.NextSkewedSize(MIN_SIZE, MAX_SIZE),
+                                                     counters);
+                }
+
+                // Free in the reverse order of the allocation.
+                for(unsigned int j = OBJECTS; j > 0; j--) {
+                    DeallocateObject(context.Allocator, objects[j - 1], counters);
+                }
+            }
+        });
+    }
+};
+
+
+// Threads are grouped in pairs: the producer allocates objects 
+// and passes them through a bounded queue to the consumer, which frees them.
+// With an odd number of threads the last one consumes its own objects.
+class ProducerConsumerWorkload : public Workload {
+private:
+    static const unsigned int MIN_SIZE = 8;
+    static const unsigned int MAX_SIZE = 512;
+    static const unsigned int OBJECTS = 1000000;
+    static const unsigned int QUEUE_SIZE = 1024; // Must be a power of two.
+
+    // Single-producer single-consumer ring buffer.
+    struct Queue {
+        void* Objects[QUEUE_SIZE];
+        std::atomic<unsigned int> Head; // Written by the consumer.
+        char Padding[64];
+        std::atomic<unsigned int> Tail; // Written by the producer.
+
+        Queue() {
+            Head.store(0);
+            Tail.store(0);
+        }
+
+        bool Push(void* object) {
+            unsigned int tail = Tail.load(std::memory_order_relaxed);
+
+            if((tail - Head.load(std::memory_order_acquire)) == QUEUE_SIZE) {
+                return false;
+            }
+
+            Objects[tail & (QUEUE_SIZE - 1)] = object;
+            Tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        void* Pop() {
+            unsigned int head = Head.load(std::memory_order_relaxed);
+
+            if(head == Tail.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+
+            void* object = Objects[head & (QUEUE_SIZE - 1)];
+            Head.store(head + 1, std::memory_order_release);
+            return object;
+        }
+    };
+
+    void Produce(WorkloadContext& context, Queue& queue, 
+                 unsigned int thread, unsigned int objects) {
+        Random random(Random::ThreadSeed(context.Seed, thread));
+        ThreadCounters& counters = context.Counters[thread];
+
+        for(unsigned int i = 0; i < objects; i++) {
+            void* object = AllocateObject(context.Allocator, 
+                                          random.NextSize(MIN_SIZE, MAX_SIZE), counters);
+            while(!queue.Push(object)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void Consume(WorkloadContext& context, Queue& queue, 
+                 unsigned int thread, unsigned int objects) {
+        ThreadCounters& counters = context.Counters[thread];
+
+        for(unsigned int i = 0; i < objects; i++) {
+            void* object;
+
+            while((object = queue.Pop()) == nullptr) {
+                std::this_thread::yield();
+            }
+
+            DeallocateObject(context.Allocator, object, counters);
+        }
+    }
+
+public:
+    virtual const char* Name() const {
+        return "prodcons";
+    }
+
+    virtual void Run(WorkloadContext& context) {
+        unsigned int objects = context.Scaled(OBJECTS);
+        std::vector<Queue*> queues;
+
+        for(unsigned int i = 0; i < (context.Threads + 1) / 2; i++) {
+            queues.push_back(new Queue());
+        }
+
+        RunThreads(context.Threads, [&](unsigned int thread) {
+            Queue& queue = *queues[thread / 2];
+
+            if((thread + 1) == context.Threads && (thread % 2) == 0) {
+                // Unpaired thread, consume its own objects in batches.
+                Random random(Random::ThreadSeed(context.Seed, thread));
+                ThreadCounters& counters = context.Counters[thread];
+
+                for(unsigned int i = 0; i < objects; i += QUEUE_SIZE) {
+                    unsigned int batch = (objects - i) < QUEUE_SIZE ? (objects - i) : QUEUE_SIZE;
+
+                    for(unsigned int j = 0; j < batch; j++) {
+                        queue.Push(AllocateObject(context.Allocator, 
+                                                  random.NextSize(MIN_SIZE, MAX_SIZE), 
+                                                  counters));
+                    }
+
+                    Consume(context, queue, thread, batch);
+                }
+            }
+            else if((thread % 2) == 0) {
+                Produce(context, queue, thread, objects);
+            }
+            else Consume(context, queue, thread, objects);
+        });
+
+        for(size_t i = 0; i < queues.size(); i++) {
+            delete queues[i];
+        }
+    }
+};
+
+
+// Each thread allocates a batch of objects and hands it to the next thread
+// (in a ring), then frees the batch it received from the previous one.
+class CrossThreadFreeWorkload : public Workload {
+private:
+    static const unsigned int MIN_SIZE = 8;
+    static const unsigned int MAX_SIZE = 256;
+    static const unsigned int BATCH_SIZE = 256;
+    static const unsigned int ITERATIONS = 2000;
+
+    struct Mailbox {
+        std::mutex Lock;
+        std::vector<void*> Objects;
+    };
+
+public:
+    virtual const char* Name() const {
+        return "xfree";
+    }
+
+    virtual void Run(WorkloadContext& context) {
+        unsigned int iterations = context.Scaled(ITERATIONS);
+        std::vector<Mailbox*> mailboxes;
+
+        for(unsigned int i = 0; i < context.Threads; i++) {
+            mailboxes.push_back(new Mailbox());
+        }
+
+        RunThreads(context.Threads, [&](unsigned int thread) {
+            Random random(Random::ThreadSeed(context.Seed, thread));
+            ThreadCounters& counters = context.Counters[thread];
+            Mailbox& next = *mailboxes[(thread + 1) % context.Threads];
+            Mailbox& own = *mailboxes[thread];
+            std::vector<void*> batch;
+            std::vector<void*> received;
+
+            for(unsigned int i = 0; i < iterations; i++) {
+                for(unsigned int j = 0; j < BATCH_SIZE; j++) {
+                    batch.push_back(AllocateObject(context.Allocator, 
+                                                   random.NextSize(MIN_SIZE, MAX_SIZE),
+                                                   counters));
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(next.Lock);
+                    next.Objects.insert(next.Objects.end(), batch.begin(), batch.end());
+                }
+
+                batch.clear();
+                {
+                    std::lock_guard<std::mutex> lock(own.Lock);
+                    received.swap(own.Objects);
+                }
+
+                for(size_t j = 0; j < received.size(); j++) {
+                    DeallocateObject(context.Allocator, received[j], counters);
+                }
+
+                received.clear();
+            }
+        });
+
+        // Free the objects that were not picked up before the threads finished.
+        for(unsigned int i = 0; i < context.Threads; i++) {
+            for(size_t j = 0; j < mailboxes[i]->Objects.size(); j++) {
+                DeallocateObject(context.Allocator, mailboxes[i]->Objects[j], 
+                                 context.Counters[i]);
+            }
+
+            delete mailboxes[i];
+        }
+    }
+};
+
+} // namespace Benchmark
+#endif
@@ -0,0 +1,227 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Portable multi-threaded benchmark comparing the Parallel Allocator
+// with the native allocator. For each workload and thread count it reports
+// the throughput, the scaling relative to one thread, the peak resident memory
+// and the ratio between the requested bytes and the resident memory.
+//
+// Usage: AllocatorBenchmark [-a native|parallel|all] [-w workload|all] 
+//                           [-t maxThreads] [-s seed] [-x scale] [-c]
+// Because freed memory is often retained by an allocator, each allocator
+// should be measured in a separate process when comparing memory usage.
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Workloads.hpp"
+
+using namespace Benchmark;
+
+struct Options {
+    std::string Allocator;
+    std::string Workload;
+    unsigned int MaxThreads;
+    unsigned int Seed;
+    double Scale;
+    bool Csv;
+
+    Options() : Allocator("all"), Workload("all"), MaxThreads(0), 
+                Seed(27), Scale(1.0), Csv(false) { }
+};
+
+static void PrintUsage() {
+    std::cout<<"Usage: AllocatorBenchmark [-a native|parallel|all] [-w workload|all]\n"
+             <<"                          [-t maxThreads] [-s seed] [-x scale] [-c]\n"
+             <<"Workloads: larson, threadtest, shbench, prodcons, xfree\n";
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+    for(int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+
+        if(option == "-c") {
+            options.Csv = true;
+            continue;
+        }
+        else if((i + 1) == argc) {
+            return false;
+        }
+
+        const char* value = argv[++i];
+
+        if(option == "-a") options.Allocator = value;
+        else if(option == "-w") options.Workload = value;
+        else if(option == "-t") options.MaxThreads = (unsigned int)atoi(value);
+        else if(option == "-s") options.Seed = (unsigned int)strtoul(value, nullptr, 10);
+        else if(option == "-x") options.Scale = atof(value);
+        else return false;
+    }
+
+    if(options.MaxThreads == 0) {
+        options.MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    return options.Scale > 0;
+}
+
+// Returns 1, 2, 4, ... up to the maximum number of threads (always included).
+static std::vector<unsigned int> ThreadCounts(unsigned int maxThreads) {
+    std::vector<unsigned int> counts;
+
+    for(unsigned int count = 1; count < maxThreads; count *= 2) {
+        counts.push_back(count);
+    }
+
+    counts.push_back(maxThreads);
+    return counts;
+}
+
+static void RunWorkload(AllocatorInterface* allocator, Workload* workload,
+                        const Options& options) {
+    double singleThreadRate = 0;
+    std::vector<unsigned int> counts = ThreadCounts(options.MaxThreads);
+
+    for(size_t i = 0; i < counts.size(); i++) {
+        unsigned int threads = counts[i];
+        ThreadCounters* counters = new ThreadCounters[threads];
+        MemoryMonitor monitor(counters, threads);
+
+        WorkloadContext context;
+        context.Allocator = allocator;
+        context.Counters = counters;
+        context.Threads = threads;
+        context.Seed = options.Seed;
+        context.Scale = options.Scale;
+
+        monitor.Start();
+        Timer timer;
+        workload->Run(context);
+        double seconds = timer.Seconds();
+        monitor.Stop();
+
+        unsigned long long operations = 0;
+
+        for(unsigned int j = 0; j < threads; j++) {
+            operations += counters[j].Operations.load();
+        }
+
+        double rate = seconds > 0 ? operations / seconds : 0;
+        if(threads == 1) singleThreadRate = rate;
+        double scaling = singleThreadRate > 0 ? rate / singleThreadRate : 0;
+        
+        if(options.Csv) {
+            printf("%s,%s,%u,%u,%.3f,%llu,%.0f,%.2f,%llu,%llu,%.3f\n",
+                   allocator->Name(), workload->Name(), threads, options.Seed, 
+                   seconds, operations, rate, scaling, 
+                   (unsigned long long)monitor.PeakResident(),
+                   (unsigned long long)monitor.PeakRequested(), monitor.Efficiency());
+        }
+        else {
+            printf("%-9s %-11s %4u %9.3f %14.0f %8.2fx %10.1f %10.1f %8.3f\n",
+                   allocator->Name(), workload->Name(), threads, seconds, rate, 
+                   scaling, monitor.PeakResident() / (1024.0 * 1024.0),
+                   monitor.PeakRequested() / (1024.0 * 1024.0), monitor.Efficiency());
+        }
+
+        fflush(stdout);
+        delete[] counters;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    if(!ParseOptions(argc, argv, options)) {
+        PrintUsage();
+        return -1;
+    }
+
+    std::vector<std::string> allocators;
+
+    if(options.Allocator == "all") {
+        allocators.push_back("native");
+#if defined(BENCHMARK_PARALLEL)
+        allocators.push_back("parallel");
+#endif
+    }
+    else allocators.push_back(options.Allocator);
+
+    std::vector<Workload*> workloads;
+    workloads.push_back(new LarsonWorkload());
+    workloads.push_back(new ThreadTestWorkload());
+    workloads.push_back(new ShBenchWorkload());
+    workloads.push_back(new ProducerConsumerWorkload());
+    workloads.push_back(new CrossThreadFreeWorkload());
+
+    if(options.Csv) {
+        printf("allocator,workload,threads,seed,seconds,operations,ops_per_sec,"
+               "scaling,peak_rss,peak_requested,efficiency\n");
+    }
+    else {
+        printf("Seed: %u, scale: %.2f, max threads: %u\n", 
+               options.Seed, options.Scale, options.MaxThreads);
+        printf("%-9s %-11s %4s %9s %14s %9s %10s %10s %8s\n",
+               "allocator", "workload", "thr", "seconds", "ops/sec", 
+               "scaling", "rss (MB)", "req (MB)", "req/rss");
+    }
+
+    bool found = false;
+
+    for(size_t i = 0; i < allocators.size(); i++) {
+        AllocatorInterface* allocator = CreateAllocator(allocators[i]);
+
+        if(allocator == nullptr) {
+            std::cout<<"Unknown allocator: "<<allocators[i]<<"\n";
+            return -1;
+        }
+
+        for(size_t j = 0; j < workloads.size(); j++) {
+            if(options.Workload == "all" || options.Workload == workloads[j]->Name()) {
+                RunWorkload(allocator, workloads[j], options);
+                found = true;
+            }
+        }
+
+        delete allocator;
+    }
+
+    for(size_t i = 0; i < workloads.size(); i++) {
+        delete workloads[i];
+    }
+
+    if(!found) {
+        std::cout<<"Unknown workload: "<<options.Workload<<"\n";
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,659 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Multi-threaded stress test that runs on all supported platforms.
+// It exercises the paths where threads share allocator structures:
+// remote frees, the handoff of groups through the public list,
+// the adoption of groups from idle threads and the object pool/stack.
+// Should be run built with a race detector (-fsanitize=thread).
+#include <Allocator.hpp>
+#include <ObjectPool.hpp>
+#include <LockFreeStack.hpp>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const int THREAD_COUNT = 4;
+static const int ACTION_COUNT = 20000; // For each thread.
+static const int REMOTE_THRESHOLD = 40; // Percent of locations freed by other threads.
+static const int LARGE_THRESHOLD = 10;
+static const int HUGE_THRESHOLD = 1;
+static const int MIN_OBJECT_SIZE = 8;
+static const int MAX_SMALL_OBJECT_SIZE = 256;
+static const int MAX_KEPT_OBJECTS = 512;
+static const int ADOPT_OBJECTS = 2000;
+static const int POOL_OBJECT_SIZE = 64;
+static const int POOL_BLOCK_SIZE = 64 * 1024;
+
+static Base::Allocator* allocator;
+static std::atomic<int> errors;
+
+// Generates pseudo-random numbers without sharing state between threads.
+class Random {
+private:
+    unsigned int state_;
+
+public:
+    Random(unsigned int seed) : state_(seed * 2654435761u + 1) { }
+
+    unsigned int Next(unsigned int limit) {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 17;
+        state_ ^= state_ << 5;
+        return state_ % limit;
+    }
+};
+
+// The locations sent to a thread, which frees them.
+struct Mailbox {
+    std::mutex Lock;
+    std::vector<void*> Objects;
+};
+
+static Mailbox mailboxes[THREAD_COUNT];
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The size and the owner are written at both ends of the location, 
+// so that overlapping locations are detected when they are freed.
+struct ObjectHeader {
+    size_t Size;
+    size_t Tag;
+};
+
+// The smallest location that holds both copies without overlapping.
+static const size_t MIN_CHECKED_SIZE = 2 * sizeof(ObjectHeader);
+
+static void* AllocateObject(size_t size, size_t tag) {
+    auto header = reinterpret_cast<ObjectHeader*>(allocator->Allocate(size));
+
+    if(header == nullptr) {
+        errors++;
+        return nullptr;
+    }
+
+    header->Size = size;
+    header->Tag = tag;
+    memcpy((char*)header + size - sizeof(ObjectHeader), header, sizeof(ObjectHeader));
+    return header;
+}
+
+static void FreeObject(void* object) {
+    if(object == nullptr) {
+        return; // Already counted as an error.
+    }
+
+    auto header = reinterpret_cast<ObjectHeader*>(object);
+    ObjectHeader trailer;
+    memcpy(&trailer, (char*)object + header->Size - sizeof(ObjectHeader), sizeof(ObjectHeader));
+
+    if((trailer.Size != header->Size) || (trailer.Tag != header->Tag)) {
+        errors++;
+    }
+
+    allocator->Deallocate(object);
+}
+
+static size_t SelectSize(Random& random) {
+    unsigned int kind = random.Next(100);
+
+    if(kind < HUGE_THRESHOLD) {
+        return Base::Constants::MAX_LARGE_SIZE + 1 + random.Next(64 * 1024);
+    }
+    else if(kind < LARGE_THRESHOLD) {
+        return Base::Constants::MAX_SMALL_SIZE + 1 + 
+               random.Next(Base::Constants::MAX_LARGE_SIZE - Base::Constants::MAX_SMALL_SIZE);
+    }
+
+    return MIN_OBJECT_SIZE + MIN_CHECKED_SIZE + random.Next(MAX_SMALL_OBJECT_SIZE);
+}
+
+// Selects a size from the first small bins, used by the adoption test
+// to fill many groups of the same few bins.
+static size_t SelectSmallSize(Random& random) {
+    return MIN_CHECKED_SIZE + random.Next(128);
+}
+
+static void DrainMailbox(int thread) {
+    std::vector<void*> objects;
+    {
+        std::lock_guard<std::mutex> lock(mailboxes[thread].Lock);
+        objects.swap(mailboxes[thread].Objects);
+    }
+
+    for(size_t i = 0; i < objects.size(); i++) {
+        FreeObject(objects[i]);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Each thread allocates locations and frees some of them itself, 
+// the others are sent to the other threads (they become public locations
+// and their groups are handed back to the owner through the public list).
+static void RemoteFreeThread(int thread, std::atomic<int>* finished) {
+    Random random(thread + 1);
+    std::vector<void*> kept;
+
+    for(int i = 0; i < ACTION_COUNT; i++) {
+        void* object = AllocateObject(SelectSize(random), thread);
+
+        if(object == nullptr) {
+            continue;
+        }
+
+        if((int)random.Next(100) < REMOTE_THRESHOLD) {
+            int target = (thread + 1 + random.Next(THREAD_COUNT - 1)) % THREAD_COUNT;
+            std::lock_guard<std::mutex> lock(mailboxes[target].Lock);
+            mailboxes[target].Objects.push_back(object);
+        }
+        else kept.push_back(object);
+
+        if(kept.size() > MAX_KEPT_OBJECTS) {
+            // Free a random half, so that the groups become partially used.
+            for(size_t j = 0; j < kept.size(); j += 2) {
+                FreeObject(kept[j]);
+                kept[j] = kept.back();
+                kept.pop_back();
+            }
+        }
+
+        if((i % 64) == 0) {
+            DrainMailbox(thread);
+        }
+    }
+
+    for(size_t j = 0; j < kept.size(); j++) {
+        FreeObject(kept[j]);
+    }
+
+    // Free the locations sent by the threads that are still running.
+    (*finished)++;
+
+    while(finished->load() < THREAD_COUNT) {
+        DrainMailbox(thread);
+        std::this_thread::yield();
+    }
+
+    DrainMailbox(thread);
+}
+
+static void RemoteFreeTest() {
+    std::vector<std::thread> threads;
+    std::atomic<int> finished(0);
+
+    for(int i = 0; i < THREAD_COUNT; i++) {
+        threads.push_back(std::thread(RemoteFreeThread, i, &finished));
+    }
+
+    for(int i = 0; i < THREAD_COUNT; i++) {
+        threads[i].join();
+    }
+
+    for(int i = 0; i < THREAD_COUNT; i++) {
+        DrainMailbox(i);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The idle threads leave partially used groups in their bins and stop 
+// using the allocator long enough for the groups to be adopted by the busy 
+// threads. They wake up while the busy threads still allocate, free
+// their locations (now in adopted groups) and allocate again.
+static void IdleThread(int thread, std::atomic<bool>* stop) {
+    Random random(thread + 100);
+    std::vector<void*> objects;
+
+    for(int i = 0; i < ADOPT_OBJECTS; i++) {
+        objects.push_back(AllocateObject(SelectSmallSize(random), thread));
+    }
+
+    for(size_t i = 0; i < objects.size(); i += 2) {
+        FreeObject(objects[i]);
+        objects[i] = nullptr;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(
+                                2 * Base::Constants::ADOPT_IDLE_TIME));
+
+    for(size_t i = 0; i < objects.size(); i++) {
+        if(objects[i] != nullptr) {
+            FreeObject(objects[i]);
+        }
+    }
+
+    while(!stop->load()) {
+        FreeObject(AllocateObject(SelectSmallSize(random), thread));
+    }
+}
+
+static void BusyThread(int thread, std::atomic<bool>* stop) {
+    Random random(thread + 200);
+    std::vector<void*> objects;
+
+    while(!stop->load()) {
+        objects.push_back(AllocateObject(SelectSmallSize(random), thread));
+
+        if(objects.size() > MAX_KEPT_OBJECTS) {
+            for(size_t i = 0; i < objects.size(); i++) {
+                FreeObject(objects[i]);
+            }
+
+            objects.clear();
+        }
+    }
+
+    for(size_t i = 0; i < objects.size(); i++) {
+        FreeObject(objects[i]);
+    }
+}
+
+static void AdoptionTest() {
+    std::vector<std::thread> threads;
+    std::atomic<bool> stop(false);
+
+    for(int i = 0; i < THREAD_COUNT; i++) {
+        if(i % 2 == 0) {
+            threads.push_back(std::thread(IdleThread, i, &stop));
+        }
+        else threads.push_back(std::thread(BusyThread, i, &stop));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(
+                                3 * Base::Constants::ADOPT_IDLE_TIME));
+    stop = true;
+
+    for(int i = 0; i < THREAD_COUNT; i++) {
+        threads[i].join();
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The objects of the pool are used by all threads at the same time.
+static void PoolThread(Base::ObjectPool* pool, int thread) {
+    Random random(thread + 300);
+    std::vector<size_t*> objects;
+
+    for(int i = 0; i < ACTION_COUNT; i++) {
+        if((objects.size() < 64) && (random.Next(100) < 60)) {
+            auto object = reinterpret_cast<size_t*>(pool->GetObject());
+            object[0] = thread;
+            object[POOL_OBJECT_SIZE / sizeof(size_t) - 1] = i;
+            objects.push_back(object);
+        }
+        else if(objects.size() > 0) {
+            size_t* object = objects.back();
+            objects.pop_back();
+
+            if(object[0] != (size_t)thread) {
+                errors++;
+            }
+
+            pool->ReturnObject(object);
+        }
+    }
+
+    for(size_t i = 0; i < objects.size(); i++) {
+        pool->ReturnObject(objects[i]);
+    }
+}
+
+static void PoolTest() {
+    std::vector<std::thread> threads;
+    Base::ObjectPool pool(POOL_BLOCK_SIZE, POOL_OBJECT_SIZE);
+
+    for(int i = 0; i < THREAD_COUNT; i++) {
+        threads.push_back(std::thread(PoolThread, &pool, i));
+    }
+
+    for(int i = 0; i < THREAD_COUNT; i++) {
+        threads[i].join();
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The block allocator takes the partially used group with the most used locations.
+// Two groups are returned with the same number of used locations, then most
+// locations of the first group in the list are freed by another thread.
+// It must be moved to a lower bucket and the other group must be taken first.
+static const unsigned int BUCKET_LOCATION_SIZE = 256;
+
+static void PartialBucketTest() {
+    typedef Base::Allocator::SmallBAType BAType;
+    typedef Base::Allocator::MemoryPolicy PolicyType;
+    const unsigned int threadId = 1;
+    const unsigned int locations = (Base::Constants::SMALL_GROUP_SIZE - 
+                                    Base::Constants::SMALL_GROUP_HEADER_SIZE) / 
+                                   BUCKET_LOCATION_SIZE;
+    PolicyType policy;
+    BAType::BinT bin;
+    BAType* manager = new BAType();
+    Base::Group* groups[2];
+    std::vector<void*> used[2];
+
+    policy.Initialize();
+    manager->Initialize<PolicyType>(&policy, 0);
+    bin.Number = 0;
+    bin.Lifetime = Base::LIFETIME_SHORT;
+
+    for(int i = 0; i < 2; i++) {
+        groups[i] = manager->GetGroup<PolicyType>(BUCKET_LOCATION_SIZE, locations, 
+                                                  &bin, threadId, false);
+        for(unsigned int j = 0; j < locations / 4; j++) {
+            used[i].push_back(groups[i]->GetPrivateLocation());
+        }
+
+        manager->ReturnPartialGroup<PolicyType>(groups[i], BAType::ADD_GROUP, 
+                                                &bin, threadId);
+    }
+
+    // The last returned group is the first one in the list.
+    std::thread other([&used, &groups]() {
+        for(size_t j = 1; j < used[1].size(); j++) {
+            groups[1]->ReturnPublicLocation(used[1][j]);
+        }
+    });
+    other.join();
+
+    if(manager->GetGroup<PolicyType>(BUCKET_LOCATION_SIZE, locations, 
+                                     &bin, threadId, true) != groups[0]) {
+        errors++;
+    }
+
+    if(manager->GetGroup<PolicyType>(BUCKET_LOCATION_SIZE, locations, 
+                                     &bin, threadId, true) != groups[1]) {
+        errors++;
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// A bin that obtains groups right after returning them starts retaining empty ones.
+// After all locations are freed, 'Trim' must return the retained groups too,
+// so that the only block of the allocator can be released.
+static const int TRIM_ROUNDS = 4;
+
+static void TrimTest() {
+    std::thread thread([]() {
+        Base::Allocator* local = new Base::Allocator();
+        const unsigned int locations = (Base::Constants::SMALL_GROUP_SIZE - 
+                                        Base::Constants::SMALL_GROUP_HEADER_SIZE) / 
+                                       BUCKET_LOCATION_SIZE;
+        std::vector<void*> objects;
+
+        for(int round = 0; round < TRIM_ROUNDS; round++) {
+            for(unsigned int i = 0; i < (2 * locations); i++) {
+                objects.push_back(local->Allocate(BUCKET_LOCATION_SIZE));
+            }
+
+            while(!objects.empty()) {
+                local->Deallocate(objects.back());
+                objects.pop_back();
+            }
+        }
+
+        if(local->Trim(0) < Base::Constants::BLOCK_SIZE) {
+            errors++;
+        }
+    });
+    thread.join();
+}
+
+#if defined(SORT)
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Two groups receive the same allocations and frees. The first one inserts
+// each freed location in the sorted private list, the second one receives 
+// some of them as public locations and merges them all at once.
+// Both must return the same locations, in increasing order after the frees.
+static const int MERGE_ROUNDS = 200;
+
+static bool AllocateBoth(Base::Group* first, Base::Group* second, 
+                         unsigned int size, std::vector<bool>& used, int& previous) {
+    char* location1 = (char*)first->GetPrivateLocation();
+    char* location2 = (char*)second->GetPrivateLocation();
+
+    if((location1 == nullptr) || (location2 == nullptr)) {
+        if(location1 != location2) errors++;
+        return false;
+    }
+
+    int offset1 = (int)(location1 - (char*)first - Base::Constants::SMALL_GROUP_HEADER_SIZE);
+    int offset2 = (int)(location2 - (char*)second - Base::Constants::SMALL_GROUP_HEADER_SIZE);
+
+    if((offset1 != offset2) || (offset1 <= previous) || used[offset1 / size]) {
+        errors++;
+    }
+
+    used[offset1 / size] = true;
+    previous = offset1;
+    return true;
+}
+
+static void SortedMergeTest(unsigned int size) {
+    const unsigned int groupSize = Base::Constants::SMALL_GROUP_SIZE;
+    const unsigned int locations = (groupSize - Base::Constants::SMALL_GROUP_HEADER_SIZE) / size;
+    auto first = reinterpret_cast<Base::Group*>(Base::Memory::Allocate(groupSize));
+    auto second = reinterpret_cast<Base::Group*>(Base::Memory::Allocate(groupSize));
+    std::vector<bool> used(locations);
+    Random random(size);
+
+    first->InitializeUnused(size, locations, 0, false);
+    second->InitializeUnused(size, locations, 0, false);
+
+    for(int round = 0; round < MERGE_ROUNDS; round++) {
+        unsigned int count = random.Next(locations / 2);
+        int previous = -1;
+
+        for(unsigned int i = 0; i < count; i++) {
+            if(!AllocateBoth(first, second, size, used, previous)) break;
+        }
+
+        for(unsigned int i = 0; i < locations; i++) {
+            if(!used[i] || (random.Next(3) != 0)) {
+                continue;
+            }
+
+            unsigned int offset = Base::Constants::SMALL_GROUP_HEADER_SIZE + (i * size);
+            first->ReturnPrivateLocation((char*)first + offset);
+
+            if(random.Next(2) == 0) {
+                second->ReturnPublicLocation((char*)second + offset);
+            }
+            else second->ReturnPrivateLocation((char*)second + offset);
+
+            used[i] = false;
+        }
+
+        second->PrivatizeLocations();
+
+        if(first->GetUsedLocations() != second->GetUsedLocations()) {
+            errors++;
+        }
+    }
+
+    // All remaining locations must be found exactly once.
+    int previous = -1;
+    while(AllocateBoth(first, second, size, used, previous)) { }
+
+    for(unsigned int i = 0; i < locations; i++) {
+        if(!used[i]) errors++;
+    }
+
+    Base::Memory::Deallocate(first);
+    Base::Memory::Deallocate(second);
+}
+#endif
+
+#if defined(STEAL)
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The groups of two small bins fill up, so they steal locations from the 
+// almost empty active group of a larger bin. The stolen locations must not 
+// overlap, must be large enough and must be freed correctly by both 
+// the owner and another thread, while the owner continues to steal.
+static const int STEAL_OBJECTS = 6000;
+
+static void* AllocateFilled(size_t size, void* hint) {
+    void* object = hint != nullptr ? allocator->AllocateNear(size, hint) :
+                                     allocator->Allocate(size);
+    if(object == nullptr) {
+        errors++;
+        return nullptr;
+    }
+
+    if(allocator->UsableSize(object) < size) {
+        errors++;
+    }
+
+    // Neighbor locations are filled with different values.
+    memset(object, (int)(((uintptr_t)object >> 3) & 0xFF), size);
+    return object;
+}
+
+static void FreeFilled(void* object, size_t size) {
+    if(object == nullptr) {
+        return; // Already counted as an error.
+    }
+
+    unsigned char value = (unsigned char)(((uintptr_t)object >> 3) & 0xFF);
+
+    for(size_t i = 0; i < size; i++) {
+        if(((unsigned char*)object)[i] != value) {
+            errors++;
+            break;
+        }
+    }
+
+    allocator->Deallocate(object);
+}
+
+static bool IsInGroup(void* object, void* groupObject) {
+    const uintptr_t mask = ~((uintptr_t)Base::Constants::SMALL_GROUP_SIZE - 1);
+    return ((uintptr_t)object & mask) == ((uintptr_t)groupObject & mask);
+}
+
+static void FreeEachSecond(std::vector<void*>* objects, std::vector<size_t>* sizes,
+                           size_t start) {
+    for(size_t i = start; i < objects->size(); i += 2) {
+        FreeFilled((*objects)[i], (*sizes)[i]);
+    }
+}
+
+static void StealThread(size_t sourceSize, size_t firstSize, size_t secondSize) {
+    void* source = AllocateFilled(sourceSize, nullptr);
+    std::vector<void*> objects;
+    std::vector<size_t> sizes;
+    size_t stolen = 0;
+
+    for(int i = 0; i < STEAL_OBJECTS; i++) {
+        // Allocating near the previous location updates
+        // the stealing state of the bin outside the normal path.
+        size_t size = (i % 2) == 0 ? firstSize : secondSize;
+        void* hint = (i >= 2) && ((i % 8) < 2) ? objects[i - 2] : nullptr;
+        void* object = AllocateFilled(size, hint);
+
+        if(IsInGroup(object, source)) {
+            stolen++;
+        }
+
+        objects.push_back(object);
+        sizes.push_back(size);
+    }
+
+    if(stolen == 0) {
+        errors++; // The test no longer covers stealing.
+    }
+
+    // Half of the locations are freed by another thread, 
+    // while the owner frees the others and steals again.
+    std::thread other(FreeEachSecond, &objects, &sizes, 1);
+    FreeEachSecond(&objects, &sizes, 0);
+
+    for(int round = 0; round < 4; round++) {
+        std::vector<void*> again;
+
+        for(int i = 0; i < STEAL_OBJECTS / 4; i++) {
+            again.push_back(AllocateFilled(firstSize, nullptr));
+        }
+
+        for(size_t i = 0; i < again.size(); i++) {
+            FreeFilled(again[i], firstSize);
+        }
+    }
+
+    other.join();
+    FreeFilled(source, sourceSize);
+}
+
+static void StealTest() {
+    // Each scenario uses a new thread, so that the bins are empty.
+    std::thread first(StealThread, 64, 8, 16);
+    first.join();
+
+    // Locations of 12 bytes are given whole to the bin of 8 bytes.
+    std::thread second(StealThread, 12, 8, 8);
+    second.join();
+}
+#endif
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+int main() {
+    allocator = new Base::Allocator();
+
+    std::cout<<"Remote frees and public groups...\n";
+    RemoteFreeTest();
+    std::cout<<"Adoption of groups from idle threads...\n";
+    AdoptionTest();
+    std::cout<<"Object pool...\n";
+    PoolTest();
+    std::cout<<"Partially used groups in the block allocator...\n";
+    PartialBucketTest();
+    std::cout<<"Release of the retained groups...\n";
+    TrimTest();
+#if defined(SORT)
+    std::cout<<"Sorted merge of the public locations...\n";
+    SortedMergeTest(8);
+    SortedMergeTest(24);
+    SortedMergeTest(64);
+#endif
+#if defined(STEAL)
+    std::cout<<"Locations stolen from larger bins...\n";
+    StealTest();
+#endif
+
+    if(errors.load() != 0) {
+        std::cout<<"FAILED: "<<errors.load()<<" errors\n";
+        return 1;
+    }
+
+    std::cout<<"Passed\n";
+    return 0;
+}
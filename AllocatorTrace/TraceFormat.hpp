@@ -0,0 +1,123 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Defines the binary format of the allocation traces.
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+#ifndef PC_TRACE_FORMAT_HPP
+#define PC_TRACE_FORMAT_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace Trace {
+
+// The operations that can appear in a trace.
+enum class OperationType : unsigned char {
+    Allocate,
+    Deallocate,
+    Reallocate
+};
+
+
+#pragma pack(push)
+#pragma pack(1)
+// Written once at the beginning of the file.
+struct TraceHeader {
+    char Magic[4];
+    unsigned int Version;
+    unsigned int Flags;
+
+    static const unsigned int VERSION = 2;
+
+    // Set when the object identifiers were exhausted and recording stopped;
+    // the trace contains only the operations executed before.
+    static const unsigned int FLAG_TRUNCATED = 1;
+
+    void Initialize() {
+        memcpy(Magic, "PATR", 4);
+        Version = VERSION;
+        Flags = 0;
+    }
+
+    bool IsValid() const {
+        return (memcmp(Magic, "PATR", 4) == 0) && (Version == VERSION);
+    }
+};
+
+
+// Object identifiers are unique for the whole trace, a new one being
+// assigned each time a location is allocated (or moved by a reallocation).
+// Frees of locations allocated before tracing started use NO_OBJECT.
+// Records from different threads can be interleaved in any order,
+// but the records of a thread appear in the order they were executed.
+struct TraceRecord {
+    unsigned int Thread;     // Index assigned when the thread is first seen.
+    OperationType Operation;
+    unsigned char Reserved[3];
+    unsigned int Size;       // The requested size (Allocate/Reallocate).
+    unsigned int Object;     // The allocated/freed object.
+    unsigned int Previous;   // The object that was moved (Reallocate).
+    unsigned int TimeDelta;  // Nanoseconds since the previous record of the thread.
+
+    static const unsigned int NO_OBJECT = 0;
+    static const unsigned int MAX_TIME_DELTA = 0xFFFFFFFF;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(TraceRecord) == 24, "Unexpected trace record size");
+
+
+// Loads a complete trace in memory.
+inline bool ReadTrace(const char* path, std::vector<TraceRecord>& records, 
+                      TraceHeader& header) {
+    FILE* file = fopen(path, "rb");
+    if(file == nullptr) return false;
+
+    if((fread(&header, sizeof(header), 1, file) != 1) || !header.IsValid()) {
+        fclose(file);
+        return false;
+    }
+
+    TraceRecord buffer[4096];
+    size_t count;
+
+    while((count = fread(buffer, sizeof(TraceRecord), 4096, file)) > 0) {
+        records.insert(records.end(), buffer, buffer + count);
+    }
+
+    fclose(file);
+    return true;
+}
+
+} // namespace Trace
+#endif
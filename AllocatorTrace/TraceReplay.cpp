@@ -0,0 +1,294 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Replays an allocation trace recorded by TraceShim through one of the
+// allocators. Each traced thread is replayed on its own thread, in the recorded
+// order. A free of an object allocated by another thread waits until
+// the allocation was replayed, so the remote-free pattern is preserved.
+//
+// Usage: AllocatorTrace trace [-a native|parallel] [-p]
+// With -p the recorded delays between the operations of a thread are kept.
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <BenchmarkUtils.hpp>
+#include "TraceFormat.hpp"
+
+using namespace Benchmark;
+using namespace Trace;
+
+// The state shared by all replay threads.
+struct ReplayState {
+    AllocatorInterface* Allocator;
+    std::vector<std::vector<TraceRecord>> Threads;
+    std::atomic<void*>* Objects;   // Indexed by object identifier.
+    unsigned int* Sizes;           // The size of each object.
+    bool* Allocated;               // If the allocation of the object is in the trace.
+    unsigned int ObjectCount;
+    ThreadCounters* Counters;
+    std::atomic<unsigned long long> Waits;
+    bool KeepDelays;
+    bool Truncated;                // If recording stopped before the process exited.
+};
+
+static bool LoadTrace(const char* path, ReplayState& state) {
+    std::vector<TraceRecord> records;
+    TraceHeader header;
+
+    if(!ReadTrace(path, records, header)) {
+        return false;
+    }
+
+    state.Truncated = (header.Flags & TraceHeader::FLAG_TRUNCATED) != 0;
+
+    // The identifiers can be spread over the whole 32-bit range,
+    // so they are replaced by consecutive indices (NO_OBJECT is kept).
+    std::unordered_map<unsigned int, unsigned int> indices;
+    unsigned int maxThread = 0;
+
+    for(size_t i = 0; i < records.size(); i++) {
+        TraceRecord& record = records[i];
+        maxThread = std::max(maxThread, record.Thread);
+
+        if(record.Object != TraceRecord::NO_OBJECT) {
+            auto result = indices.insert(std::make_pair(record.Object, 
+                                                        (unsigned int)indices.size() + 1));
+            record.Object = result.first->second;
+        }
+
+        if(record.Previous != TraceRecord::NO_OBJECT) {
+            auto result = indices.insert(std::make_pair(record.Previous, 
+                                                        (unsigned int)indices.size() + 1));
+            record.Previous = result.first->second;
+        }
+    }
+
+    state.ObjectCount = (unsigned int)indices.size() + 1;
+    state.Objects = new std::atomic<void*>[state.ObjectCount];
+    state.Sizes = new unsigned int[state.ObjectCount];
+    state.Allocated = new bool[state.ObjectCount];
+    state.Threads.resize(records.empty() ? 0 : maxThread + 1);
+
+    for(unsigned int i = 0; i < state.ObjectCount; i++) {
+        state.Objects[i].store(nullptr, std::memory_order_relaxed);
+        state.Sizes[i] = 0;
+        state.Allocated[i] = false;
+    }
+
+    // Split the records by thread, keeping their relative order.
+    for(size_t i = 0; i < records.size(); i++) {
+        const TraceRecord& record = records[i];
+        state.Threads[record.Thread].push_back(record);
+
+        if(record.Operation != OperationType::Deallocate) {
+            state.Sizes[record.Object] = record.Size;
+            state.Allocated[record.Object] = true;
+        }
+    }
+
+    return true;
+}
+
+// Waits until the allocation of the object was replayed by its thread
+// and takes ownership of it. Returns nullptr if the object was 
+// allocated before the trace started.
+static void* AcquireObject(ReplayState& state, unsigned int object) {
+    if((object == TraceRecord::NO_OBJECT) || !state.Allocated[object]) {
+        return nullptr;
+    }
+
+    void* address;
+
+    if((address = state.Objects[object].exchange(nullptr)) == nullptr) {
+        state.Waits.fetch_add(1, std::memory_order_relaxed);
+
+        while((address = state.Objects[object].exchange(nullptr)) == nullptr) {
+            std::this_thread::yield();
+        }
+    }
+
+    return address;
+}
+
+static void* ReplayAllocate(ReplayState& state, const TraceRecord& record,
+                            ThreadCounters& counters) {
+    size_t size = std::max(record.Size, 1u);
+    void* address = state.Allocator->Allocate(size);
+
+    if(address == nullptr) {
+        std::cout<<"Object of size "<<size<<" could not be allocated!\n";
+        exit(-1);
+    }
+
+    *reinterpret_cast<char*>(address) = 0; // Touch the location.
+    counters.Add(record.Size);
+    return address;
+}
+
+static void ReplayThread(ReplayState& state, unsigned int thread) {
+    std::vector<TraceRecord>& records = state.Threads[thread];
+    ThreadCounters& counters = state.Counters[thread];
+    unsigned long long pendingDelay = 0;
+
+    for(size_t i = 0; i < records.size(); i++) {
+        const TraceRecord& record = records[i];
+
+        if(state.KeepDelays) {
+            // Sleeping for very short delays is not precise, so they are accumulated.
+            pendingDelay += record.TimeDelta;
+
+            if(pendingDelay >= 50000) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(pendingDelay));
+                pendingDelay = 0;
+            }
+        }
+
+        switch(record.Operation) {
+            case OperationType::Allocate: {
+                void* address = ReplayAllocate(state, record, counters);
+                state.Objects[record.Object].store(address, std::memory_order_release);
+                break;
+            }
+            case OperationType::Deallocate: {
+                void* address = AcquireObject(state, record.Object);
+                
+                if(address != nullptr) {
+                    state.Allocator->Deallocate(address);
+                    counters.Add(-(long long)state.Sizes[record.Object]);
+                }
+                break;
+            }
+            case OperationType::Reallocate: {
+                // Replayed as an allocation, a copy and a free.
+                void* address = ReplayAllocate(state, record, counters);
+                void* previous = AcquireObject(state, record.Previous);
+
+                if(previous != nullptr) {
+                    unsigned int previousSize = state.Sizes[record.Previous];
+                    memcpy(address, previous, std::min(previousSize, record.Size));
+                    state.Allocator->Deallocate(previous);
+                    counters.Add(-(long long)previousSize);
+                }
+
+                state.Objects[record.Object].store(address, std::memory_order_release);
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        std::cout<<"Usage: AllocatorTrace trace [-a native|parallel] [-p]\n";
+        return -1;
+    }
+
+    std::string allocatorName = "parallel";
+    ReplayState state;
+    state.KeepDelays = false;
+    state.Waits.store(0);
+
+    for(int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+
+        if(option == "-p") state.KeepDelays = true;
+        else if((option == "-a") && ((i + 1) < argc)) allocatorName = argv[++i];
+        else {
+            std::cout<<"Unknown option: "<<option<<"\n";
+            return -1;
+        }
+    }
+
+    if(!LoadTrace(argv[1], state)) {
+        std::cout<<"Could not read trace "<<argv[1]<<"\n";
+        return -1;
+    }
+
+    if(state.Truncated) {
+        std::cout<<"Warning: the trace was truncated, not all operations were recorded\n";
+    }
+
+    state.Allocator = CreateAllocator(allocatorName);
+
+    if(state.Allocator == nullptr) {
+        std::cout<<"Unknown allocator: "<<allocatorName<<"\n";
+        return -1;
+    }
+
+    unsigned int threads = (unsigned int)state.Threads.size();
+    unsigned long long operations = 0;
+    state.Counters = new ThreadCounters[threads + 1];
+    MemoryMonitor monitor(state.Counters, threads);
+
+    for(unsigned int i = 0; i < threads; i++) {
+        operations += state.Threads[i].size();
+    }
+
+    monitor.Start();
+    Timer timer;
+    std::vector<std::thread> handles;
+
+    for(unsigned int i = 0; i < threads; i++) {
+        handles.push_back(std::thread(ReplayThread, std::ref(state), i));
+    }
+
+    for(unsigned int i = 0; i < threads; i++) {
+        handles[i].join();
+    }
+
+    double seconds = timer.Seconds();
+    monitor.Stop();
+
+    // Objects that were never freed in the trace.
+    unsigned long long leaked = 0;
+
+    for(unsigned int i = 0; i < state.ObjectCount; i++) {
+        void* address = state.Objects[i].load();
+
+        if(address != nullptr) {
+            state.Allocator->Deallocate(address);
+            leaked++;
+        }
+    }
+
+    printf("allocator: %s\nthreads: %u\noperations: %llu\nseconds: %.3f\n"
+           "ops/sec: %.0f\nremote waits: %llu\nnot freed: %llu\n"
+           "peak rss: %.1f MB\npeak requested: %.1f MB\nreq/rss: %.3f\n",
+           state.Allocator->Name(), threads, operations, seconds,
+           seconds > 0 ? operations / seconds : 0.0, state.Waits.load(), leaked,
+           monitor.PeakResident() / (1024.0 * 1024.0), 
+           monitor.PeakRequested() / (1024.0 * 1024.0), monitor.Efficiency());
+
+    delete state.Allocator;
+    return 0;
+}
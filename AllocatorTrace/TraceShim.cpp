@@ -0,0 +1,443 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Records the allocations made by a process into a binary trace.
+// The library replaces the allocation functions when it's preloaded
+// (the CMake build creates it as the 'AllocatorTraceShim' target):
+//     g++ -O2 -shared -fPIC -o libtrace.so TraceShim.cpp
+//     ALLOCATOR_TRACE=app.trace LD_PRELOAD=./libtrace.so ./app
+// If ALLOCATOR_TRACE is not set nothing is recorded.
+// Currently works only under Linux with glibc.
+#include "TraceFormat.hpp"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// The allocation functions of glibc, used to allocate the real memory.
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void __libc_free(void* address);
+}
+
+namespace {
+
+using namespace Trace;
+
+static const unsigned int BUFFER_RECORDS = 4096;
+static const unsigned int MAX_THREADS = 65536; // Live threads flushed at exit.
+static const unsigned int NO_SLOT = 0xFFFFFFFF;
+static const size_t HEADER_SIZE = 16;
+
+// Placed before each location, so that frees can be mapped
+// to the object identifier without a global table.
+struct ObjectHeader {
+    void* RealAddress;   // The address returned by glibc.
+    unsigned int Object;
+    unsigned int Size;
+};
+
+static_assert(sizeof(ObjectHeader) <= HEADER_SIZE, "Object header too large");
+
+// Records are buffered per thread and written in batches.
+struct ThreadBuffer {
+    unsigned int Count;
+    unsigned int Thread;
+    unsigned int Slot;   // The position in 'buffers_', or NO_SLOT.
+    unsigned long long LastTime;
+    TraceRecord Records[BUFFER_RECORDS];
+};
+
+enum class TraceState {
+    Uninitialized,
+    Enabled,
+    Disabled,
+    Truncated // The object identifiers were exhausted.
+};
+
+static std::atomic<int> state_(0);
+static int file_ = -1;
+static std::atomic_flag fileLock_ = ATOMIC_FLAG_INIT;
+static std::atomic<unsigned int> nextObject_(1);
+static std::atomic<unsigned int> nextThread_(0);
+static std::atomic<ThreadBuffer*> buffers_[MAX_THREADS]; // The buffers of the live threads.
+static pthread_key_t threadKey_;
+
+// Initial-exec TLS doesn't allocate when first accessed.
+static __thread ThreadBuffer* threadBuffer_ __attribute__((tls_model("initial-exec")));
+static __thread unsigned int threadIndex_ __attribute__((tls_model("initial-exec"))); // Index + 1.
+static __thread bool insideTracer_ __attribute__((tls_model("initial-exec")));
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+unsigned long long GetTime() {
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (unsigned long long)time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+void WriteAll(const void* data, size_t size) {
+    const char* position = reinterpret_cast<const char*>(data);
+
+    while(size > 0) {
+        ssize_t written = write(file_, position, size);
+
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return; // Nothing that can be done about it.
+        }
+
+        position += written;
+        size -= written;
+    }
+}
+
+void Flush(ThreadBuffer* buffer) {
+    if(buffer->Count == 0) {
+        return;
+    }
+
+    while(fileLock_.test_and_set(std::memory_order_acquire)) {
+        sched_yield();
+    }
+
+    WriteAll(buffer->Records, buffer->Count * sizeof(TraceRecord));
+    fileLock_.clear(std::memory_order_release);
+    buffer->Count = 0;
+}
+
+// Called when a thread exits; writes its records and releases the buffer.
+// If the thread allocates again (in other TLS destructors)
+// a new buffer is created, with the same thread index.
+void ThreadExit(void* data) {
+    ThreadBuffer* buffer = reinterpret_cast<ThreadBuffer*>(data);
+    threadBuffer_ = nullptr;
+
+    if(buffer->Slot != NO_SLOT) {
+        // If the process is exiting the buffer may have been taken
+        // by 'FlushAllBuffers'; it's not unmapped then.
+        if(buffers_[buffer->Slot].exchange(nullptr) != buffer) {
+            return;
+        }
+    }
+
+    Flush(buffer);
+    munmap(buffer, sizeof(ThreadBuffer));
+}
+
+// Remembers the buffer so that it's flushed if the process exits
+// while the thread is still running. If all slots are used 
+// the records are written only when the thread exits.
+void RegisterBuffer(ThreadBuffer* buffer) {
+    buffer->Slot = NO_SLOT;
+
+    for(unsigned int i = 0; i < MAX_THREADS; i++) {
+        unsigned int slot = (buffer->Thread + i) % MAX_THREADS;
+        ThreadBuffer* expected = nullptr;
+
+        if(buffers_[slot].compare_exchange_strong(expected, buffer)) {
+            buffer->Slot = slot;
+            return;
+        }
+    }
+}
+
+// Stops recording when the object identifiers wrap around,
+// because new objects would get the identifiers of existing ones.
+void TruncateTrace() {
+    int expected = (int)TraceState::Enabled;
+    state_.compare_exchange_strong(expected, (int)TraceState::Truncated);
+}
+
+bool IsEnabled() {
+    int state = state_.load(std::memory_order_acquire);
+
+    if(state == (int)TraceState::Uninitialized) {
+        // Racing threads may both try to open the file, only one wins.
+        while(fileLock_.test_and_set(std::memory_order_acquire)) {
+            sched_yield();
+        }
+
+        state = state_.load(std::memory_order_relaxed);
+
+        if(state == (int)TraceState::Uninitialized) {
+            const char* path = getenv("ALLOCATOR_TRACE");
+            state = (int)TraceState::Disabled;
+
+            if(path != nullptr) {
+                file_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+                if(file_ != -1) {
+                    TraceHeader header;
+                    header.Initialize();
+                    WriteAll(&header, sizeof(header));
+                    pthread_key_create(&threadKey_, ThreadExit);
+                    state = (int)TraceState::Enabled;
+                }
+            }
+
+            state_.store(state, std::memory_order_release);
+        }
+
+        fileLock_.clear(std::memory_order_release);
+    }
+
+    return state == (int)TraceState::Enabled;
+}
+
+ThreadBuffer* GetThreadBuffer() {
+    if(threadBuffer_ == nullptr) {
+        // The buffer is allocated directly from the OS.
+        void* memory = mmap(nullptr, sizeof(ThreadBuffer), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(memory == MAP_FAILED) return nullptr;
+
+        ThreadBuffer* buffer = reinterpret_cast<ThreadBuffer*>(memory);
+
+        if(threadIndex_ == 0) {
+            threadIndex_ = nextThread_.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+
+        buffer->Thread = threadIndex_ - 1;
+        buffer->Count = 0;
+        buffer->LastTime = GetTime();
+        RegisterBuffer(buffer);
+
+        threadBuffer_ = buffer;
+        pthread_setspecific(threadKey_, buffer); // May allocate.
+    }
+
+    return threadBuffer_;
+}
+
+void Record(OperationType operation, size_t size, 
+            unsigned int object, unsigned int previous) {
+    if(insideTracer_ || !IsEnabled()) {
+        return;
+    }
+
+    insideTracer_ = true;
+    ThreadBuffer* buffer = GetThreadBuffer();
+
+    if(buffer != nullptr) {
+        unsigned long long time = GetTime();
+        unsigned long long delta = time - buffer->LastTime;
+        buffer->LastTime = time;
+
+        TraceRecord& record = buffer->Records[buffer->Count];
+        record.Thread = buffer->Thread;
+        record.Operation = operation;
+        record.Reserved[0] = record.Reserved[1] = record.Reserved[2] = 0;
+        record.Size = (unsigned int)size;
+        record.Object = object;
+        record.Previous = previous;
+        record.TimeDelta = delta < TraceRecord::MAX_TIME_DELTA ? 
+                           (unsigned int)delta : TraceRecord::MAX_TIME_DELTA;
+
+        if(++buffer->Count == BUFFER_RECORDS) {
+            Flush(buffer);
+        }
+    }
+
+    insideTracer_ = false;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ObjectHeader* GetHeader(void* address) {
+    return reinterpret_cast<ObjectHeader*>((char*)address - HEADER_SIZE);
+}
+
+// Allocates a location having the header right before it.
+void* AllocateLocation(size_t size, size_t alignment, bool zero) {
+    if(alignment < HEADER_SIZE) {
+        alignment = HEADER_SIZE;
+    }
+
+    size_t total = size + HEADER_SIZE + (alignment - HEADER_SIZE);
+
+    if(total < size) {
+        errno = ENOMEM;
+        return nullptr; // Overflow.
+    }
+
+    void* real = zero ? __libc_calloc(1, total) : __libc_malloc(total);
+    if(real == nullptr) return nullptr;
+
+    uintptr_t address = ((uintptr_t)real + HEADER_SIZE + alignment - 1) & ~(alignment - 1);
+    ObjectHeader* header = GetHeader((void*)address);
+    header->RealAddress = real;
+    header->Object = nextObject_.fetch_add(1, std::memory_order_relaxed);
+    header->Size = (unsigned int)size;
+
+    if(header->Object == TraceRecord::NO_OBJECT) {
+        TruncateTrace();
+    }
+    return (void*)address;
+}
+
+void* TracedAllocate(size_t size, size_t alignment, bool zero) {
+    void* address = AllocateLocation(size, alignment, zero);
+
+    if(address != nullptr) {
+        Record(OperationType::Allocate, size, GetHeader(address)->Object, 
+               TraceRecord::NO_OBJECT);
+    }
+
+    return address;
+}
+
+bool IsPowerOfTwo(size_t value) {
+    return (value != 0) && ((value & (value - 1)) == 0);
+}
+
+} // namespace
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The replaced allocation functions.
+extern "C" {
+
+void* malloc(size_t size) {
+    return TracedAllocate(size, HEADER_SIZE, false);
+}
+
+void* calloc(size_t count, size_t size) {
+    if((size != 0) && (count > ((size_t)-1 / size))) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    return TracedAllocate(count * size, HEADER_SIZE, true);
+}
+
+void free(void* address) {
+    if(address == nullptr) {
+        return;
+    }
+
+    ObjectHeader* header = GetHeader(address);
+    Record(OperationType::Deallocate, header->Size, header->Object, 
+           TraceRecord::NO_OBJECT);
+    __libc_free(header->RealAddress);
+}
+
+void* realloc(void* address, size_t size) {
+    if(address == nullptr) {
+        return malloc(size);
+    }
+    else if(size == 0) {
+        free(address);
+        return nullptr;
+    }
+
+    ObjectHeader* header = GetHeader(address);
+    void* newAddress = AllocateLocation(size, HEADER_SIZE, false);
+    if(newAddress == nullptr) return nullptr;
+
+    memcpy(newAddress, address, size < header->Size ? size : header->Size);
+    Record(OperationType::Reallocate, size, GetHeader(newAddress)->Object, 
+           header->Object);
+    __libc_free(header->RealAddress);
+    return newAddress;
+}
+
+int posix_memalign(void** result, size_t alignment, size_t size) {
+    if(!IsPowerOfTwo(alignment) || (alignment % sizeof(void*)) != 0) {
+        return EINVAL;
+    }
+
+    void* address = TracedAllocate(size, alignment, false);
+    if(address == nullptr) return ENOMEM;
+
+    *result = address;
+    return 0;
+}
+
+void* memalign(size_t alignment, size_t size) {
+    if(!IsPowerOfTwo(alignment)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    return TracedAllocate(size, alignment, false);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+void* valloc(size_t size) {
+    return TracedAllocate(size, sysconf(_SC_PAGESIZE), false);
+}
+
+void* pvalloc(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return TracedAllocate((size + page - 1) & ~(page - 1), page, false);
+}
+
+size_t malloc_usable_size(void* address) {
+    return address != nullptr ? GetHeader(address)->Size : 0;
+}
+
+} // extern "C"
+
+
+// Writes the records still buffered when the process exits.
+__attribute__((destructor))
+static void FlushAllBuffers() {
+    int state = state_.load();
+
+    if((state != (int)TraceState::Enabled) &&
+       (state != (int)TraceState::Truncated)) {
+        return;
+    }
+
+    for(unsigned int i = 0; i < MAX_THREADS; i++) {
+        ThreadBuffer* buffer = buffers_[i].exchange(nullptr);
+
+        if(buffer != nullptr) {
+            Flush(buffer);
+        }
+    }
+
+    if(state == (int)TraceState::Truncated) {
+        TraceHeader header;
+        header.Initialize();
+        header.Flags |= TraceHeader::FLAG_TRUNCATED;
+        pwrite(file_, &header, sizeof(header), 0);
+    }
+}
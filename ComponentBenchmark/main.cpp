@@ -0,0 +1,390 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Microbenchmarks for the primitives used on the allocation paths:
+// bitmap searches, the free object stack, the public list CAS operations, 
+// the locks and the private location lists of a group.
+// Each benchmark is run with 1, 2, 4, ... up to the maximum number of threads
+// (if it's a multi-threaded one) and the results are written as CSV 
+// to the output file, so that they can be compared between builds.
+//
+// Usage: ComponentBenchmark [-t maxThreads] [-o file] [-x scale]
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <BenchmarkUtils.hpp>
+#include <AllocatorConstants.hpp>
+#include <Bitmap.hpp>
+#include <BitSpinLock.hpp>
+#include <Group.hpp>
+#include <ListHead.hpp>
+#include <LockFreeStack.hpp>
+#include <Memory.hpp>
+#include <SpinLock.hpp>
+
+using namespace Benchmark;
+
+static const unsigned int BITMAP_COUNT = 4096;         // Must be a power of two.
+static const unsigned int BITMAP_ITERATIONS = 50000000;
+static const unsigned int STACK_NODES = 1024;
+static const unsigned int STACK_ITERATIONS = 2000000;
+static const unsigned int PUBLIC_ROUNDS = 20000;
+static const unsigned int LOCK_ITERATIONS = 2000000;
+static const unsigned int GROUP_ROUNDS = 20000;
+
+// The results of a benchmark run.
+struct Result {
+    std::string Name;
+    unsigned int Threads;
+    unsigned long long Operations;
+    double Seconds;
+};
+
+// Prevents the compiler from removing the benchmarked code.
+static volatile unsigned long long sink_;
+
+
+// Barrier used to separate the phases of the multi-threaded benchmarks.
+class SpinBarrier {
+private:
+    std::atomic<unsigned int> waiting_;
+    std::atomic<unsigned int> generation_;
+    unsigned int threads_;
+
+public:
+    explicit SpinBarrier(unsigned int threads) : threads_(threads) {
+        waiting_.store(0);
+        generation_.store(0);
+    }
+
+    void Wait() {
+        unsigned int generation = generation_.load(std::memory_order_acquire);
+
+        if((waiting_.fetch_add(1, std::memory_order_acq_rel) + 1) == threads_) {
+            waiting_.store(0, std::memory_order_relaxed);
+            generation_.fetch_add(1, std::memory_order_acq_rel);
+            return;
+        }
+
+        while(generation_.load(std::memory_order_acquire) == generation) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+
+// Runs the function on the specified number of threads and measures 
+// the time until all of them finish. The function returns the number
+// of operations it executed.
+template <class Function>
+Result RunThreads(const char* name, unsigned int threads, Function function) {
+    std::vector<std::thread> handles;
+    std::vector<unsigned long long> operations(threads);
+    Timer timer;
+
+    for(unsigned int i = 0; i < threads; i++) {
+        handles.push_back(std::thread([&, i]() { 
+            operations[i] = function(i); 
+        }));
+    }
+
+    for(unsigned int i = 0; i < threads; i++) {
+        handles[i].join();
+    }
+
+    Result result;
+    result.Name = name;
+    result.Threads = threads;
+    result.Seconds = timer.Seconds();
+    result.Operations = 0;
+
+    for(unsigned int i = 0; i < threads; i++) {
+        result.Operations += operations[i];
+    }
+
+    return result;
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Bitmap searches with random masks and start offsets. 
+// About 1/8 of the bits are set in each mask.
+static Result BenchmarkBitmapSearch(bool forward, unsigned int iterations, unsigned int seed) {
+    std::vector<unsigned __int64> masks(BITMAP_COUNT);
+    std::vector<unsigned int> starts(BITMAP_COUNT);
+    Random random(seed);
+
+    for(unsigned int i = 0; i < BITMAP_COUNT; i++) {
+        unsigned __int64 mask = 0;
+
+        for(unsigned int bit = 0; bit < 64; bit++) {
+            if(random.Next(8) == 0) mask |= 1ULL << bit;
+        }
+
+        masks[i] = mask;
+        starts[i] = random.Next(64);
+    }
+
+    const char* name = forward ? "bitmap_search_forward" : "bitmap_search_reverse";
+    return RunThreads(name, 1, [&](unsigned int) -> unsigned long long {
+        unsigned long long sum = 0;
+
+        for(unsigned int i = 0; i < iterations; i++) {
+            unsigned int index = i & (BITMAP_COUNT - 1);
+
+            if(forward) {
+                sum += Base::Bitmap::SearchForward(masks[index], starts[index]);
+            }
+            else sum += Base::Bitmap::SearchReverse(masks[index], starts[index]);
+        }
+
+        sink_ = sum;
+        return iterations;
+    });
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Each thread pops a node from the shared stack and pushes it back.
+static Result BenchmarkStack(unsigned int threads, unsigned int iterations) {
+    Base::Stack<Base::ListNode> stack;
+    std::vector<Base::ListNode> nodes(STACK_NODES);
+
+    for(unsigned int i = 0; i < STACK_NODES; i++) {
+        stack.Push(&nodes[i]);
+    }
+
+    return RunThreads("stack_push_pop", threads, [&](unsigned int) -> unsigned long long {
+        for(unsigned int i = 0; i < iterations; i++) {
+            auto node = stack.Pop();
+
+            if(node != nullptr) {
+                stack.Push(node);
+            }
+        }
+
+        return 2ULL * iterations;
+    });
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// All threads free their share of the locations of a group as public ones 
+// (the CAS push used by foreign threads), then the first thread takes 
+// the whole public list (the CAS used by the owner when merging the lists).
+static Result BenchmarkPublicList(unsigned int threads, unsigned int rounds) {
+    const unsigned int locationSize = 64;
+    const unsigned int locations = (Base::Constants::SMALL_GROUP_SIZE - 
+                                    Base::Constants::SMALL_GROUP_HEADER_SIZE) / locationSize;
+    void* memory = Base::Memory::Allocate(Base::Constants::SMALL_GROUP_SIZE);
+    Base::Group* group = reinterpret_cast<Base::Group*>(memory);
+    std::vector<void*> addresses;
+    SpinBarrier barrier(threads);
+
+    group->InitializeUnused(locationSize, locations, 0, false);
+
+    for(unsigned int i = 0; i < locations; i++) {
+        addresses.push_back(group->GetPrivateLocation());
+    }
+
+    Result result = RunThreads("listhead_cas_push_take", threads, 
+                               [&](unsigned int thread) -> unsigned long long {
+        unsigned int first = (locations * thread) / threads;
+        unsigned int last = (locations * (thread + 1)) / threads;
+
+        for(unsigned int i = 0; i < rounds; i++) {
+            for(unsigned int j = first; j < last; j++) {
+                group->ReturnPublicLocation(addresses[j]);
+            }
+
+            barrier.Wait();
+
+            if(thread == 0) {
+                // The locations are not used, just the list is reset.
+                group->PrivatizeLocations();
+                group->InitializeUnused(locationSize, locations, 0, false);
+            }
+
+            barrier.Wait();
+        }
+
+        // One push for each location, and one take for the whole list.
+        return (unsigned long long)rounds * ((last - first) + (thread == 0 ? 1 : 0));
+    });
+
+    Base::Memory::Deallocate(memory);
+    return result;
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Each thread acquires the lock, increments a shared counter and releases it.
+static Result BenchmarkSpinLock(unsigned int threads, unsigned int iterations) {
+    unsigned int lock = 0;
+    unsigned long long counter = 0;
+
+    return RunThreads("spinlock", threads, [&](unsigned int) -> unsigned long long {
+        for(unsigned int i = 0; i < iterations; i++) {
+            Base::SpinLock holder(&lock);
+            counter++;
+        }
+
+        return iterations;
+    });
+}
+
+static Result BenchmarkBitSpinLock(unsigned int threads, unsigned int iterations) {
+    Base::BitSpinLock<unsigned int, 31> lock;
+    unsigned long long counter = 0;
+
+    return RunThreads("bitspinlock", threads, [&](unsigned int) -> unsigned long long {
+        for(unsigned int i = 0; i < iterations; i++) {
+            lock.Lock();
+            counter++;
+            lock.Unlock();
+        }
+
+        return iterations;
+    });
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The owner thread allocates all locations of a group, then frees them
+// in the reverse order, so that the next round uses the private list.
+static Result BenchmarkGroup(unsigned int locationSize, unsigned int rounds) {
+    const unsigned int locations = (Base::Constants::SMALL_GROUP_SIZE - 
+                                    Base::Constants::SMALL_GROUP_HEADER_SIZE) / locationSize;
+    void* memory = Base::Memory::Allocate(Base::Constants::SMALL_GROUP_SIZE);
+    Base::Group* group = reinterpret_cast<Base::Group*>(memory);
+    std::vector<void*> addresses(locations);
+    std::string name = "group_private_" + std::to_string((unsigned long long)locationSize);
+
+    group->InitializeUnused(locationSize, locations, 0, false);
+
+    Result result = RunThreads(name.c_str(), 1, [&](unsigned int) -> unsigned long long {
+        for(unsigned int i = 0; i < rounds; i++) {
+            for(unsigned int j = 0; j < locations; j++) {
+                addresses[j] = group->GetPrivateLocation();
+            }
+
+            for(unsigned int j = locations; j > 0; j--) {
+                group->ReturnPrivateLocation(addresses[j - 1]);
+            }
+        }
+
+        return 2ULL * rounds * locations;
+    });
+
+    Base::Memory::Deallocate(memory);
+    return result;
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+static void Report(FILE* file, const Result& result) {
+    double nsPerOperation = result.Operations > 0 ? 
+                            (result.Seconds * 1e9) / result.Operations : 0;
+    double rate = result.Seconds > 0 ? result.Operations / result.Seconds : 0;
+
+    printf("%-24s %4u %14llu %9.3f %10.2f %14.0f\n", result.Name.c_str(), 
+           result.Threads, result.Operations, result.Seconds, nsPerOperation, rate);
+    fprintf(file, "%s,%u,%llu,%.6f,%.3f,%.0f\n", result.Name.c_str(), result.Threads,
+            result.Operations, result.Seconds, nsPerOperation, rate);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    std::string output = "ComponentResults.csv";
+    unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    double scale = 1.0;
+
+    for(int i = 1; (i + 1) < argc; i += 2) {
+        std::string option = argv[i];
+
+        if(option == "-t") maxThreads = std::max(1, atoi(argv[i + 1]));
+        else if(option == "-o") output = argv[i + 1];
+        else if(option == "-x") scale = atof(argv[i + 1]);
+        else {
+            std::cout<<"Usage: ComponentBenchmark [-t maxThreads] [-o file] [-x scale]\n";
+            return -1;
+        }
+    }
+
+    FILE* file = fopen(output.c_str(), "w");
+
+    if(file == nullptr) {
+        std::cout<<"Could not create "<<output<<"\n";
+        return -1;
+    }
+
+    std::vector<unsigned int> threadCounts;
+
+    for(unsigned int count = 1; count < maxThreads; count *= 2) {
+        threadCounts.push_back(count);
+    }
+
+    threadCounts.push_back(maxThreads);
+    auto scaled = [scale](unsigned int value) -> unsigned int {
+        return std::max(1u, (unsigned int)(value * scale));
+    };
+
+    fprintf(file, "benchmark,threads,operations,seconds,ns_per_op,ops_per_sec\n");
+    printf("%-24s %4s %14s %9s %10s %14s\n", "benchmark", "thr", 
+           "operations", "seconds", "ns/op", "ops/sec");
+
+    Report(file, BenchmarkBitmapSearch(true, scaled(BITMAP_ITERATIONS), 27));
+    Report(file, BenchmarkBitmapSearch(false, scaled(BITMAP_ITERATIONS), 27));
+    Report(file, BenchmarkGroup(8, scaled(GROUP_ROUNDS)));
+    Report(file, BenchmarkGroup(64, scaled(GROUP_ROUNDS)));
+    Report(file, BenchmarkGroup(256, scaled(GROUP_ROUNDS)));
+
+    for(size_t i = 0; i < threadCounts.size(); i++) {
+        Report(file, BenchmarkStack(threadCounts[i], scaled(STACK_ITERATIONS)));
+    }
+
+    for(size_t i = 0; i < threadCounts.size(); i++) {
+        Report(file, BenchmarkPublicList(threadCounts[i], scaled(PUBLIC_ROUNDS)));
+    }
+
+    for(size_t i = 0; i < threadCounts.size(); i++) {
+        Report(file, BenchmarkSpinLock(threadCounts[i], scaled(LOCK_ITERATIONS)));
+    }
+
+    for(size_t i = 0; i < threadCounts.size(); i++) {
+        Report(file, BenchmarkBitSpinLock(threadCounts[i], scaled(LOCK_ITERATIONS)));
+    }
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,350 @@
+// Copyright (c) 2009 Gratian Lup. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// * The name "ParallelAllocator" must not be used to endorse or promote
+// products derived from this software without prior written permission.
+//
+// * Products derived from this software may not be called "ParallelAllocator" nor
+// may "ParallelAllocator" appear in their names without prior written
+// permission of the author.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Benchmark comparing the churn of STL containers (insertions and removals
+// of random keys) when using the standard allocator and the adaptors from
+// StlAllocator.hpp. Each thread works with its own containers; it is run 
+// with 1, 2, 4, ... up to the maximum number of threads.
+//
+// Usage: ContainerBenchmark [-a std|parallel|pmr|all] [-w container|all]
+//                           [-t maxThreads] [-s seed] [-x scale] [-c]
+// The 'pmr' adaptor is available only when MEMORY_RESOURCE is defined.
+#include <iostream>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <BenchmarkUtils.hpp>
+#include <StlAllocator.hpp>
+
+using namespace Benchmark;
+
+static const unsigned int OPERATIONS = 2000000; // Per thread, multiplied by the scale.
+static const unsigned int KEY_RANGE = 65536;    // About half of the keys are present.
+static const unsigned int LIST_LENGTH = 32768;
+
+struct Options {
+    std::string Allocator;
+    std::string Container;
+    unsigned int MaxThreads;
+    unsigned int Seed;
+    double Scale;
+    bool Csv;
+
+    Options() : Allocator("all"), Container("all"), MaxThreads(0), 
+                Seed(27), Scale(1.0), Csv(false) { }
+};
+
+static void PrintUsage() {
+    std::cout<<"Usage: ContainerBenchmark [-a std|parallel|pmr|all] [-w container|all]\n"
+             <<"                          [-t maxThreads] [-s seed] [-x scale] [-c]\n"
+             <<"Containers: map, unordered_map, list\n";
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+    for(int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+
+        if(option == "-c") {
+            options.Csv = true;
+            continue;
+        }
+        else if((i + 1) == argc) {
+            return false;
+        }
+
+        const char* value = argv[++i];
+
+        if(option == "-a") options.Allocator = value;
+        else if(option == "-w") options.Container = value;
+        else if(option == "-t") options.MaxThreads = (unsigned int)atoi(value);
+        else if(option == "-s") options.Seed = (unsigned int)strtoul(value, nullptr, 10);
+        else if(option == "-x") options.Scale = atof(value);
+        else return false;
+    }
+
+    if(options.MaxThreads == 0) {
+        options.MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    return options.Scale > 0;
+}
+
+// Returns 1, 2, 4, ... up to the maximum number of threads (always included).
+static std::vector<unsigned int> ThreadCounts(unsigned int maxThreads) {
+    std::vector<unsigned int> counts;
+
+    for(unsigned int count = 1; count < maxThreads; count *= 2) {
+        counts.push_back(count);
+    }
+
+    counts.push_back(maxThreads);
+    return counts;
+}
+
+
+// Inserts a random key if it's not found in the map, else removes it.
+template <class Map>
+static unsigned long long MapChurn(Map& map, Random& random, unsigned int operations) {
+    for(unsigned int i = 0; i < operations; i++) {
+        unsigned int key = random.Next(KEY_RANGE);
+        auto position = map.find(key);
+
+        if(position == map.end()) {
+            map.insert(std::make_pair(key, i));
+        }
+        else map.erase(position);
+    }
+
+    return operations;
+}
+
+// Appends values at the end of the list and removes them 
+// from the front once the list is long enough.
+template <class List>
+static unsigned long long ListChurn(List& list, Random& random, unsigned int operations) {
+    for(unsigned int i = 0; i < operations; i++) {
+        if((list.size() < LIST_LENGTH) || (random.Next(2) == 0)) {
+            list.push_back(i);
+        }
+        else list.pop_front();
+    }
+
+    return operations;
+}
+
+
+// Runs the churn for a container type using a certain allocator.
+class ContainerRunner {
+public:
+    virtual const char* Name() const = 0;
+    virtual unsigned long long Run(const std::string& container, Random& random,
+                                   unsigned int operations) = 0;
+
+    virtual ~ContainerRunner() { }
+};
+
+// Implementation for the stateless allocators ('std::allocator' 
+// and 'Base::ParallelStlAllocator').
+template <template <class> class Alloc>
+class AllocatorRunner : public ContainerRunner {
+private:
+    typedef std::pair<const unsigned int, unsigned int> ValueType;
+    typedef std::map<unsigned int, unsigned int, std::less<unsigned int>, 
+                     Alloc<ValueType>> MapType;
+    typedef std::unordered_map<unsigned int, unsigned int, std::hash<unsigned int>,
+                               std::equal_to<unsigned int>, Alloc<ValueType>> HashMapType;
+    typedef std::list<unsigned int, Alloc<unsigned int>> ListType;
+
+    const char* name_;
+
+public:
+    explicit AllocatorRunner(const char* name) : name_(name) { }
+
+    virtual const char* Name() const {
+        return name_;
+    }
+
+    virtual unsigned long long Run(const std::string& container, Random& random,
+                                   unsigned int operations) {
+        if(container == "map") {
+            MapType map;
+            return MapChurn(map, random, operations);
+        }
+        else if(container == "unordered_map") {
+            HashMapType map;
+            return MapChurn(map, random, operations);
+        }
+        
+        ListType list;
+        return ListChurn(list, random, operations);
+    }
+};
+
+#if defined(MEMORY_RESOURCE)
+// Implementation for the 'std::pmr' containers using 'Base::ParallelMemoryResource'.
+class ResourceRunner : public ContainerRunner {
+private:
+    Base::ParallelMemoryResource resource_;
+
+public:
+    virtual const char* Name() const {
+        return "pmr";
+    }
+
+    virtual unsigned long long Run(const std::string& container, Random& random,
+                                   unsigned int operations) {
+        if(container == "map") {
+            std::pmr::map<unsigned int, unsigned int> map(&resource_);
+            return MapChurn(map, random, operations);
+        }
+        else if(container == "unordered_map") {
+            std::pmr::unordered_map<unsigned int, unsigned int> map(&resource_);
+            return MapChurn(map, random, operations);
+        }
+
+        std::pmr::list<unsigned int> list(&resource_);
+        return ListChurn(list, random, operations);
+    }
+};
+#endif
+
+// Creates the runner for the allocator with the specified name.
+// Returns nullptr if the name is not recognized.
+static ContainerRunner* CreateRunner(const std::string& name) {
+    if(name == "std") {
+        return new AllocatorRunner<std::allocator>("std");
+    }
+    else if(name == "parallel") {
+        return new AllocatorRunner<Base::ParallelStlAllocator>("parallel");
+    }
+#if defined(MEMORY_RESOURCE)
+    else if(name == "pmr") {
+        return new ResourceRunner();
+    }
+#endif
+
+    return nullptr;
+}
+
+
+static void RunContainer(ContainerRunner* runner, const std::string& container,
+                         const Options& options) {
+    double singleThreadRate = 0;
+    unsigned int operations = (unsigned int)(OPERATIONS * options.Scale);
+    std::vector<unsigned int> counts = ThreadCounts(options.MaxThreads);
+
+    for(size_t i = 0; i < counts.size(); i++) {
+        unsigned int threads = counts[i];
+        std::vector<unsigned long long> results(threads);
+        std::vector<std::thread> workers;
+
+        Timer timer;
+
+        for(unsigned int j = 0; j < threads; j++) {
+            workers.push_back(std::thread([&, j]() {
+                Random random(Random::ThreadSeed(options.Seed, j));
+                results[j] = runner->Run(container, random, operations);
+            }));
+        }
+
+        for(unsigned int j = 0; j < threads; j++) {
+            workers[j].join();
+        }
+
+        double seconds = timer.Seconds();
+        unsigned long long total = 0;
+
+        for(unsigned int j = 0; j < threads; j++) {
+            total += results[j];
+        }
+
+        double rate = seconds > 0 ? total / seconds : 0;
+        if(threads == 1) singleThreadRate = rate;
+        double scaling = singleThreadRate > 0 ? rate / singleThreadRate : 0;
+
+        if(options.Csv) {
+            printf("%s,%s,%u,%u,%.3f,%llu,%.0f,%.2f\n", runner->Name(), 
+                   container.c_str(), threads, options.Seed, seconds, 
+                   total, rate, scaling);
+        }
+        else {
+            printf("%-9s %-14s %4u %9.3f %14.0f %8.2fx\n", runner->Name(), 
+                   container.c_str(), threads, seconds, rate, scaling);
+        }
+
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    if(!ParseOptions(argc, argv, options)) {
+        PrintUsage();
+        return -1;
+    }
+
+    std::vector<std::string> allocators;
+
+    if(options.Allocator == "all") {
+        allocators.push_back("std");
+        allocators.push_back("parallel");
+#if defined(MEMORY_RESOURCE)
+        allocators.push_back("pmr");
+#endif
+    }
+    else allocators.push_back(options.Allocator);
+
+    std::vector<std::string> containers;
+    containers.push_back("map");
+    containers.push_back("unordered_map");
+    containers.push_back("list");
+
+    if(options.Csv) {
+        printf("allocator,container,threads,seed,seconds,operations,ops_per_sec,scaling\n");
+    }
+    else {
+        printf("Seed: %u, scale: %.2f, max threads: %u\n", 
+               options.Seed, options.Scale, options.MaxThreads);
+        printf("%-9s %-14s %4s %9s %14s %9s\n", "allocator", "container", 
+               "thr", "seconds", "ops/sec", "scaling");
+    }
+
+    bool found = false;
+
+    for(size_t i = 0; i < allocators.size(); i++) {
+        ContainerRunner* runner = CreateRunner(allocators[i]);
+
+        if(runner == nullptr) {
+            std::cout<<"Unknown allocator: "<<allocators[i]<<"\n";
+            return -1;
+        }
+
+        for(size_t j = 0; j < containers.size(); j++) {
+            if(options.Container == "all" || options.Container == containers[j]) {
+                RunContainer(runner, containers[j], options);
+                found = true;
+            }
+        }
+
+        delete runner;
+    }
+
+    if(!found) {
+        std::cout<<"Unknown container: "<<options.Container<<"\n";
+        return -1;
+    }
+
+    return 0;
+}